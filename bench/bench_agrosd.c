@@ -0,0 +1,206 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Login-to-session time, cold and through agrosd. Each session runs in
+ * script mode with nothing to read, so it loads everything a login loads
+ * and exits.
+ *
+ *   login_exec_floor     spawning /bin/true: what any login pays to exec
+ *                        its shell on this host
+ *   login_cold_agros     "agros -s", from exec to exit
+ *   login_agrosd_client  "agros-login -s" through agrosd, from exec to exit
+ *   login_agrosd_ready   from connect to the session reporting it started,
+ *                        i.e. to the point a prompt would be printed
+ *   login_agrosd_session from connect to the session's exit status
+ *
+ * The agrosd started here serves the current user only and uses the
+ * agros.conf AGROS was built with.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "agrosd.h"
+
+#define BENCH_ROUNDS 300
+#define BENCH_PAUSE_US 5000
+
+extern char** environ;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Runs argv BENCH_ROUNDS times with /dev/null as input and output and
+ * returns the average time per run, or -1 if it ever fails.
+ */
+
+static double time_runs (char** argv){
+    posix_spawn_file_actions_t actions;
+    double start = 0;
+    pid_t pid = 0;
+    int status = 0, i = 0;
+
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        if (posix_spawn (&pid, argv[0], &actions, NULL, argv, environ) != 0)
+            return -1;
+        if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+            return -1;
+    }
+
+    posix_spawn_file_actions_destroy (&actions);
+    return (now_ns () - start) / BENCH_ROUNDS;
+}
+
+/*
+ * What agros-login does, in process: one script session with /dev/null
+ * as input and output. Adds the time to AGROSD_STARTED to *ready and the
+ * time to AGROSD_EXITED to *done. Returns -1 on failure.
+ */
+
+static int agrosd_session (const char* path, double* ready, double* done){
+    union { struct cmsghdr align; char buf[CMSG_SPACE (AGROSD_CLIENT_FDS * sizeof (int))]; } control;
+    agrosd_request request = { AGROSD_MAGIC, AGROSD_VERSION, AGROSD_SCRIPT, 0, 0 };
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr* cmsg = NULL;
+    struct iovec iov = { &request, sizeof (request) };
+    agrosd_reply reply;
+    int fds[AGROSD_CLIENT_FDS];
+    double start = now_ns ();
+    int sock = -1, result = -1;
+
+    fds[0] = open ("/dev/null", O_RDONLY);
+    fds[1] = fds[2] = open ("/dev/null", O_WRONLY);
+    fds[3] = open (".", O_PATH | O_DIRECTORY);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    sock = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (connect (sock, (struct sockaddr*) &addr, sizeof (addr)) == 0 && sendmsg (sock, &msg, 0) >= 0
+        && recv (sock, &reply, sizeof (reply), 0) == sizeof (reply) && reply.type == AGROSD_STARTED){
+        *ready += now_ns () - start;
+        if (recv (sock, &reply, sizeof (reply), 0) == sizeof (reply) && reply.type == AGROSD_EXITED){
+            *done += now_ns () - start;
+            result = 0;
+        }
+    }
+
+    close (sock);
+    close (fds[0]);
+    close (fds[1]);
+    close (fds[3]);
+    return result;
+}
+
+int main (){
+    char dir[] = "/tmp/agros-agrosd-XXXXXX";
+    char sock[64];
+    char* true_argv[] = { "/bin/true", NULL };
+    char* cold_argv[] = { "./agros", "-s", NULL };
+    char* client_argv[] = { "./agros-login", "-S", sock, "-s", NULL };
+    char* daemon_argv[] = { "./agrosd", "-f", "-S", sock, NULL };
+    struct stat st;
+    double floor = 0, cold = 0, client = 0, ready = 0, done = 0;
+    pid_t daemon = 0;
+    int i = 0;
+
+    if (access ("./agros", X_OK) < 0 || access ("./agrosd", X_OK) < 0 || access ("./agros-login", X_OK) < 0){
+        printf ("agrosd: skipped, agros, agrosd and agros-login are not built\n");
+        return EXIT_SUCCESS;
+    }
+    if (mkdtemp (dir) == NULL){
+        printf ("agrosd: skipped, can't create a directory in /tmp\n");
+        return EXIT_SUCCESS;
+    }
+    snprintf (sock, sizeof (sock), "%s/agrosd.sock", dir);
+
+    if (posix_spawn (&daemon, daemon_argv[0], NULL, NULL, daemon_argv, environ) != 0){
+        printf ("agrosd: skipped, could not start agrosd\n");
+        return EXIT_SUCCESS;
+    }
+    for (i=0; i<100 && stat (sock, &st) < 0; i++)
+        usleep (10000);
+    usleep (100000);
+
+    floor = time_runs (true_argv);
+    cold = time_runs (cold_argv);
+    client = time_runs (client_argv);
+    /* Logins don't come back to back: let the previous session exit and
+       agrosd fork its replacement, which matters on small hosts */
+    for (i=0; i<BENCH_ROUNDS; i++){
+        usleep (BENCH_PAUSE_US);
+        if (agrosd_session (sock, &ready, &done) < 0){
+            done = -1;
+            break;
+        }
+    }
+
+    kill (daemon, SIGTERM);
+    waitpid (daemon, NULL, 0);
+    unlink (sock);
+    rmdir (dir);
+
+    if (cold < 0 || client < 0 || done < 0){
+        printf ("agrosd: skipped, a session failed\n");
+        return EXIT_SUCCESS;
+    }
+    printf ("login_exec_floor     %12.0f ns/op\n", floor);
+    printf ("login_cold_agros     %12.0f ns/op\n", cold);
+    printf ("login_agrosd_client  %12.0f ns/op\n", client);
+    printf ("login_agrosd_ready   %12.0f ns/op\n", ready / BENCH_ROUNDS);
+    printf ("login_agrosd_session %12.0f ns/op\n", done / BENCH_ROUNDS);
+    return EXIT_SUCCESS;
+}
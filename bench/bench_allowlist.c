@@ -0,0 +1,115 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Compares the compiled allowed list with the linear strcmp() loop that
+ * check_validity() used to run, on lists of 10 to 10k entries. A tenth of
+ * the entries are prefix patterns ("tool123-*").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allowlist.h"
+
+#define BENCH_LOOKUPS 50000
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The loop check_validity() used before the allowed list was compiled */
+static int linear_match (char** list, const char* name){
+    int valid = 0, i = 0;
+    while (list[i]){
+        if (!strcmp (list[i], name) || !strcmp (list[i], "*"))
+            valid = 1;
+        i++;
+    }
+    return valid;
+}
+
+static void run (int size){
+    char** patterns = (char**) malloc ((size + 1) * sizeof (char*));
+    char** names = (char**) malloc (BENCH_LOOKUPS * sizeof (char*));
+    allowlist* list = NULL;
+    double start = 0, compiled = 0, linear = 0;
+    volatile int hits = 0;
+    int i = 0;
+
+    for (i=0; i<size; i++){
+        patterns[i] = (char*) malloc (32);
+        if (i % 10 == 0)
+            sprintf (patterns[i], "tool%d-*", i);
+        else
+            sprintf (patterns[i], "command%d", i);
+    }
+    patterns[size] = NULL;
+
+    /* Half hits (exact and prefix), half misses */
+    srand (size);
+    for (i=0; i<BENCH_LOOKUPS; i++){
+        int n = rand () % size;
+        names[i] = (char*) malloc (32);
+        switch (i % 4){
+            case 0: sprintf (names[i], "command%d", n); break;
+            case 1: sprintf (names[i], "tool%d-status", n - n%10); break;
+            case 2: sprintf (names[i], "missing%d", n); break;
+            case 3: sprintf (names[i], "tool%d-x/../../sh", n - n%10); break;
+        }
+    }
+
+    list = allowlist_compile (patterns, size);
+
+    start = now_ns ();
+    for (i=0; i<BENCH_LOOKUPS; i++)
+        hits += allowlist_match (list, names[i]);
+    compiled = (now_ns () - start) / BENCH_LOOKUPS;
+
+    start = now_ns ();
+    for (i=0; i<BENCH_LOOKUPS; i++)
+        hits += linear_match (patterns, names[i]);
+    linear = (now_ns () - start) / BENCH_LOOKUPS;
+
+    printf ("allowlist_compiled  entries=%-6d %10.1f ns/op\n", size, compiled);
+    printf ("allowlist_linear    entries=%-6d %10.1f ns/op\n", size, linear);
+
+    allowlist_free (list);
+    for (i=0; i<size; i++)
+        free (patterns[i]);
+    for (i=0; i<BENCH_LOOKUPS; i++)
+        free (names[i]);
+    free (patterns);
+    free (names);
+}
+
+int main (){
+    run (10);
+    run (100);
+    run (1000);
+    run (10000);
+    return EXIT_SUCCESS;
+}
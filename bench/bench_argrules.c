@@ -0,0 +1,122 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Argument rules: compile time, number of states, and the time to check a
+ * command line with 10 to 5000 rules in one automaton, against checking
+ * the same rules one by one (one automaton per rule). The rules look like
+ * the ones of a real profile: "svcN status <unit>", "toolN --mode <m> **"
+ * and, for a third of them, "toolN ** --force **" in deny_args.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "argrules.h"
+
+#define BENCH_CHECKS 200000
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run (int size){
+    char** allow = (char**) malloc (size * sizeof (char*));
+    char** deny = (char**) malloc (size * sizeof (char*));
+    argrules** singles = (argrules**) malloc (2 * size * sizeof (argrules*));
+    char name[32], mode[32];
+    char* line[] = { name, "--mode", mode, "--verbose", "/var/log/messages", NULL };
+    argrules* rules = NULL;
+    double start = 0, compile = 0, one = 0, each = 0;
+    volatile int denied = 0;
+    int allow_nbr = 0, deny_nbr = 0, single_nbr = 0, i = 0, j = 0;
+
+    for (i=0; i<size; i++){
+        char rule[64];
+        if (i % 3 == 0)
+            snprintf (rule, sizeof (rule), "svc%d status <unit>", i);
+        else if (i % 3 == 1)
+            snprintf (rule, sizeof (rule), "tool%d --mode <m> **", i);
+        else {
+            snprintf (rule, sizeof (rule), "tool%d ** --force **", i - 1);
+            deny[deny_nbr++] = strdup (rule);
+            continue;
+        }
+        allow[allow_nbr++] = strdup (rule);
+    }
+
+    start = now_ns ();
+    rules = argrules_compile (allow, allow_nbr, deny, deny_nbr);
+    compile = now_ns () - start;
+    if (rules == NULL){
+        printf ("argrules_%-5d too many states\n", size);
+        return;
+    }
+
+    for (i=0; i<allow_nbr; i++)
+        singles[single_nbr++] = argrules_compile (allow + i, 1, NULL, 0);
+    for (i=0; i<deny_nbr; i++)
+        singles[single_nbr++] = argrules_compile (NULL, 0, deny + i, 1);
+
+    start = now_ns ();
+    for (i=0; i<BENCH_CHECKS; i++){
+        snprintf (name, sizeof (name), "tool%d", 3 * (i % (size / 3 + 1)) + 1);
+        snprintf (mode, sizeof (mode), "m%d", i & 7);
+        denied += argrules_check (rules, line);
+    }
+    one = (now_ns () - start) / BENCH_CHECKS;
+
+    start = now_ns ();
+    for (i=0; i<BENCH_CHECKS / 10; i++){
+        snprintf (name, sizeof (name), "tool%d", 3 * (i % (size / 3 + 1)) + 1);
+        snprintf (mode, sizeof (mode), "m%d", i & 7);
+        for (j=0; j<single_nbr; j++)
+            denied += argrules_check (singles[j], line);
+    }
+    each = (now_ns () - start) / (BENCH_CHECKS / 10);
+
+    printf ("argrules_%-5d states=%-7d compile %10.0f ns  check %6.0f ns/line  one by one %10.0f ns/line\n",
+            size, argrules_states (rules), compile, one, each);
+
+    argrules_free (rules);
+    for (i=0; i<single_nbr; i++)
+        argrules_free (singles[i]);
+    for (i=0; i<allow_nbr; i++)
+        free (allow[i]);
+    for (i=0; i<deny_nbr; i++)
+        free (deny[i]);
+    free (singles);
+    free (allow);
+    free (deny);
+}
+
+int main (){
+    run (10);
+    run (100);
+    run (1000);
+    run (5000);
+    return EXIT_SUCCESS;
+}
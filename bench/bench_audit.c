@@ -0,0 +1,143 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Latency of one audit record when the sink can't keep up. The sink is a
+ * FIFO drained at BENCH_SINK_KB KB per millisecond, much slower than the
+ * shell produces records, like a rate-limiting syslog daemon. "sync"
+ * writes each record straight to the sink, the way syslog() is called on
+ * the command path; the other runs go through the audit ring with each
+ * overflow behaviour. What matters is p99 and max: a command waits for
+ * its record before it is executed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "audit.h"
+
+#define BENCH_RECORDS   20000
+#define BENCH_SINK_KB   4
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare (const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * The slow sink: reads BENCH_SINK_KB KB, sleeps a millisecond, until EOF.
+ */
+
+static void drain_slowly (const char* fifo){
+    char buf[BENCH_SINK_KB * 1024];
+    int fd = open (fifo, O_RDONLY);
+
+    while (fd >= 0 && read (fd, buf, sizeof (buf)) > 0)
+        usleep (1000);
+    _exit (0);
+}
+
+static void produce (const char* name, int overflow, const char* fifo, const char* spill){
+    static double lat[BENCH_RECORDS];
+    char line[256];
+    double start = 0;
+    int fd = -1, len = 0, i = 0;
+
+    if (overflow < 0)
+        fd = open (fifo, O_WRONLY);
+    else {
+        audit_open ("bench");
+        audit_start (AUDIT_FILE, fifo, overflow, spill);
+    }
+
+    for (i=0; i<BENCH_RECORDS; i++){
+        start = now_ns ();
+        if (overflow < 0){
+            len = snprintf (line, sizeof (line), "bench: Using command: /usr/bin/ls (%d).\n", i);
+            if (write (fd, line, len) < 0)
+                break;
+        }else
+            audit (LOG_NOTICE, "Using command: /usr/bin/ls (%d).", i);
+        lat[i] = now_ns () - start;
+    }
+
+    qsort (lat, BENCH_RECORDS, sizeof (double), compare);
+    printf ("audit_%-6s p50 %8.0f ns  p99 %10.0f ns  max %10.0f ns\n", name,
+            lat[BENCH_RECORDS / 2], lat[BENCH_RECORDS * 99 / 100], lat[BENCH_RECORDS - 1]);
+    fflush (stdout);
+
+    /* Don't wait for the sink to take what's left */
+    _exit (0);
+}
+
+static void run (const char* name, int overflow, const char* fifo, const char* spill){
+    pid_t reader = 0, writer = 0;
+
+    reader = fork ();
+    if (reader == 0)
+        drain_slowly (fifo);
+    writer = fork ();
+    if (writer == 0)
+        produce (name, overflow, fifo, spill);
+
+    waitpid (writer, NULL, 0);
+    kill (reader, SIGTERM);
+    waitpid (reader, NULL, 0);
+}
+
+int main (){
+    char dir[] = "/tmp/agros-audit-XXXXXX";
+    char fifo[64], spill[64];
+
+    if (mkdtemp (dir) == NULL){
+        printf ("audit: skipped, can't create a directory in /tmp\n");
+        return EXIT_SUCCESS;
+    }
+    snprintf (fifo, sizeof (fifo), "%s/sink", dir);
+    snprintf (spill, sizeof (spill), "%s/spill", dir);
+    mkfifo (fifo, 0600);
+    signal (SIGPIPE, SIG_IGN);
+
+    run ("sync", -1, fifo, spill);
+    run ("block", AUDIT_BLOCK, fifo, spill);
+    run ("drop", AUDIT_DROP, fifo, spill);
+    run ("spill", AUDIT_SPILL, fifo, spill);
+
+    unlink (fifo);
+    unlink (spill);
+    rmdir (dir);
+    return EXIT_SUCCESS;
+}
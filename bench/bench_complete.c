@@ -0,0 +1,157 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Tab-completion over a PATH of 20k executables ("allowed = *"):
+ *   - the time to complete a 1 to 3 character prefix with the index,
+ *     against the strncmp() loop over every name that cmd_generator() used
+ *   - the time to build the index with the PATH scanned, and with the
+ *     names read from the cache file
+ *
+ * The executables are empty files created in a temporary directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "complete.h"
+
+#define BENCH_NAMES    20000
+#define BENCH_LOOKUPS  20000
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The loop cmd_generator() used before the index: one pass per prefix */
+static int linear_count (char** names, const char* prefix){
+    size_t length = strlen (prefix);
+    int count = 0, i = 0;
+
+    for (i=0; i<BENCH_NAMES; i++){
+        if (!strncmp (names[i], prefix, length))
+            count++;
+    }
+    return count;
+}
+
+static completion_index* build (exec_cache* paths, allowlist* all, const char* cache_file){
+    completion_index* index = completion_new ();
+
+    if (index == NULL || completion_add_path (index, paths, all, cache_file) < 0 || completion_build (index) < 0){
+        completion_free (index);
+        return NULL;
+    }
+    return index;
+}
+
+int main (){
+    char dir[] = "/tmp/bench_complete.XXXXXX";
+    char cache_dir[] = "/tmp/bench_complete_cache.XXXXXX";
+    char path[256], cache_file[300], prefix[4];
+    char* star[] = { "*" };
+    char** names = (char**) malloc (BENCH_NAMES * sizeof (char*));
+    completion_index* index = NULL;
+    exec_cache* paths = NULL;
+    allowlist* all = allowlist_compile (star, 1);
+    double start = 0, scanned = 0, cached = 0, indexed = 0, linear = 0;
+    volatile int hits = 0;
+    int first = 0, i = 0, len = 0, fd = -1;
+
+    if (mkdtemp (dir) == NULL || mkdtemp (cache_dir) == NULL || names == NULL || all == NULL){
+        printf ("complete: skipped, no temporary directory\n");
+        return EXIT_SUCCESS;
+    }
+
+    /* Names such as "kd3-tool17", spread over the alphabet like real ones */
+    srand (1);
+    for (i=0; i<BENCH_NAMES; i++){
+        snprintf (path, sizeof (path), "%c%c%d-tool%d", 'a' + rand () % 26, 'a' + rand () % 26, rand () % 10, i);
+        names[i] = strdup (path);
+        snprintf (path, sizeof (path), "%s/%s", dir, names[i]);
+        fd = open (path, O_CREAT | O_WRONLY, 0755);
+        if (fd >= 0)
+            close (fd);
+    }
+
+    /* Not in dir, which it would change */
+    snprintf (cache_file, sizeof (cache_file), "%s/commands", cache_dir);
+    paths = exec_cache_new (dir);
+
+    start = now_ns ();
+    index = build (paths, all, cache_file);
+    scanned = now_ns () - start;
+    completion_free (index);
+
+    start = now_ns ();
+    index = build (paths, all, cache_file);
+    cached = now_ns () - start;
+
+    if (index == NULL || exec_cache_dir (paths, 0) == NULL){
+        printf ("complete: skipped, could not scan %s\n", dir);
+        return EXIT_SUCCESS;
+    }
+
+    printf ("complete_build_scan   names=%d %12.0f ns\n", BENCH_NAMES, scanned);
+    printf ("complete_build_cache  names=%d %12.0f ns\n", BENCH_NAMES, cached);
+
+    for (len=1; len<=3; len++){
+        start = now_ns ();
+        for (i=0; i<BENCH_LOOKUPS; i++){
+            memcpy (prefix, names[i % BENCH_NAMES], len);
+            prefix[len] = '\0';
+            hits += completion_find (index, prefix, &first);
+        }
+        indexed = (now_ns () - start) / BENCH_LOOKUPS;
+
+        start = now_ns ();
+        for (i=0; i<BENCH_LOOKUPS / 100; i++){
+            memcpy (prefix, names[i % BENCH_NAMES], len);
+            prefix[len] = '\0';
+            hits += linear_count (names, prefix);
+        }
+        linear = (now_ns () - start) / (BENCH_LOOKUPS / 100);
+
+        printf ("complete_prefix_%d     index %8.0f ns/op   linear %10.0f ns/op\n", len, indexed, linear);
+    }
+
+    completion_free (index);
+    exec_cache_free (paths);
+    for (i=0; i<BENCH_NAMES; i++){
+        snprintf (path, sizeof (path), "%s/%s", dir, names[i]);
+        unlink (path);
+        free (names[i]);
+    }
+    unlink (cache_file);
+    rmdir (cache_dir);
+    rmdir (dir);
+    free (names);
+    allowlist_free (all);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The glib/readline build against the embedded one: ./agros and
+ * ./agros-embedded, each started BENCH_ROUNDS times on a new PTY, as a
+ * login would, until its prompt is printed. For each:
+ *
+ *   size     the size of the binary
+ *   mapped   that plus the shared libraries it maps, read from
+ *            /proc/<pid>/maps at the prompt
+ *   rss      VmRSS at the prompt, and RssAnon, the part that is the
+ *            session's own
+ *   prompt   from fork() to the prompt, on average
+ *
+ * Sessions run with the conf the binaries were built with, for the
+ * current user, and with HOME in a new directory so that no history is
+ * read or written.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define BENCH_ROUNDS 50
+#define BENCH_TIMEOUT_MS 5000
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The sizes of the distinct files pid maps, binary included */
+static long mapped_size (pid_t pid){
+    char path[64], line[512], last[512] = "";
+    char* file = NULL;
+    struct stat st;
+    long total = 0;
+    FILE* maps = NULL;
+
+    snprintf (path, sizeof (path), "/proc/%d/maps", (int) pid);
+    maps = fopen (path, "r");
+    if (maps == NULL)
+        return -1;
+    while (fgets (line, sizeof (line), maps) != NULL){
+        line[strcspn (line, "\n")] = '\0';
+        file = strchr (line, '/');
+        /* The mappings of a file follow each other */
+        if (file == NULL || !strcmp (file, last))
+            continue;
+        snprintf (last, sizeof (last), "%s", file);
+        if (stat (file, &st) == 0)
+            total += st.st_size;
+    }
+    fclose (maps);
+    return total;
+}
+
+static long status_kb (pid_t pid, const char* field){
+    char path[64], line[256];
+    size_t len = strlen (field);
+    long kb = -1;
+    FILE* status = NULL;
+
+    snprintf (path, sizeof (path), "/proc/%d/status", (int) pid);
+    status = fopen (path, "r");
+    if (status == NULL)
+        return -1;
+    while (fgets (line, sizeof (line), status) != NULL){
+        if (!strncmp (line, field, len) && line[len] == ':')
+            kb = atol (line + len + 1);
+    }
+    fclose (status);
+    return kb;
+}
+
+/*
+ * Starts binary on a new PTY and waits for the end of its prompt, "$ ".
+ * Fills in what was measured at the prompt. Returns the time it took, or
+ * -1 on failure.
+ */
+
+static double start_session (const char* binary, long* mapped, long* rss, long* anon){
+    struct pollfd pfd;
+    char buf[4096], tail[3] = "";
+    double start = 0, elapsed = -1;
+    ssize_t n = 0;
+    pid_t pid = 0;
+    int master = -1, slave = -1, i = 0;
+
+    master = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0 || grantpt (master) < 0 || unlockpt (master) < 0)
+        return -1;
+
+    start = now_ns ();
+    pid = fork ();
+    if (pid == 0){
+        setsid ();
+        slave = open (ptsname (master), O_RDWR);
+        if (slave < 0)
+            _exit (127);
+        dup2 (slave, 0);
+        dup2 (slave, 1);
+        dup2 (slave, 2);
+        execl (binary, "agros", (char*) NULL);
+        _exit (127);
+    }
+    if (pid < 0){
+        close (master);
+        return -1;
+    }
+
+    pfd.fd = master;
+    pfd.events = POLLIN;
+    while (poll (&pfd, 1, BENCH_TIMEOUT_MS) > 0 && (n = read (master, buf, sizeof (buf))) > 0){
+        for (i=0; i<n; i++){
+            tail[0] = tail[1];
+            tail[1] = buf[i];
+            if (!strcmp (tail, "$ "))
+                elapsed = now_ns () - start;
+        }
+        if (elapsed >= 0)
+            break;
+    }
+
+    if (elapsed >= 0){
+        *mapped = mapped_size (pid);
+        *rss = status_kb (pid, "VmRSS");
+        *anon = status_kb (pid, "RssAnon");
+    }
+    kill (pid, SIGKILL);
+    waitpid (pid, NULL, 0);
+    close (master);
+    return elapsed;
+}
+
+static void measure (const char* binary){
+    struct stat st;
+    double total = 0, one = 0;
+    long mapped = 0, rss = 0, anon = 0;
+    int i = 0;
+
+    if (stat (binary, &st) < 0){
+        printf ("startup %-18s skipped, not built\n", binary);
+        return;
+    }
+    for (i=0; i<BENCH_ROUNDS; i++){
+        one = start_session (binary, &mapped, &rss, &anon);
+        if (one < 0){
+            printf ("startup %-18s skipped, no prompt\n", binary);
+            return;
+        }
+        total += one;
+    }
+    printf ("startup %-18s size=%8ld B  mapped=%8ld B  rss=%5ld kB  anon=%5ld kB  prompt=%10.0f ns\n",
+            binary, (long) st.st_size, mapped, rss, anon, total / BENCH_ROUNDS);
+}
+
+int main (){
+    char home[] = "/tmp/agros-startup-XXXXXX";
+
+    if (mkdtemp (home) == NULL){
+        perror ("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    setenv ("HOME", home, 1);
+    unsetenv ("XDG_STATE_HOME");
+
+    measure ("./agros");
+    measure ("./agros-embedded");
+
+    rmdir (home);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Cost of finding "true" behind a deep PATH: BENCH_DEPTH empty directories
+ * come before the real ones, as on hosts whose PATH lists many mounted
+ * tool trees. It compares a PATH walk with a cached lookup, and execvp()
+ * with execveat() on the pinned descriptor. Point BENCH_DIR at a network
+ * mount to see what the walk costs there; every missed directory is a
+ * lookup round trip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "execcache.h"
+#include "launcher.h"
+
+#define BENCH_DEPTH         50
+#define BENCH_LOOKUPS       100000
+#define BENCH_SPAWNS        500
+
+static char* true_argv[] = { "true", NULL };
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * What execvp() does before exec: try each directory in turn.
+ */
+
+static int walk_path (const char* path, const char* name){
+    char buf[PATH_MAX];
+    const char* dir = path;
+    const char* end = NULL;
+    int len = 0;
+
+    while (*dir){
+        end = strchr (dir, ':');
+        len = end ? (int) (end - dir) : (int) strlen (dir);
+        snprintf (buf, sizeof (buf), "%.*s/%s", len, dir, name);
+        if (access (buf, X_OK) == 0)
+            return 0;
+        if (end == NULL)
+            break;
+        dir = end + 1;
+    }
+    return -1;
+}
+
+static void spawn_true (int fd){
+    spawn_t sp;
+    int status = 0;
+
+    sp.argv = true_argv;
+    sp.exec_fd = fd;
+    sp.exec_path = NULL;
+    sp.pgroup = 0;
+    sp.timed = 0;
+    sp.fds[0] = sp.fds[1] = sp.fds[2] = -1;
+    sp.limits = NULL;
+    sp.cgroup_fd = -1;
+    sp.ctty_fd = -1;
+    if (spawn_process (&sp) == 0)
+        spawn_wait (&sp, &status);
+}
+
+int main (){
+    const char* base = getenv ("BENCH_DIR") ? getenv ("BENCH_DIR") : "/tmp";
+    char root[PATH_MAX];
+    char dir[PATH_MAX];
+    char* path = NULL;
+    size_t size = 0;
+    exec_cache* cache = NULL;
+    exec_entry* entry = NULL;
+    double start = 0;
+    int i = 0;
+
+    snprintf (root, sizeof (root), "%s/agros-bench-XXXXXX", base);
+    if (mkdtemp (root) == NULL){
+        printf ("execcache: skipped, can't create a directory in %s\n", base);
+        return EXIT_SUCCESS;
+    }
+    chmod (root, 0755);
+
+    size = BENCH_DEPTH * (strlen (root) + 8) + 64;
+    path = (char*) malloc (size);
+    path[0] = '\0';
+    for (i=0; i<BENCH_DEPTH; i++){
+        snprintf (dir, sizeof (dir), "%s/%d", root, i);
+        mkdir (dir, 0755);
+        strcat (path, dir);
+        strcat (path, ":");
+    }
+    strcat (path, "/usr/bin:/bin");
+    setenv ("PATH", path, 1);
+
+    cache = exec_cache_new (path);
+    entry = exec_cache_lookup (cache, "true");
+    if (entry == NULL){
+        printf ("execcache: skipped, \"true\" not found\n");
+    }else {
+        start = now_ns ();
+        for (i=0; i<BENCH_LOOKUPS; i++)
+            walk_path (path, "true");
+        printf ("execcache_path_walk  depth=%d %10.0f ns/op\n", BENCH_DEPTH, (now_ns () - start) / BENCH_LOOKUPS);
+
+        start = now_ns ();
+        for (i=0; i<BENCH_LOOKUPS; i++)
+            exec_cache_lookup (cache, "true");
+        printf ("execcache_lookup     depth=%d %10.0f ns/op\n", BENCH_DEPTH, (now_ns () - start) / BENCH_LOOKUPS);
+
+        start = now_ns ();
+        for (i=0; i<BENCH_SPAWNS; i++)
+            spawn_true (-1);
+        printf ("execcache_execvp     depth=%d %10.0f ns/op\n", BENCH_DEPTH, (now_ns () - start) / BENCH_SPAWNS);
+
+        start = now_ns ();
+        for (i=0; i<BENCH_SPAWNS; i++)
+            spawn_true (exec_cache_lookup (cache, "true")->fd);
+        printf ("execcache_execveat   depth=%d %10.0f ns/op\n", BENCH_DEPTH, (now_ns () - start) / BENCH_SPAWNS);
+    }
+
+    exec_cache_free (cache);
+    for (i=0; i<BENCH_DEPTH; i++){
+        snprintf (dir, sizeof (dir), "%s/%d", root, i);
+        rmdir (dir);
+    }
+    rmdir (root);
+    free (path);
+    return EXIT_SUCCESS;
+}
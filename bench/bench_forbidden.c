@@ -0,0 +1,124 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Compares the compiled forbidden list with the nested strstr() loop that
+ * check_validity() used to run. Two lists are measured: single characters
+ * only, and a mix of characters and multi-character sequences. Words are
+ * clean, so every byte has to be scanned.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scanner.h"
+
+#define BENCH_WORDS   4096
+#define BENCH_ROUNDS  50
+
+static char* single_list[] = { ";", "|", ">", "<", "`", "&", NULL };
+
+static char* mixed_list[] = {
+    ";", "&&", "||", "$(", "${", "`", ">", ">>", "<", "|", "..", "\\",
+    "~/", "*", "?", "!", "'", "\"", "/etc/shadow", "/proc/", "--exec",
+    "-exec", "eval", "2>", "&>", "<<", "/dev/tcp", "sudo", "chmod", "IFS=",
+    NULL
+};
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The loop check_validity() used before the forbidden list was compiled */
+static int nested_search (char** list, char** words, int nwords){
+    int i = 0, j = 0;
+    while (list[i]){
+        for (j=0; j<nwords; j++){
+            if (strstr (words[j], list[i]) != NULL)
+                return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+static void run (const char* name, char** list, char** words, size_t bytes){
+    forbidden_scanner* scanner = NULL;
+    double start = 0, compiled = 0, nested = 0;
+    volatile int hits = 0;
+    int count = 0, i = 0, r = 0;
+
+    while (list[count])
+        count++;
+    scanner = scanner_compile (list, count);
+
+    start = now_ns ();
+    for (r=0; r<BENCH_ROUNDS; r++){
+        for (i=0; i<BENCH_WORDS; i++)
+            hits += scanner_search (scanner, words[i]);
+    }
+    compiled = now_ns () - start;
+
+    start = now_ns ();
+    for (r=0; r<BENCH_ROUNDS; r++)
+        hits += nested_search (list, words, BENCH_WORDS);
+    nested = now_ns () - start;
+
+    printf ("forbidden_compiled  list=%-6s patterns=%-3d %8.1f MB/s\n", name, count,
+            bytes * BENCH_ROUNDS / (compiled / 1e9) / 1e6);
+    printf ("forbidden_nested    list=%-6s patterns=%-3d %8.1f MB/s\n", name, count,
+            bytes * BENCH_ROUNDS / (nested / 1e9) / 1e6);
+    scanner_free (scanner);
+}
+
+int main (){
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-_/.=";
+    char** words = (char**) malloc (BENCH_WORDS * sizeof (char*));
+    size_t bytes = 0;
+    int i = 0, j = 0, len = 0;
+
+    srand (42);
+    for (i=0; i<BENCH_WORDS; i++){
+        len = 4 + rand () % 60;
+        words[i] = (char*) malloc (len + 1);
+        for (j=0; j<len; j++){
+            words[i][j] = alphabet[rand () % (sizeof (alphabet) - 1)];
+            /* No accidental "..": it's in the mixed list */
+            if (j > 0 && words[i][j] == '.' && words[i][j-1] == '.')
+                words[i][j] = 'x';
+        }
+        words[i][len] = '\0';
+        bytes += len;
+    }
+
+    run ("single", single_list, words, bytes);
+    run ("mixed", mixed_list, words, bytes);
+
+    for (i=0; i<BENCH_WORDS; i++)
+        free (words[i]);
+    free (words);
+    return EXIT_SUCCESS;
+}
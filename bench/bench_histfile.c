@@ -0,0 +1,130 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The history file: loading it at login, with BENCH_LINES lines of about
+ * 40 bytes, keeping all of them or the last 1000 (the default
+ * history_size), appending a line, and compacting the file down to 1000
+ * lines in the thread a session starts for it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "histfile.h"
+
+#define BENCH_LINES    100000
+#define BENCH_ROUNDS   20
+#define BENCH_APPENDS  10000
+
+static char* copies[BENCH_LINES];
+static int copy_nbr = 0;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* What readline's add_history() does: a copy of each line */
+static void keep_line (const char* line, size_t len){
+    copies[copy_nbr++ % BENCH_LINES] = strndup (line, len);
+}
+
+static void forget_lines (void){
+    int i = 0;
+
+    for (i=0; i<copy_nbr && i<BENCH_LINES; i++)
+        free (copies[i]);
+    copy_nbr = 0;
+}
+
+static void fill (const char* path){
+    char line[64];
+    histfile* hist = NULL;
+    int i = 0;
+
+    unlink (path);
+    hist = histfile_open (path, BENCH_LINES, keep_line);
+    for (i=0; i<BENCH_LINES; i++){
+        snprintf (line, sizeof (line), "grep -r pattern%d /var/log/app/%08d.log", i, i);
+        histfile_append (hist, line);
+    }
+    histfile_close (hist);
+}
+
+static void measure_load (const char* path, int max_lines){
+    histfile* hist = NULL;
+    double start = 0, total = 0;
+    int i = 0;
+
+    for (i=0; i<BENCH_ROUNDS; i++){
+        start = now_ns ();
+        hist = histfile_open (path, max_lines, keep_line);
+        total += now_ns () - start;
+        histfile_close (hist);
+        forget_lines ();
+    }
+    printf ("histfile_load     lines=%d keep=%6d %10.0f ns/op\n", BENCH_LINES, max_lines, total / BENCH_ROUNDS);
+}
+
+int main (){
+    char path[] = "/tmp/bench_histfile.XXXXXX";
+    histfile* hist = NULL;
+    double start = 0;
+    int fd = -1, i = 0;
+
+    fd = mkstemp (path);
+    if (fd < 0){
+        perror ("histfile: skipped");
+        return EXIT_SUCCESS;
+    }
+    close (fd);
+
+    fill (path);
+    measure_load (path, BENCH_LINES);
+
+    /* Loading with a smaller history_size starts a compaction, so the file
+       is filled again each time */
+    start = now_ns ();
+    hist = histfile_open (path, 1000, keep_line);
+    printf ("histfile_load     lines=%d keep=%6d %10.0f ns/op\n", BENCH_LINES, 1000, now_ns () - start);
+    start = now_ns ();
+    histfile_close (hist);
+    printf ("histfile_compact  lines=%d keep=%6d %10.0f ns/op\n", BENCH_LINES, 1000, now_ns () - start);
+    forget_lines ();
+
+    hist = histfile_open (path, 1000, keep_line);
+    start = now_ns ();
+    for (i=0; i<BENCH_APPENDS; i++)
+        histfile_append (hist, i % 2 ? "ls -l" : "make");
+    printf ("histfile_append   %10.0f ns/op\n", (now_ns () - start) / BENCH_APPENDS);
+    histfile_close (hist);
+    forget_lines ();
+
+    unlink (path);
+    return EXIT_SUCCESS;
+}
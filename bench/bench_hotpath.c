@@ -0,0 +1,285 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The work AGROS does for every line typed, function by function:
+ * parse_command() on lines from 256 bytes to half of ARG_MAX,
+ * find_builtin(), check_validity() and cmd_generator() against generated
+ * allowed lists of 1 to 10000 names, and runs_in_background().
+ *
+ * The results are printed one per line in the format of Go's testing
+ * package, which benchstat and most CI dashboards read:
+ *
+ *   BenchmarkCheckValidity/allowed=1000/denied  2000000  61.2 ns/op  0 B/op  0.00 allocs/op
+ *
+ * Each case runs for about BENCH_TIME_MS. malloc() and friends are counted
+ * by wrapping glibc's own allocator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "agros.h"
+#include "builtins.h"
+
+#define BENCH_TIME_MS  100
+
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t nmemb, size_t size);
+extern void* __libc_realloc (void* ptr, size_t size);
+extern void  __libc_free (void* ptr);
+
+static long allocations = 0;
+static long allocated = 0;
+
+void* malloc (size_t size){
+    allocations++;
+    allocated += size;
+    return __libc_malloc (size);
+}
+
+void* calloc (size_t nmemb, size_t size){
+    allocations++;
+    allocated += nmemb * size;
+    return __libc_calloc (nmemb, size);
+}
+
+void* realloc (void* ptr, size_t size){
+    allocations++;
+    allocated += size;
+    return __libc_realloc (ptr, size);
+}
+
+void free (void* ptr){
+    __libc_free (ptr);
+}
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Runs op n times, with n grown until the whole takes BENCH_TIME_MS, and
+ * prints the result.
+ */
+
+static void run (const char* name, void (*op)(void)){
+    double start = 0, elapsed = 0, target = BENCH_TIME_MS * 1e6;
+    long n = 1, i = 0;
+
+    for (;;){
+        allocations = allocated = 0;
+        start = now_ns ();
+        for (i=0; i<n; i++)
+            op ();
+        elapsed = now_ns () - start;
+        if (elapsed >= target || n >= 1000000000L)
+            break;
+        n = elapsed > 0 && target / elapsed * n < n * 100.0 ? (long) (target / elapsed * n * 1.2) + 1 : n * 100;
+    }
+
+    printf ("Benchmark%s\t%ld\t%.1f ns/op\t%ld B/op\t%.2f allocs/op\n", name, n, elapsed / n,
+            allocated / n, (double) allocations / n);
+    fflush (stdout);
+}
+
+/* What the cases work on */
+static char* line = NULL;
+static char* copy = NULL;
+static size_t line_size = 0;
+static command_t cmd = COMMAND_EMPTY;
+static config_t config;
+static const char* builtin_name = NULL;
+static const char* prefix = NULL;
+
+static void op_parse (void){
+    memcpy (copy, line, line_size);
+    if (parse_command (copy, &cmd) != PARSE_OK){
+        fprintf (stderr, "bench_hotpath: parse error\n");
+        exit (EXIT_FAILURE);
+    }
+}
+
+static void op_find_builtin (void){
+    if (find_builtin (builtin_name) == (const builtin_t*) 1)
+        exit (EXIT_FAILURE);
+}
+
+static void op_check_validity (void){
+    check_validity (&cmd, &config);
+}
+
+static void op_background (void){
+    if (runs_in_background (&cmd) == -1)
+        exit (EXIT_FAILURE);
+}
+
+/* What readline does for a tab: every match, then frees them */
+static void op_complete (void){
+    char* match = NULL;
+    int state = 0;
+
+    while ((match = cmd_generator (prefix, state++)) != NULL)
+        free (match);
+}
+
+/*
+ * Makes a line of "ls" and words of 16 bytes, size bytes long in all.
+ */
+
+static void make_line (size_t size){
+    size_t used = 0;
+    int i = 0;
+
+    free (line);
+    free (copy);
+    line = (char*) malloc (size + 1);
+    copy = (char*) malloc (size + 1);
+    if (line == NULL || copy == NULL){
+        perror ("bench_hotpath");
+        exit (EXIT_FAILURE);
+    }
+    used = sprintf (line, "ls");
+    while (used + 16 <= size)
+        used += sprintf (line + used, " file%010d", i++);
+    line_size = used + 1;
+}
+
+static void bench_parse (void){
+    size_t sizes[] = { 256, 4096, 65536, 0 };
+    char name[64];
+    long arg_max = sysconf (_SC_ARG_MAX);
+    int i = 0;
+
+    /* Half of ARG_MAX as text is most of it as argv: each word also costs
+       a pointer and its NUL */
+    sizes[3] = arg_max > 0 ? arg_max / 2 : 1048576;
+    for (i=0; i<4; i++){
+        make_line (sizes[i]);
+        snprintf (name, sizeof (name), "ParseCommand/bytes=%zu", sizes[i]);
+        run (name, op_parse);
+    }
+}
+
+static void bench_builtins (void){
+    builtin_name = "echo";
+    run ("FindBuiltin/hit", op_find_builtin);
+    builtin_name = "grep";
+    run ("FindBuiltin/miss", op_find_builtin);
+}
+
+static void bench_background (void){
+    char text[] = "sleep 10";
+    char text_amp[] = "sleep 10&";
+
+    parse_command (text, &cmd);
+    run ("RunsInBackground/foreground", op_background);
+
+    parse_command (text_amp, &cmd);
+    run ("RunsInBackground/background", op_background);
+}
+
+/*
+ * Writes a conf whose General section allows names cmd0 to cmd<n-1>, and
+ * loads it.
+ */
+
+static void load_allowed (const char* dir, int n){
+    char conf[128], image[128];
+    FILE* f = NULL;
+    int i = 0;
+
+    snprintf (conf, sizeof (conf), "%s/agros.conf", dir);
+    snprintf (image, sizeof (image), "%s/none.img", dir);
+    f = fopen (conf, "w");
+    if (f == NULL){
+        perror (conf);
+        exit (EXIT_FAILURE);
+    }
+    fprintf (f, "[General]\nallowed = ");
+    for (i=0; i<n; i++)
+        fprintf (f, "%scmd%d", i ? ";" : "", i);
+    fprintf (f, "\nforbidden = \\;;&&;`;$(;>;<\nloglevel = 0\n");
+    fclose (f);
+
+    if (load_config (&config, "bench", conf, image) != CONF_OK){
+        fprintf (stderr, "bench_hotpath: could not load %s\n", conf);
+        exit (EXIT_FAILURE);
+    }
+    unlink (conf);
+}
+
+static void bench_policy (const char* dir){
+    static const int sizes[] = { 1, 10, 100, 1000, 10000 };
+    char name[64], text[64];
+    int i = 0;
+
+    for (i=0; i<5; i++){
+        load_allowed (dir, sizes[i]);
+
+        /* The last name of the list, with a few arguments */
+        snprintf (text, sizeof (text), "cmd%d -l --color=never /var/log", sizes[i] - 1);
+        parse_command (text, &cmd);
+        snprintf (name, sizeof (name), "CheckValidity/allowed=%d/allowed", sizes[i]);
+        run (name, op_check_validity);
+
+        snprintf (text, sizeof (text), "rm -rf /var/log");
+        parse_command (text, &cmd);
+        snprintf (name, sizeof (name), "CheckValidity/allowed=%d/denied", sizes[i]);
+        run (name, op_check_validity);
+
+        /* The first tab builds the completion index */
+        set_completion_list (&config);
+        prefix = "cmd1";
+        op_complete ();
+        snprintf (name, sizeof (name), "CmdGenerator/allowed=%d/prefix=cmd1", sizes[i]);
+        run (name, op_complete);
+
+        set_completion_list (NULL);
+        config_free (&config);
+    }
+}
+
+int main (){
+    char dir[] = "/tmp/agros-bench-XXXXXX";
+
+    if (mkdtemp (dir) == NULL){
+        perror ("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    bench_parse ();
+    bench_builtins ();
+    bench_background ();
+    bench_policy (dir);
+
+    command_free (&cmd);
+    free (line);
+    free (copy);
+    rmdir (dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Compares the configuration step of a login when agros.conf is parsed
+ * with GKeyFile and when the compiled policy image is mapped instead.
+ * The generated conf has one [userN] section per user, which is what makes
+ * the INI path slow on hosts with many users.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "agros.h"
+#include "policy.h"
+#include "allowlist.h"
+#include "scanner.h"
+
+#define BENCH_USERS   2000
+#define BENCH_ROUNDS  200
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void write_conf (const char* path, int users){
+    FILE* f = fopen (path, "w");
+    int i = 0;
+
+    if (f == NULL){
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    fprintf (f, "[General]\nallowed = ls;grep;cat;df;uptime\nforbidden = \\;;&&;|;>\n\n");
+    for (i=0; i<users; i++)
+        fprintf (f, "[user%d]\nwelcome = Hello user%d\nallowed = ls;grep;tail;head;less;ps;top;df;du;uptime;cmd%d\n\n", i, i, i);
+    fclose (f);
+}
+
+static double time_login (const char* conf, const char* image, char* username){
+    config_t config;
+    double start = 0;
+    int i = 0;
+
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        if (load_config (&config, username, conf, image) != CONF_OK){
+            fprintf (stderr, "bench_login: could not load %s\n", conf);
+            exit (EXIT_FAILURE);
+        }
+        free (config.allowed_list);
+        allowlist_free (config.allowed_matcher);
+        free (config.forbidden_list);
+        scanner_free (config.forbidden_matcher);
+        free (config.welcome_message);
+    }
+
+    return (now_ns () - start) / BENCH_ROUNDS;
+}
+
+int main (){
+    char dir[] = "/tmp/agros-bench-XXXXXX";
+    char conf[64], image[64], missing[64];
+    char username[] = "user1999";
+    double ini = 0, img = 0;
+
+    if (mkdtemp (dir) == NULL){
+        perror ("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf (conf, sizeof (conf), "%s/agros.conf", dir);
+    snprintf (image, sizeof (image), "%s/agros.conf.img", dir);
+    snprintf (missing, sizeof (missing), "%s/none.img", dir);
+
+    write_conf (conf, BENCH_USERS);
+    if (policy_image_compile (conf, image) < 0)
+        return EXIT_FAILURE;
+
+    ini = time_login (conf, missing, username);
+    img = time_login (conf, image, username);
+
+    printf ("login_config_ini    users=%d  %12.0f ns/op\n", BENCH_USERS, ini);
+    printf ("login_config_image  users=%d  %12.0f ns/op\n", BENCH_USERS, img);
+
+    unlink (image);
+    unlink (conf);
+    rmdir (dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Cost of the metrics of one command: the allowed, started and ran
+ * updates a session makes for each. "one" counts the same command every
+ * time, which the lookup cache catches; "many" goes through
+ * BENCH_NAMES names, each a lookup in the shared table. "off" is the cost
+ * with metrics disabled. The segment is a private one, gone on exit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include "metrics.h"
+
+#define BENCH_ROUNDS  1000000
+#define BENCH_NAMES   256
+
+static char names[BENCH_NAMES][16];
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void measure (const char* mode, int name_nbr){
+    struct rusage usage;
+    double start = 0;
+    const char* name = NULL;
+    int i = 0;
+
+    memset (&usage, 0, sizeof (usage));
+    usage.ru_utime.tv_usec = 1000;
+    usage.ru_stime.tv_usec = 500;
+    usage.ru_maxrss = 2048;
+
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        name = names[i % name_nbr];
+        metrics_allowed (name);
+        metrics_started (name, 20000 + i % 4096, 100000 + i % 65536);
+        metrics_ran (name, 1000000 + i, &usage);
+    }
+    printf ("metrics_%-5s names=%3d %8.1f ns/command\n", mode, name_nbr, (now_ns () - start) / BENCH_ROUNDS);
+}
+
+int main (){
+    int i = 0;
+
+    for (i=0; i<BENCH_NAMES; i++)
+        snprintf (names[i], sizeof (names[i]), "cmd%d", i);
+
+    measure ("off", 1);
+
+    if (metrics_open (IPC_PRIVATE) < 0){
+        perror ("metrics: skipped, no shared memory");
+        return EXIT_SUCCESS;
+    }
+    metrics_session ("bench");
+    measure ("one", 1);
+    measure ("many", BENCH_NAMES);
+    metrics_close ();
+    return EXIT_SUCCESS;
+}
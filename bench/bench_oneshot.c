@@ -0,0 +1,99 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Measures what "agros -c" adds to a command, the way monitoring calls it
+ * through ssh: the time to run "agros -c 'ls -d /'" minus the time to run
+ * "ls -d /" directly. It uses the agros binary built in the current
+ * directory (or the one given as argument) and the agros.conf it was built
+ * with, which must allow "ls".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define BENCH_ROUNDS 300
+
+extern char** environ;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Runs argv BENCH_ROUNDS times with its output discarded and returns the
+ * average time per run, or -1 if it ever fails.
+ */
+
+static double time_runs (char** argv){
+    posix_spawn_file_actions_t actions;
+    double start = 0;
+    pid_t pid = 0;
+    int status = 0, i = 0;
+
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        if (posix_spawnp (&pid, argv[0], &actions, NULL, argv, environ) != 0)
+            return -1;
+        if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+            return -1;
+    }
+
+    posix_spawn_file_actions_destroy (&actions);
+    return (now_ns () - start) / BENCH_ROUNDS;
+}
+
+int main (int argc, char** argv){
+    char* agros = argc > 1 ? argv[1] : "./agros";
+    char* direct_argv[] = { "ls", "-d", "/", NULL };
+    char* agros_argv[] = { agros, "-c", "ls -d /", NULL };
+    double direct = 0, wrapped = 0;
+
+    if (access (agros, X_OK) < 0){
+        printf ("oneshot: skipped, %s not built\n", agros);
+        return EXIT_SUCCESS;
+    }
+
+    direct = time_runs (direct_argv);
+    wrapped = time_runs (agros_argv);
+    if (direct < 0 || wrapped < 0){
+        printf ("oneshot: skipped, \"ls -d /\" failed or is not allowed\n");
+        return EXIT_SUCCESS;
+    }
+
+    printf ("oneshot_direct      %12.0f ns/op\n", direct);
+    printf ("oneshot_agros_c     %12.0f ns/op\n", wrapped);
+    printf ("oneshot_overhead    %12.0f ns/op\n", wrapped - direct);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * What the shared output cache saves a polling command. uncached runs
+ * "uptime" with the launcher, its output in memfds, as a miss does; hit
+ * is a lookup that finds the entry. coalesced starts BENCH_CLIENTS
+ * processes at once on a key nobody has, for a command that takes
+ * BENCH_SLOW_MS, and counts how many of them ran it: one, if single-flight
+ * works.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "outcache.h"
+
+#define BENCH_ROUNDS   200
+#define BENCH_HITS     100000
+#define BENCH_CLIENTS  16
+#define BENCH_SLOW_MS  100
+
+static char* uptime_argv[] = { "uptime", NULL };
+static char profile[64];
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Runs argv with its output in two new memfds, as run_cached() does.
+ */
+
+static int run_captured (char** argv, int* out, int* err){
+    spawn_t sp;
+    int status = 0;
+
+    *out = memfd_create ("bench-stdout", MFD_CLOEXEC);
+    *err = memfd_create ("bench-stderr", MFD_CLOEXEC);
+    sp.argv = argv;
+    sp.exec_fd = -1;
+    sp.exec_path = NULL;
+    sp.pgroup = 0;
+    sp.timed = 0;
+    sp.fds[0] = -1;
+    sp.fds[1] = *out;
+    sp.fds[2] = *err;
+    sp.limits = NULL;
+    sp.cgroup_fd = -1;
+    sp.ctty_fd = -1;
+    if (spawn_process (&sp) < 0 || spawn_wait (&sp, &status) < 0)
+        return -1;
+    return WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+}
+
+static double time_uncached (void){
+    double start = now_ns ();
+    int out = -1, err = -1, i = 0;
+
+    for (i=0; i<BENCH_ROUNDS; i++){
+        run_captured (uptime_argv, &out, &err);
+        close (out);
+        close (err);
+    }
+    return (now_ns () - start) / BENCH_ROUNDS;
+}
+
+static double time_hit (void){
+    outcache_result cached;
+    double start = 0;
+    int out = -1, err = -1, status = 0, i = 0;
+
+    /* The entry the hits find */
+    if (outcache_lookup (profile, uptime_argv, &cached) == OUTCACHE_MISS){
+        status = run_captured (uptime_argv, &out, &err);
+        outcache_store (&cached, out, err, status, 60);
+        close (out);
+        close (err);
+    }
+    outcache_release (&cached);
+
+    start = now_ns ();
+    for (i=0; i<BENCH_HITS; i++){
+        if (outcache_lookup (profile, uptime_argv, &cached) != OUTCACHE_HIT){
+            fprintf (stderr, "bench_outcache: no entry, is %s usable?\n", OUTCACHE_DIR);
+            exit (EXIT_FAILURE);
+        }
+        outcache_release (&cached);
+    }
+    return (now_ns () - start) / BENCH_HITS;
+}
+
+/*
+ * Each client looks the slow command up and runs it on a miss. Returns
+ * how many ran it.
+ */
+
+static int count_runs (void){
+    char delay[16];
+    char* slow_argv[] = { "sleep", delay, NULL };
+    outcache_result cached;
+    int out = -1, err = -1, status = 0, runs = 0, i = 0;
+    pid_t pid = 0;
+
+    snprintf (delay, sizeof (delay), "%.3f", BENCH_SLOW_MS / 1000.0);
+    for (i=0; i<BENCH_CLIENTS; i++){
+        pid = fork ();
+        if (pid < 0){
+            perror ("fork");
+            exit (EXIT_FAILURE);
+        }
+        if (pid > 0)
+            continue;
+
+        if (outcache_lookup (profile, slow_argv, &cached) != OUTCACHE_MISS)
+            _exit (0);
+        status = run_captured (slow_argv, &out, &err);
+        outcache_store (&cached, out, err, status, 60);
+        _exit (1);
+    }
+
+    while (wait (&status) > 0){
+        if (WIFEXITED (status))
+            runs += WEXITSTATUS (status);
+    }
+    return runs;
+}
+
+int main (){
+    double uncached = 0, hit = 0;
+
+    snprintf (profile, sizeof (profile), "bench-%d", (int) getpid ());
+
+    uncached = time_uncached ();
+    hit = time_hit ();
+    printf ("outcache_uncached  %12.0f ns/op\n", uncached);
+    printf ("outcache_hit       %12.0f ns/op\n", hit);
+    printf ("outcache_coalesced clients=%d  runs=%d\n", BENCH_CLIENTS, count_runs ());
+    return EXIT_SUCCESS;
+}
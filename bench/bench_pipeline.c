@@ -0,0 +1,175 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Throughput of "head -c N /dev/zero | cat | wc -c", three ways: stages
+ * connected by pipes, stages connected through the splice() relay of
+ * pipe_relay, and the round trips a pipeline replaces, each command run
+ * on its own with its output kept in a file for the next one.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "pipeline.h"
+
+#define BENCH_MB 256
+
+static char size_arg[32];
+static char* head_argv[] = { "head", "-c", size_arg, "/dev/zero", NULL };
+static char* cat_argv[] = { "cat", NULL };
+static char* wc_argv[] = { "wc", "-c", NULL };
+static char** stages[] = { head_argv, cat_argv, wc_argv };
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int start (spawn_t* sp, char** argv, int in, int out){
+    sp->argv = argv;
+    sp->exec_fd = -1;
+    sp->exec_path = NULL;
+    sp->pgroup = 0;
+    sp->timed = 0;
+    sp->fds[0] = in;
+    sp->fds[1] = out;
+    sp->fds[2] = -1;
+    sp->limits = NULL;
+    sp->cgroup_fd = -1;
+    sp->ctty_fd = -1;
+    return spawn_process (sp);
+}
+
+static void close_fd (int fd){
+    if (fd >= 0)
+        close (fd);
+}
+
+/*
+ * The three stages, with pipes between them or, with relay, two pipes
+ * each and the relay in the middle.
+ */
+
+static int run_pipeline (int relay, int out){
+    spawn_t sps[3];
+    int from[2], to[2];
+    size_t bytes[2] = {0, 0};
+    int a[2], b[2];
+    int in = -1, next = -1, write_end = -1, i = 0, status = 0;
+
+    for (i=0; i<3; i++){
+        write_end = out;
+        if (i < 2){
+            if (pipe2 (a, O_CLOEXEC) < 0)
+                return -1;
+            write_end = a[1];
+            next = a[0];
+            if (relay){
+                if (pipe2 (b, O_CLOEXEC) < 0)
+                    return -1;
+                from[i] = a[0];
+                to[i] = b[1];
+                next = b[0];
+            }
+        }
+        if (start (&sps[i], stages[i], in, write_end) < 0)
+            return -1;
+        close_fd (in);
+        if (i < 2)
+            close (write_end);
+        in = next;
+    }
+
+    if (relay)
+        pipeline_relay (from, to, bytes, 2, NULL);
+    for (i=0; i<3; i++)
+        spawn_wait (&sps[i], &status);
+    return status;
+}
+
+/*
+ * One command after the other, through files.
+ */
+
+static int run_round_trips (int out){
+    char first[] = "/tmp/bench_pipeline.XXXXXX";
+    char second[] = "/tmp/bench_pipeline.XXXXXX";
+    spawn_t sp;
+    int a = mkstemp (first), b = mkstemp (second), status = 0;
+
+    if (a < 0 || b < 0)
+        return -1;
+    if (start (&sp, head_argv, -1, a) == 0)
+        spawn_wait (&sp, &status);
+    lseek (a, 0, SEEK_SET);
+    if (start (&sp, cat_argv, a, b) == 0)
+        spawn_wait (&sp, &status);
+    lseek (b, 0, SEEK_SET);
+    if (start (&sp, wc_argv, b, out) == 0)
+        spawn_wait (&sp, &status);
+
+    close (a);
+    close (b);
+    unlink (first);
+    unlink (second);
+    return status;
+}
+
+static int run_direct (int out){
+    return run_pipeline (0, out);
+}
+
+static int run_relay (int out){
+    return run_pipeline (1, out);
+}
+
+static void measure (const char* name, int (*run)(int), int out){
+    double start_ns = now_ns (), elapsed = 0;
+
+    if (run (out) != 0){
+        printf ("pipeline_%-12s failed\n", name);
+        return;
+    }
+    elapsed = now_ns () - start_ns;
+    printf ("pipeline_%-12s %4d MB %8.1f ms %8.0f MB/s\n", name, BENCH_MB, elapsed / 1e6, BENCH_MB / (elapsed / 1e9));
+}
+
+int main (){
+    int out = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    snprintf (size_arg, sizeof (size_arg), "%dM", BENCH_MB);
+    measure ("pipes", run_direct, out);
+    measure ("relay", run_relay, out);
+    measure ("round_trips", run_round_trips, out);
+    close (out);
+    return EXIT_SUCCESS;
+}
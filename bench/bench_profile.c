@@ -0,0 +1,202 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * The configuration step of a login with agros.conf.d: resolving the
+ * user's profile (the drop-in file of the user and of each of its groups)
+ * and reading a merged list and a scalar through it. Each size has one
+ * drop-in file per user. "cold" logs in a different user each round, so
+ * every profile is resolved; "cached" logs the same user in again, which
+ * only checks that its files didn't change. Both should stay flat as the
+ * number of users grows. The groups are those of the process running the
+ * benchmark, each with a drop-in file of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include "policy.h"
+
+#define BENCH_ROUNDS  2000
+#define BENCH_GROUPS  64
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static gid_t groups[BENCH_GROUPS];
+static int ngroups = 0;
+
+static void write_file (const char* path, const char* section, const char* allowed){
+    FILE* f = fopen (path, "w");
+
+    if (f == NULL){
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    fprintf (f, "[%s]\nwelcome = Hello %s\nallowed = %s\n", section, section, allowed);
+    fclose (f);
+}
+
+static void write_tree (const char* dir, int users){
+    char path[256], name[64];
+    struct group* grp = NULL;
+    FILE* f = NULL;
+    int i = 0;
+
+    snprintf (path, sizeof (path), "%s/agros.conf", dir);
+    f = fopen (path, "w");
+    if (f == NULL){
+        perror (path);
+        exit (EXIT_FAILURE);
+    }
+    fprintf (f, "[General]\nallowed = ls;grep;cat;df;uptime\nforbidden = \\;;&&;|;>\n");
+    fclose (f);
+
+    snprintf (path, sizeof (path), "%s/agros.conf.d", dir);
+    mkdir (path, 0755);
+    snprintf (path, sizeof (path), "%s/agros.conf.d/users", dir);
+    mkdir (path, 0755);
+    snprintf (path, sizeof (path), "%s/agros.conf.d/groups", dir);
+    mkdir (path, 0755);
+
+    for (i=0; i<users; i++){
+        snprintf (name, sizeof (name), "user%d", i);
+        snprintf (path, sizeof (path), "%s/agros.conf.d/users/%s.conf", dir, name);
+        write_file (path, name, "ls;grep;tail;head;less;ps;top;df;du;uptime");
+    }
+    for (i=0; i<ngroups; i++){
+        if ((grp = getgrgid (groups[i])) == NULL)
+            continue;
+        snprintf (name, sizeof (name), "@%s", grp->gr_name);
+        snprintf (path, sizeof (path), "%s/agros.conf.d/groups/%s.conf", dir, grp->gr_name);
+        write_file (path, name, "tail;head;journalctl;systemctl");
+    }
+}
+
+static void remove_tree (const char* dir, int users){
+    char path[256];
+    struct group* grp = NULL;
+    int i = 0;
+
+    for (i=0; i<users; i++){
+        snprintf (path, sizeof (path), "%s/agros.conf.d/users/user%d.conf", dir, i);
+        unlink (path);
+    }
+    for (i=0; i<ngroups; i++){
+        if ((grp = getgrgid (groups[i])) == NULL)
+            continue;
+        snprintf (path, sizeof (path), "%s/agros.conf.d/groups/%s.conf", dir, grp->gr_name);
+        unlink (path);
+    }
+    snprintf (path, sizeof (path), "%s/agros.conf.d/users", dir);
+    rmdir (path);
+    snprintf (path, sizeof (path), "%s/agros.conf.d/groups", dir);
+    rmdir (path);
+    snprintf (path, sizeof (path), "%s/agros.conf.d", dir);
+    rmdir (path);
+    snprintf (path, sizeof (path), "%s/agros.conf", dir);
+    unlink (path);
+}
+
+/*
+ * Logs user<first> to user<first + spread - 1> in, in turn.
+ */
+
+static double time_login (const char* conf, int first, int spread){
+    conf_source* src = NULL;
+    const char* group = NULL;
+    char** allowed = NULL;
+    char* welcome = NULL;
+    char name[64];
+    double start = 0;
+    int count = 0;
+    int i = 0;
+
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        snprintf (name, sizeof (name), "user%d", first + i % spread);
+        src = conf_open (conf, NULL);
+        if (src == NULL || conf_use_profile (src, conf, name, 10000 + first + i % spread,
+                                             getgid (), groups, ngroups) < 0){
+            fprintf (stderr, "bench_profile: could not load %s\n", conf);
+            exit (EXIT_FAILURE);
+        }
+        allowed = conf_get_merged_list (src, name, "allowed", &count, &group);
+        welcome = conf_get_string (src, conf_select_group (src, name, "welcome"), "welcome");
+        if (allowed == NULL || welcome == NULL){
+            fprintf (stderr, "bench_profile: no profile for %s\n", name);
+            exit (EXIT_FAILURE);
+        }
+        free (allowed);
+        free (welcome);
+        conf_close (src);
+    }
+
+    return (now_ns () - start) / BENCH_ROUNDS;
+}
+
+int main (){
+    static const int sizes[] = { 100, 1000, 10000, 100000 };
+    char dir[] = "/tmp/agros-bench-XXXXXX";
+    char conf[64];
+    double cold = 0, cached = 0;
+    int i = 0;
+
+    if (mkdtemp (dir) == NULL){
+        perror ("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf (conf, sizeof (conf), "%s/agros.conf", dir);
+    ngroups = getgroups (BENCH_GROUPS - 1, groups);
+    if (ngroups < 0)
+        ngroups = 0;
+    for (i=0; i<ngroups && groups[i] != getgid (); i++)
+        ;
+    if (i == ngroups)
+        groups[ngroups++] = getgid ();
+
+    for (i=0; i<4; i++){
+        write_tree (dir, sizes[i]);
+
+        /* More users than the cache holds, so every round resolves */
+        cold = time_login (conf, 0, sizes[i] < 1000 ? sizes[i] : 1000);
+        cached = time_login (conf, sizes[i] - 1, 1);
+
+        printf ("login_profile_cold    users=%-6d groups=%d  %10.0f ns/op\n", sizes[i], ngroups, cold);
+        printf ("login_profile_cached  users=%-6d groups=%d  %10.0f ns/op\n", sizes[i], ngroups, cached);
+        fflush (stdout);
+
+        remove_tree (dir, sizes[i]);
+    }
+
+    rmdir (dir);
+    return EXIT_SUCCESS;
+}
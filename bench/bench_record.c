@@ -0,0 +1,266 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * What recording a session costs: "cat FILE" of a BENCH_MB file, with its
+ * output going straight to the sink and through the recorder. The sinks
+ * are a pipe, where the recorder tee()s and splice()s, a terminal (a PTY)
+ * and /dev/null, where it reads and writes; a reader drains the first two.
+ * FILE is log-like text, which compresses well, and random bytes, which
+ * don't. The best of BENCH_ROUNDS runs is kept.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "record.h"
+
+#define BENCH_MB      64
+#define BENCH_ROUNDS  3
+
+static char file_arg[64];
+static char* cat_argv[] = { "cat", file_arg, NULL };
+static char* drain_argv[] = { "cat", NULL };
+
+static char record_dir[] = "/tmp/bench_record.XXXXXX";
+static recorder* rec = NULL;
+static FILE* report = NULL;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int start (spawn_t* sp, char** argv, int in, int out){
+    sp->argv = argv;
+    sp->exec_fd = -1;
+    sp->exec_path = NULL;
+    sp->pgroup = 0;
+    sp->timed = 0;
+    sp->fds[0] = in;
+    sp->fds[1] = out;
+    sp->fds[2] = out;
+    sp->limits = NULL;
+    sp->cgroup_fd = -1;
+    sp->ctty_fd = -1;
+    return spawn_process (sp);
+}
+
+/*
+ * Writes BENCH_MB of text lines, or of random bytes, to path.
+ */
+
+static int make_file (const char* path, int text){
+    char line[256];
+    size_t size = 0, len = 0;
+    FILE* out = fopen (path, "w");
+    FILE* random = text ? NULL : fopen ("/dev/urandom", "r");
+    int i = 0;
+
+    if (out == NULL || (!text && random == NULL))
+        return -1;
+    while (size < (size_t) BENCH_MB * 1024 * 1024){
+        if (text)
+            len = snprintf (line, sizeof (line), "2026-10-17T12:%02d:%02d.%06dZ host sshd[%d]: Accepted publickey for user%d from 10.0.%d.%d port %d\n",
+                            i / 60 % 60, i % 60, i * 7919 % 1000000, 1000 + i % 5000, i % 97, i % 256, i * 31 % 256, 1024 + i % 60000);
+        else
+            len = fread (line, 1, sizeof (line), random);
+        fwrite (line, 1, len, out);
+        size += len;
+        i++;
+    }
+    if (random != NULL)
+        fclose (random);
+    return fclose (out);
+}
+
+static int run_direct (void){
+    spawn_t sp;
+    int status = 0;
+
+    if (start (&sp, cat_argv, -1, -1) < 0 || spawn_wait (&sp, &status) < 0)
+        return -1;
+    return status;
+}
+
+static int run_recorded (void){
+    command_t cmd = COMMAND_EMPTY;
+    stage_t stage = { 2, cat_argv, 0, 0 };
+    spawn_t sp;
+    int output = -1, capture = -1, terminal = 0, status = 0;
+
+    cmd.stages = &stage;
+    cmd.stage_nbr = 1;
+    if (record_begin (rec, &cmd) < 0 || record_capture (&output, &capture, &terminal) < 0)
+        return -1;
+    if (start (&sp, cat_argv, -1, capture) < 0)
+        return -1;
+    close (capture);
+    record_relay (rec, output, terminal, &sp, 1, NULL);
+    spawn_wait (&sp, &status);
+    close (output);
+    return record_end (rec, status) < 0 ? -1 : status;
+}
+
+static double best_of (int (*run)(void)){
+    double best = -1, elapsed = 0, start_ns = 0;
+    int i = 0;
+
+    for (i=0; i<BENCH_ROUNDS; i++){
+        start_ns = now_ns ();
+        if (run () != 0)
+            return -1;
+        elapsed = now_ns () - start_ns;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+/*
+ * The size of the recording so far.
+ */
+
+static off_t recorded_size (void){
+    char path[PATH_MAX];
+    struct dirent* entry = NULL;
+    struct stat st;
+    off_t size = 0;
+    DIR* dir = opendir (record_dir);
+
+    while (dir != NULL && (entry = readdir (dir)) != NULL){
+        snprintf (path, sizeof (path), "%s/%s", record_dir, entry->d_name);
+        if (stat (path, &st) == 0 && S_ISREG (st.st_mode))
+            size += st.st_size;
+    }
+    if (dir != NULL)
+        closedir (dir);
+    return size;
+}
+
+static void measure (const char* kind, const char* sink){
+    double direct = 0, recorded = 0;
+    off_t size = recorded_size ();
+
+    direct = best_of (run_direct);
+    recorded = best_of (run_recorded);
+    if (direct < 0 || recorded < 0){
+        fprintf (report, "record_%-6s %-5s failed\n", kind, sink);
+        return;
+    }
+    size = recorded_size () - size;
+    fprintf (report, "record_%-6s %-5s direct %6.0f MB/s  recorded %6.0f MB/s  overhead %5.1f%%  ratio %5.1f%%\n",
+             kind, sink, BENCH_MB / (direct / 1e9), BENCH_MB / (recorded / 1e9), 100 * (recorded - direct) / direct,
+             100.0 * size / ((double) BENCH_ROUNDS * BENCH_MB * 1024 * 1024));
+}
+
+/*
+ * Runs both kinds of file against the sink now on the standard output.
+ */
+
+static void measure_sink (const char* sink){
+    snprintf (file_arg, sizeof (file_arg), "%s/text", record_dir);
+    measure ("text", sink);
+    snprintf (file_arg, sizeof (file_arg), "%s/random", record_dir);
+    measure ("random", sink);
+}
+
+/*
+ * Makes sink the standard output, with a reader that discards what it
+ * gets from drain_fd.
+ */
+
+static int set_sink (int sink, int drain_fd, int null, spawn_t* drain){
+    if (start (drain, drain_argv, drain_fd, null) < 0)
+        return -1;
+    close (drain_fd);
+    dup2 (sink, STDOUT_FILENO);
+    close (sink);
+    return 0;
+}
+
+int main (){
+    char path[PATH_MAX];
+    char name[64];
+    spawn_t drain;
+    int pipefd[2];
+    int null = open ("/dev/null", O_RDWR | O_CLOEXEC);
+    int master = -1, slave = -1, status = 0;
+
+    /* The results go to the real output, the commands' to the sinks. The
+       recorder must not take the terminal the benchmark runs in */
+    report = fdopen (fcntl (STDOUT_FILENO, F_DUPFD_CLOEXEC, 3), "w");
+    if (report == NULL || null < 0 || mkdtemp (record_dir) == NULL){
+        perror ("bench_record");
+        return EXIT_FAILURE;
+    }
+    setvbuf (report, NULL, _IOLBF, 0);
+    dup2 (null, STDIN_FILENO);
+
+    snprintf (path, sizeof (path), "%s/text", record_dir);
+    if (make_file (path, 1) < 0){
+        perror (path);
+        return EXIT_FAILURE;
+    }
+    snprintf (path, sizeof (path), "%s/random", record_dir);
+    if (make_file (path, 0) < 0){
+        perror (path);
+        return EXIT_FAILURE;
+    }
+    rec = record_open (record_dir, "bench");
+    if (rec == NULL){
+        perror (record_dir);
+        return EXIT_FAILURE;
+    }
+
+    if (pipe2 (pipefd, O_CLOEXEC) == 0 && set_sink (pipefd[1], pipefd[0], null, &drain) == 0){
+        measure_sink ("pipe");
+        dup2 (null, STDOUT_FILENO);
+        spawn_wait (&drain, &status);
+    }
+
+    master = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master >= 0 && grantpt (master) == 0 && unlockpt (master) == 0 && ptsname_r (master, name, sizeof (name)) == 0
+        && (slave = open (name, O_RDWR | O_NOCTTY | O_CLOEXEC)) >= 0 && set_sink (slave, master, null, &drain) == 0){
+        measure_sink ("pty");
+        dup2 (null, STDOUT_FILENO);
+        spawn_wait (&drain, &status);
+    }
+
+    measure_sink ("null");
+
+    record_close (rec);
+    snprintf (path, sizeof (path), "rm -rf %s", record_dir);
+    status = system (path);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
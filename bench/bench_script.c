@@ -0,0 +1,133 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Forks and time per line of an "agros -s" script, for a script of
+ * built-ins that run in-process (echo, pwd, true) and for one of system
+ * commands (ls -d /). Forks are counted system-wide, from the "processes"
+ * line of /proc/stat, so run it on a quiet machine. It uses the agros
+ * binary built in the current directory (or the one given as argument)
+ * and the agros.conf it was built with, which must allow echo, pwd, true
+ * and ls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define BENCH_LINES 1000
+
+extern char** environ;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * The number of processes created since boot.
+ */
+
+static long forks (void){
+    char line[256];
+    long count = -1;
+    FILE* stat = fopen ("/proc/stat", "r");
+
+    if (stat == NULL)
+        return -1;
+    while (fgets (line, sizeof (line), stat) != NULL){
+        if (sscanf (line, "processes %ld", &count) == 1)
+            break;
+    }
+    fclose (stat);
+    return count;
+}
+
+/*
+ * Runs BENCH_LINES lines, cycling through lines, with "agros -s" and
+ * prints the time and forks per line. Returns -1 if agros fails.
+ */
+
+static int measure (const char* name, char* agros, const char** lines){
+    char path[] = "/tmp/bench_script.XXXXXX";
+    char* argv[] = { agros, "-s", NULL };
+    posix_spawn_file_actions_t actions;
+    double start = 0, elapsed = 0;
+    long forks_before = 0, forks_after = 0;
+    FILE* script = NULL;
+    pid_t pid = 0;
+    int fd = -1, status = 0, i = 0, n = 0;
+
+    fd = mkstemp (path);
+    if (fd < 0 || (script = fdopen (fd, "w")) == NULL)
+        return -1;
+    for (i=0; i<BENCH_LINES; i++){
+        if (lines[n] == NULL)
+            n = 0;
+        fprintf (script, "%s\n", lines[n++]);
+    }
+    fclose (script);
+
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, path, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    forks_before = forks ();
+    start = now_ns ();
+    if (posix_spawn (&pid, agros, &actions, NULL, argv, environ) != 0 || waitpid (pid, &status, 0) < 0)
+        status = -1;
+    elapsed = now_ns () - start;
+    forks_after = forks ();
+
+    posix_spawn_file_actions_destroy (&actions);
+    unlink (path);
+
+    if (status != 0)
+        return -1;
+
+    printf ("script_%-10s %8.0f ns/line %6.2f forks/line\n", name, elapsed / BENCH_LINES,
+            (double) (forks_after - forks_before - 1) / BENCH_LINES);
+    return 0;
+}
+
+int main (int argc, char** argv){
+    char* agros = argc > 1 ? argv[1] : "./agros";
+    const char* builtins[] = { "echo hello world", "pwd", "true", NULL };
+    const char* external[] = { "ls -d /", NULL };
+
+    if (access (agros, X_OK) < 0){
+        printf ("script: skipped, %s not built\n", agros);
+        return EXIT_SUCCESS;
+    }
+
+    if (measure ("builtins", agros, builtins) < 0 || measure ("external", agros, external) < 0)
+        printf ("script: skipped, echo, pwd, true or ls is not allowed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Spawn-to-exit latency of "true" with fork(), vfork(), posix_spawn() and
+ * the AGROS launcher. The load is the size of the shell's own memory: fork()
+ * copies page tables, so its cost grows with the resident set, which is
+ * what a long session with a big history and policy looks like. Each
+ * method runs with 0 and with BENCH_LOAD_MB of touched heap.
+ * launcher_limits is the launcher applying a profile's resource limits
+ * (five rlimits, nice and CPU affinity, set to what they already are).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "launcher.h"
+
+#define BENCH_ROUNDS   500
+#define BENCH_LOAD_MB  256
+
+extern char** environ;
+
+static char* true_argv[] = { "true", NULL };
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run_fork (void){
+    pid_t pid = fork ();
+    if (pid == 0){
+        execvp (true_argv[0], true_argv);
+        _exit (127);
+    }
+    waitpid (pid, NULL, 0);
+}
+
+static void run_vfork (void){
+    pid_t pid = vfork ();
+    if (pid == 0){
+        execvp (true_argv[0], true_argv);
+        _exit (127);
+    }
+    waitpid (pid, NULL, 0);
+}
+
+static void run_posix_spawn (void){
+    pid_t pid = 0;
+    posix_spawnp (&pid, true_argv[0], NULL, NULL, true_argv, environ);
+    waitpid (pid, NULL, 0);
+}
+
+static spawn_limits limits;
+
+static void run_launcher_with (const spawn_limits* with){
+    spawn_t sp;
+    int status = 0;
+
+    sp.argv = true_argv;
+    sp.exec_fd = -1;
+    sp.pgroup = 0;
+    sp.timed = 0;
+    sp.fds[0] = sp.fds[1] = sp.fds[2] = -1;
+    sp.limits = with;
+    sp.cgroup_fd = -1;
+    sp.ctty_fd = -1;
+    if (spawn_process (&sp) == 0)
+        spawn_wait (&sp, &status);
+}
+
+static void run_launcher (void){
+    run_launcher_with (NULL);
+}
+
+static void run_launcher_limits (void){
+    run_launcher_with (&limits);
+}
+
+static void set_limits (void){
+    static const int resources[SPAWN_RLIMITS] = { RLIMIT_CPU, RLIMIT_AS, RLIMIT_NOFILE, RLIMIT_NPROC, RLIMIT_FSIZE };
+    int i = 0;
+
+    for (i=0; i<SPAWN_RLIMITS; i++){
+        limits.resources[i] = resources[i];
+        getrlimit (resources[i], &limits.values[i]);
+    }
+    limits.rlimit_nbr = SPAWN_RLIMITS;
+    limits.set_nice = 1;
+    limits.nice = getpriority (PRIO_PROCESS, 0);
+    limits.set_affinity = sched_getaffinity (0, sizeof (cpu_set_t), &limits.affinity) == 0;
+}
+
+static void measure (const char* name, void (*run)(void), int load){
+    double start = now_ns ();
+    int i = 0;
+
+    for (i=0; i<BENCH_ROUNDS; i++)
+        run ();
+    printf ("spawn_%-16s load=%3dMB %10.0f ns/op\n", name, load, (now_ns () - start) / BENCH_ROUNDS);
+}
+
+static void measure_all (int load){
+    measure ("fork", run_fork, load);
+    measure ("vfork", run_vfork, load);
+    measure ("posix_spawn", run_posix_spawn, load);
+    measure ("launcher", run_launcher, load);
+    measure ("launcher_limits", run_launcher_limits, load);
+}
+
+int main (){
+    size_t size = (size_t) BENCH_LOAD_MB * 1024 * 1024;
+    char* heap = NULL;
+
+    set_limits ();
+    measure_all (0);
+
+    heap = (char*) malloc (size);
+    if (heap == NULL){
+        printf ("spawn: skipped the %dMB run, out of memory\n", BENCH_LOAD_MB);
+        return EXIT_SUCCESS;
+    }
+    memset (heap, 1, size);
+    measure_all (BENCH_LOAD_MB);
+
+    free (heap);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * How late a timed out command is gone. "sleep 10" is started in a group
+ * of its own with a timeout of BENCH_TIMEOUT_MS, and the loop of the
+ * session kills it: the timerfd fires, SIGTERM goes to the group and the
+ * exit comes back through the signalfd. Printed are the percentiles of
+ * the time from the deadline to the timer (timer_late) and to the reaped
+ * child (reaped_late), which is what a caller of "agros -c" waits for on
+ * top of its timeout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include "evloop.h"
+#include "launcher.h"
+
+#define BENCH_ROUNDS      500
+#define BENCH_TIMEOUT_MS  5
+
+static char* sleep_argv[] = { "sleep", "10", NULL };
+
+static spawn_t sp;
+static int timer = -1;
+static int reaped = 0;
+static double deadline = 0;
+static double timer_late[BENCH_ROUNDS];
+static double reaped_late[BENCH_ROUNDS];
+static int round_nbr = 0;
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void on_deadline (evloop* loop, int expirations, void* data){
+    (void) loop;
+    (void) expirations;
+    (void) data;
+
+    timer_late[round_nbr] = now_ns () - deadline;
+    killpg (sp.pid, SIGTERM);
+}
+
+static void on_child (evloop* loop, int sig, void* data){
+    int status = 0;
+
+    (void) loop;
+    (void) sig;
+    (void) data;
+
+    if (spawn_reap (&sp, &status) == 1){
+        reaped_late[round_nbr] = now_ns () - deadline;
+        reaped = 1;
+    }
+}
+
+static int compare (const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static void print (const char* name, double* values){
+    qsort (values, BENCH_ROUNDS, sizeof (double), compare);
+    printf ("timeout_%-12s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name,
+            values[BENCH_ROUNDS / 2] / 1000, values[BENCH_ROUNDS * 99 / 100] / 1000,
+            values[BENCH_ROUNDS - 1] / 1000);
+}
+
+int main (){
+    evloop* loop = NULL;
+    sigset_t set;
+
+    sigemptyset (&set);
+    sigaddset (&set, SIGCHLD);
+    sigprocmask (SIG_BLOCK, &set, NULL);
+
+    loop = evloop_new ();
+    if (loop == NULL || evloop_signals (loop, &set, on_child, NULL) < 0
+        || (timer = evloop_timer (loop, on_deadline, NULL)) < 0){
+        perror ("bench_timeout");
+        return EXIT_FAILURE;
+    }
+
+    memset (&sp, 0, sizeof (sp));
+    sp.argv = sleep_argv;
+    sp.exec_fd = -1;
+    sp.pgroup = 1;
+    sp.tty_fd = -1;
+    sp.fds[0] = sp.fds[1] = sp.fds[2] = -1;
+    sp.cgroup_fd = -1;
+    sp.ctty_fd = -1;
+
+    for (round_nbr=0; round_nbr<BENCH_ROUNDS; round_nbr++){
+        if (spawn_process (&sp) < 0){
+            perror ("bench_timeout");
+            return EXIT_FAILURE;
+        }
+        reaped = 0;
+        deadline = now_ns () + BENCH_TIMEOUT_MS * 1e6;
+        evloop_arm (timer, BENCH_TIMEOUT_MS);
+        while (!reaped)
+            evloop_run (loop, -1);
+        spawn_release (&sp);
+    }
+
+    print ("timer_late", timer_late);
+    print ("reaped_late", reaped_late);
+    evloop_free (loop);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Parsing time and heap allocations per line, for generated command lines
+ * of a few hundred words: plain words, quoted words with blanks and words
+ * with backslashes. The allocation count of the first line is the warm up;
+ * once parse_command() has grown its argv and arena, it should be 0.
+ *
+ * malloc() and friends are counted by wrapping glibc's own allocator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "agros.h"
+
+#define BENCH_ROUNDS  20000
+#define BENCH_WORDS   400
+
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t nmemb, size_t size);
+extern void* __libc_realloc (void* ptr, size_t size);
+extern void  __libc_free (void* ptr);
+
+static long allocations = 0;
+
+void* malloc (size_t size){
+    allocations++;
+    return __libc_malloc (size);
+}
+
+void* calloc (size_t nmemb, size_t size){
+    allocations++;
+    return __libc_calloc (nmemb, size);
+}
+
+void* realloc (void* ptr, size_t size){
+    allocations++;
+    return __libc_realloc (ptr, size);
+}
+
+void free (void* ptr){
+    __libc_free (ptr);
+}
+
+static double now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Fills line with BENCH_WORDS words in the given style.
+ */
+
+static void make_line (char* line, const char* style){
+    char* p = line;
+    int i = 0;
+
+    p += sprintf (p, "ls");
+    for (i=0; i<BENCH_WORDS; i++){
+        if (!strcmp (style, "plain"))
+            p += sprintf (p, " file%d.txt", i);
+        else if (!strcmp (style, "quoted"))
+            p += sprintf (p, " \"my file %d.txt\"", i);
+        else
+            p += sprintf (p, " my\\ file\\ %d.txt", i);
+    }
+}
+
+static void measure (const char* style){
+    static char line[BENCH_WORDS * 32];
+    static char copy[BENCH_WORDS * 32];
+    command_t cmd = COMMAND_EMPTY;
+    size_t length = 0;
+    long first = 0;
+    double start = 0;
+    int i = 0;
+
+    make_line (line, style);
+    length = strlen (line) + 1;
+
+    /* parse_command() writes to the line, so each round parses a fresh copy */
+    memcpy (copy, line, length);
+    allocations = 0;
+    parse_command (copy, &cmd);
+    first = allocations;
+
+    allocations = 0;
+    start = now_ns ();
+    for (i=0; i<BENCH_ROUNDS; i++){
+        memcpy (copy, line, length);
+        if (parse_command (copy, &cmd) != PARSE_OK || cmd.argc != BENCH_WORDS + 1){
+            printf ("tokenizer_%s: parse error\n", style);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    printf ("tokenizer_%-8s %4d words %8.0f ns/line  first line %ld allocs, then %.2f allocs/line\n",
+            style, BENCH_WORDS + 1, (now_ns () - start) / BENCH_ROUNDS, first,
+            (double) allocations / BENCH_ROUNDS);
+    command_free (&cmd);
+}
+
+int main (){
+    measure ("plain");
+    measure ("quoted");
+    measure ("escaped");
+    return EXIT_SUCCESS;
+}
@@ -20,35 +20,80 @@
  *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef AGROS_H
+#define AGROS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifndef CONFIG_FILE
+#define CONFIG_FILE "agros.conf"
+#endif
+
+/* The compiled policy lives next to the conf file unless told otherwise */
+#ifndef POLICY_FILE
+#define POLICY_FILE CONFIG_FILE ".img"
+#endif
 
 #define MAX_LINE_LEN 256
-#define MAX_ARGS (MAX_LINE_LEN/2)
+#define DEFAULT_HISTORY_SIZE 1000
 #define WHITESPACE " \t\n"
 
-#define OTHER_CMD   0
-#define EMPTY_CMD   1
-#define CD_CMD      2
-#define HELP_CMD    3
-#define ENV_CMD     4
-#define EXIT_CMD    5
-
-#define CMD_NBR     6
+#define CONF_OK             0
+#define CONF_ERR_READ       1
+#define CONF_ERR_ALLOWED    2
+#define CONF_ERR_FORBIDDEN  3
+#define CONF_ERR_ARGS       4
+#define CONF_ERR_LIMITS     5
+#define CONF_ERR_CACHEABLE  6
+#define CONF_ERR_GROUPS     7
+
+#define PARSE_OK            0
+#define PARSE_ERR_QUOTE     1
+#define PARSE_ERR_LONG      2
+#define PARSE_ERR_SYNTAX    3
+
+/* What a redirection does with its descriptor */
+#define REDIR_IN            0       /* < path */
+#define REDIR_OUT           1       /* > path */
+#define REDIR_APPEND        2       /* >> path */
+#define REDIR_DUP           3       /* >&n */
+
+/* Exit statuses, the same ones a POSIX shell uses */
+#define AG_STATUS_USAGE     2
+#define AG_STATUS_TIMEOUT   124     /* as timeout(1) */
+#define AG_STATUS_DENIED    126
+#define AG_STATUS_NOEXEC    127
 
 #define AG_FALSE 0
 #define AG_TRUE  1
 
 
 /*
- * This structure allows me to handle built-in commands with a switch statement
- * instead of multiple ifs. Since I cannot switch on a string, I associate a
- * command_code to each built-in command. The codes are define as preprocessor
- * instructions.
+ * A redirection of one of the standard descriptors (0, 1 or 2) of a
+ * stage: to a file, or to a copy of another standard descriptor.
+ */
+
+typedef struct redirect_t redirect_t;
+struct redirect_t{
+    int fd;
+    int mode;
+    char* path;         /* NULL for REDIR_DUP */
+    int target;         /* for REDIR_DUP */
+};
+
+/*
+ * One command of a pipeline. argv points into command_t.argv and ends with
+ * NULL; its redirections are redirect_nbr entries of command_t.redirects,
+ * from redirect_first on, in the order they were written.
  */
 
-typedef struct built_in_commands built_in_commands;
-struct built_in_commands{
-    char command_name[MAX_LINE_LEN];
-    int command_code;
+typedef struct stage_t stage_t;
+struct stage_t{
+    int argc;
+    char** argv;
+    int redirect_first;
+    int redirect_nbr;
 };
 
 /*
@@ -57,58 +102,130 @@ struct built_in_commands{
  *   - name: the name of the executable called. By default it's argv[0]
  *   - argc: the number of words given in input. It's equivalent to the length of argv.
  *
- * Note: Some filenames have a space character (" ") in their names. I will have
- * to deal with that properly ... someday.
+ * A line can be a pipeline, "ls -l | grep foo > out": stages then holds
+ * each command, and name, argc and argv are those of the first one.
+ *
+ * argv, stages, redirects and words (where quoted words are unescaped) are
+ * kept from one line to the next by parse_command(), and freed with
+ * command_free().
  */
 
+typedef struct arena arena;
+
 typedef struct command_t command_t;
-struct command_t{		
+struct command_t{
     char* name;
     int argc;
-    char* argv[MAX_ARGS+1];
+    char** argv;
+    int argv_size;
+    arena* words;
+    stage_t* stages;
+    int stage_nbr;
+    int stages_size;
+    redirect_t* redirects;
+    int redirect_nbr;
+    int redirects_size;
+    int background;     /* the line ended with an unquoted '&' */
 };
 
+/* A command_t that holds nothing yet */
+#define COMMAND_EMPTY {NULL, 0, NULL, 0, NULL, NULL, 0, 0, NULL, 0, 0, 0}
+
 
 /*
  * A structure that holds the AGROS conf.
+ * allowed_matcher and forbidden_matcher are allowed_list and forbidden_list
+ * compiled by load_config() for lookups. profile is the section that
+ * allowed_list comes from: the user's, the first [@group] of the user's
+ * groups that sets it, or "General".
  */
 
+typedef struct allowlist allowlist;
+typedef struct forbidden_scanner forbidden_scanner;
+typedef struct argrules argrules;
+typedef struct exec_cache exec_cache;
+typedef struct spawn_limits spawn_limits;
+
 typedef struct config_t config_t;
 struct config_t{
     char** allowed_list;
+    allowlist* allowed_matcher;
     char** forbidden_list;
+    forbidden_scanner* forbidden_matcher;
     int allowed_nbr;
     int forbidden_nbr;
+    char** allow_args;
+    char** deny_args;
+    int allow_args_nbr;
+    int deny_args_nbr;
+    argrules* args_matcher;
+    char** redirect_paths;
+    int redirect_paths_nbr;
+    int pipe_relay;
+    spawn_limits* limits;
+    char** cacheable;       /* "name:ttl", see outcache.h */
+    int cacheable_nbr;
+    char* record_dir;
+    int metrics;
+    char* profile;          /* the section the allowed list comes from */
     char* welcome_message;
     int loglevel;
     int warnings;
+    int max_jobs;
+    int history_size;
+    int timeout;            /* seconds a command may run, 0 for no limit */
+    int idle_timeout;       /* seconds at the prompt before logout, 0 for none */
+    int audit_sink;
+    int audit_overflow;
+    char* audit_file;
+    char* audit_spill;
 };
 
+/* Where allowed commands are found in PATH, see session.c */
+extern exec_cache* exec_paths;
+
 /*
  * These are the functions called by AGROS. These declarations are pretty explicit.
  * More detailed comments can be found in source files.
  *
  */
 
-void    parse_command       (char *cmdline, command_t *cmd);
+int     parse_command       (char *cmdline, command_t *cmd);
+void    command_free        (command_t* cmd);
 void	get_prompt	    (char *prompt, int length, char *username);
-char*	read_input	    (char *prompt);
+void    read_input_start    (char* prompt);
+int     read_input_key      (char** line);
+void    read_input_stop     (void);
+void    hide_input          (void);
+void    show_input          (void);
 void    print_prompt        (char* username);
 void    print_help          (config_t* config);
 void    change_directory    (char* path, int loglevel);
-int     get_cmd_code        (char* cmd_name);
-int     check_validity      (command_t cmd, config_t config);
+int     check_validity      (command_t* cmd, config_t* config);
+int     check_operators     (command_t* cmd, config_t* config);
 void    print_env           (char* env_variable);
 void    print_allowed       (char** allowed);
 void    print_forbidden     (char** forbidden);
 void    parse_config        (config_t* config, char* username);
+void    watch_config        (char* username);
+void    prefetch_config     (char* username, uid_t uid, gid_t gid, const gid_t* groups, int ngroups);
+void    config_free         (config_t* config);
+int     load_config         (config_t* config, char* username, const char* conf_path, const char* image_path);
 void    set_username        (char** username);
 void    set_homedir         (char** homedir);
 void    decrease_warnings   (config_t* ag_config);
 int     runs_in_background  (command_t* cmd);
-/*void    set_glib_group      (char** glib_group, GKeyFile* gkf, char* username, char* key);*/
 void	initialize_readline (config_t *config);
+void    finish_readline     (void);
+void    set_completion_list (config_t* config);
 char*	make_completion	    (char *string);
 char**	cmd_completion	    (const char *text, int start, int end);
 char*	cmd_generator	    (const char *text, int state);
-
+void    prepare_session     (config_t* config, int prime);
+int     execute_line        (char* commandline, command_t* cmd, config_t* config, int* exiting);
+int     run_interactive     (config_t* config, char* username);
+int     run_command         (config_t* config, char* commandline);
+int     run_script          (config_t* config, FILE* input);
+int     run_session         (char* username, char* commandline, int script);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_AGROSD_H
+#define AGROS_AGROSD_H
+
+#include <stdint.h>
+
+/*
+ * The protocol between agros-login, agrosd and the sessions agrosd starts.
+ *
+ * agros-login connects to AGROSD_SOCKET (SOCK_SEQPACKET, one message per
+ * request) and sends an agrosd_request followed by the command line and
+ * the environment, along with its stdin, stdout, stderr and a descriptor
+ * on its current directory. agrosd reads the caller's uid with
+ * SO_PEERCRED, never from the message.
+ *
+ * agrosd hands the connection, those descriptors and the resolved user to
+ * one of its pre-forked sessions. The session answers on the connection
+ * with an agrosd_reply of type AGROSD_STARTED carrying its pid, and one of
+ * type AGROSD_EXITED carrying the exit status when it is done.
+ */
+
+#ifndef AGROSD_SOCKET
+#define AGROSD_SOCKET "/run/agros/agrosd.sock"
+#endif
+
+#define AGROSD_MAGIC        0x41475344      /* "AGSD" */
+#define AGROSD_VERSION      1
+
+/* Command line and environment, together */
+#define AGROSD_MAX_DATA     (64 * 1024)
+
+/* stdin, stdout, stderr and the current directory */
+#define AGROSD_CLIENT_FDS   4
+
+/* Modes */
+#define AGROSD_INTERACTIVE  0
+#define AGROSD_COMMAND      1
+#define AGROSD_SCRIPT       2
+
+/* Replies */
+#define AGROSD_STARTED      1
+#define AGROSD_EXITED       2
+
+typedef struct agrosd_request agrosd_request;
+struct agrosd_request{
+    uint32_t magic;
+    uint32_t version;
+    int32_t mode;
+    uint32_t command_len;           /* including the final '\0', 0 if none */
+    uint32_t env_len;               /* '\0'-separated NAME=value strings */
+};
+
+typedef struct agrosd_reply agrosd_reply;
+struct agrosd_reply{
+    int32_t type;
+    int32_t value;
+};
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_ALLOWLIST_H
+#define AGROS_ALLOWLIST_H
+
+/*
+ * The allowed list, compiled once when the configuration is loaded.
+ *
+ * Each entry of the list is one of:
+ *   - "*": every command is allowed.
+ *   - a plain name ("ls"): stored in a hash set.
+ *   - a prefix pattern ("git-*", "/usr/lib/nagios/plugins/check_*"): stored
+ *     in a prefix trie. The '*' does not match '/', so a prefix pattern can't be
+ *     used to reach outside of its directory.
+ *   - any other glob ("*.sh", "check_[a-z]*"): matched with fnmatch().
+ *
+ * Looking up a name costs one hash probe and one trie walk, both bounded
+ * by the length of the name rather than by the size of the list. Only the
+ * (usually few) generic globs are tried one by one.
+ */
+
+typedef struct allowlist allowlist;
+
+allowlist*  allowlist_compile   (char** patterns, int count);
+int         allowlist_match     (const allowlist* list, const char* name);
+void        allowlist_free      (allowlist* list);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_ARGRULES_H
+#define AGROS_ARGRULES_H
+
+/*
+ * Rules on the arguments of allowed commands, from the allow_args and
+ * deny_args keys. A rule is a command line pattern, word by word:
+ *
+ *     systemctl status *
+ *     journalctl -u <unit> --since <time>
+ *     grep ** -r ** / **
+ *
+ *   - a plain word matches itself; '\' keeps the next character as it is
+ *   - '*' and '?' inside a word match any characters, or one character
+ *   - a word that is '*' or '<anything>' matches any one word
+ *   - a word that is '**' matches any number of words, none included
+ *
+ * A rule matches a command line if it matches all of its words. A command
+ * that has allow_args rules may only run with the arguments of one of
+ * them; commands without any are not restricted. A command line that
+ * matches a deny_args rule is refused in any case.
+ *
+ * All the rules of a profile are compiled into one deterministic automaton
+ * over the words of the command line, each followed by a '\0'. Checking a
+ * command line is one table lookup per character, whatever the number of
+ * rules.
+ */
+
+#define ARGS_OK         0
+#define ARGS_DENIED     1
+
+typedef struct argrules argrules;
+
+argrules*   argrules_compile    (char** allow, int allow_nbr, char** deny, int deny_nbr);
+int         argrules_check      (const argrules* rules, char* const* argv);
+int         argrules_states     (const argrules* rules);
+void        argrules_free       (argrules* rules);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_AUDIT_H
+#define AGROS_AUDIT_H
+
+#include <syslog.h>
+
+/*
+ * The audit log. audit() takes the place of syslog(): it formats a
+ * fixed-size record into an in-process ring and returns. A writer thread
+ * drains the ring in batches to syslog, to an append-only file, or to
+ * both, so a slow or rate-limited syslog daemon no longer stalls the
+ * shell between the prompt and exec.
+ *
+ * When the ring is full, audit() does what audit_overflow says:
+ *   - AUDIT_BLOCK: waits for the writer (nothing is lost)
+ *   - AUDIT_DROP: drops the record and counts it; the count is logged
+ *     once the writer catches up
+ *   - AUDIT_SPILL: appends the record to the spill file instead
+ *
+ * Records issued before audit_start() wait in the ring. audit_close() is
+ * registered with atexit(), so whatever is queued is written when AGROS
+ * exits.
+ */
+
+#define AUDIT_RING_SIZE     1024
+#define AUDIT_TEXT_LEN      240
+
+/* Sinks */
+#define AUDIT_SYSLOG        1
+#define AUDIT_FILE          2
+
+/* Overflow behaviours */
+#define AUDIT_BLOCK         0
+#define AUDIT_DROP          1
+#define AUDIT_SPILL         2
+
+void    audit_open      (const char* ident);
+int     audit_start     (int sinks, const char* file, int overflow, const char* spill);
+void    audit           (int priority, const char* format, ...) __attribute__ ((format (printf, 2, 3)));
+void    audit_flush     (void);
+void    audit_close     (void);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_BUILTINS_H
+#define AGROS_BUILTINS_H
+
+#include <stdint.h>
+#include "agros.h"
+
+/*
+ * The built-in commands, listed in builtins.def. find_builtin() looks a
+ * name up with a perfect hash generated from that list: one hash of the
+ * name, one slot, one strcmp().
+ */
+
+#define BUILTIN_SHELL       0
+#define BUILTIN_CHECKED     1
+
+/* Returned by a handler that leaves the command to the system */
+#define BUILTIN_EXTERNAL    (-1)
+
+typedef int (*builtin_fn) (command_t* cmd, config_t* config, int* exiting);
+
+typedef struct builtin_t builtin_t;
+struct builtin_t{
+    const char* name;
+    builtin_fn run;
+    int policy;
+};
+
+/*
+ * FNV-1a from a seed, with the high bits folded into the low ones that
+ * pick the slot. mkbuiltins looks for the seed that gives every name of
+ * builtins.def its own slot.
+ */
+
+static inline uint32_t builtin_hash (uint32_t seed, const char* name){
+    uint32_t h = seed;
+    while (*name){
+        h ^= (unsigned char) *name++;
+        h *= 16777619U;
+    }
+    return h ^ (h >> 16);
+}
+
+const builtin_t*    find_builtin    (const char* name);
+int                 exit_status     (int status);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_COMPLETE_H
+#define AGROS_COMPLETE_H
+
+#include "allowlist.h"
+#include "execcache.h"
+
+/*
+ * The names offered by tab-completion: the built-ins, the allowed list and,
+ * when the allowed list has patterns ("*", "git-*"), the allowed commands
+ * found in PATH.
+ *
+ * The names are sorted, and a prefix trie is built over them in which each
+ * node covers the range of names that start with its prefix. Completing a
+ * prefix walks the trie once and returns that range: the cost depends on
+ * the length of the prefix and the number of matches, not on the number
+ * of names.
+ *
+ * Scanning PATH means a stat() per file, so the names found are kept in
+ * a cache file along with the modification time of each directory. The
+ * scan is done again when a directory changed.
+ */
+
+typedef struct completion_index completion_index;
+
+completion_index*   completion_new      (void);
+int                 completion_add      (completion_index* index, const char* name);
+int                 completion_add_path (completion_index* index, const exec_cache* paths,
+                                         const allowlist* allowed, const char* cache_file);
+int                 completion_build    (completion_index* index);
+int                 completion_find     (const completion_index* index, const char* prefix, int* first);
+const char*         completion_name     (const completion_index* index, int i);
+int                 completion_stale    (const completion_index* index, const exec_cache* paths);
+void                completion_free     (completion_index* index);
+
+#endif
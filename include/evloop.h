@@ -0,0 +1,68 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_EVLOOP_H
+#define AGROS_EVLOOP_H
+
+#include <stdint.h>
+#include <signal.h>
+
+/*
+ * The event loop of a session. Everything the session waits for is a
+ * descriptor in one epoll set: the terminal, the exits of its children
+ * (SIGCHLD through a signalfd), timers (timerfds) and the notifications
+ * of its threads (eventfds). evloop_run() sleeps until one of them is
+ * ready and calls its function, so the shell can, while a command runs or
+ * while it waits for a line, kill a command that took too long, log out
+ * an idle user or pick up a new policy.
+ *
+ * Each source has a function, called with the loop and:
+ *   - for a descriptor: the descriptor, which the function reads itself
+ *   - for a timer: the number of expirations, already read
+ *   - for signals: the number of the signal, once for each one read
+ *
+ * The signals given to evloop_signals() must be blocked by the caller in
+ * every thread, or they are delivered as usual instead. The descriptors
+ * the loop creates are close-on-exec.
+ *
+ * evloop_fd() is the epoll descriptor itself: it is readable when an
+ * event is pending, so code with a poll() loop of its own (the pipeline
+ * and recording relays) can watch it and call evloop_run() with a timeout
+ * of 0 to keep the loop going.
+ */
+
+#define EVLOOP_MAX_SOURCES  16
+
+typedef struct evloop evloop;
+typedef void (*evloop_fn) (evloop* loop, int what, void* data);
+
+evloop* evloop_new      (void);
+void    evloop_free     (evloop* loop);
+int     evloop_fd       (const evloop* loop);
+int     evloop_watch    (evloop* loop, int fd, evloop_fn fn, void* data);
+void    evloop_unwatch  (evloop* loop, int fd);
+int     evloop_timer    (evloop* loop, evloop_fn fn, void* data);
+int     evloop_arm      (int timer, int64_t ms);
+int     evloop_signals  (evloop* loop, const sigset_t* set, evloop_fn fn, void* data);
+int     evloop_run      (evloop* loop, int timeout_ms);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_EXECCACHE_H
+#define AGROS_EXECCACHE_H
+
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Resolved executables. Each command name is searched in PATH once, and
+ * the binary found is pinned: AGROS keeps an O_PATH descriptor on it and
+ * remembers its device, inode, size and modification time. Commands are
+ * then executed through that descriptor with execveat(), so there is no
+ * PATH walk per command. "#!" scripts are executed by their absolute path
+ * instead: their interpreter opens them again by name, and a /dev/fd path
+ * as $0 would break the scripts that look for files next to themselves.
+ *
+ * Before each use, the pinned identity is compared with a stat() of the
+ * path. If the file was replaced (a package upgrade, say), the entry is
+ * resolved again.
+ *
+ * PATH directories that are relative, or that the user can write to, are
+ * skipped. A user who can write a directory early in PATH can't shadow an
+ * allowed command with their own program.
+ */
+
+typedef struct exec_entry exec_entry;
+struct exec_entry{
+    char* name;
+    char* path;
+    int fd;
+    int script;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+typedef struct exec_cache exec_cache;
+
+exec_cache*  exec_cache_new     (const char* search_path);
+void         exec_cache_free    (exec_cache* cache);
+void         exec_cache_prime   (exec_cache* cache, char** names, int count);
+exec_entry*  exec_cache_lookup  (exec_cache* cache, const char* name);
+const char*  exec_cache_dir     (const exec_cache* cache, int index);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_GOVERNOR_H
+#define AGROS_GOVERNOR_H
+
+#include "launcher.h"
+
+/*
+ * What the commands of a profile may use. The keys of agros.conf, per
+ * user or group like the others:
+ *
+ *   limit_cpu       CPU seconds                 RLIMIT_CPU
+ *   limit_as        address space, in bytes     RLIMIT_AS
+ *   limit_nofile    open files                  RLIMIT_NOFILE
+ *   limit_nproc     processes of the user       RLIMIT_NPROC
+ *   limit_fsize     size of a written file      RLIMIT_FSIZE
+ *   nice            niceness, -20 to 19
+ *   ionice          idle, best-effort[:0-7] or realtime[:0-7]
+ *   cpu_affinity    CPUs, like "0-3,6"
+ *
+ * Sizes take a K, M, G or T suffix, and "unlimited" lifts a limit. The
+ * launcher applies them to every command it starts (see launcher.h), so
+ * they bind the command and what it starts in turn.
+ *
+ * cgroup_memory_max (a size) and cgroup_cpu_max (a share of one CPU, like
+ * "50%", or "quota period" in microseconds) cap the session as a whole:
+ * its commands are put in a cgroup v2 of their own, created under
+ * cgroup_parent (/sys/fs/cgroup/agros by default). The parent must exist,
+ * be writable by AGROS and have the memory and cpu controllers in its
+ * cgroup.subtree_control. Without it, the session runs without a cgroup.
+ */
+
+extern const char* const governor_keys[];
+
+spawn_limits*   governor_new        (void);
+int             governor_set        (spawn_limits* limits, const char* key, const char* value);
+void            governor_free       (spawn_limits* limits);
+int             governor_cgroup     (const spawn_limits* limits);
+void            governor_release    (void);
+
+#endif
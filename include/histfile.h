@@ -0,0 +1,64 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_HISTFILE_H
+#define AGROS_HISTFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The history kept between sessions, one file per user shared by all
+ * their sessions. The file is append-only: after an 8-byte header, each
+ * line is stored without its newline, between two copies of its length
+ * (32 bits, in host order). A line is appended with one write() under an
+ * exclusive flock(), so concurrent sessions interleave whole lines, and a
+ * write that comes up short is cut off again.
+ *
+ * A session maps the file and reads only the last max_lines lines,
+ * walking back from the end: the time to load doesn't depend on the size
+ * of the file. When the lines before take more room than those, or the
+ * file is larger than HISTFILE_MAX_BYTES, a thread of the session rewrites
+ * the last lines to a new file and renames it over the old one. Sessions
+ * that still have the old one notice when they next append, and open the
+ * new one.
+ *
+ * A line the same as the one before it isn't saved again, nor is a line
+ * longer than HISTFILE_LINE_MAX.
+ */
+
+#define HISTFILE_MAGIC      "AGHIST01"
+#define HISTFILE_MAGIC_LEN  8
+#define HISTFILE_FRAME      (2 * sizeof (uint32_t))
+#define HISTFILE_LINE_MAX   4096
+#define HISTFILE_MAX_BYTES  (8 * 1024 * 1024)
+
+typedef struct histfile histfile;
+
+/* Called by histfile_open() with each line loaded, oldest first */
+typedef void (*histfile_add) (const char* line, size_t len);
+
+histfile*   histfile_open       (const char* path, int max_lines, histfile_add add);
+int         histfile_append     (histfile* hist, const char* line);
+void        histfile_close      (histfile* hist);
+
+#endif
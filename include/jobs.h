@@ -0,0 +1,73 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_JOBS_H
+#define AGROS_JOBS_H
+
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * The job table. Background commands are recorded here when they start.
+ * jobs_reap() collects the ones that finished with wait4() and stores
+ * their status and resource usage. The session calls it whenever SIGCHLD
+ * arrives (SIGCHLD is blocked and read from the session's event loop, see
+ * evloop.h), so no zombie is left behind, and the shell never waits for a
+ * child that isn't the one it asked for: foreground commands are waited
+ * for by pid.
+ *
+ * A finished job keeps its slot until it is reported (before the next
+ * prompt, or by "jobs") or collected by "wait".
+ *
+ * Each job runs in its own process group, whose id is the job's pid, so
+ * "kill %n" reaches everything it started.
+ */
+
+#define JOB_TABLE_SIZE 64
+
+typedef struct job_t job_t;
+struct job_t{
+    int id;                         /* 0 for a free slot */
+    pid_t pid;
+    char* line;
+    int done;
+    int status;                     /* as returned by wait4() */
+    struct rusage usage;
+    struct timespec started;
+    struct timespec finished;
+};
+
+void    jobs_init       (int max_jobs, int loglevel);
+void    jobs_reap       (void);
+int     jobs_full       (void);
+void    jobs_wait_slot  (void);
+int     jobs_add        (pid_t pid, char** argv);
+int     jobs_done       (void);
+void    jobs_notify     (FILE* out);
+void    jobs_list       (FILE* out);
+int     jobs_wait       (int id, int* status);
+int     jobs_kill       (int id, int sig);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_KEYFILE_H
+#define AGROS_KEYFILE_H
+
+#include <stddef.h>
+
+/*
+ * The part of glib's GKeyFile that policy.c uses, for the embedded build
+ * (make embedded), which doesn't link glib. The names and semantics are
+ * glib's, so policy.c includes this header instead of <glib.h> and is
+ * otherwise the same in both builds:
+ *
+ *   - "[group]" lines start a group; a group given twice is one group
+ *   - "key = value", with the spaces around '=' dropped; the last value
+ *     given for a key is the one kept; lines starting with '#' are comments
+ *   - strings unescape \s \n \t \r and \\ and keep any other escape as
+ *     it is; lists also unescape \;, and any other escape makes the list
+ *     read as missing
+ *   - lists are split on ';', and a ';' at the end doesn't add an item
+ *   - integers may be followed by spaces; anything else reads as 0
+ *
+ * Translations ("name[fr]") are skipped, as glib does in the C locale,
+ * and the flags of g_key_file_load_from_*() are ignored.
+ */
+
+typedef char    gchar;
+typedef int     gboolean;
+typedef size_t  gsize;
+
+#ifndef FALSE
+#define FALSE   0
+#define TRUE    1
+#endif
+
+typedef enum {
+    G_KEY_FILE_NONE = 0
+} GKeyFileFlags;
+
+typedef struct {
+    int     domain;
+    int     code;
+    gchar*  message;
+} GError;
+
+typedef struct GKeyFile GKeyFile;
+
+GKeyFile*   g_key_file_new              (void);
+void        g_key_file_free             (GKeyFile* key_file);
+gboolean    g_key_file_load_from_file   (GKeyFile* key_file, const gchar* file, GKeyFileFlags flags,
+                                         GError** error);
+gboolean    g_key_file_load_from_data   (GKeyFile* key_file, const gchar* data, gsize length,
+                                         GKeyFileFlags flags, GError** error);
+gboolean    g_key_file_has_group        (GKeyFile* key_file, const gchar* group);
+gboolean    g_key_file_has_key          (GKeyFile* key_file, const gchar* group, const gchar* key,
+                                         GError** error);
+gchar**     g_key_file_get_groups       (GKeyFile* key_file, gsize* length);
+gchar**     g_key_file_get_keys         (GKeyFile* key_file, const gchar* group, gsize* length,
+                                         GError** error);
+gchar*      g_key_file_get_string       (GKeyFile* key_file, const gchar* group, const gchar* key,
+                                         GError** error);
+int         g_key_file_get_integer      (GKeyFile* key_file, const gchar* group, const gchar* key,
+                                         GError** error);
+gchar**     g_key_file_get_string_list  (GKeyFile* key_file, const gchar* group, const gchar* key,
+                                         gsize* length, GError** error);
+
+void        g_free                      (void* mem);
+void        g_strfreev                  (gchar** str_array);
+void        g_error_free                (GError* error);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_LAUNCHER_H
+#define AGROS_LAUNCHER_H
+
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * The launcher. Every decision (policy, logging, warnings) is taken by the
+ * caller before spawn_process() is called, so a denied command never
+ * creates a process.
+ *
+ * The child is created with clone(CLONE_VM | CLONE_VFORK), the same way
+ * glibc implements posix_spawn(): no page tables are copied and the parent
+ * sleeps until the child has called exec. Unlike with vfork(), the child
+ * runs on its own stack, with every signal blocked until its handlers are
+ * reset, and only does what spawn_t asks for before calling exec. The
+ * parent gets a pidfd for the child when the kernel supports it.
+ *
+ * An exec failure is reported to the parent in spawn_t.error, so the
+ * parent knows synchronously whether the command started.
+ *
+ * When exec_fd is a descriptor on an executable already resolved by the
+ * caller (see execcache.h), the child runs it with execveat() instead of
+ * searching PATH. Otherwise exec_fd must be -1. A "#!" script is run by
+ * exec_path instead, the absolute path it was resolved to, so that its
+ * interpreter gets a $0 it can use; exec_fd is then -1.
+ *
+ * fds[0], fds[1] and fds[2] become the child's standard input, output and
+ * error: the ends of pipes, redirected files. -1 leaves the descriptor the
+ * child inherits. They must be 3 or above, and should be close-on-exec so
+ * that no other command gets them.
+ *
+ * limits, when not NULL, is what the child is allowed (see governor.h):
+ * the child applies it to itself before exec, and fails like exec would if
+ * it can't. With cgroup_fd, a descriptor on the cgroup.procs file of a
+ * cgroup, the child first moves itself into that cgroup.
+ *
+ * With ctty_fd, a descriptor on a terminal (the PTY of a recorded session,
+ * see record.h), the child starts a new session and takes that terminal as
+ * its controlling terminal, so the keys typed in it signal the command.
+ *
+ * With pgroup, the child joins the process group pgid, or starts one of
+ * its own when pgid is 0, and with tty_fd, a descriptor on the controlling
+ * terminal, makes that group the foreground one of the terminal.
+ *
+ * The command starts with no signal blocked, whatever AGROS blocks for
+ * itself (see evloop.h).
+ */
+
+/* Resources that can be limited with setrlimit() */
+#define SPAWN_RLIMITS 5
+
+typedef struct spawn_limits spawn_limits;
+struct spawn_limits{
+    int rlimit_nbr;
+    int resources[SPAWN_RLIMITS];
+    struct rlimit values[SPAWN_RLIMITS];
+    int set_nice;
+    int nice;
+    int ioprio;             /* for ioprio_set(), 0 to leave it */
+    int set_affinity;
+    cpu_set_t affinity;
+
+    /* The cgroup of the session, see governor.h */
+    char* memory_max;
+    char* cpu_max;
+    char* cgroup_parent;
+};
+
+typedef struct spawn_t spawn_t;
+struct spawn_t{
+    /* Set by the caller */
+    char** argv;
+    int exec_fd;
+    const char* exec_path;  /* a script, run by its absolute path, or NULL */
+    int pgroup;         /* run in a process group of its own */
+    pid_t pgid;         /* with pgroup, the group to join, 0 for a new one */
+    int tty_fd;         /* with pgroup, a terminal to take, or -1 */
+    int timed;          /* note exec_time */
+    int fds[3];         /* stdin, stdout and stderr, or -1 */
+    const spawn_limits* limits;
+    int cgroup_fd;
+    int ctty_fd;        /* a terminal to start a new session on, or -1 */
+
+    /* Set by spawn_process() */
+    pid_t pid;          /* -1 if no process could be created */
+    int pidfd;
+    int error;
+    struct timespec exec_time;      /* when the child called exec */
+
+    /* Set by spawn_wait() */
+    struct rusage usage;
+
+    /* Private to the launcher */
+    sigset_t saved_mask;
+};
+
+int     spawn_process   (spawn_t* sp);
+int     spawn_wait      (spawn_t* sp, int* status);
+int     spawn_reap      (spawn_t* sp, int* status);
+void    spawn_release   (spawn_t* sp);
+
+#endif
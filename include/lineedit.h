@@ -0,0 +1,83 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_LINEEDIT_H
+#define AGROS_LINEEDIT_H
+
+/*
+ * The part of GNU Readline and its history that AGROS uses, for the
+ * embedded build (make embedded), which doesn't link libreadline. As with
+ * keyfile.h, the names are readline's, so the code that calls them is the
+ * same in both builds.
+ *
+ * Lines are read with readline's callback interface, a key at a time:
+ * rl_callback_handler_install() prints the prompt, rl_callback_read_char()
+ * is called whenever the terminal is readable, and the handler is called
+ * with the line (NULL at the end of the input). As AGROS always does with
+ * readline's, the handler is then removed until the next line. Something
+ * printed while a line is read goes between rl_clear_visible_line() and
+ * rl_forced_update_display(), which take the line off the screen and draw
+ * it again.
+ *
+ * The line is edited on the terminal with the arrows, Home, End and
+ * Delete keys, and the Emacs keys ^A ^E ^B ^F ^D ^H ^K ^U ^W ^L ^P and ^N.
+ * Lines longer than the terminal scroll sideways. ^C drops the line and
+ * starts a new one. Tab calls rl_attempted_completion_function on the
+ * word before the cursor: one match is completed with a space after it,
+ * several to their common prefix, and a second Tab lists them. There is
+ * no completion of file names, no undo, no search and no ~/.inputrc.
+ * When stdin isn't a terminal, or TERM is "dumb", the prompt is printed
+ * and a plain line is read.
+ *
+ * The history works as readline's: history_base is the number of the
+ * oldest line, and a stifled history drops its oldest line for each new
+ * one past the limit.
+ */
+
+typedef struct _hist_entry {
+    char*   line;
+    char*   timestamp;
+    void*   data;
+} HIST_ENTRY;
+
+typedef void    rl_vcpfunc_t            (char* line);
+typedef char*   rl_compentry_func_t     (const char* text, int state);
+typedef char**  rl_completion_func_t    (const char* text, int start, int end);
+
+extern const char*              rl_readline_name;
+extern rl_completion_func_t*    rl_attempted_completion_function;
+extern int                      history_base;
+extern int                      history_length;
+
+void            rl_callback_handler_install (const char* prompt, rl_vcpfunc_t* handler);
+void            rl_callback_read_char   (void);
+void            rl_callback_handler_remove (void);
+int             rl_clear_visible_line   (void);
+int             rl_forced_update_display (void);
+char**          rl_completion_matches   (const char* text, rl_compentry_func_t* generator);
+
+void            add_history             (const char* line);
+HIST_ENTRY*     history_get             (int offset);
+HIST_ENTRY**    history_list            (void);
+void            stifle_history          (int max);
+
+#endif
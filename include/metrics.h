@@ -0,0 +1,149 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_METRICS_H
+#define AGROS_METRICS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * Host-wide metrics. With metrics = 1 in the conf, every session adds to
+ * one System V shared memory segment, METRICS_KEY. Updates are atomic adds: no lock is ever taken,
+ * and a session killed in the middle of one leaves nothing to clean up.
+ * agros-stats (src/stats.c) prints the segment in Prometheus text format.
+ *
+ * For each command: how often it was allowed, denied and couldn't be
+ * executed; histograms of its spawn, exec and wall times; the CPU time and
+ * the peak memory of its processes; with cacheable, how often its output
+ * came from the shared cache (see outcache.h), how often after waiting for
+ * another session to run it, and how often it had to run. For each profile (the section of
+ * agros.conf the user's allowed list comes from): sessions, commands,
+ * denials, failures and users kicked out for running out of warnings.
+ *
+ * The histograms are log-linear, as in HDR histograms: each power of two
+ * from about a microsecond to two hours is split in METRICS_SUB buckets, so
+ * a time is known to within 25%. Denials of a command that isn't in the
+ * allowed list are counted as "other", so that typing random names can't
+ * fill the table; so is everything once the table is full.
+ *
+ * The segment is created by root only (a root session, or "agros-stats
+ * -c" at boot), mode 0660 with group METRICS_GROUP, so that only sessions
+ * and agros-stats run by members of that group can use it; the other
+ * sessions run without metrics. A segment that root doesn't own, or that
+ * anyone can write, isn't used: another account could have created it to
+ * feed made-up counts to Prometheus. Unlike a file, it can't be truncated
+ * under the sessions that map it.
+ */
+
+#define METRICS_KEY         0x4147524d      /* "AGRM" */
+#ifndef METRICS_GROUP
+#define METRICS_GROUP       "agros"
+#endif
+#define METRICS_MAGIC       0x32475341      /* "ASG2", the layout version */
+#define METRICS_NAME        32
+#define METRICS_COMMANDS    512
+#define METRICS_PROFILES    64
+
+/* Time is counted in units of 2^METRICS_UNIT ns, about a microsecond */
+#define METRICS_UNIT        10
+#define METRICS_SUB_BITS    2
+#define METRICS_SUB         (1 << METRICS_SUB_BITS)
+#define METRICS_OCTAVES     32
+#define METRICS_BUCKETS     (METRICS_OCTAVES * METRICS_SUB)
+
+#define METRICS_SPAWN       0
+#define METRICS_EXEC        1
+#define METRICS_WALL        2
+#define METRICS_HISTOGRAMS  3
+
+/* How the output cache served a command */
+#define METRICS_CACHE_HIT       0
+#define METRICS_CACHE_COALESCED 1
+#define METRICS_CACHE_MISS      2
+
+/* A slot's state: free, being claimed, in use */
+#define METRICS_FREE        0
+#define METRICS_CLAIMED     1
+#define METRICS_READY       2
+
+typedef struct metrics_histogram metrics_histogram;
+struct metrics_histogram{
+    uint64_t count;
+    uint64_t sum;           /* ns */
+    uint64_t buckets[METRICS_BUCKETS];
+};
+
+typedef struct metrics_command metrics_command;
+struct metrics_command{
+    uint32_t state;
+    char name[METRICS_NAME];
+    uint64_t allowed;
+    uint64_t denied;
+    uint64_t failed;
+    uint64_t user_us;
+    uint64_t system_us;
+    uint64_t max_rss_kb;
+    uint64_t cache_hits;
+    uint64_t cache_coalesced;
+    uint64_t cache_misses;
+    metrics_histogram times[METRICS_HISTOGRAMS];
+};
+
+typedef struct metrics_profile metrics_profile;
+struct metrics_profile{
+    uint32_t state;
+    char name[METRICS_NAME];
+    uint64_t sessions;
+    uint64_t commands;
+    uint64_t denied;
+    uint64_t failed;
+    uint64_t kicks;
+};
+
+typedef struct metrics_segment metrics_segment;
+struct metrics_segment{
+    uint32_t magic;
+    uint32_t size;
+    uint64_t spawn_failures;        /* no process could be created */
+    metrics_profile profiles[METRICS_PROFILES];
+    metrics_command commands[METRICS_COMMANDS];
+};
+
+int      metrics_open       (key_t key);
+void     metrics_close      (void);
+uint64_t metrics_bucket_end (int bucket);
+
+void     metrics_session    (const char* profile);
+void     metrics_allowed    (const char* name);
+void     metrics_denied     (const char* name);
+void     metrics_failed     (const char* name, int fork_failed);
+void     metrics_started    (const char* name, uint64_t spawn_ns, uint64_t exec_ns);
+void     metrics_ran        (const char* name, uint64_t wall_ns, const struct rusage* usage);
+void     metrics_cached     (const char* name, int how);
+void     metrics_kick       (void);
+
+/* True once metrics_open() succeeded */
+extern int metrics_enabled;
+
+#endif
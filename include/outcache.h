@@ -0,0 +1,119 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_OUTCACHE_H
+#define AGROS_OUTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The output cache shared by the sessions of a host. With "cacheable =
+ * name:ttl" in the conf, a command run on its own (no pipe, redirection or
+ * '&') keeps its stdout, stderr and exit status in OUTCACHE_DIR, on tmpfs,
+ * for ttl seconds. The same argv typed in a session of the same profile
+ * from the same directory during that time gets them back without a fork.
+ *
+ * An entry is named after a 64-bit hash of its key, and holds the key so
+ * that a collision is a miss:
+ *
+ *   outcache_header
+ *   key                 profile '\0' cwd '\0' argv[0] '\0' argv[1] '\0' ...
+ *   stdout, stderr
+ *
+ * The working directory is part of the key, rather than commands with a
+ * relative path argument going uncached: "ls" alone depends on it too.
+ * Commands that read the environment or the user still must not be marked
+ * cacheable.
+ *
+ * Identical commands that miss at the same time run once: the first one
+ * takes an exclusive flock() on <name>.lock, runs the command and writes
+ * the entry before it lets go; the others wait for the lock, up to
+ * OUTCACHE_WAIT_MS, and find the entry.
+ *
+ * Entries are written to a temporary file and renamed into place, so a
+ * reader sees a whole entry or none. The directory must belong to root or
+ * to the user, or the cache is off. It is sticky, like /tmp, but anyone
+ * can still create files in it: a session only reads entries and waits on
+ * locks owned by root or by its own user, and ignores an entry that
+ * expires more than OUTCACHE_MAX_TTL from now. Users therefore share only
+ * what root's sessions wrote. When another user's file holds the shared
+ * name, which can't be replaced, the user writes <name>.<uid> next to it.
+ * Root's entries are 0644; a user's are 0600, since the directory can be
+ * listed by anyone and the output may be private.
+ */
+
+#ifndef OUTCACHE_DIR
+#define OUTCACHE_DIR        "/dev/shm/agros-cache"
+#endif
+
+#define OUTCACHE_MAGIC      "AGCACHE1"
+#define OUTCACHE_MAX_TTL    86400
+#define OUTCACHE_MAX_OUTPUT (1024 * 1024)
+#define OUTCACHE_WAIT_MS    10000
+
+/* What outcache_lookup() found */
+#define OUTCACHE_OFF        -1
+#define OUTCACHE_HIT        0
+#define OUTCACHE_MISS       1
+
+typedef struct outcache_header outcache_header;
+struct outcache_header{
+    char     magic[8];
+    int64_t  expires_ns;            /* CLOCK_REALTIME */
+    int32_t  status;
+    uint32_t key_len;
+    uint64_t out_len;
+    uint64_t err_len;
+};
+
+/*
+ * A lookup. On a hit, out, err and status hold the entry, mapped until
+ * outcache_release(); coalesced tells that the session waited for another
+ * one to run the command. On a miss, the session holds the key's lock
+ * until outcache_store() or outcache_release().
+ */
+
+typedef struct outcache_result outcache_result;
+struct outcache_result{
+    const char* out;
+    size_t out_len;
+    const char* err;
+    size_t err_len;
+    int status;
+    int coalesced;
+
+    char* key;
+    size_t key_len;
+    char name[32];
+    void* map;
+    size_t map_len;
+    int lock_fd;
+};
+
+int     outcache_check      (char** rules, int count);
+int     outcache_ttl        (char** rules, int count, const char* name);
+int     outcache_lookup     (const char* profile, char** argv, outcache_result* result);
+int     outcache_store      (outcache_result* result, int out_fd, int err_fd, int status, int ttl);
+void    outcache_release    (outcache_result* result);
+
+#endif
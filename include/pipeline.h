@@ -0,0 +1,57 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_PIPELINE_H
+#define AGROS_PIPELINE_H
+
+#include <stddef.h>
+#include "agros.h"
+#include "evloop.h"
+
+/*
+ * What running a pipeline needs besides the launcher.
+ *
+ * Redirections are opened by AGROS, not by the command, and only inside
+ * the redirect_paths of the policy. The directory of the target is opened
+ * first and its real path, symbolic links resolved, is what the patterns
+ * are matched against; the file itself is then opened in that directory
+ * without following a symbolic link. Neither a link in the path nor one
+ * swapped in after the check leads outside the allowed directories.
+ *
+ * A pattern is matched like the allowed list against the absolute path.
+ * A pattern ending with '/' allows everything under that directory, and a
+ * leading "~/" stands for the user's home directory.
+ *
+ * With pipe_relay, the stages aren't connected to each other but to AGROS,
+ * which moves the data from one pipe to the next with splice(): it never
+ * copies it, but knows how much each stage wrote. The session's event loop,
+ * when one is given, keeps running meanwhile.
+ */
+
+/* pipeline_open() of a path outside redirect_paths */
+#define PIPELINE_DENIED (-2)
+
+int     pipeline_open   (const redirect_t* r, char** paths, int path_nbr, const char* home,
+                         char* resolved, size_t size);
+void    pipeline_relay  (int* from, int* to, size_t* bytes, int link_nbr, evloop* loop);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_POLICY_H
+#define AGROS_POLICY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A policy image is agros.conf compiled by agros-policyc into a flat binary
+ * file that sessions can mmap() instead of parsing the INI file. Layout:
+ *
+ *   policy_header
+ *   policy_section[nsections]   sorted by group name
+ *   policy_key[nkeys]           sorted by key name inside each section
+ *   uint32_t lists[]            string offsets of every list value
+ *   char strings[]              NUL-terminated strings
+ *
+ * All offsets are relative to the start of the image. The header checksum
+ * only covers the header. Each section carries a checksum of its own entry,
+ * keys, list entries and strings, so a login only verifies the [username]
+ * and [General] sections it reads instead of the whole image. The header
+ * also records the identity of the agros.conf it was compiled from, so a
+ * session can tell a stale image.
+ */
+
+#define POLICY_MAGIC    "AGROSPOL"
+#define POLICY_VERSION  1
+
+typedef struct policy_header policy_header;
+struct policy_header{
+    char     magic[8];
+    uint32_t version;
+    uint32_t total_size;
+    uint64_t checksum;
+    uint64_t src_size;
+    int64_t  src_mtime_sec;
+    int64_t  src_mtime_nsec;
+    uint64_t src_ino;
+    uint32_t nsections;
+    uint32_t section_off;
+    uint32_t key_off;
+    uint32_t list_off;
+    uint32_t str_off;
+    uint32_t reserved;
+};
+
+typedef struct policy_section policy_section;
+struct policy_section{
+    uint32_t name_off;
+    uint32_t first_key;
+    uint32_t nkeys;
+    uint32_t list_first;
+    uint32_t list_count;
+    uint32_t str_first;
+    uint32_t str_len;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+/*
+ * Each key stores both interpretations of its value: the unescaped string
+ * (as g_key_file_get_string() returns it) and the ';' separated list (as
+ * g_key_file_get_string_list() returns it). The loader doesn't know which
+ * keys are lists, so it's cheaper to store both than to re-parse.
+ */
+
+typedef struct policy_key policy_key;
+struct policy_key{
+    uint32_t name_off;
+    uint32_t value_off;
+    uint32_t list_first;
+    uint32_t list_count;
+};
+
+/*
+ * conf_source hides where the configuration comes from. parse_config() only
+ * talks to this interface, so the INI file and the policy image share the
+ * same [username] / [General] fallback logic.
+ *
+ * Once conf_use_profile() is called, a key is looked up in the user's own
+ * section, then in a [@group] section for each of the user's groups, then
+ * in [General]. Each of these sections can also come from a drop-in file
+ * next to agros.conf, which takes precedence over the same section in
+ * agros.conf:
+ *
+ *   agros.conf.d/users/<user>.conf      [<user>]
+ *   agros.conf.d/groups/<group>.conf    [@<group>]
+ *
+ * Only the files of the user and of the user's groups are read.
+ */
+
+#define CONF_SRC_KEYFILE 0
+#define CONF_SRC_IMAGE   1
+
+typedef struct conf_source conf_source;
+
+conf_source*  conf_open             (const char* conf_path, const char* image_path);
+void          conf_close            (conf_source* src);
+int           conf_kind             (conf_source* src);
+int           conf_has_group        (conf_source* src, const char* group);
+int           conf_has_key          (conf_source* src, const char* group, const char* key);
+char*         conf_get_string       (conf_source* src, const char* group, const char* key);
+int           conf_get_integer      (conf_source* src, const char* group, const char* key);
+char**        conf_get_string_list  (conf_source* src, const char* group, const char* key, int* count);
+const char*   conf_select_group     (conf_source* src, const char* username, const char* key);
+int           conf_failed           (conf_source* src);
+
+int           conf_user_groups      (const char* username, uid_t* uid, gid_t* gid, gid_t** groups, int* ngroups);
+int           conf_use_profile      (conf_source* src, const char* conf_path, const char* username,
+                                     uid_t uid, gid_t gid, const gid_t* groups, int ngroups);
+int           conf_prefetch_profile (const char* conf_path, const char* username,
+                                     uid_t uid, gid_t gid, const gid_t* groups, int ngroups);
+char**        conf_get_merged_list  (conf_source* src, const char* username, const char* key,
+                                     int* count, const char** group);
+
+int           policy_image_compile  (const char* conf_path, const char* image_path);
+
+#endif
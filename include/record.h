@@ -0,0 +1,84 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_RECORD_H
+#define AGROS_RECORD_H
+
+#include <stddef.h>
+#include "agros.h"
+#include "launcher.h"
+#include "evloop.h"
+
+/*
+ * Session recording. With record_dir set in the profile, everything a
+ * session runs is written to one file in that directory, named after the
+ * user, the time the session started and the pid of AGROS:
+ *
+ *     record_dir/<user>-<YYYYmmdd-HHMMSS>-<pid>.agrec
+ *
+ * The commands of a recorded session don't write to the terminal. At a
+ * prompt they get a PTY of their own, so they still see a terminal, and
+ * AGROS relays what is typed to it and what it prints to the real one.
+ * Without a terminal they write to a pipe, which AGROS tee()s and
+ * splice()s to its own output, so the bytes are only read once, for the
+ * recording. Either way AGROS compresses a copy into the file as it goes.
+ *
+ * The file starts with RECORD_MAGIC, followed by records of an 8-byte
+ * header, the type and the length of what follows, little-endian:
+ *
+ *   RECORD_SESSION  u64 start (ns since the epoch), u32 pid, the user
+ *   RECORD_BEGIN    u64 start, u32 stage count, then for each stage a
+ *                   u32 argc and its words, a u32 count and its
+ *                   redirections as typed ("2>&1", ">>log"), each word
+ *                   ending with a NUL
+ *   RECORD_DATA     u64 time, then deflate output
+ *   RECORD_END      u64 end, i32 exit status, u64 bytes of output
+ *
+ * Each command is a frame: a BEGIN, its DATA and an END. The output of a
+ * command is one deflate stream, flushed into a DATA record whenever
+ * RECORD_CHUNK bytes were compressed or the command was quiet for a
+ * second, so a file cut short still replays up to its last record.
+ * agros-replay (src/replay.c) lists and prints recordings.
+ */
+
+#define RECORD_MAGIC        "AGREC001"
+#define RECORD_MAGIC_LEN    8
+#define RECORD_HEADER       8
+#define RECORD_CHUNK        65536
+
+#define RECORD_SESSION      1
+#define RECORD_BEGIN        2
+#define RECORD_DATA         3
+#define RECORD_END          4
+
+typedef struct recorder recorder;
+
+recorder*  record_open     (const char* dir, const char* username);
+void       record_close    (recorder* rec);
+int        record_begin    (recorder* rec, const command_t* cmd);
+void       record_output   (recorder* rec, const void* data, size_t size);
+int        record_end      (recorder* rec, int status);
+
+int        record_capture  (int* output, int* capture, int* terminal);
+int        record_relay    (recorder* rec, int output, int terminal, const spawn_t* sps, int count, evloop* loop);
+
+#endif
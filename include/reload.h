@@ -0,0 +1,46 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_RELOAD_H
+#define AGROS_RELOAD_H
+
+#include "agros.h"
+
+/*
+ * Policy hot-reload. A thread watches the directory of agros.conf with
+ * inotify. When agros.conf or its policy image is written or replaced, it
+ * waits for the writes to settle, loads the policy again and publishes it
+ * as a new snapshot. It does all of this off the command path.
+ *
+ * The session picks the snapshot up between commands with reload_poll().
+ * While nothing has changed, that costs one atomic load. reload_fd() is
+ * readable once there is a new one, so a session idle at the prompt takes
+ * it without waiting for the next line. A configuration
+ * that doesn't load is logged and ignored: the session keeps the policy it
+ * has.
+ */
+
+int     reload_start    (const char* conf_path, const char* image_path, const char* username);
+int     reload_poll     (config_t* config);
+int     reload_fd       (void);
+
+#endif
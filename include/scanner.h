@@ -0,0 +1,42 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_SCANNER_H
+#define AGROS_SCANNER_H
+
+/*
+ * The forbidden list, compiled once when the configuration is loaded.
+ *
+ * When every forbidden sequence is a single character (the usual ";", "|",
+ * ">" kind of list), a word is scanned 16 bytes at a time with SSE2, or
+ * through a 256 entry table on other targets. Otherwise all sequences are
+ * compiled into one Aho-Corasick automaton. Either way each byte of a word
+ * is looked at once, whatever the number of forbidden sequences.
+ */
+
+typedef struct forbidden_scanner forbidden_scanner;
+
+forbidden_scanner*  scanner_compile     (char** patterns, int count);
+int                 scanner_search      (const forbidden_scanner* scanner, const char* text);
+void                scanner_free        (forbidden_scanner* scanner);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_TOKENIZER_H
+#define AGROS_TOKENIZER_H
+
+#include <stddef.h>
+
+/*
+ * Splitting command lines into words, the way a POSIX shell does it:
+ *   - words are separated by blanks
+ *   - 'single quotes' keep everything up to the next single quote
+ *   - "double quotes" keep everything, except that \" \\ \$ and \` are
+ *     unescaped
+ *   - outside quotes, a backslash keeps the next character as it is
+ *   - outside quotes, '|' separates the stages of a pipeline, and '<',
+ *     '>', '>>' and '>&n' redirect the standard descriptors of a stage,
+ *     fd 0 or 1 unless a 0, 1 or 2 comes right before ("2>err", "2>&1")
+ *   - outside quotes, a '&' that ends the line runs it in the background
+ *     ("sleep 10 &", "sleep 10&"); any other '&' is an ordinary character
+ *
+ * A word without quotes or backslashes is used where it is: parse_command()
+ * ends it with a '\0' in the line and points argv at it. Only words that
+ * need unescaping, or that end right at an operator, are copied, into an
+ * arena that is reset at the start of the next line. Once the arena and
+ * the tables of command_t are as big as the longest line seen, parsing a
+ * line allocates nothing.
+ */
+
+typedef struct arena arena;
+
+arena*  arena_new       (void);
+void*   arena_alloc     (arena* a, size_t size);
+void    arena_reset     (arena* a);
+void    arena_free      (arena* a);
+
+#endif
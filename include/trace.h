@@ -0,0 +1,55 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGROS_TRACE_H
+#define AGROS_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Phase tracing. Off unless AGROS_TRACE is set in the environment of the
+ * session, in which case every phase of the login and of each command
+ * (read_input, parse_command, check_validity, spawn, exec, wait...) is
+ * timed and written to TRACE_DIR/agros-trace-<pid>.json when the session
+ * ends. The file is in the Chrome trace format: open it in Perfetto or
+ * chrome://tracing.
+ *
+ * When tracing is off, each TRACE_BEGIN/TRACE_END is one branch that is
+ * never taken.
+ */
+
+#ifndef TRACE_DIR
+#define TRACE_DIR "/tmp"
+#endif
+
+extern int trace_enabled;
+
+#define TRACE_BEGIN(name)   do { if (__builtin_expect (trace_enabled, 0)) trace_event ('B', (name)); } while (0)
+#define TRACE_END(name)     do { if (__builtin_expect (trace_enabled, 0)) trace_event ('E', (name)); } while (0)
+
+void        trace_open      (void);
+uint64_t    trace_now       (void);
+void        trace_event     (char phase, const char* name);
+void        trace_span      (const char* name, uint64_t start, uint64_t end);
+void        trace_close     (void);
+
+#endif
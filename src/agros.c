@@ -26,100 +26,145 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <errno.h>
 #include <assert.h>
 #include <syslog.h>
-#include <glib.h>
 #include <pwd.h>
 #include <sys/types.h>
 #include "agros.h"
-
+#include "builtins.h"
+#include "complete.h"
+#include "audit.h"
+#include "reload.h"
+#include "policy.h"
+#include "allowlist.h"
+#include "scanner.h"
+#include "argrules.h"
+#include "governor.h"
+#include "metrics.h"
+#include "histfile.h"
+#include "outcache.h"
+
+#ifdef AGROS_EMBEDDED
+#include "lineedit.h"
+#else
 #include <readline/readline.h>
 #include <readline/history.h>
-
-#ifndef CONFIG_FILE
-#define CONFIG_FILE "agros.conf"
 #endif
 
 /*
- * A global array holding the associations between each built-in command
- * and their command_code. More explanations can be found in the declaration
- * of the "built_in_commands" structure.
- *
+ * The built-in commands of the shell itself, for completion. The ones that
+ * stand for system commands complete when they are allowed, with the other
+ * allowed commands.
  */
 
-built_in_commands my_commands[CMD_NBR] = {
-    {"exit" , EXIT_CMD  },
-    {""     , EMPTY_CMD },
-    {"cd"   , CD_CMD    },
-    {"env"  , ENV_CMD   },
-    {"help" , HELP_CMD  },
-    {"?"    , HELP_CMD  }
+static const char* shell_builtins[] = {
+#define BUILTIN(name, handler, policy) policy == BUILTIN_SHELL ? name : NULL,
+#include "builtins.def"
+#undef BUILTIN
 };
 
+#define SHELL_BUILTIN_NBR ((int) (sizeof (shell_builtins) / sizeof (shell_builtins[0])))
+
 /*
- * A reference to the list and number of allowed commands.
- * This list is used when autocompleting commands.
+ * The configuration that tab-completion offers the commands of, and the
+ * index built from it on the first completion.
  */
-char **allowed_list = (char **)NULL;
-int allowed_nbr = 0;
+static config_t* completion_config = NULL;
+static completion_index* completions = NULL;
 
 /* This variable contains the environment. I use it in my "env" built-in
    function */
 extern char** environ;
 
+/* The history saved between sessions, see initialize_readline() */
+static histfile* history_file = NULL;
+
+/* What readline's callback interface was given, see read_input_key() */
+static char* input_line = NULL;
+static int input_done = AG_TRUE;
+
+static void take_line (char* line){
+    input_line = line;
+    input_done = AG_TRUE;
+
+    /* Nothing is drawn again until the next read_input_start() */
+    rl_callback_handler_remove ();
+}
+
 /*
- * This function parses a string and fills a command_t struct.
- * It uses the strtok() to split the string into tokens. Then it fills the argv
- * array with the tokens.
- *
- * After filling the array, it copies argv[0] as the cmd->name and cmd->argc
- * as the length of the array.
- *
+ * Reads the input using GNU Readline, a key at a time with its callback
+ * interface, so the session can do other things while the user types (see
+ * run_interactive()): read_input_start() prints the prompt, then
+ * read_input_key() is called each time the terminal has something to
+ * read.
  */
 
-void parse_command (char *cmdline, command_t *cmd){
-    int count = 0;
-    char* word;
+void read_input_start (char* prompt){
+    input_line = NULL;
+    input_done = AG_FALSE;
+    rl_callback_handler_install (prompt, take_line);
+}
 
-    word = strtok (cmdline, WHITESPACE);
+/*
+ * Returns AG_TRUE once the line is complete, with *line set to it, or to
+ * NULL at the end of the input (Ctrl-D).
+ * Saves each input in a history list, and in the history file.
+ * The result is dynamically allocated and should
+ * be cleaned up with free().
+ */
 
-    if (word == NULL) { word = ""; } // Fixes blank line bug
+int read_input_key (char** line){
+    HIST_ENTRY *previous = NULL;
+    char *result;
 
-    if (cmd->name != NULL){
-        free (cmd->name);
-    }
+    rl_callback_read_char ();
+    if (!input_done)
+        return AG_FALSE;
+    result = input_line;
+    input_line = NULL;
 
-    while (word) {
-        cmd->argv[count] = word;
-        word = strtok (NULL, WHITESPACE);
-        count++;
+    /* Add the line to the history if it's valid and non-empty, and not
+       the same as the one before */
+    if (result  && *result) {
+        if (history_length > 0)
+            previous = history_get (history_base + history_length - 1);
+        if (previous == NULL || strcmp (previous->line, result))
+	    add_history(result);
+        if (history_file != NULL)
+            histfile_append (history_file, result);
     }
-    cmd->argv[count] = NULL;
 
-    cmd->argc = count;
-    cmd->name = (char *) malloc (strlen (cmd->argv[0])+1);
-    strcpy (cmd->name, cmd->argv[0]);
+    *line = result;
+    return AG_TRUE;
 }
 
 /*
- * Reads the input using GNU Readline.
- * Saves each input in a history list.
- * - prompt: The prompt to display when asking for input.
- * The result is dynamically allocated and should 
- * be cleaned up with free().
+ * Gives up on the line being typed, and puts the terminal back.
  */
 
-char *read_input (char *prompt)
-{
-    char *result;
-    result  = readline(prompt);
+void read_input_stop (void){
+    if (input_done)
+        return;
+    input_done = AG_TRUE;
+    rl_callback_handler_remove ();
+}
 
-    /* Add the line to the history if it's valid and non-empty */
-    if (result  && *result) {
-	add_history(result);
-    } 
+/*
+ * Takes the line being typed off the screen, so that the session can print
+ * something, and draws it again after. Nothing happens when no line is
+ * being read.
+ */
 
-    return result;
+void hide_input (void){
+    if (!input_done)
+        rl_clear_visible_line ();
+}
+
+void show_input (void){
+    if (!input_done)
+        rl_forced_update_display ();
 }
 
 /*
@@ -177,69 +222,81 @@ void print_help(config_t* config){
  */
 
 void change_directory (char* path, int loglevel){
+    char cwd[PATH_MAX];
 
     /* If no arguments are given, go to $HOME directory */
     if (path == NULL)
         set_homedir (&path);
 
     if (chdir (path) == 0){
-        if (loglevel >= 3) syslog (LOG_NOTICE, "Changing to directory: %s.", path);
-        getcwd (path, MAX_LINE_LEN);
-        setenv ("PWD", path, 1);
+        if (loglevel >= 3) audit (LOG_NOTICE, "Changing to directory: %s.", path);
+        if (getcwd (cwd, sizeof (cwd)) != NULL)
+            setenv ("PWD", cwd, 1);
     } else {
         fprintf (stderr, "%s: Could not change to such directory\n", path);
-        if (loglevel >= 2) syslog (LOG_NOTICE, "Could not change to directory: %s.", path);
+        if (loglevel >= 2) audit (LOG_NOTICE, "Could not change to directory: %s.", path);
     }
 
 }
 
 /*
- * This function access the global array variable my_commands
- * and returns the command_code eauivalent to each command.
+ * This function checks for the validity of user input.
+ * The command name must match the allowed list (compiled into
+ * config->allowed_matcher), no word of the command line may
+ * contain a forbidden sequence (compiled into config->forbidden_matcher)
+ * and the arguments must pass the allow_args and deny_args rules
+ * (compiled into config->args_matcher).
  *
+ * Returns AG_FALSE if the command may run, AG_TRUE otherwise.
  */
 
-int get_cmd_code (char* cmd_name){
+int check_validity (command_t* cmd, config_t* config){
     int i = 0;
-    for (i=0; i<CMD_NBR; i++){
-	    if (!strcmp (my_commands[i].command_name, cmd_name))
-	        return my_commands[i].command_code;
+
+    /* Checks if the command name is part of the allowed list */
+    if (!allowlist_match (config->allowed_matcher, cmd->name))
+        return AG_TRUE;
+
+    /* Checks that the command line does not include any forbidden character */
+    for (i=0; i<cmd->argc; i++){
+        if (scanner_search (config->forbidden_matcher, cmd->argv[i]))
+            return AG_TRUE;
     }
-    return OTHER_CMD;
+
+    /* Checks the arguments against allow_args and deny_args */
+    if (argrules_check (config->args_matcher, cmd->argv) != ARGS_OK)
+        return AG_TRUE;
+
+    return AG_FALSE;
 }
 
 /*
- * This function checks for the validity of user input.
- * allowed_list is an array of strings, the only commands
- * allowed to use.
- *
+ * This function checks the operators of a pipeline or of redirections
+ * ('|', '<', '>', ">>" and ">&") and the files redirected to against the
+ * forbidden list, so that a conf which forbids '|' or '>' keeps them out.
+ * Where a redirection may go is checked when the file is opened, against
+ * redirect_paths (see pipeline.h).
  *
+ * Returns AG_FALSE if they may be used, AG_TRUE otherwise.
  */
 
-int check_validity (command_t cmd, config_t config){
-    int valid = 1;
-    int i = 0, j = 0;
-
-    /* Checks if the command name is part of the allowed list */
-    while (config.allowed_list[i]){
-	    if (!strcmp (config.allowed_list[i], cmd.name) || !strcmp (config.allowed_list[i], "*"))
-	        valid = AG_FALSE;
-	    i++;
-    }
-
-    /* Checks that the command line does not include any forbidden character */
-    i = 0;
+int check_operators (command_t* cmd, config_t* config){
+    static const char* const operators[] = { "<", ">", ">>", ">&" };
+    redirect_t* r = NULL;
+    int i = 0;
 
-    while (config.forbidden_list[i]){
-        for (j=0; j<cmd.argc; j++){
-            if (strstr (cmd.argv[j], config.forbidden_list[i]) != NULL)
-                valid = AG_TRUE;
-        }
+    if (cmd->stage_nbr > 1 && scanner_search (config->forbidden_matcher, "|"))
+        return AG_TRUE;
 
-        i++;
+    for (i=0; i<cmd->redirect_nbr; i++){
+        r = &cmd->redirects[i];
+        if (scanner_search (config->forbidden_matcher, operators[r->mode]))
+            return AG_TRUE;
+        if (r->path != NULL && scanner_search (config->forbidden_matcher, r->path))
+            return AG_TRUE;
     }
 
-    return valid;
+    return AG_FALSE;
 }
 
 /* 
@@ -305,92 +362,369 @@ void print_allowed (char** allowed){
 }
 
 /*
- * EFFECTS: parses CONFIG_FILE.
- * MODIFIES: allowed_list, allowed_nbr, welcome_message, loglevel
+ * EFFECTS: loads the configuration of username from conf_path, or from
+ *          image_path if it holds an up to date compiled policy.
+ * MODIFIES: allowed_list, allowed_nbr, forbidden_list, forbidden_nbr,
+ *           allow_args, deny_args, redirect_paths, pipe_relay, limits,
+ *           cacheable, record_dir, metrics, profile, welcome_message, loglevel, warnings,
+ *           max_jobs, history_size, timeout, idle_timeout, audit_*
+ * RETURNS: CONF_OK or one of the CONF_ERR_* codes.
  */
 
-void parse_config (config_t* config, char* username){
-    GKeyFile* gkf;
-    gsize gallowed_nbr;
-    gsize gforbidden_nbr;
-    char* glib_group = NULL;
-
-    gkf = g_key_file_new ();
-
-    /* Loads the file into gkf */
-    if (!g_key_file_load_from_file (gkf, CONFIG_FILE, G_KEY_FILE_NONE, NULL)){
-	    fprintf (stderr, "Could not read config file %s\nTry using another shell or contact an administrator.\n", CONFIG_FILE);
-        syslog (LOG_ERR, "Could not read config file: %s.", CONFIG_FILE);
-        closelog ();
-	    exit (EXIT_FAILURE);
-    }
+static int load_config_from (config_t* config, char* username, conf_source* src){
+    const char* group = NULL;
+    char* value = NULL;
+    int i = 0;
 
-    /* If the file exists and is loaded, we proceed to parsing it */
+    config->welcome_message = NULL;
+    config->allowed_list = NULL;
+    config->allowed_matcher = NULL;
+    config->forbidden_list = NULL;
+    config->forbidden_matcher = NULL;
+    config->allow_args = NULL;
+    config->deny_args = NULL;
+    config->allow_args_nbr = 0;
+    config->deny_args_nbr = 0;
+    config->args_matcher = NULL;
+    config->redirect_paths = NULL;
+    config->redirect_paths_nbr = 0;
+    config->limits = NULL;
+    config->cacheable = NULL;
+    config->cacheable_nbr = 0;
+    config->record_dir = NULL;
+    config->profile = NULL;
+    config->audit_file = NULL;
+    config->audit_spill = NULL;
 
     /* LOGLEVEL */
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, "loglevel", NULL)){
-        glib_group =  username;
-    }else
-        glib_group = "General";
-    if (g_key_file_has_key (gkf, glib_group, "loglevel", NULL)){
-	    config->loglevel = g_key_file_get_integer (gkf, glib_group, "loglevel", NULL);
-        syslog (LOG_NOTICE, "Setting log level to: %d.", config->loglevel);
+    group = conf_select_group (src, username, "loglevel");
+    if (conf_has_key (src, group, "loglevel")){
+        config->loglevel = conf_get_integer (src, group, "loglevel");
+        audit (LOG_NOTICE, "Setting log level to: %d.", config->loglevel);
     }
     else
-	    config->loglevel = 0;
+        config->loglevel = 0;
 
     /* WELCOME MESSAGE */
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, "welcome", NULL)){
-        glib_group =  username;
-    }else
-        glib_group = "General";
-    if (g_key_file_has_key (gkf, glib_group, "welcome", NULL)){
-	    config->welcome_message = g_key_file_get_string (gkf, glib_group, "welcome", NULL);
-        if (config->loglevel >=3) syslog (LOG_NOTICE, "Setting welcome message to: %s.", config->welcome_message);
-    } else
-	    config->welcome_message = NULL;
+    group = conf_select_group (src, username, "welcome");
+    config->welcome_message = conf_get_string (src, group, "welcome");
+    if (config->welcome_message != NULL && config->loglevel >= 3)
+        audit (LOG_NOTICE, "Setting welcome message to: %s.", config->welcome_message);
 
     /* ALLOWED COMMANDS */
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, "allowed", NULL)){
-        glib_group =  username;
-    }else
-        glib_group = "General";
-    if (g_key_file_has_key (gkf, glib_group, "allowed", NULL)){
-	    config->allowed_list = g_key_file_get_string_list (gkf, glib_group, "allowed", &gallowed_nbr, NULL);
-	    config->allowed_nbr = gallowed_nbr;
-    }else {
-        fprintf (stderr, "Cannot launch AGROS; missing allowed list from conf file.\n");
-        if (config->loglevel >=1) syslog (LOG_NOTICE, "Error in conf file, missing allowed list!");
-        exit (EXIT_SUCCESS);
-    }
+    config->allowed_list = conf_get_merged_list (src, username, "allowed", &config->allowed_nbr, &group);
+    if (config->allowed_list == NULL)
+        return CONF_ERR_ALLOWED;
+    config->allowed_matcher = allowlist_compile (config->allowed_list, config->allowed_nbr);
+    config->profile = strdup (group);
+    if (config->allowed_matcher == NULL || config->profile == NULL)
+        return CONF_ERR_READ;
 
     /* FORBIDDEN CHARACTERS */
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, "forbidden", NULL)){
-        glib_group =  username;
-    }else
-        glib_group = "General";
-    if (g_key_file_has_key (gkf, glib_group, "forbidden", NULL)){
-	    config->forbidden_list = g_key_file_get_string_list (gkf, glib_group, "forbidden", &gforbidden_nbr, NULL);
-	    config->forbidden_nbr = gforbidden_nbr;
-    }else {
-        fprintf (stderr, "Cannot launch AGROS; missing parameter from conf file.\n");
-        if (config->loglevel >=1) syslog (LOG_NOTICE, "Error in conf file, missing forbidden list!");
-        exit (EXIT_SUCCESS);
+    config->forbidden_list = conf_get_merged_list (src, username, "forbidden", &config->forbidden_nbr, &group);
+    if (config->forbidden_list == NULL)
+        return CONF_ERR_FORBIDDEN;
+    config->forbidden_matcher = scanner_compile (config->forbidden_list, config->forbidden_nbr);
+    if (config->forbidden_matcher == NULL)
+        return CONF_ERR_READ;
+
+    /* ARGUMENT RULES */
+    config->allow_args = conf_get_merged_list (src, username, "allow_args", &config->allow_args_nbr, &group);
+    config->deny_args = conf_get_merged_list (src, username, "deny_args", &config->deny_args_nbr, &group);
+    config->args_matcher = argrules_compile (config->allow_args, config->allow_args_nbr,
+                                             config->deny_args, config->deny_args_nbr);
+    if (config->args_matcher == NULL)
+        return CONF_ERR_ARGS;
+    if (config->loglevel >= 3 && config->allow_args_nbr + config->deny_args_nbr > 0)
+        audit (LOG_NOTICE, "Compiled %d argument rules into %d states.", config->allow_args_nbr + config->deny_args_nbr,
+               argrules_states (config->args_matcher));
+
+    /* PIPES AND REDIRECTIONS */
+    config->redirect_paths = conf_get_merged_list (src, username, "redirect_paths", &config->redirect_paths_nbr, &group);
+    group = conf_select_group (src, username, "pipe_relay");
+    if (conf_has_key (src, group, "pipe_relay"))
+        config->pipe_relay = conf_get_integer (src, group, "pipe_relay");
+    else
+        config->pipe_relay = 0;
+
+    /* RESOURCE LIMITS */
+    for (i=0; governor_keys[i] != NULL; i++){
+        group = conf_select_group (src, username, governor_keys[i]);
+        value = conf_get_string (src, group, governor_keys[i]);
+        if (value == NULL)
+            continue;
+        if (config->limits == NULL && (config->limits = governor_new ()) == NULL){
+            free (value);
+            return CONF_ERR_READ;
+        }
+        if (governor_set (config->limits, governor_keys[i], value) < 0){
+            audit (LOG_ERR, "Invalid %s: %s.", governor_keys[i], value);
+            free (value);
+            return CONF_ERR_LIMITS;
+        }
+        if (config->loglevel >= 3) audit (LOG_NOTICE, "Setting %s to: %s.", governor_keys[i], value);
+        free (value);
     }
 
+    /* OUTPUT CACHE */
+    config->cacheable = conf_get_merged_list (src, username, "cacheable", &config->cacheable_nbr, &group);
+    if (config->cacheable != NULL && (i = outcache_check (config->cacheable, config->cacheable_nbr)) >= 0){
+        audit (LOG_ERR, "Invalid cacheable: %s.", config->cacheable[i]);
+        return CONF_ERR_CACHEABLE;
+    }
+
+    /* SESSION RECORDING */
+    group = conf_select_group (src, username, "record_dir");
+    config->record_dir = conf_get_string (src, group, "record_dir");
+    if (config->record_dir != NULL && config->loglevel >= 3)
+        audit (LOG_NOTICE, "Setting record_dir to: %s.", config->record_dir);
+
+    /* METRICS */
+    group = conf_select_group (src, username, "metrics");
+    if (conf_has_key (src, group, "metrics"))
+        config->metrics = conf_get_integer (src, group, "metrics");
+    else
+        config->metrics = 0;
+
     /* WARNING_NBR */
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, "warnings", NULL)){
-        glib_group =  username;
-    }else
-        glib_group = "General";
-    if (g_key_file_has_key (gkf, glib_group, "warnings", NULL)){
-	    config->warnings = g_key_file_get_integer (gkf, glib_group, "warnings", NULL);
-        syslog (LOG_NOTICE, "Setting initial warning number to: %d.", config->warnings);
+    group = conf_select_group (src, username, "warnings");
+    if (conf_has_key (src, group, "warnings")){
+        config->warnings = conf_get_integer (src, group, "warnings");
+        audit (LOG_NOTICE, "Setting initial warning number to: %d.", config->warnings);
     }
     else
-	    config->warnings = -1;
+        config->warnings = -1;
+
+    /* MAX_JOBS */
+    group = conf_select_group (src, username, "max_jobs");
+    if (conf_has_key (src, group, "max_jobs")){
+        config->max_jobs = conf_get_integer (src, group, "max_jobs");
+        if (config->loglevel >= 3) audit (LOG_NOTICE, "Setting maximum background jobs to: %d.", config->max_jobs);
+    }
+    else
+        config->max_jobs = -1;
+
+    /* HISTORY */
+    group = conf_select_group (src, username, "history_size");
+    if (conf_has_key (src, group, "history_size")){
+        config->history_size = conf_get_integer (src, group, "history_size");
+        if (config->history_size < 0)
+            config->history_size = 0;
+        if (config->loglevel >= 3) audit (LOG_NOTICE, "Setting history size to: %d.", config->history_size);
+    }
+    else
+        config->history_size = DEFAULT_HISTORY_SIZE;
+
+    /* TIMEOUTS */
+    group = conf_select_group (src, username, "timeout");
+    config->timeout = conf_get_integer (src, group, "timeout");
+    if (config->timeout < 0)
+        config->timeout = 0;
+    if (config->timeout > 0 && config->loglevel >= 3) audit (LOG_NOTICE, "Setting command timeout to: %d.", config->timeout);
+
+    group = conf_select_group (src, username, "idle_timeout");
+    config->idle_timeout = conf_get_integer (src, group, "idle_timeout");
+    if (config->idle_timeout < 0)
+        config->idle_timeout = 0;
+    if (config->idle_timeout > 0 && config->loglevel >= 3) audit (LOG_NOTICE, "Setting idle timeout to: %d.", config->idle_timeout);
+
+    /* AUDIT LOG */
+    group = conf_select_group (src, username, "audit_sink");
+    value = conf_get_string (src, group, "audit_sink");
+    if (value == NULL || !strcmp (value, "syslog"))
+        config->audit_sink = AUDIT_SYSLOG;
+    else if (!strcmp (value, "file"))
+        config->audit_sink = AUDIT_FILE;
+    else if (!strcmp (value, "both"))
+        config->audit_sink = AUDIT_SYSLOG | AUDIT_FILE;
+    else {
+        audit (LOG_WARNING, "Unknown audit_sink: %s, using syslog.", value);
+        config->audit_sink = AUDIT_SYSLOG;
+    }
+    free (value);
+
+    group = conf_select_group (src, username, "audit_overflow");
+    value = conf_get_string (src, group, "audit_overflow");
+    if (value == NULL || !strcmp (value, "block"))
+        config->audit_overflow = AUDIT_BLOCK;
+    else if (!strcmp (value, "drop"))
+        config->audit_overflow = AUDIT_DROP;
+    else if (!strcmp (value, "spill"))
+        config->audit_overflow = AUDIT_SPILL;
+    else {
+        audit (LOG_WARNING, "Unknown audit_overflow: %s, using block.", value);
+        config->audit_overflow = AUDIT_BLOCK;
+    }
+    free (value);
+
+    group = conf_select_group (src, username, "audit_file");
+    config->audit_file = conf_get_string (src, group, "audit_file");
+    group = conf_select_group (src, username, "audit_spill");
+    config->audit_spill = conf_get_string (src, group, "audit_spill");
+
+    return CONF_OK;
+}
+
+/*
+ * Reads src as username's profile: the [@group] sections of its groups and
+ * the drop-in files of agros.conf.d apply. Without it, only [username] and
+ * [General] do. Returns CONF_ERR_GROUPS if the user's groups can't all be
+ * read, since the sections of the missing ones may forbid things.
+ */
+
+static int use_profile (conf_source* src, char* username, const char* conf_path){
+    gid_t* groups = NULL;
+    uid_t uid = (uid_t) -1;
+    gid_t gid = (gid_t) -1;
+    int ngroups = 0;
+
+    if (conf_user_groups (username, &uid, &gid, &groups, &ngroups) == -2)
+        return CONF_ERR_GROUPS;
+    if (conf_use_profile (src, conf_path, username, uid, gid, groups, ngroups) < 0)
+        audit (LOG_WARNING, "Could not resolve the profile of %s, using [%s] and [General] only.", username, username);
+    free (groups);
+    return CONF_OK;
+}
+
+int load_config (config_t* config, char* username, const char* conf_path, const char* image_path){
+    conf_source* src = NULL;
+    int result = CONF_OK;
+
+    src = conf_open (conf_path, image_path);
+    if (src == NULL)
+        return CONF_ERR_READ;
+    result = use_profile (src, username, conf_path);
+    if (result != CONF_OK){
+        conf_close (src);
+        return result;
+    }
+
+    result = load_config_from (config, username, src);
+
+    /* A corrupted section in the policy image: forget what was read from
+       it and parse agros.conf instead */
+    if (conf_failed (src)){
+        conf_close (src);
+        audit (LOG_WARNING, "Ignoring corrupted policy image: %s.", image_path);
+        config_free (config);
+
+        src = conf_open (conf_path, NULL);
+        if (src == NULL)
+            return CONF_ERR_READ;
+        result = use_profile (src, username, conf_path);
+        if (result == CONF_OK)
+            result = load_config_from (config, username, src);
+    }
+
+    conf_close (src);
+    return result;
+}
 
-     g_key_file_free (gkf);
+/*
+ * EFFECTS: parses CONFIG_FILE (or its compiled POLICY_FILE). Exits AGROS
+ *          with EXIT_FAILURE if the configuration is unusable.
+ * MODIFIES: allowed_list, allowed_nbr, welcome_message, loglevel
+ */
+
+void parse_config (config_t* config, char* username){
+    switch (load_config (config, username, CONFIG_FILE, POLICY_FILE)){
+        case CONF_OK:
+            break;
+
+        case CONF_ERR_READ:
+	        fprintf (stderr, "Could not read config file %s\nTry using another shell or contact an administrator.\n", CONFIG_FILE);
+            audit (LOG_ERR, "Could not read config file: %s.", CONFIG_FILE);
+            audit_close ();
+	        exit (EXIT_FAILURE);
+
+        case CONF_ERR_ALLOWED:
+            fprintf (stderr, "Cannot launch AGROS; missing allowed list from conf file.\n");
+            if (config->loglevel >=1) audit (LOG_NOTICE, "Error in conf file, missing allowed list!");
+            exit (EXIT_FAILURE);
+
+        case CONF_ERR_FORBIDDEN:
+            fprintf (stderr, "Cannot launch AGROS; missing parameter from conf file.\n");
+            if (config->loglevel >=1) audit (LOG_NOTICE, "Error in conf file, missing forbidden list!");
+            exit (EXIT_FAILURE);
+
+        case CONF_ERR_ARGS:
+            fprintf (stderr, "Cannot launch AGROS; allow_args and deny_args are too complex.\n");
+            if (config->loglevel >=1) audit (LOG_NOTICE, "Error in conf file, could not compile allow_args and deny_args!");
+            exit (EXIT_FAILURE);
+
+        case CONF_ERR_LIMITS:
+            fprintf (stderr, "Cannot launch AGROS; a resource limit is not valid.\n");
+            if (config->loglevel >=1) audit (LOG_NOTICE, "Error in conf file, a resource limit is not valid!");
+            exit (EXIT_FAILURE);
+
+        case CONF_ERR_CACHEABLE:
+            fprintf (stderr, "Cannot launch AGROS; a cacheable command is not valid.\n");
+            if (config->loglevel >=1) audit (LOG_NOTICE, "Error in conf file, a cacheable command is not valid!");
+            exit (EXIT_FAILURE);
+
+        case CONF_ERR_GROUPS:
+            fprintf (stderr, "Cannot launch AGROS; the groups of %s can't be read.\n", username);
+            audit (LOG_ERR, "Could not read all the groups of %s, refusing the login.", username);
+            audit_close ();
+            exit (EXIT_FAILURE);
+    }
+}
+
+/*
+ * Starts watching CONFIG_FILE, so that a long session picks up changes to
+ * the policy. See reload.h.
+ */
+
+void watch_config (char* username){
+    if (reload_start (CONFIG_FILE, POLICY_FILE, username) < 0)
+        audit (LOG_WARNING, "Could not watch %s, changes will apply at the next login.", CONFIG_FILE);
+}
+
+/*
+ * Resolves the profile of a user who is about to log in, so that sessions
+ * forked afterwards find it cached. Used by agrosd.
+ */
+
+void prefetch_config (char* username, uid_t uid, gid_t gid, const gid_t* groups, int ngroups){
+    conf_prefetch_profile (CONFIG_FILE, username, uid, gid, groups, ngroups);
+}
+
+/*
+ * Frees what load_config() allocated in config.
+ */
+
+void config_free (config_t* config){
+    free (config->welcome_message);
+    free (config->allowed_list);
+    free (config->forbidden_list);
+    free (config->allow_args);
+    free (config->deny_args);
+    free (config->redirect_paths);
+    allowlist_free (config->allowed_matcher);
+    scanner_free (config->forbidden_matcher);
+    argrules_free (config->args_matcher);
+    governor_free (config->limits);
+    free (config->cacheable);
+    free (config->record_dir);
+    free (config->profile);
+    free (config->audit_file);
+    free (config->audit_spill);
+    config->welcome_message = NULL;
+    config->allowed_list = NULL;
+    config->allowed_matcher = NULL;
+    config->forbidden_list = NULL;
+    config->forbidden_matcher = NULL;
+    config->allow_args = NULL;
+    config->deny_args = NULL;
+    config->args_matcher = NULL;
+    config->redirect_paths = NULL;
+    config->limits = NULL;
+    config->cacheable = NULL;
+    config->cacheable_nbr = 0;
+    config->record_dir = NULL;
+    config->profile = NULL;
+    config->audit_file = NULL;
+    config->audit_spill = NULL;
 }
 
 /*
@@ -410,51 +744,71 @@ void set_homedir (char** phomedir){
     *phomedir = pwd->pw_dir;
 }
 
+/*
+ * Counts down the warnings after a forbidden command. When none are left,
+ * the session ends. This runs in the shell itself, never in a child.
+ */
+
 void decrease_warnings (config_t* ag_config){
     if (ag_config->warnings > 0){
         ag_config->warnings--;
         if (ag_config->warnings >= 0)  fprintf (stdout, "Warnings remaining: %d\n", ag_config->warnings);
     }else {
         fprintf (stderr, "Exiting AGROS. The incident will be reported. \n");
-        if (ag_config->loglevel >= 1)    syslog (LOG_NOTICE, "User reached Max warnings. \n");
-        kill (getppid(), SIGTERM);
-        _exit (EXIT_FAILURE);
+        metrics_kick ();
+        if (ag_config->loglevel >= 1)    audit (LOG_NOTICE, "User reached Max warnings. \n");
+        governor_release ();
+        audit_close ();
+        exit (EXIT_FAILURE);
     }
 }
 
 /*
- * This function looks for the '&' character.
- *
+ * A command runs in the background when the line ends with an unquoted
+ * '&', either as a word of its own ("sleep 10 &") or stuck to the last one
+ * ("sleep 10&"). parse_command() takes it off the line; a '&' anywhere
+ * else, quoted or escaped, is an ordinary character, left to the
+ * forbidden list.
  */
 int runs_in_background (command_t* cmd){
-    int i=0;
-    char* position=NULL;
-
-    for (i=0; i<cmd->argc; i++){
-        position = strchr (cmd->argv[i], '&');
-        if (position){
-            *position = '\0';
-            return AG_TRUE;
-        }
-    }
-
-    return AG_FALSE;
+    return cmd->background ? AG_TRUE : AG_FALSE;
 }
 
-/***************************************************************************************************************************
+/*
+ * Readline functionality
+ */
 
-void set_glib_group (char** glib_group, GKeyFile* gkf, char* username, char* key){
-    if (g_key_file_has_group (gkf, username) && g_key_file_has_key(gkf, username, key, NULL)){
-        *glib_group =  username;
-    }else
-        *glib_group = "General";
-}
+/*
+ * Where the history is kept between sessions:
+ * $XDG_STATE_HOME/agros/history or ~/.local/state/agros/history.
+ */
+static const char* history_file_path (void)
+{
+    static char path[PATH_MAX];
+    const char* base = getenv ("XDG_STATE_HOME");
+    int length = 0;
+
+    if (base != NULL && base[0] == '/')
+        length = snprintf (path, sizeof (path), "%s/agros/history", base);
+    else if ((base = getenv ("HOME")) != NULL && base[0] == '/')
+        length = snprintf (path, sizeof (path), "%s/.local/state/agros/history", base);
+    else
+        return NULL;
 
-***************************************************************************************************************************/
+    return length < (int) sizeof (path) ? path : NULL;
+}
 
 /*
- * Readline functionality
+ * Adds a line of the history file to the history list.
  */
+static void load_history_line (const char* line, size_t len)
+{
+    char buf[HISTFILE_LINE_MAX + 1];
+
+    memcpy (buf, line, len);
+    buf[len] = '\0';
+    add_history (buf);
+}
 
 /*
  * Set up autocompletion and history using GNU Readline
@@ -462,17 +816,101 @@ void set_glib_group (char** glib_group, GKeyFile* gkf, char* username, char* key
  */
 void initialize_readline(config_t *config)
 {
+    const char* path = NULL;
+
     /* Can be used for customization in the future */
     rl_readline_name = "AGROS";
 
     /* The function to call before default autocompletion kicks in */
     rl_attempted_completion_function = cmd_completion;
 
-    /* Get a handle to the list of allowed commands and its length
-     * This allows us to autocomplete these as well.
-     */
-    allowed_list = config->allowed_list;
-    allowed_nbr = config->allowed_nbr;
+    set_completion_list (config);
+
+    /* The history is kept to history_size lines, here and in the file */
+    stifle_history (config->history_size);
+    path = history_file_path ();
+    if (config->history_size > 0 && path != NULL){
+        history_file = histfile_open (path, config->history_size, load_history_line);
+        if (history_file == NULL && config->loglevel >= 2)
+            audit (LOG_NOTICE, "Could not open the history file %s: %s.", path, strerror (errno));
+    }
+}
+
+/*
+ * Closes the history file, at the end of an interactive session.
+ */
+void finish_readline (void)
+{
+    histfile_close (history_file);
+    history_file = NULL;
+}
+
+/*
+ * Get a handle to the list of allowed commands. This allows us to
+ * autocomplete these as well. Called again when the policy is reloaded;
+ * the completion index is built again on the next completion.
+ */
+void set_completion_list (config_t* config)
+{
+    completion_config = config;
+    completion_free (completions);
+    completions = NULL;
+}
+
+/*
+ * Where the PATH scan of the completion index is kept:
+ * $XDG_CACHE_HOME/agros/commands or ~/.cache/agros/commands.
+ */
+static const char* completion_cache_file (void)
+{
+    static char path[PATH_MAX];
+    const char* base = getenv ("XDG_CACHE_HOME");
+    int length = 0;
+
+    if (base != NULL && base[0] == '/')
+        length = snprintf (path, sizeof (path), "%s/agros/commands", base);
+    else if ((base = getenv ("HOME")) != NULL && base[0] == '/')
+        length = snprintf (path, sizeof (path), "%s/.cache/agros/commands", base);
+    else
+        return NULL;
+
+    return length < (int) sizeof (path) ? path : NULL;
+}
+
+/*
+ * Builds the completion index: the built-ins of the shell, the plain names
+ * of the allowed list and, if the list has patterns, the commands of PATH
+ * that they allow.
+ */
+static completion_index* build_completions (config_t* config)
+{
+    completion_index* index = completion_new ();
+    int patterns = AG_FALSE;
+    int i = 0;
+
+    if (index == NULL)
+        return NULL;
+
+    for (i=0; i<SHELL_BUILTIN_NBR; i++){
+        if (shell_builtins[i] != NULL && *shell_builtins[i])
+            completion_add (index, shell_builtins[i]);
+    }
+
+    for (i=0; i<config->allowed_nbr; i++){
+        if (config->allowed_list[i][strcspn (config->allowed_list[i], "*?[\\")] == '\0')
+            completion_add (index, config->allowed_list[i]);
+        else
+            patterns = AG_TRUE;
+    }
+
+    if (patterns && exec_paths != NULL)
+        completion_add_path (index, exec_paths, config->allowed_matcher, completion_cache_file ());
+
+    if (completion_build (index) < 0){
+        completion_free (index);
+        return NULL;
+    }
+    return index;
 }
 
 /*
@@ -528,38 +966,26 @@ char *make_completion(char *string)
  */
 char *cmd_generator(const char *text, int state)
 {
-    static int cmd_index;
-    static int allowed_index;
-    static int length;
-
-    char *value = (char *)NULL;
+    static int next;
+    static int last;
 
     /* Prepare a new search for matches */
     if (state == 0) {
-	cmd_index = 0;
-	allowed_index = 0;
-	length = strlen(text);
-    }
-
-    /* Check the list of built-in functions for a match */
-    while (cmd_index < CMD_NBR) {
-	value = my_commands[cmd_index].command_name;
-	cmd_index++;
-	if (strncmp(value, text, length) == 0) {
-	    return make_completion(value);
+	if (completions != NULL && exec_paths != NULL && completion_stale (completions, exec_paths)) {
+	    completion_free (completions);
+	    completions = NULL;
 	}
-    }
+	if (completions == NULL && completion_config != NULL)
+	    completions = build_completions (completion_config);
 
-    /* Check the list of allowed commands for a match */
-    while (allowed_index < allowed_nbr) {
-	value = allowed_list[allowed_index];
-	allowed_index++;
-	if (strncmp(value, text, length) == 0) {
-	    return make_completion(value);
-	}
+	next = last = 0;
+	if (completions != NULL)
+	    last = next + completion_find (completions, text, &next);
     }
 
-    /* No matches were found. */
+    if (next < last)
+	return make_completion ((char *) completion_name (completions, next++));
+
+    /* No more matches. */
     return (char *)NULL;
 }
-
@@ -0,0 +1,513 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * agrosd: hands ready-made AGROS sessions to agros-login.
+ *
+ * A cold login execs agros, which loads glib and readline, resolves the
+ * user through NSS and reads the policy. agrosd does the loading once and
+ * keeps AGROSD_WARM sessions forked in advance, each waiting for a user.
+ * It also caches what NSS says about users (name, gid, groups).
+ *
+ * For each connection, agrosd reads the caller's uid from SO_PEERCRED and
+ * passes the connection, the caller's descriptors and the user to a
+ * waiting session. That session drops to the user's ids, takes the
+ * caller's terminal, directory and environment, and runs like agros would.
+ * Then agrosd forks a new waiting session.
+ *
+ * Run as root, agrosd serves every user. Run as anyone else, it only
+ * serves its own uid.
+ *
+ * Usage: agrosd [-f] [-n warm] [-S socket]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "agros.h"
+#include "agrosd.h"
+#include "trace.h"
+
+#define AGROSD_WARM         4
+#define AGROSD_MAX_WARM     64
+#define AGROSD_MAX_GROUPS   64
+#define AGROSD_NAME_LEN     64
+
+/* Users are looked up again after this many seconds */
+#define AGROSD_USER_TTL     300
+#define AGROSD_USER_CACHE   256
+
+/* A client that doesn't send its request within this time is dropped */
+#define AGROSD_REQUEST_TIMEOUT 2
+
+/* stdin, stdout, stderr, directory and the connection */
+#define AGROSD_HANDOFF_FDS  (AGROSD_CLIENT_FDS + 1)
+
+typedef struct agrosd_user agrosd_user;
+struct agrosd_user{
+    uid_t uid;
+    gid_t gid;
+    int ngroups;
+    gid_t groups[AGROSD_MAX_GROUPS];
+    char name[AGROSD_NAME_LEN];
+    time_t loaded;
+};
+
+/*
+ * What a waiting session receives: the request as the client sent it and
+ * the user agrosd resolved, then the command line and environment.
+ */
+
+typedef struct agrosd_handoff agrosd_handoff;
+struct agrosd_handoff{
+    agrosd_request request;
+    agrosd_user user;
+};
+
+static agrosd_user user_cache[AGROSD_USER_CACHE];
+
+/* The waiting sessions: agrosd's end of a socketpair, -1 when empty */
+static int warm_fds[AGROSD_MAX_WARM];
+static int warm_nbr = AGROSD_WARM;
+
+static int listen_fd = -1;
+
+/* Requests and handoffs are read into this buffer */
+static char message[sizeof (agrosd_handoff) + AGROSD_MAX_DATA];
+
+static void reap_sessions (int sig){
+    int saved_errno = errno;
+
+    (void) sig;
+    while (waitpid (-1, NULL, WNOHANG) > 0)
+        ;
+    errno = saved_errno;
+}
+
+/*
+ * Receives one message into message[] and its descriptors into fds.
+ * Returns the length of the message, or -1 unless exactly nfds
+ * descriptors came with it. Extra descriptors are closed.
+ */
+
+static ssize_t receive (int sock, int* fds, int nfds){
+    union { struct cmsghdr align; char buf[CMSG_SPACE (AGROSD_HANDOFF_FDS * sizeof (int))]; } control;
+    struct msghdr msg;
+    struct cmsghdr* cmsg = NULL;
+    struct iovec iov;
+    ssize_t len = 0;
+    int received = 0, i = 0;
+
+    iov.iov_base = message;
+    iov.iov_len = sizeof (message);
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+
+    do {
+        len = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (len < 0 && errno == EINTR);
+    if (len <= 0)
+        return -1;
+
+    for (cmsg=CMSG_FIRSTHDR (&msg); cmsg; cmsg=CMSG_NXTHDR (&msg, cmsg)){
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        for (i=0; i<(int) ((cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int)); i++){
+            int fd = ((int*) CMSG_DATA (cmsg))[i];
+            if (received < nfds)
+                fds[received++] = fd;
+            else
+                close (fd);
+        }
+    }
+
+    if (received != nfds || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))){
+        for (i=0; i<received; i++)
+            close (fds[i]);
+        return -1;
+    }
+    return len;
+}
+
+static void reply (int sock, int type, int value){
+    agrosd_reply r;
+
+    r.type = type;
+    r.value = value;
+    send (sock, &r, sizeof (r), MSG_NOSIGNAL);
+}
+
+/*
+ * The waiting session. Blocks until agrosd hands it a user, becomes that
+ * user's session and never returns.
+ */
+
+static void serve (int pool_fd){
+    agrosd_handoff* handoff = (agrosd_handoff*) message;
+    int fds[AGROSD_HANDOFF_FDS];
+    char cwd[4096];
+    char* command = NULL;
+    char* env = NULL;
+    char* end = NULL;
+    int status = 0;
+    int i = 0;
+
+    if (receive (pool_fd, fds, AGROSD_HANDOFF_FDS) < 0)
+        _exit (EXIT_SUCCESS);
+    close (pool_fd);
+
+    /* The session is the leader of its own group: agros-login forwards
+       signals to the whole group, like a terminal would */
+    setsid ();
+
+    for (i=0; i<3; i++){
+        dup2 (fds[i], i);
+        close (fds[i]);
+    }
+    if (fchdir (fds[3]) < 0)
+        _exit (EXIT_FAILURE);
+    close (fds[3]);
+
+    if (geteuid () == 0){
+        if (setgroups (handoff->user.ngroups, handoff->user.groups) < 0
+            || setgid (handoff->user.gid) < 0 || setuid (handoff->user.uid) < 0)
+            _exit (EXIT_FAILURE);
+    }
+    if (getuid () != handoff->user.uid || geteuid () != handoff->user.uid)
+        _exit (EXIT_FAILURE);
+
+    /* The environment of the login. The strings stay in message[] */
+    command = message + sizeof (agrosd_handoff);
+    env = command + handoff->request.command_len;
+    end = env + handoff->request.env_len;
+    clearenv ();
+    for (; env < end; env += strlen (env) + 1){
+        if (strchr (env, '=') != NULL)
+            putenv (env);
+    }
+    if (getcwd (cwd, sizeof (cwd)) != NULL)
+        setenv ("PWD", cwd, 1);
+    trace_open ();
+
+    reply (fds[4], AGROSD_STARTED, getpid ());
+    status = run_session (handoff->user.name,
+                          handoff->request.mode == AGROSD_COMMAND ? command : NULL,
+                          handoff->request.mode == AGROSD_SCRIPT);
+    reply (fds[4], AGROSD_EXITED, status);
+    exit (status);
+}
+
+/*
+ * Forks a waiting session into slot. Returns -1 on failure.
+ */
+
+static int fork_warm (int slot){
+    int pair[2];
+    pid_t pid = 0;
+    int i = 0;
+
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0)
+        return -1;
+
+    pid = fork ();
+    if (pid < 0){
+        close (pair[0]);
+        close (pair[1]);
+        return -1;
+    }
+
+    if (pid == 0){
+        signal (SIGCHLD, SIG_DFL);
+        close (listen_fd);
+        close (pair[0]);
+        for (i=0; i<warm_nbr; i++){
+            if (warm_fds[i] >= 0)
+                close (warm_fds[i]);
+        }
+        serve (pair[1]);
+    }
+
+    close (pair[1]);
+    warm_fds[slot] = pair[0];
+    return 0;
+}
+
+/*
+ * Returns what NSS says about uid, from the cache when it's fresh enough.
+ * A user in more than AGROSD_MAX_GROUPS groups isn't served: a session
+ * missing some of them would miss what their [@group] sections forbid,
+ * and the client runs agros itself, which reads them all.
+ */
+
+static agrosd_user* lookup_user (uid_t uid){
+    agrosd_user* user = NULL;
+    agrosd_user* oldest = &user_cache[0];
+    struct passwd pwd;
+    struct passwd* found = NULL;
+    char buf[4096];
+    time_t now = time (NULL);
+    int ngroups = AGROSD_MAX_GROUPS;
+    int i = 0;
+
+    for (i=0; i<AGROSD_USER_CACHE; i++){
+        if (user_cache[i].loaded != 0 && user_cache[i].uid == uid){
+            user = &user_cache[i];
+            break;
+        }
+        if (user_cache[i].loaded < oldest->loaded)
+            oldest = &user_cache[i];
+    }
+    if (user != NULL && now - user->loaded < AGROSD_USER_TTL)
+        return user;
+    if (user == NULL)
+        user = oldest;
+
+    if (getpwuid_r (uid, &pwd, buf, sizeof (buf), &found) != 0 || found == NULL
+        || strlen (pwd.pw_name) >= AGROSD_NAME_LEN){
+        syslog (LOG_NOTICE, "Unknown uid %d.", (int) uid);
+        user->loaded = 0;
+        return NULL;
+    }
+
+    user->uid = uid;
+    user->gid = pwd.pw_gid;
+    strcpy (user->name, pwd.pw_name);
+
+    if (getgrouplist (pwd.pw_name, pwd.pw_gid, user->groups, &ngroups) < 0){
+        syslog (LOG_NOTICE, "Not serving %s: %d groups, more than %d.", pwd.pw_name, ngroups, AGROSD_MAX_GROUPS);
+        user->loaded = 0;
+        return NULL;
+    }
+    user->ngroups = ngroups;
+    user->loaded = now;
+    return user;
+}
+
+/*
+ * Checks a request read into message[]. Returns 0 if it is well formed.
+ */
+
+static int check_request (ssize_t len){
+    agrosd_request* request = (agrosd_request*) message;
+    char* data = message + sizeof (agrosd_request);
+
+    if (len < (ssize_t) sizeof (agrosd_request) || request->magic != AGROSD_MAGIC
+        || request->version != AGROSD_VERSION)
+        return -1;
+    if (request->mode < AGROSD_INTERACTIVE || request->mode > AGROSD_SCRIPT)
+        return -1;
+    if (request->command_len > AGROSD_MAX_DATA || request->env_len > AGROSD_MAX_DATA
+        || len != (ssize_t) (sizeof (agrosd_request) + request->command_len + request->env_len))
+        return -1;
+    if ((request->mode == AGROSD_COMMAND) != (request->command_len > 0))
+        return -1;
+    if (request->command_len > 0 && data[request->command_len - 1] != '\0')
+        return -1;
+    if (request->env_len > 0 && data[request->command_len + request->env_len - 1] != '\0')
+        return -1;
+    return 0;
+}
+
+/*
+ * Passes a connection to a waiting session. fds holds the client's
+ * descriptors followed by the connection.
+ */
+
+static int hand_off (agrosd_user* user, ssize_t len, int* fds){
+    union { struct cmsghdr align; char buf[CMSG_SPACE (AGROSD_HANDOFF_FDS * sizeof (int))]; } control;
+    agrosd_handoff handoff;
+    struct msghdr msg;
+    struct cmsghdr* cmsg = NULL;
+    struct iovec iov[2];
+    int slot = 0;
+
+    memcpy (&handoff.request, message, sizeof (agrosd_request));
+    handoff.user = *user;
+
+    iov[0].iov_base = &handoff;
+    iov[0].iov_len = sizeof (handoff);
+    iov[1].iov_base = message + sizeof (agrosd_request);
+    iov[1].iov_len = len - sizeof (agrosd_request);
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (AGROSD_HANDOFF_FDS * sizeof (int));
+    memcpy (CMSG_DATA (cmsg), fds, AGROSD_HANDOFF_FDS * sizeof (int));
+
+    /* A session that died while waiting is replaced, and the next one tried */
+    for (slot=0; slot<warm_nbr; slot++){
+        if (warm_fds[slot] < 0 && fork_warm (slot) < 0)
+            continue;
+        if (sendmsg (warm_fds[slot], &msg, MSG_NOSIGNAL) >= 0){
+            close (warm_fds[slot]);
+            warm_fds[slot] = -1;
+            return slot;
+        }
+        close (warm_fds[slot]);
+        warm_fds[slot] = -1;
+    }
+    return -1;
+}
+
+static void accept_client (void){
+    struct timeval timeout = { AGROSD_REQUEST_TIMEOUT, 0 };
+    struct ucred cred;
+    socklen_t cred_len = sizeof (cred);
+    agrosd_user* user = NULL;
+    int fds[AGROSD_HANDOFF_FDS];
+    ssize_t len = 0;
+    int conn = -1;
+    int slot = -1;
+    int i = 0;
+
+    conn = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0)
+        return;
+
+    if (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0){
+        close (conn);
+        return;
+    }
+    if (geteuid () != 0 && cred.uid != geteuid ()){
+        syslog (LOG_NOTICE, "Refusing uid %d: agrosd only serves uid %d.", (int) cred.uid, (int) geteuid ());
+        close (conn);
+        return;
+    }
+
+    setsockopt (conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    len = receive (conn, fds, AGROSD_CLIENT_FDS);
+    if (len < 0){
+        close (conn);
+        return;
+    }
+    fds[AGROSD_CLIENT_FDS] = conn;
+
+    if (check_request (len) < 0)
+        syslog (LOG_NOTICE, "Malformed request from uid %d.", (int) cred.uid);
+    else if ((user = lookup_user (cred.uid)) != NULL)
+        slot = hand_off (user, len, fds);
+
+    /* The session has its own copies now, or the client runs agros itself */
+    for (i=0; i<AGROSD_HANDOFF_FDS; i++)
+        close (fds[i]);
+
+    /* The next sessions are forked with this user's profile resolved: the
+       user's next login skips reading the groups and drop-in files */
+    if (slot >= 0)
+        prefetch_config (user->name, user->uid, user->gid, user->groups, user->ngroups);
+
+    if (slot >= 0 && fork_warm (slot) < 0)
+        syslog (LOG_ERR, "Could not fork a waiting session: %s.", strerror (errno));
+}
+
+int main (int argc, char** argv){
+    const char* path = AGROSD_SOCKET;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int foreground = 0;
+    int opt = 0;
+    int i = 0;
+
+    while ((opt = getopt (argc, argv, "fn:S:")) != -1){
+        switch (opt){
+            case 'f':
+                foreground = 1;
+                break;
+            case 'n':
+                warm_nbr = atoi (optarg);
+                break;
+            case 'S':
+                path = optarg;
+                break;
+            default:
+                fprintf (stderr, "usage: %s [-f] [-n warm] [-S socket]\n", argv[0]);
+                return AG_STATUS_USAGE;
+        }
+    }
+    if (warm_nbr < 1 || warm_nbr > AGROSD_MAX_WARM){
+        fprintf (stderr, "agrosd: between 1 and %d waiting sessions\n", AGROSD_MAX_WARM);
+        return AG_STATUS_USAGE;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (addr.sun_path)){
+        fprintf (stderr, "agrosd: socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy (addr.sun_path, path);
+
+    listen_fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink (path);
+    if (listen_fd < 0 || bind (listen_fd, (struct sockaddr*) &addr, sizeof (addr)) < 0
+        || chmod (path, 0666) < 0 || listen (listen_fd, 128) < 0){
+        fprintf (stderr, "agrosd: could not listen on %s: %s\n", path, strerror (errno));
+        return EXIT_FAILURE;
+    }
+
+    if (!foreground && daemon (0, 0) < 0){
+        fprintf (stderr, "agrosd: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+
+    openlog ("agrosd", LOG_PID, LOG_DAEMON);
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = reap_sessions;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset (&sa.sa_mask);
+    sigaction (SIGCHLD, &sa, NULL);
+
+    for (i=0; i<AGROSD_MAX_WARM; i++)
+        warm_fds[i] = -1;
+    for (i=0; i<warm_nbr; i++){
+        if (fork_warm (i) < 0)
+            syslog (LOG_ERR, "Could not fork a waiting session: %s.", strerror (errno));
+    }
+
+    syslog (LOG_NOTICE, "Listening on %s with %d waiting sessions.", path, warm_nbr);
+    for (;;)
+        accept_client ();
+}
@@ -0,0 +1,243 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include "allowlist.h"
+
+/*
+ * A trie node. Children are kept as a linked list of siblings; the alphabet
+ * of command names is small so the walk stays cheap. Node 0 is the root.
+ */
+
+typedef struct trie_node trie_node;
+struct trie_node{
+    int first_child;
+    int next_sibling;
+    unsigned char c;
+    char terminal;
+};
+
+struct allowlist{
+    int allow_all;
+
+    /* Exact names: open addressing, size is a power of 2 */
+    const char** names;
+    uint32_t* hashes;
+    uint32_t mask;
+
+    /* Prefix patterns */
+    trie_node* nodes;
+    int node_nbr;
+    int node_cap;
+
+    /* Every other glob */
+    const char** globs;
+    int glob_nbr;
+
+    /* Copies of every pattern, so the list doesn't depend on the config */
+    char* strings;
+};
+
+static uint32_t hash_name (const char* name){
+    uint32_t h = 2166136261U;
+    while (*name){
+        h ^= (unsigned char) *name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ * Returns the child of node labelled c, or -1.
+ */
+
+static int trie_child (const allowlist* list, int node, unsigned char c){
+    int child = list->nodes[node].first_child;
+    while (child >= 0 && list->nodes[child].c != c)
+        child = list->nodes[child].next_sibling;
+    return child;
+}
+
+static int trie_insert (allowlist* list, const char* prefix, size_t len){
+    trie_node* nodes = NULL;
+    int node = 0, child = 0;
+    size_t i = 0;
+
+    for (i=0; i<len; i++){
+        child = trie_child (list, node, (unsigned char) prefix[i]);
+        if (child < 0){
+            if (list->node_nbr == list->node_cap){
+                nodes = (trie_node*) realloc (list->nodes, 2 * list->node_cap * sizeof (trie_node));
+                if (nodes == NULL)
+                    return -1;
+                list->nodes = nodes;
+                list->node_cap *= 2;
+            }
+            child = list->node_nbr++;
+            list->nodes[child].c = (unsigned char) prefix[i];
+            list->nodes[child].terminal = 0;
+            list->nodes[child].first_child = -1;
+            list->nodes[child].next_sibling = list->nodes[node].first_child;
+            list->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    list->nodes[node].terminal = 1;
+    return 0;
+}
+
+static void hash_insert (allowlist* list, const char* name){
+    uint32_t h = hash_name (name);
+    uint32_t slot = h & list->mask;
+
+    while (list->names[slot] != NULL){
+        if (list->hashes[slot] == h && !strcmp (list->names[slot], name))
+            return;
+        slot = (slot + 1) & list->mask;
+    }
+    list->names[slot] = name;
+    list->hashes[slot] = h;
+}
+
+/*
+ * A pattern is a prefix pattern if its only special character is a
+ * trailing '*'.
+ */
+
+static int is_prefix_pattern (const char* pattern, size_t len){
+    return len > 1 && pattern[len-1] == '*' && strcspn (pattern, "*?[\\") == len-1;
+}
+
+static int is_plain_name (const char* pattern){
+    return pattern[strcspn (pattern, "*?[\\")] == '\0';
+}
+
+/*
+ * Builds a matcher out of the patterns of the allowed list.
+ * Returns NULL if memory runs out.
+ */
+
+allowlist* allowlist_compile (char** patterns, int count){
+    allowlist* list = NULL;
+    size_t size = 0, len = 0;
+    uint32_t slots = 16;
+    char* cursor = NULL;
+    int i = 0;
+
+    list = (allowlist*) calloc (1, sizeof (allowlist));
+    if (list == NULL)
+        return NULL;
+
+    for (i=0; i<count; i++)
+        size += strlen (patterns[i]) + 1;
+    while (slots < 2 * (uint32_t) count)
+        slots *= 2;
+
+    list->strings = (char*) malloc (size ? size : 1);
+    list->names = (const char**) calloc (slots, sizeof (char*));
+    list->hashes = (uint32_t*) calloc (slots, sizeof (uint32_t));
+    list->globs = (const char**) malloc ((count ? count : 1) * sizeof (char*));
+    list->nodes = (trie_node*) malloc (16 * sizeof (trie_node));
+    if (!list->strings || !list->names || !list->hashes || !list->globs || !list->nodes){
+        allowlist_free (list);
+        return NULL;
+    }
+    list->mask = slots - 1;
+    list->node_cap = 16;
+    list->node_nbr = 1;
+    list->nodes[0].first_child = -1;
+    list->nodes[0].next_sibling = -1;
+    list->nodes[0].terminal = 0;
+
+    cursor = list->strings;
+    for (i=0; i<count; i++){
+        len = strlen (patterns[i]);
+        memcpy (cursor, patterns[i], len+1);
+
+        if (!strcmp (cursor, "*"))
+            list->allow_all = 1;
+        else if (is_plain_name (cursor))
+            hash_insert (list, cursor);
+        else if (is_prefix_pattern (cursor, len)){
+            if (trie_insert (list, cursor, len-1) < 0){
+                allowlist_free (list);
+                return NULL;
+            }
+        }else
+            list->globs[list->glob_nbr++] = cursor;
+
+        cursor += len+1;
+    }
+
+    return list;
+}
+
+/*
+ * Returns 1 if name is allowed by the list, 0 otherwise.
+ */
+
+int allowlist_match (const allowlist* list, const char* name){
+    uint32_t h = 0, slot = 0;
+    const char* c = NULL;
+    int node = 0, i = 0;
+
+    if (list->allow_all)
+        return 1;
+
+    h = hash_name (name);
+    slot = h & list->mask;
+    while (list->names[slot] != NULL){
+        if (list->hashes[slot] == h && !strcmp (list->names[slot], name))
+            return 1;
+        slot = (slot + 1) & list->mask;
+    }
+
+    /* Walk down the trie. Once a terminal node is passed, the rest of the
+       name is what the '*' matched, and it must not contain a '/'. */
+    for (c = name; *c && node >= 0; c++){
+        node = trie_child (list, node, (unsigned char) *c);
+        if (node >= 0 && list->nodes[node].terminal && strchr (c+1, '/') == NULL)
+            return 1;
+    }
+
+    for (i=0; i<list->glob_nbr; i++){
+        if (fnmatch (list->globs[i], name, FNM_PATHNAME) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+void allowlist_free (allowlist* list){
+    if (list == NULL)
+        return;
+    free (list->names);
+    free (list->hashes);
+    free (list->nodes);
+    free (list->globs);
+    free (list->strings);
+    free (list);
+}
@@ -0,0 +1,542 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "argrules.h"
+
+/* Past this many states, a profile's rules are refused as too complex */
+#define ARGRULES_MAX_STATES (1 << 20)
+
+/*
+ * The rules are first built into one NFA, Thompson style: each state
+ * either reads a byte and goes to out, or goes to out and out2 without
+ * reading anything.
+ */
+
+#define NFA_BYTE    0       /* reads byte */
+#define NFA_WORD    1       /* reads any byte but '\0' */
+#define NFA_SPLIT   2       /* goes to out and out2 (if >= 0) */
+#define NFA_MATCH   3       /* end of a rule */
+
+/* Flags of NFA and DFA states */
+#define ARG_RESTRICT    1   /* after the command name of an allow_args rule */
+#define ARG_ALLOW       2   /* an allow_args rule matched */
+#define ARG_DENY        4   /* a deny_args rule matched */
+
+typedef struct nfa_state nfa_state;
+struct nfa_state{
+    unsigned char kind;
+    unsigned char byte;
+    unsigned char flags;
+    int out;
+    int out2;
+};
+
+typedef struct nfa nfa;
+struct nfa{
+    nfa_state* states;
+    int state_nbr;
+    int state_size;
+    int* starts;
+    int start_nbr;
+};
+
+/*
+ * The DFA reads byte classes: bytes that appear in no rule share class 0,
+ * '\0' is class 1 and every other byte used has a class of its own.
+ * State 0 is the dead state: no rule can match any more.
+ */
+
+struct argrules{
+    unsigned char classes[256];
+    int class_nbr;
+    uint32_t* next;         /* next[state * class_nbr + class] */
+    unsigned char* flags;
+    uint32_t start;
+    int state_nbr;
+};
+
+static int nfa_add (nfa* n, int kind, unsigned char byte, int out, int out2){
+    if (n->state_nbr == n->state_size){
+        int size = n->state_size ? 2 * n->state_size : 256;
+        nfa_state* states = (nfa_state*) realloc (n->states, size * sizeof (nfa_state));
+        if (states == NULL)
+            return -1;
+        n->states = states;
+        n->state_size = size;
+    }
+    n->states[n->state_nbr].kind = kind;
+    n->states[n->state_nbr].byte = byte;
+    n->states[n->state_nbr].flags = 0;
+    n->states[n->state_nbr].out = out;
+    n->states[n->state_nbr].out2 = out2;
+    return n->state_nbr++;
+}
+
+/*
+ * Adds the states of one word of a rule. Each of them leads to the state
+ * added after it, so the word ends where the next one starts.
+ */
+
+static int nfa_add_word (nfa* n, const char* word, size_t length){
+    int s = 0;
+    size_t i = 0;
+
+    /* "**": any number of whole words */
+    if (length == 2 && word[0] == '*' && word[1] == '*'){
+        s = n->state_nbr;
+        if (nfa_add (n, NFA_SPLIT, 0, s + 1, s + 4) < 0     /* another word, or done */
+            || nfa_add (n, NFA_SPLIT, 0, s + 2, s + 3) < 0  /* in the word */
+            || nfa_add (n, NFA_WORD, 0, s + 1, -1) < 0
+            || nfa_add (n, NFA_BYTE, '\0', s, -1) < 0)
+            return -1;
+        return 0;
+    }
+
+    /* "<unit>" is "*" with a name */
+    if (length >= 2 && word[0] == '<' && word[length-1] == '>'){
+        word = "*";
+        length = 1;
+    }
+
+    for (i=0; i<length; i++){
+        s = n->state_nbr;
+        if (word[i] == '*'){
+            if (nfa_add (n, NFA_SPLIT, 0, s + 1, s + 2) < 0 || nfa_add (n, NFA_WORD, 0, s, -1) < 0)
+                return -1;
+        }else if (word[i] == '?'){
+            if (nfa_add (n, NFA_WORD, 0, s + 1, -1) < 0)
+                return -1;
+        }else {
+            if (word[i] == '\\' && i + 1 < length)
+                i++;
+            if (nfa_add (n, NFA_BYTE, (unsigned char) word[i], s + 1, -1) < 0)
+                return -1;
+        }
+    }
+
+    s = n->state_nbr;
+    return nfa_add (n, NFA_BYTE, '\0', s + 1, -1) < 0 ? -1 : 0;
+}
+
+static int nfa_add_rule (nfa* n, const char* rule, int flag){
+    const char* p = rule;
+    size_t length = 0;
+    int words = 0, mark = 0;
+    int* starts = NULL;
+
+    starts = (int*) realloc (n->starts, (n->start_nbr + 1) * sizeof (int));
+    if (starts == NULL)
+        return -1;
+    n->starts = starts;
+    n->starts[n->start_nbr++] = n->state_nbr;
+
+    while (1){
+        p += strspn (p, " \t");
+        if (*p == '\0')
+            break;
+        for (length=0; p[length] && p[length] != ' ' && p[length] != '\t'; length++){
+            if (p[length] == '\\' && p[length+1])
+                length++;
+        }
+        if (nfa_add_word (n, p, length) < 0)
+            return -1;
+        p += length;
+
+        /* Commands that have allow_args rules are restricted to them */
+        if (++words == 1 && flag == ARG_ALLOW){
+            mark = nfa_add (n, NFA_SPLIT, 0, n->state_nbr + 1, -1);
+            if (mark < 0)
+                return -1;
+            n->states[mark].flags = ARG_RESTRICT;
+        }
+    }
+
+    if (words == 0){
+        /* An empty rule matches nothing */
+        n->start_nbr--;
+        return 0;
+    }
+
+    mark = nfa_add (n, NFA_MATCH, 0, -1, -1);
+    if (mark < 0)
+        return -1;
+    n->states[mark].flags = flag;
+    return 0;
+}
+
+/*
+ * Subset construction. A DFA state is a sorted set of NFA states, closed
+ * under the SPLIT moves; sets are kept in one array and found again
+ * through a hash table.
+ */
+
+typedef struct subsets subsets;
+struct subsets{
+    int* members;
+    size_t member_nbr;
+    size_t member_size;
+    size_t* first;          /* first[d]: where the set of DFA state d starts */
+    int* hash;              /* DFA state + 1, 0 for empty slots */
+    uint32_t hash_mask;
+    int rows;               /* DFA states there is room for */
+};
+
+static int compare_int (const void* a, const void* b){
+    return *(const int*) a - *(const int*) b;
+}
+
+static uint32_t hash_set (const int* set, int count){
+    uint32_t h = 2166136261U;
+    int i = 0;
+    for (i=0; i<count; i++){
+        h ^= (uint32_t) set[i];
+        h *= 16777619U;
+    }
+    return h ^ (h >> 15);
+}
+
+/*
+ * Closes set (count states) under SPLIT moves, in place; set must have
+ * room for every NFA state. seen is a scratch array, stamped with stamp.
+ * Returns the size of the closed, sorted set.
+ */
+
+static int close_set (const nfa* n, int* set, int count, int* seen, int stamp){
+    int i = 0, size = 0, out = 0;
+    const nfa_state* s = NULL;
+
+    for (i=0; i<count; i++){
+        if (seen[set[i]] != stamp){
+            seen[set[i]] = stamp;
+            set[size++] = set[i];
+        }
+    }
+    for (i=0; i<size; i++){
+        s = &n->states[set[i]];
+        if (s->kind != NFA_SPLIT)
+            continue;
+        out = s->out;
+        if (out >= 0 && seen[out] != stamp){
+            seen[out] = stamp;
+            set[size++] = out;
+        }
+        out = s->out2;
+        if (out >= 0 && seen[out] != stamp){
+            seen[out] = stamp;
+            set[size++] = out;
+        }
+    }
+    if (size > 1)
+        qsort (set, size, sizeof (int), compare_int);
+    return size;
+}
+
+/*
+ * Makes room for DFA states up to twice the current number.
+ */
+
+static int grow_dfa (argrules* rules, subsets* sub){
+    int rows = sub->rows ? 2 * sub->rows : 1024;
+    uint32_t mask = 2 * rows - 1;
+    uint32_t* next = NULL;
+    unsigned char* flags = NULL;
+    size_t* first = NULL;
+    int* hash = NULL;
+    uint32_t slot = 0;
+    int d = 0;
+
+    next = (uint32_t*) realloc (rules->next, (size_t) rows * rules->class_nbr * sizeof (uint32_t));
+    if (next == NULL)
+        return -1;
+    rules->next = next;
+    flags = (unsigned char*) realloc (rules->flags, rows);
+    if (flags == NULL)
+        return -1;
+    rules->flags = flags;
+    first = (size_t*) realloc (sub->first, (rows + 1) * sizeof (size_t));
+    if (first == NULL)
+        return -1;
+    sub->first = first;
+    hash = (int*) calloc (mask + 1, sizeof (int));
+    if (hash == NULL)
+        return -1;
+
+    for (d=0; d<rules->state_nbr; d++){
+        slot = hash_set (sub->members + sub->first[d], sub->first[d+1] - sub->first[d]) & mask;
+        while (hash[slot])
+            slot = (slot + 1) & mask;
+        hash[slot] = d + 1;
+    }
+    free (sub->hash);
+    sub->hash = hash;
+    sub->hash_mask = mask;
+    sub->rows = rows;
+    return 0;
+}
+
+/*
+ * Returns the DFA state of set, adding it if it is new, or -1.
+ */
+
+static int find_subset (argrules* rules, subsets* sub, const nfa* n, const int* set, int count){
+    uint32_t slot = 0;
+    unsigned char flags = 0;
+    int d = 0, i = 0;
+
+    slot = hash_set (set, count) & sub->hash_mask;
+    while (sub->hash[slot]){
+        d = sub->hash[slot] - 1;
+        if ((int) (sub->first[d+1] - sub->first[d]) == count
+            && !memcmp (sub->members + sub->first[d], set, count * sizeof (int)))
+            return d;
+        slot = (slot + 1) & sub->hash_mask;
+    }
+
+    if (rules->state_nbr == ARGRULES_MAX_STATES)
+        return -1;
+    if (rules->state_nbr == sub->rows){
+        if (grow_dfa (rules, sub) < 0)
+            return -1;
+        slot = hash_set (set, count) & sub->hash_mask;
+        while (sub->hash[slot])
+            slot = (slot + 1) & sub->hash_mask;
+    }
+
+    if (sub->member_nbr + count > sub->member_size){
+        size_t size = sub->member_size ? sub->member_size : 1024;
+        int* members = NULL;
+        while (size < sub->member_nbr + count)
+            size *= 2;
+        members = (int*) realloc (sub->members, size * sizeof (int));
+        if (members == NULL)
+            return -1;
+        sub->members = members;
+        sub->member_size = size;
+    }
+    memcpy (sub->members + sub->member_nbr, set, count * sizeof (int));
+    sub->member_nbr += count;
+
+    d = rules->state_nbr++;
+    sub->first[d+1] = sub->member_nbr;
+    sub->hash[slot] = d + 1;
+
+    for (i=0; i<count; i++)
+        flags |= n->states[set[i]].flags;
+    rules->flags[d] = flags;
+    return d;
+}
+
+/*
+ * Builds the DFA, one row of transitions per state. In a row, the classes
+ * that no NFA state of the set reads by name all go to the same state:
+ * the one its NFA_WORD states lead to, or the dead state. Only the other
+ * classes need a set of their own.
+ */
+
+static int build_dfa (argrules* rules, const nfa* n){
+    subsets sub;
+    int* set = NULL;
+    int* seen = NULL;
+    int* marked = NULL;
+    int* touched = NULL;
+    uint32_t* row = NULL;
+    const nfa_state* s = NULL;
+    int stamp = 0, count = 0, words = 0, touched_nbr = 0, status = -1;
+    int d = 0, c = 0, i = 0, j = 0, target = 0, other = 0;
+
+    memset (&sub, 0, sizeof (sub));
+    set = (int*) malloc ((n->state_nbr + 1) * sizeof (int));
+    seen = (int*) calloc (n->state_nbr + 1, sizeof (int));
+    marked = (int*) calloc (rules->class_nbr, sizeof (int));
+    touched = (int*) malloc (rules->class_nbr * sizeof (int));
+    if (!set || !seen || !marked || !touched || grow_dfa (rules, &sub) < 0)
+        goto out;
+    sub.first[0] = 0;
+
+    /* The dead state, then the start */
+    if (find_subset (rules, &sub, n, set, 0) != 0)
+        goto out;
+    memcpy (set, n->starts, n->start_nbr * sizeof (int));
+    count = close_set (n, set, n->start_nbr, seen, ++stamp);
+    if ((int) (rules->start = find_subset (rules, &sub, n, set, count)) < 0)
+        goto out;
+
+    /* States are numbered in the order they're found, so the loop reaches
+       every one of them */
+    for (d=0; d<rules->state_nbr; d++){
+        /* Where the bytes no state of d names go */
+        words = 0;
+        for (i=sub.first[d]; i<(int) sub.first[d+1]; i++){
+            s = &n->states[sub.members[i]];
+            if (s->kind == NFA_WORD)
+                set[words++] = s->out;
+        }
+        other = 0;
+        if (words > 0){
+            count = close_set (n, set, words, seen, ++stamp);
+            other = find_subset (rules, &sub, n, set, count);
+            if (other < 0)
+                goto out;
+        }
+
+        /* find_subset() may have moved the table */
+        row = rules->next + (size_t) d * rules->class_nbr;
+        for (c=0; c<rules->class_nbr; c++)
+            row[c] = c == 1 ? 0 : other;
+
+        /* The classes read by name */
+        touched_nbr = 0;
+        stamp++;
+        for (i=sub.first[d]; i<(int) sub.first[d+1]; i++){
+            s = &n->states[sub.members[i]];
+            c = rules->classes[s->byte];
+            if (s->kind == NFA_BYTE && marked[c] != stamp){
+                marked[c] = stamp;
+                touched[touched_nbr++] = c;
+            }
+        }
+
+        for (j=0; j<touched_nbr; j++){
+            c = touched[j];
+            count = 0;
+            for (i=sub.first[d]; i<(int) sub.first[d+1]; i++){
+                s = &n->states[sub.members[i]];
+                if ((s->kind == NFA_BYTE && rules->classes[s->byte] == c) || (s->kind == NFA_WORD && c != 1))
+                    set[count++] = s->out;
+            }
+            count = close_set (n, set, count, seen, ++stamp);
+            target = find_subset (rules, &sub, n, set, count);
+            if (target < 0)
+                goto out;
+            rules->next[(size_t) d * rules->class_nbr + c] = target;
+        }
+    }
+    status = 0;
+
+out:
+    free (sub.members);
+    free (sub.first);
+    free (sub.hash);
+    free (set);
+    free (seen);
+    free (marked);
+    free (touched);
+    return status;
+}
+
+/*
+ * Compiles the allow_args and deny_args rules of a profile. Returns NULL
+ * if memory is exhausted or the rules need more than ARGRULES_MAX_STATES
+ * states.
+ */
+
+argrules* argrules_compile (char** allow, int allow_nbr, char** deny, int deny_nbr){
+    argrules* rules = (argrules*) calloc (1, sizeof (argrules));
+    nfa n;
+    int i = 0, c = 0;
+
+    if (rules == NULL)
+        return NULL;
+    memset (&n, 0, sizeof (n));
+
+    for (i=0; i<allow_nbr; i++){
+        if (nfa_add_rule (&n, allow[i], ARG_ALLOW) < 0)
+            goto fail;
+    }
+    for (i=0; i<deny_nbr; i++){
+        if (nfa_add_rule (&n, deny[i], ARG_DENY) < 0)
+            goto fail;
+    }
+
+    /* No rule: nothing to check */
+    if (n.start_nbr == 0){
+        free (n.states);
+        free (n.starts);
+        return rules;
+    }
+
+    /* Class 0 for the bytes no rule names, 1 for '\0' */
+    c = 2;
+    rules->classes[0] = 1;
+    for (i=0; i<n.state_nbr; i++){
+        if (n.states[i].kind == NFA_BYTE && n.states[i].byte != '\0' && rules->classes[n.states[i].byte] == 0)
+            rules->classes[n.states[i].byte] = c++;
+    }
+    rules->class_nbr = c;
+
+    if (build_dfa (rules, &n) < 0)
+        goto fail;
+
+    free (n.states);
+    free (n.starts);
+    return rules;
+
+fail:
+    free (n.states);
+    free (n.starts);
+    argrules_free (rules);
+    return NULL;
+}
+
+/*
+ * Returns ARGS_OK if the rules let argv run, ARGS_DENIED otherwise.
+ */
+
+int argrules_check (const argrules* rules, char* const* argv){
+    const unsigned char* p = NULL;
+    uint32_t state = 0;
+    int restricted = 0, i = 0;
+
+    if (rules == NULL || rules->state_nbr == 0)
+        return ARGS_OK;
+
+    state = rules->start;
+    for (i=0; argv[i] != NULL && state != 0; i++){
+        for (p = (const unsigned char*) argv[i]; *p; p++)
+            state = rules->next[(size_t) state * rules->class_nbr + rules->classes[*p]];
+        state = rules->next[(size_t) state * rules->class_nbr + 1];
+        if (i == 0)
+            restricted = rules->flags[state] & ARG_RESTRICT;
+    }
+
+    if (rules->flags[state] & ARG_DENY)
+        return ARGS_DENIED;
+    if (restricted && !(rules->flags[state] & ARG_ALLOW))
+        return ARGS_DENIED;
+    return ARGS_OK;
+}
+
+int argrules_states (const argrules* rules){
+    return rules ? rules->state_nbr : 0;
+}
+
+void argrules_free (argrules* rules){
+    if (rules == NULL)
+        return;
+    free (rules->next);
+    free (rules->flags);
+    free (rules);
+}
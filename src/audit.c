@@ -0,0 +1,346 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <syslog.h>
+#include <pthread.h>
+#include "audit.h"
+
+/* How many records the writer takes from the ring at once */
+#define AUDIT_BATCH 64
+
+/* Room for the timestamp and ident in front of the text, in files */
+#define AUDIT_LINE_LEN (AUDIT_TEXT_LEN + 96)
+
+typedef struct audit_record audit_record;
+struct audit_record{
+    struct timespec time;
+    int priority;
+    char text[AUDIT_TEXT_LEN];
+};
+
+/*
+ * The ring. head and tail only grow: the record i lives in
+ * ring[i % AUDIT_RING_SIZE] and the ring holds head - tail records.
+ */
+
+static audit_record ring[AUDIT_RING_SIZE];
+static unsigned long ring_head = 0;
+static unsigned long ring_tail = 0;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_drained = PTHREAD_COND_INITIALIZER;
+
+static pthread_t writer;
+static int writer_running = 0;
+static int writer_busy = 0;
+static int writer_stopping = 0;
+
+static int audit_opened = 0;
+static char audit_ident[64];
+static int audit_sinks = AUDIT_SYSLOG;
+static int audit_overflow = AUDIT_BLOCK;
+static int file_fd = -1;
+static int spill_fd = -1;
+static char* spill_path = NULL;
+
+/* Records lost or spilled since the writer last said so */
+static unsigned long audit_dropped = 0;
+static unsigned long audit_spilled = 0;
+
+void audit_open (const char* ident){
+    if (audit_opened)
+        return;
+    snprintf (audit_ident, sizeof (audit_ident), "%s", ident ? ident : "agros");
+    openlog (audit_ident, LOG_PID, LOG_USER);
+    atexit (audit_close);
+    audit_opened = 1;
+}
+
+/*
+ * Formats a record the way it is written to files:
+ *   2011-10-01T12:00:00.000000Z agros[1234] user: text
+ */
+
+static int format_line (audit_record* rec, char* buf, size_t size){
+    struct tm tm;
+    int len = 0;
+
+    gmtime_r (&rec->time.tv_sec, &tm);
+    len = snprintf (buf, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ agros[%d] %s: %s\n",
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                    rec->time.tv_nsec / 1000, (int) getpid (), audit_ident, rec->text);
+    return len < (int) size ? len : (int) size - 1;
+}
+
+static void write_all (int fd, const char* buf, size_t len){
+    ssize_t written = 0;
+
+    while (len > 0){
+        written = write (fd, buf, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        buf += written;
+        len -= written;
+    }
+}
+
+/*
+ * Writes records to the sinks, with a note about those that were lost or
+ * spilled. The file gets the whole batch in one write().
+ */
+
+static void write_batch (audit_record* batch, int count, unsigned long dropped, unsigned long spilled){
+    char buf[AUDIT_BATCH * AUDIT_LINE_LEN];
+    audit_record note;
+    size_t len = 0;
+    int i = 0;
+
+    if (audit_sinks & AUDIT_SYSLOG){
+        for (i=0; i<count; i++)
+            syslog (batch[i].priority, "%s", batch[i].text);
+    }
+
+    if ((audit_sinks & AUDIT_FILE) && file_fd >= 0){
+        for (i=0; i<count; i++)
+            len += format_line (&batch[i], buf + len, sizeof (buf) - len);
+        write_all (file_fd, buf, len);
+    }
+
+    if (dropped > 0 || spilled > 0){
+        clock_gettime (CLOCK_REALTIME, &note.time);
+        note.priority = LOG_WARNING;
+        if (dropped > 0)
+            snprintf (note.text, sizeof (note.text), "Audit log overflowed: %lu records dropped.", dropped);
+        else
+            snprintf (note.text, sizeof (note.text), "Audit log overflowed: %lu records spilled to %s.",
+                      spilled, spill_path);
+        write_batch (&note, 1, 0, 0);
+    }
+}
+
+/*
+ * The writer thread: takes up to AUDIT_BATCH records from the ring and
+ * writes them without holding the lock.
+ */
+
+static void* audit_writer (void* arg){
+    audit_record batch[AUDIT_BATCH];
+    unsigned long dropped = 0, spilled = 0;
+    int count = 0;
+
+    (void) arg;
+
+    pthread_mutex_lock (&ring_lock);
+    for (;;){
+        while (ring_head == ring_tail && !writer_stopping && audit_dropped == 0 && audit_spilled == 0)
+            pthread_cond_wait (&ring_not_empty, &ring_lock);
+        if (ring_head == ring_tail && audit_dropped == 0 && audit_spilled == 0)
+            break;
+
+        for (count=0; count<AUDIT_BATCH && ring_tail != ring_head; count++)
+            batch[count] = ring[ring_tail++ % AUDIT_RING_SIZE];
+        dropped = audit_dropped;
+        spilled = audit_spilled;
+        audit_dropped = audit_spilled = 0;
+        writer_busy = 1;
+        pthread_cond_broadcast (&ring_not_full);
+        pthread_mutex_unlock (&ring_lock);
+
+        write_batch (batch, count, dropped, spilled);
+
+        pthread_mutex_lock (&ring_lock);
+        writer_busy = 0;
+        if (ring_head == ring_tail)
+            pthread_cond_broadcast (&ring_drained);
+    }
+    pthread_cond_broadcast (&ring_drained);
+    pthread_mutex_unlock (&ring_lock);
+    return NULL;
+}
+
+/*
+ * Sets the sinks and starts the writer. file and spill are paths, or NULL.
+ * Returns -1 if a file can't be opened; the other sinks are still used,
+ * and audit_start() falls back on syslog if nothing is left.
+ */
+
+int audit_start (int sinks, const char* file, int overflow, const char* spill){
+    sigset_t all, saved;
+    int result = 0;
+
+    if (writer_running)
+        return 0;
+
+    if ((sinks & AUDIT_FILE) && file != NULL)
+        file_fd = open (file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if ((sinks & AUDIT_FILE) && file_fd < 0){
+        sinks &= ~AUDIT_FILE;
+        result = -1;
+    }
+    if (sinks == 0)
+        sinks = AUDIT_SYSLOG;
+
+    if (overflow == AUDIT_SPILL && spill != NULL){
+        spill_fd = open (spill, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        spill_path = strdup (spill);
+    }
+    if (overflow == AUDIT_SPILL && (spill_fd < 0 || spill_path == NULL)){
+        overflow = AUDIT_BLOCK;
+        result = -1;
+    }
+
+    audit_sinks = sinks;
+    audit_overflow = overflow;
+
+    /* The writer takes no signal: SIGCHLD must reach the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &saved);
+    if (pthread_create (&writer, NULL, audit_writer, NULL) == 0)
+        writer_running = 1;
+    else
+        result = -1;
+    pthread_sigmask (SIG_SETMASK, &saved, NULL);
+
+    return result;
+}
+
+/*
+ * Queues a record. Only the formatting and a copy happen here.
+ */
+
+void audit (int priority, const char* format, ...){
+    audit_record rec;
+    char line[AUDIT_LINE_LEN];
+    va_list args;
+    int len = 0;
+
+    clock_gettime (CLOCK_REALTIME, &rec.time);
+    rec.priority = priority;
+    va_start (args, format);
+    vsnprintf (rec.text, sizeof (rec.text), format, args);
+    va_end (args);
+
+    /* One record, one line */
+    len = strlen (rec.text);
+    while (len > 0 && (rec.text[len-1] == '\n' || rec.text[len-1] == ' '))
+        rec.text[--len] = '\0';
+
+    pthread_mutex_lock (&ring_lock);
+
+    if (ring_head - ring_tail == AUDIT_RING_SIZE){
+        /* Nobody drains the ring yet: write it out now */
+        if (!writer_running){
+            pthread_mutex_unlock (&ring_lock);
+            syslog (rec.priority, "%s", rec.text);
+            return;
+        }
+
+        switch (audit_overflow){
+            case AUDIT_DROP:
+                audit_dropped++;
+                pthread_cond_signal (&ring_not_empty);
+                pthread_mutex_unlock (&ring_lock);
+                return;
+
+            case AUDIT_SPILL:
+                audit_spilled++;
+                pthread_cond_signal (&ring_not_empty);
+                pthread_mutex_unlock (&ring_lock);
+                len = format_line (&rec, line, sizeof (line));
+                write_all (spill_fd, line, len);
+                return;
+
+            default:
+                while (ring_head - ring_tail == AUDIT_RING_SIZE)
+                    pthread_cond_wait (&ring_not_full, &ring_lock);
+                break;
+        }
+    }
+
+    ring[ring_head++ % AUDIT_RING_SIZE] = rec;
+    pthread_cond_signal (&ring_not_empty);
+    pthread_mutex_unlock (&ring_lock);
+}
+
+/*
+ * Waits until every queued record has been written.
+ */
+
+void audit_flush (void){
+    pthread_mutex_lock (&ring_lock);
+    while (writer_running && !writer_stopping && (ring_head != ring_tail || writer_busy))
+        pthread_cond_wait (&ring_drained, &ring_lock);
+    pthread_mutex_unlock (&ring_lock);
+}
+
+/*
+ * Writes what is left and stops the writer. Safe to call more than once.
+ */
+
+void audit_close (void){
+    audit_record batch[AUDIT_BATCH];
+    int count = 0;
+
+    if (!audit_opened)
+        return;
+
+    if (writer_running){
+        pthread_mutex_lock (&ring_lock);
+        writer_stopping = 1;
+        pthread_cond_signal (&ring_not_empty);
+        pthread_mutex_unlock (&ring_lock);
+        pthread_join (writer, NULL);
+        writer_running = 0;
+    }
+
+    /* Records of a session that never started the writer */
+    while (ring_tail != ring_head){
+        for (count=0; count<AUDIT_BATCH && ring_tail != ring_head; count++)
+            batch[count] = ring[ring_tail++ % AUDIT_RING_SIZE];
+        write_batch (batch, count, 0, 0);
+    }
+
+    if (file_fd >= 0)
+        close (file_fd);
+    if (spill_fd >= 0)
+        close (spill_fd);
+    file_fd = spill_fd = -1;
+    free (spill_path);
+    spill_path = NULL;
+    closelog ();
+    audit_opened = 0;
+}
@@ -0,0 +1,429 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/wait.h>
+#include "agros.h"
+#include "audit.h"
+#include "builtins.h"
+#include "builtins_hash.h"
+#include "execcache.h"
+#include "jobs.h"
+
+#ifdef AGROS_EMBEDDED
+#include "lineedit.h"
+#else
+#include <readline/history.h>
+#endif
+
+/* The signals "kill" accepts by name */
+static const struct { const char* name; int sig; } signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"TERM", SIGTERM},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}
+};
+
+/*
+ * Converts a status returned by waitpid() into a shell exit status.
+ */
+
+int exit_status (int status){
+    if (WIFEXITED (status))
+        return WEXITSTATUS (status);
+    if (WIFSIGNALED (status))
+        return 128 + WTERMSIG (status);
+    return EXIT_FAILURE;
+}
+
+/*
+ * The built-ins of the shell itself.
+ */
+
+static int builtin_empty (command_t* cmd, config_t* config, int* exiting){
+    (void) cmd; (void) config; (void) exiting;
+    return 0;
+}
+
+static int builtin_exit (command_t* cmd, config_t* config, int* exiting){
+    (void) cmd; (void) config;
+    *exiting = AG_TRUE;
+    return 0;
+}
+
+static int builtin_cd (command_t* cmd, config_t* config, int* exiting){
+    (void) exiting;
+    change_directory (cmd->argv[1], config->loglevel);
+    return 0;
+}
+
+static int builtin_env (command_t* cmd, config_t* config, int* exiting){
+    (void) config; (void) exiting;
+    print_env (cmd->argv[1]);
+    return 0;
+}
+
+static int builtin_help (command_t* cmd, config_t* config, int* exiting){
+    (void) cmd; (void) exiting;
+    print_help (config);
+    return 0;
+}
+
+static int builtin_jobs (command_t* cmd, config_t* config, int* exiting){
+    (void) cmd; (void) config; (void) exiting;
+    jobs_list (stdout);
+    return 0;
+}
+
+/*
+ * Reads a job id, "%n" or "n". Returns 0 if spec isn't one.
+ */
+
+static int parse_job_id (const char* spec){
+    if (*spec == '%')
+        spec++;
+    if (!isdigit ((unsigned char) *spec))
+        return 0;
+    return atoi (spec);
+}
+
+/*
+ * The "wait" built-in: "wait" waits for every job, "wait n" for job n.
+ * Returns the exit status of job n, or 0.
+ */
+
+static int builtin_wait (command_t* cmd, config_t* config, int* exiting){
+    int status = 0;
+    int id = 0;
+
+    (void) config; (void) exiting;
+
+    if (cmd->argc > 1){
+        id = parse_job_id (cmd->argv[1]);
+        if (id == 0){
+            fprintf (stderr, "wait: %s: no such job\n", cmd->argv[1]);
+            return AG_STATUS_NOEXEC;
+        }
+    }
+
+    if (jobs_wait (id, &status) < 0){
+        if (id != 0)
+            fprintf (stderr, "wait: %s: no such job\n", cmd->argv[1]);
+        else
+            fprintf (stderr, "wait: could not wait for the jobs\n");
+        return AG_STATUS_NOEXEC;
+    }
+    return id ? exit_status (status) : 0;
+}
+
+/*
+ * True if "kill" was given a job ("kill %2"). Otherwise it is the system's
+ * kill command, and the policy decides.
+ */
+
+static int names_a_job (command_t* cmd){
+    int i = 0;
+
+    for (i=1; i<cmd->argc; i++){
+        if (cmd->argv[i][0] == '%')
+            return AG_TRUE;
+    }
+    return AG_FALSE;
+}
+
+/*
+ * Reads "-9", "-KILL" or "-SIGKILL". Returns 0 if spec isn't a signal.
+ */
+
+static int parse_signal (const char* spec){
+    size_t i = 0;
+
+    if (isdigit ((unsigned char) *spec))
+        return atoi (spec);
+    if (!strncmp (spec, "SIG", 3))
+        spec += 3;
+    for (i=0; i<sizeof (signal_names) / sizeof (signal_names[0]); i++){
+        if (!strcmp (spec, signal_names[i].name))
+            return signal_names[i].sig;
+    }
+    return 0;
+}
+
+/*
+ * The "kill %n" built-in: "kill [-signal] %n ...". Only the user's own
+ * jobs can be reached this way.
+ */
+
+static int builtin_kill (command_t* cmd, config_t* config, int* exiting){
+    int sig = SIGTERM;
+    int status = 0;
+    int i = 1;
+
+    (void) config; (void) exiting;
+
+    if (!names_a_job (cmd))
+        return BUILTIN_EXTERNAL;
+
+    if (cmd->argv[i][0] == '-'){
+        sig = parse_signal (cmd->argv[i] + 1);
+        if (sig <= 0 || sig >= NSIG){
+            fprintf (stderr, "kill: %s: invalid signal\n", cmd->argv[i]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+
+    for (; i<cmd->argc; i++){
+        if (cmd->argv[i][0] != '%' || parse_job_id (cmd->argv[i]) == 0){
+            fprintf (stderr, "kill: %s: not a job\n", cmd->argv[i]);
+            status = EXIT_FAILURE;
+        }else if (jobs_kill (parse_job_id (cmd->argv[i]), sig) < 0){
+            fprintf (stderr, "kill: %s: %s\n", cmd->argv[i], errno == ESRCH ? "no such job" : strerror (errno));
+            status = EXIT_FAILURE;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * In-process versions of system commands. They do what the coreutils and
+ * debianutils commands do for the usual options, and hand anything else
+ * to the system command.
+ */
+
+static int builtin_true (command_t* cmd, config_t* config, int* exiting){
+    (void) cmd; (void) config; (void) exiting;
+    return 0;
+}
+
+static int builtin_pwd (command_t* cmd, config_t* config, int* exiting){
+    char cwd[PATH_MAX];
+    int i = 0;
+
+    (void) config; (void) exiting;
+
+    /* -P, the default, is the only option done here */
+    for (i=1; i<cmd->argc; i++){
+        if (strcmp (cmd->argv[i], "-P"))
+            return BUILTIN_EXTERNAL;
+    }
+
+    if (getcwd (cwd, sizeof (cwd)) == NULL){
+        fprintf (stderr, "pwd: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+    fprintf (stdout, "%s\n", cwd);
+    return 0;
+}
+
+/*
+ * "echo [-n] [-E] words". Escape sequences (-e) are left to the system.
+ */
+
+static int builtin_echo (command_t* cmd, config_t* config, int* exiting){
+    int newline = AG_TRUE;
+    int i = 1;
+
+    (void) config; (void) exiting;
+
+    if (cmd->argc == 2 && (!strcmp (cmd->argv[1], "--help") || !strcmp (cmd->argv[1], "--version")))
+        return BUILTIN_EXTERNAL;
+
+    /* Leading words made only of n, e and E are options */
+    for (; i<cmd->argc; i++){
+        const char* opt = cmd->argv[i];
+        if (opt[0] != '-' || opt[1] == '\0' || opt[1 + strspn (opt + 1, "neE")] != '\0')
+            break;
+        if (strchr (opt, 'e') != NULL)
+            return BUILTIN_EXTERNAL;
+        if (strchr (opt, 'n') != NULL)
+            newline = AG_FALSE;
+    }
+
+    for (; i<cmd->argc; i++){
+        fputs (cmd->argv[i], stdout);
+        if (i + 1 < cmd->argc)
+            fputc (' ', stdout);
+    }
+    if (newline)
+        fputc ('\n', stdout);
+    return 0;
+}
+
+/*
+ * "sleep n[smhd] ...". Sleeps for the sum of the durations, through the
+ * SIGCHLD of background jobs, and no longer than the profile's timeout:
+ * it times out like the system sleep would.
+ */
+
+static int builtin_sleep (command_t* cmd, config_t* config, int* exiting){
+    struct timespec left;
+    double seconds = 0, value = 0;
+    char* end = NULL;
+    int i = 0;
+
+    (void) exiting;
+
+    if (cmd->argc < 2)
+        return BUILTIN_EXTERNAL;
+
+    for (i=1; i<cmd->argc; i++){
+        errno = 0;
+        value = strtod (cmd->argv[i], &end);
+        if (errno || end == cmd->argv[i] || !isfinite (value) || value < 0)
+            return BUILTIN_EXTERNAL;
+        switch (*end){
+            case '\0':
+            case 's':   break;
+            case 'm':   value *= 60; break;
+            case 'h':   value *= 60 * 60; break;
+            case 'd':   value *= 24 * 60 * 60; break;
+            default:    return BUILTIN_EXTERNAL;
+        }
+        if (*end != '\0' && end[1] != '\0')
+            return BUILTIN_EXTERNAL;
+        seconds += value;
+    }
+
+    /* Years of sleep are the system's business */
+    if (seconds > INT_MAX)
+        return BUILTIN_EXTERNAL;
+
+    if (config->timeout > 0 && seconds > config->timeout){
+        left.tv_sec = config->timeout;
+        left.tv_nsec = 0;
+        while (nanosleep (&left, &left) < 0 && errno == EINTR)
+            ;
+        fprintf (stderr, "%s: Timed out after %d seconds.\n", cmd->name, config->timeout);
+        if (config->loglevel >= 1)    audit (LOG_WARNING, "Command timed out after %d seconds: %s.", config->timeout, cmd->name);
+        return AG_STATUS_TIMEOUT;
+    }
+
+    left.tv_sec = (time_t) seconds;
+    left.tv_nsec = (long) ((seconds - left.tv_sec) * 1e9);
+    while (nanosleep (&left, &left) < 0 && errno == EINTR)
+        ;
+    return 0;
+}
+
+/*
+ * "which name ...". Prints where AGROS finds each command, which is where
+ * the system "which" would find it unless PATH holds directories AGROS
+ * doesn't trust.
+ */
+
+static int builtin_which (command_t* cmd, config_t* config, int* exiting){
+    exec_entry* entry = NULL;
+    int status = 0;
+    int i = 0;
+
+    (void) exiting;
+
+    if (cmd->argc < 2)
+        return EXIT_FAILURE;
+    for (i=1; i<cmd->argc; i++){
+        if (cmd->argv[i][0] == '-')
+            return BUILTIN_EXTERNAL;
+    }
+
+    if (exec_paths == NULL)
+        prepare_session (config, AG_FALSE);
+
+    for (i=1; i<cmd->argc; i++){
+        if (strchr (cmd->argv[i], '/') != NULL){
+            if (access (cmd->argv[i], X_OK) == 0)
+                fprintf (stdout, "%s\n", cmd->argv[i]);
+            else
+                status = EXIT_FAILURE;
+            continue;
+        }
+        entry = exec_paths ? exec_cache_lookup (exec_paths, cmd->argv[i]) : NULL;
+        if (entry != NULL)
+            fprintf (stdout, "%s\n", entry->path);
+        else
+            status = EXIT_FAILURE;
+    }
+    return status;
+}
+
+/*
+ * "history [n]". Lists the lines typed, in this session and those kept
+ * from the ones before (see histfile.h), or the last n.
+ */
+
+static int builtin_history (command_t* cmd, config_t* config, int* exiting){
+    HIST_ENTRY** list = history_list ();
+    int count = 0, first = 0, i = 0;
+    char* end = NULL;
+
+    (void) config; (void) exiting;
+
+    while (list != NULL && list[count] != NULL)
+        count++;
+
+    if (cmd->argc > 1){
+        long n = strtol (cmd->argv[1], &end, 10);
+        if (*cmd->argv[1] == '\0' || *end != '\0' || n < 0){
+            fprintf (stderr, "history: %s: numeric argument required\n", cmd->argv[1]);
+            return AG_STATUS_USAGE;
+        }
+        if (n < count)
+            first = count - (int) n;
+    }
+
+    for (i=first; i<count; i++)
+        fprintf (stdout, "%5d  %s\n", i + history_base, list[i]->line);
+    return 0;
+}
+
+static const builtin_t builtin_table[] = {
+#define BUILTIN(name, handler, policy) { name, handler, policy },
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/*
+ * Returns the built-in called name, or NULL for system commands.
+ */
+
+const builtin_t* find_builtin (const char* name){
+    int index = 0;
+
+    if (strnlen (name, BUILTIN_MAX_LEN + 1) > BUILTIN_MAX_LEN)
+        return NULL;
+
+    index = builtin_slots[builtin_hash (BUILTIN_SEED, name) & (BUILTIN_SLOTS - 1)];
+    if (index < 0 || strcmp (builtin_table[index].name, name))
+        return NULL;
+    return &builtin_table[index];
+}
@@ -0,0 +1,448 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "complete.h"
+
+#define CACHE_MAGIC "agros-commands 1\n"
+
+/*
+ * Node 0 is the root, the empty prefix. The children of a node are listed
+ * in the order of their character, like the names they cover.
+ */
+
+typedef struct trie_node trie_node;
+struct trie_node{
+    uint32_t first;         /* names[first..last) start with this prefix */
+    uint32_t last;
+    uint32_t child;         /* first child, 0 if none */
+    uint32_t sibling;       /* next child of the same parent, 0 if none */
+    unsigned char c;
+};
+
+typedef struct path_dir path_dir;
+struct path_dir{
+    char* path;
+    struct timespec mtime;
+};
+
+struct completion_index{
+    /* The names as added, one after the other */
+    char* pool;
+    size_t pool_size;
+    size_t pool_used;
+    size_t* offsets;
+    int offset_nbr;
+    int offset_size;
+
+    /* Sorted and unique, once built */
+    char** names;
+    int name_nbr;
+
+    trie_node* nodes;
+    uint32_t node_nbr;
+    uint32_t node_size;
+
+    /* The PATH directories scanned, and when they last changed */
+    path_dir* dirs;
+    int dir_nbr;
+};
+
+completion_index* completion_new (void){
+    return (completion_index*) calloc (1, sizeof (completion_index));
+}
+
+void completion_free (completion_index* index){
+    int i = 0;
+
+    if (index == NULL)
+        return;
+    for (i=0; i<index->dir_nbr; i++)
+        free (index->dirs[i].path);
+    free (index->dirs);
+    free (index->pool);
+    free (index->offsets);
+    free (index->names);
+    free (index->nodes);
+    free (index);
+}
+
+int completion_add (completion_index* index, const char* name){
+    size_t length = strlen (name) + 1;
+
+    if (index->pool_used + length > index->pool_size){
+        size_t size = index->pool_size ? 2 * index->pool_size : 4096;
+        char* pool = NULL;
+        while (size < index->pool_used + length)
+            size *= 2;
+        pool = (char*) realloc (index->pool, size);
+        if (pool == NULL)
+            return -1;
+        index->pool = pool;
+        index->pool_size = size;
+    }
+
+    if (index->offset_nbr == index->offset_size){
+        int size = index->offset_size ? 2 * index->offset_size : 256;
+        size_t* offsets = (size_t*) realloc (index->offsets, size * sizeof (size_t));
+        if (offsets == NULL)
+            return -1;
+        index->offsets = offsets;
+        index->offset_size = size;
+    }
+
+    memcpy (index->pool + index->pool_used, name, length);
+    index->offsets[index->offset_nbr++] = index->pool_used;
+    index->pool_used += length;
+    return 0;
+}
+
+/*
+ * Remembers the PATH directories of paths and their modification times.
+ */
+
+static int note_dirs (completion_index* index, const exec_cache* paths){
+    struct stat st;
+    int n = 0, i = 0;
+
+    while (exec_cache_dir (paths, n) != NULL)
+        n++;
+    index->dirs = (path_dir*) calloc (n ? n : 1, sizeof (path_dir));
+    if (index->dirs == NULL)
+        return -1;
+
+    for (i=0; i<n; i++){
+        index->dirs[i].path = strdup (exec_cache_dir (paths, i));
+        if (index->dirs[i].path == NULL)
+            return -1;
+        index->dir_nbr++;
+        if (stat (index->dirs[i].path, &st) == 0)
+            index->dirs[i].mtime = st.st_mtim;
+    }
+    return 0;
+}
+
+/*
+ * Adds the allowed names of cache_file, if it was written for the same
+ * directories as they are now. Returns -1 if it wasn't.
+ */
+
+static int load_cache (completion_index* index, const allowlist* allowed, const char* cache_file){
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t length = 0;
+    long long sec = 0;
+    long nsec = 0;
+    int offset = 0, dir = 0, status = -1;
+    FILE* cache = fopen (cache_file, "re");
+
+    if (cache == NULL)
+        return -1;
+    if (getline (&line, &size, cache) < 0 || strcmp (line, CACHE_MAGIC))
+        goto out;
+
+    while ((length = getline (&line, &size, cache)) > 0){
+        if (line[length-1] == '\n')
+            line[length-1] = '\0';
+
+        if (line[0] == 'D' && line[1] == ' '){
+            if (dir >= index->dir_nbr || sscanf (line + 2, "%lld %ld %n", &sec, &nsec, &offset) != 2)
+                goto out;
+            if (strcmp (line + 2 + offset, index->dirs[dir].path) || sec != (long long) index->dirs[dir].mtime.tv_sec
+                || nsec != index->dirs[dir].mtime.tv_nsec)
+                goto out;
+            dir++;
+        }else if (line[0] == 'N' && line[1] == ' ' && dir == index->dir_nbr){
+            if (allowlist_match (allowed, line + 2) && completion_add (index, line + 2) < 0)
+                goto out;
+        }else {
+            goto out;
+        }
+    }
+    if (dir == index->dir_nbr)
+        status = 0;
+
+out:
+    free (line);
+    fclose (cache);
+    return status;
+}
+
+/*
+ * Creates the directories above path, private to the user.
+ */
+
+static void make_parents (const char* path){
+    char* copy = strdup (path);
+    char* slash = NULL;
+
+    if (copy == NULL)
+        return;
+    for (slash = strchr (copy + 1, '/'); slash; slash = strchr (slash + 1, '/')){
+        *slash = '\0';
+        mkdir (copy, 0700);
+        *slash = '/';
+    }
+    free (copy);
+}
+
+/*
+ * Scans the PATH directories for executables. The allowed ones are added
+ * to the index, and all of them are written to cache_file for the next
+ * session, whatever its allowed list.
+ */
+
+static int scan_dirs (completion_index* index, const allowlist* allowed, const char* cache_file){
+    char tmp[4096];
+    struct dirent* entry = NULL;
+    struct stat st;
+    FILE* cache = NULL;
+    DIR* dir = NULL;
+    int fd = -1, i = 0;
+
+    if (cache_file != NULL && snprintf (tmp, sizeof (tmp), "%s.XXXXXX", cache_file) < (int) sizeof (tmp)){
+        make_parents (cache_file);
+        fd = mkostemp (tmp, O_CLOEXEC);
+        if (fd >= 0 && (cache = fdopen (fd, "w")) == NULL)
+            close (fd);
+    }
+
+    if (cache != NULL){
+        fputs (CACHE_MAGIC, cache);
+        for (i=0; i<index->dir_nbr; i++)
+            fprintf (cache, "D %lld %ld %s\n", (long long) index->dirs[i].mtime.tv_sec,
+                     index->dirs[i].mtime.tv_nsec, index->dirs[i].path);
+    }
+
+    for (i=0; i<index->dir_nbr; i++){
+        dir = opendir (index->dirs[i].path);
+        if (dir == NULL)
+            continue;
+        while ((entry = readdir (dir)) != NULL){
+            if (entry->d_name[0] == '.' || strchr (entry->d_name, '\n') != NULL)
+                continue;
+            if (entry->d_type == DT_DIR)
+                continue;
+            if (fstatat (dirfd (dir), entry->d_name, &st, 0) < 0 || !S_ISREG (st.st_mode)
+                || faccessat (dirfd (dir), entry->d_name, X_OK, 0) < 0)
+                continue;
+            if (cache != NULL)
+                fprintf (cache, "N %s\n", entry->d_name);
+            if (allowlist_match (allowed, entry->d_name) && completion_add (index, entry->d_name) < 0){
+                closedir (dir);
+                if (cache != NULL){
+                    fclose (cache);
+                    unlink (tmp);
+                }
+                return -1;
+            }
+        }
+        closedir (dir);
+    }
+
+    if (cache != NULL){
+        if (fclose (cache) != 0 || rename (tmp, cache_file) < 0)
+            unlink (tmp);
+    }
+    return 0;
+}
+
+/*
+ * Adds the executables of the PATH directories of paths that allowed lets
+ * run, from cache_file if it is up to date. cache_file may be NULL.
+ */
+
+int completion_add_path (completion_index* index, const exec_cache* paths,
+                         const allowlist* allowed, const char* cache_file){
+    int added = index->offset_nbr;
+    size_t used = index->pool_used;
+
+    if (index->dirs != NULL || note_dirs (index, paths) < 0)
+        return -1;
+
+    if (cache_file != NULL && load_cache (index, allowed, cache_file) == 0)
+        return 0;
+
+    /* Forgets what an out of date cache added */
+    index->offset_nbr = added;
+    index->pool_used = used;
+    return scan_dirs (index, allowed, cache_file);
+}
+
+/*
+ * True if a PATH directory changed since the index was built.
+ */
+
+int completion_stale (const completion_index* index, const exec_cache* paths){
+    struct stat st;
+    int i = 0;
+
+    if (index->dirs == NULL)
+        return 0;
+    for (i=0; i<index->dir_nbr; i++){
+        if (exec_cache_dir (paths, i) == NULL || strcmp (exec_cache_dir (paths, i), index->dirs[i].path))
+            return 1;
+        if (stat (index->dirs[i].path, &st) < 0)
+            continue;
+        if (st.st_mtim.tv_sec != index->dirs[i].mtime.tv_sec || st.st_mtim.tv_nsec != index->dirs[i].mtime.tv_nsec)
+            return 1;
+    }
+    return exec_cache_dir (paths, index->dir_nbr) != NULL;
+}
+
+static int compare_names (const void* a, const void* b){
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+static uint32_t new_node (completion_index* index, unsigned char c, uint32_t first, uint32_t last){
+    trie_node* node = NULL;
+
+    if (index->node_nbr == index->node_size){
+        uint32_t size = index->node_size ? 2 * index->node_size : 256;
+        trie_node* nodes = (trie_node*) realloc (index->nodes, size * sizeof (trie_node));
+        if (nodes == NULL)
+            return 0;
+        index->nodes = nodes;
+        index->node_size = size;
+    }
+
+    node = &index->nodes[index->node_nbr];
+    node->c = c;
+    node->first = first;
+    node->last = last;
+    node->child = 0;
+    node->sibling = 0;
+    return index->node_nbr++;
+}
+
+/*
+ * Gives node a child for each character that follows its prefix. A node
+ * that covers a single name needs none: the rest of the name is compared
+ * directly.
+ */
+
+static int build_node (completion_index* index, uint32_t node, size_t depth){
+    uint32_t i = index->nodes[node].first;
+    uint32_t last = index->nodes[node].last;
+    uint32_t j = 0, child = 0, previous = 0;
+    unsigned char c = 0;
+
+    if (last - i < 2)
+        return 0;
+
+    /* The name that is the prefix itself sorts first */
+    if (index->names[i][depth] == '\0')
+        i++;
+
+    while (i < last){
+        c = (unsigned char) index->names[i][depth];
+        for (j=i+1; j<last && (unsigned char) index->names[j][depth] == c; j++)
+            ;
+        child = new_node (index, c, i, j);
+        if (child == 0)
+            return -1;
+        if (previous)
+            index->nodes[previous].sibling = child;
+        else
+            index->nodes[node].child = child;
+        previous = child;
+        if (build_node (index, child, depth + 1) < 0)
+            return -1;
+        i = j;
+    }
+    return 0;
+}
+
+/*
+ * Sorts the names added, drops the duplicates and builds the trie.
+ */
+
+int completion_build (completion_index* index){
+    int i = 0, n = 0;
+
+    free (index->names);
+    index->names = (char**) malloc ((index->offset_nbr ? index->offset_nbr : 1) * sizeof (char*));
+    if (index->names == NULL)
+        return -1;
+    for (i=0; i<index->offset_nbr; i++)
+        index->names[i] = index->pool + index->offsets[i];
+    qsort (index->names, index->offset_nbr, sizeof (char*), compare_names);
+
+    for (i=0; i<index->offset_nbr; i++){
+        if (n == 0 || strcmp (index->names[n-1], index->names[i]))
+            index->names[n++] = index->names[i];
+    }
+    index->name_nbr = n;
+
+    index->node_nbr = 0;
+    if (new_node (index, '\0', 0, n) != 0)
+        return -1;
+    return build_node (index, 0, 0);
+}
+
+/*
+ * Finds the names that start with prefix. Returns how many there are, the
+ * first one being completion_name (index, *first).
+ */
+
+int completion_find (const completion_index* index, const char* prefix, int* first){
+    const trie_node* node = NULL;
+    uint32_t child = 0;
+    size_t depth = 0;
+
+    if (index->node_nbr == 0 || index->name_nbr == 0)
+        return 0;
+
+    node = &index->nodes[0];
+    while (prefix[depth] != '\0'){
+        if (node->child == 0){
+            /* One name left: the rest of it must match */
+            if (strncmp (index->names[node->first] + depth, prefix + depth, strlen (prefix + depth)))
+                return 0;
+            break;
+        }
+        for (child = node->child; child && index->nodes[child].c < (unsigned char) prefix[depth];
+             child = index->nodes[child].sibling)
+            ;
+        if (child == 0 || index->nodes[child].c != (unsigned char) prefix[depth])
+            return 0;
+        node = &index->nodes[child];
+        depth++;
+    }
+
+    *first = node->first;
+    return node->last - node->first;
+}
+
+const char* completion_name (const completion_index* index, int i){
+    return index->names[i];
+}
@@ -0,0 +1,224 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "evloop.h"
+
+#define SOURCE_WATCH    1
+#define SOURCE_TIMER    2
+#define SOURCE_SIGNALS  3
+
+typedef struct source source;
+struct source{
+    int kind;           /* 0 for a free slot */
+    int fd;
+    evloop_fn fn;
+    void* data;
+};
+
+struct evloop{
+    int epoll_fd;
+    source sources[EVLOOP_MAX_SOURCES];
+};
+
+evloop* evloop_new (void){
+    evloop* loop = (evloop*) calloc (1, sizeof (evloop));
+
+    if (loop == NULL)
+        return NULL;
+    loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0){
+        free (loop);
+        return NULL;
+    }
+    return loop;
+}
+
+/*
+ * Closes the timers and signalfds of the loop. Watched descriptors are
+ * the caller's.
+ */
+
+void evloop_free (evloop* loop){
+    int i = 0;
+
+    if (loop == NULL)
+        return;
+    for (i=0; i<EVLOOP_MAX_SOURCES; i++){
+        if (loop->sources[i].kind == SOURCE_TIMER || loop->sources[i].kind == SOURCE_SIGNALS)
+            close (loop->sources[i].fd);
+    }
+    close (loop->epoll_fd);
+    free (loop);
+}
+
+int evloop_fd (const evloop* loop){
+    return loop->epoll_fd;
+}
+
+static int add_source (evloop* loop, int kind, int fd, evloop_fn fn, void* data){
+    struct epoll_event event;
+    source* src = NULL;
+    int i = 0;
+
+    for (i=0; i<EVLOOP_MAX_SOURCES && src == NULL; i++){
+        if (loop->sources[i].kind == 0)
+            src = &loop->sources[i];
+    }
+    if (src == NULL){
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLIN;
+    event.data.ptr = src;
+    if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        return -1;
+    src->kind = kind;
+    src->fd = fd;
+    src->fn = fn;
+    src->data = data;
+    return 0;
+}
+
+/*
+ * Calls fn whenever fd is readable, until evloop_unwatch().
+ */
+
+int evloop_watch (evloop* loop, int fd, evloop_fn fn, void* data){
+    return add_source (loop, SOURCE_WATCH, fd, fn, data);
+}
+
+void evloop_unwatch (evloop* loop, int fd){
+    int i = 0;
+
+    for (i=0; i<EVLOOP_MAX_SOURCES; i++){
+        if (loop->sources[i].kind == SOURCE_WATCH && loop->sources[i].fd == fd){
+            epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            memset (&loop->sources[i], 0, sizeof (source));
+        }
+    }
+}
+
+/*
+ * Creates a timer, disarmed. Returns its descriptor, for evloop_arm(), or
+ * -1.
+ */
+
+int evloop_timer (evloop* loop, evloop_fn fn, void* data){
+    int fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+    if (fd < 0)
+        return -1;
+    if (add_source (loop, SOURCE_TIMER, fd, fn, data) < 0){
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Makes timer expire once, ms milliseconds from now, instead of when it
+ * was set to. 0 disarms it.
+ */
+
+int evloop_arm (int timer, int64_t ms){
+    struct itimerspec when;
+
+    memset (&when, 0, sizeof (when));
+    when.it_value.tv_sec = ms / 1000;
+    when.it_value.tv_nsec = (ms % 1000) * 1000000;
+    return timerfd_settime (timer, 0, &when, NULL);
+}
+
+/*
+ * Calls fn with each signal of set that arrives. Returns the signalfd, or
+ * -1.
+ */
+
+int evloop_signals (evloop* loop, const sigset_t* set, evloop_fn fn, void* data){
+    int fd = signalfd (-1, set, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    if (fd < 0)
+        return -1;
+    if (add_source (loop, SOURCE_SIGNALS, fd, fn, data) < 0){
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void dispatch (evloop* loop, source* src){
+    struct signalfd_siginfo info[8];
+    uint64_t expirations = 0;
+    ssize_t n = 0;
+    int i = 0;
+
+    switch (src->kind){
+    case SOURCE_WATCH:
+        src->fn (loop, src->fd, src->data);
+        break;
+    case SOURCE_TIMER:
+        /* Nothing to read if it was disarmed or armed again since */
+        if (read (src->fd, &expirations, sizeof (expirations)) == sizeof (expirations))
+            src->fn (loop, (int) expirations, src->data);
+        break;
+    case SOURCE_SIGNALS:
+        while ((n = read (src->fd, info, sizeof (info))) > 0){
+            for (i=0; i<n / (ssize_t) sizeof (info[0]) && src->kind == SOURCE_SIGNALS; i++)
+                src->fn (loop, (int) info[i].ssi_signo, src->data);
+        }
+        break;
+    }
+}
+
+/*
+ * Waits up to timeout_ms (-1 for as long as it takes) for events, and
+ * calls the functions of the sources that have some. Returns the number
+ * of sources that had events, or -1 with errno set. Being interrupted by
+ * a signal counts as no event.
+ */
+
+int evloop_run (evloop* loop, int timeout_ms){
+    struct epoll_event events[EVLOOP_MAX_SOURCES];
+    source* src = NULL;
+    int n = 0, i = 0;
+
+    n = epoll_wait (loop->epoll_fd, events, EVLOOP_MAX_SOURCES, timeout_ms);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (i=0; i<n; i++){
+        src = (source*) events[i].data.ptr;
+        /* Unwatched by the function of an event before it */
+        if (src->kind != 0)
+            dispatch (loop, src);
+    }
+    return n;
+}
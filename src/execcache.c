@@ -0,0 +1,297 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "execcache.h"
+
+/* Past this many names, lookups still work but aren't remembered */
+#define EXEC_CACHE_MAX 4096
+
+/* Used when PATH is not set */
+#define EXEC_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+struct exec_cache{
+    /* The PATH directories that are safe to search */
+    char** dirs;
+    int dir_nbr;
+
+    exec_entry* entries;
+    int entry_nbr;
+
+    /* Open addressing index into entries, -1 for empty slots */
+    int* slots;
+    uint32_t mask;
+
+    /* Holds the result of a lookup once the cache is full */
+    exec_entry scratch;
+};
+
+static uint32_t hash_name (const char* name){
+    uint32_t h = 2166136261U;
+    while (*name){
+        h ^= (unsigned char) *name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ * A PATH directory is searched only if it is absolute and the user can't
+ * add programs to it. root can write anywhere, so for root the directory
+ * must belong to root and not be writable by group or others.
+ */
+
+static int safe_directory (const char* dir){
+    struct stat st;
+
+    if (dir[0] != '/' || stat (dir, &st) < 0 || !S_ISDIR (st.st_mode))
+        return 0;
+    if (getuid () == 0)
+        return st.st_uid == 0 && !(st.st_mode & (S_IWGRP | S_IWOTH));
+    return access (dir, W_OK) != 0;
+}
+
+exec_cache* exec_cache_new (const char* search_path){
+    exec_cache* cache = NULL;
+    char* copy = NULL;
+    char* dir = NULL;
+    char* save = NULL;
+    uint32_t i = 0;
+
+    cache = (exec_cache*) calloc (1, sizeof (exec_cache));
+    if (cache == NULL)
+        return NULL;
+
+    if (search_path == NULL || *search_path == '\0')
+        search_path = EXEC_DEFAULT_PATH;
+
+    copy = strdup (search_path);
+    cache->dirs = (char**) calloc (strlen (search_path) / 2 + 2, sizeof (char*));
+    cache->entries = (exec_entry*) calloc (EXEC_CACHE_MAX, sizeof (exec_entry));
+    cache->slots = (int*) malloc (2 * EXEC_CACHE_MAX * sizeof (int));
+    if (!copy || !cache->dirs || !cache->entries || !cache->slots){
+        free (copy);
+        exec_cache_free (cache);
+        return NULL;
+    }
+
+    for (dir = strtok_r (copy, ":", &save); dir; dir = strtok_r (NULL, ":", &save)){
+        if (safe_directory (dir))
+            cache->dirs[cache->dir_nbr++] = strdup (dir);
+    }
+    free (copy);
+
+    cache->mask = 2 * EXEC_CACHE_MAX - 1;
+    for (i=0; i<=cache->mask; i++)
+        cache->slots[i] = -1;
+    cache->scratch.fd = -1;
+
+    return cache;
+}
+
+static void forget_entry (exec_entry* entry){
+    if (entry->fd >= 0)
+        close (entry->fd);
+    free (entry->path);
+    entry->fd = -1;
+    entry->path = NULL;
+}
+
+void exec_cache_free (exec_cache* cache){
+    int i = 0;
+
+    if (cache == NULL)
+        return;
+    for (i=0; i<cache->dir_nbr; i++)
+        free (cache->dirs[i]);
+    for (i=0; i<cache->entry_nbr; i++){
+        forget_entry (&cache->entries[i]);
+        free (cache->entries[i].name);
+    }
+    forget_entry (&cache->scratch);
+    free (cache->scratch.name);
+    free (cache->dirs);
+    free (cache->entries);
+    free (cache->slots);
+    free (cache);
+}
+
+/*
+ * Pins path into entry if it is an executable regular file.
+ */
+
+static int pin_file (exec_entry* entry, const char* path){
+    struct stat st;
+    char magic[2];
+    int fd = -1, rfd = -1;
+
+    if (access (path, X_OK) != 0)
+        return -1;
+
+    fd = open (path, O_PATH | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat (fd, &st) < 0 || !S_ISREG (st.st_mode)){
+        close (fd);
+        return -1;
+    }
+
+    /* A script is run by its path: its interpreter opens it again by the
+       name it gets as $0, which the descriptor couldn't give it */
+    entry->script = 0;
+    rfd = open (path, O_RDONLY | O_CLOEXEC);
+    if (rfd >= 0){
+        if (read (rfd, magic, 2) == 2 && magic[0] == '#' && magic[1] == '!')
+            entry->script = 1;
+        close (rfd);
+    }
+
+    entry->path = strdup (path);
+    if (entry->path == NULL){
+        close (fd);
+        return -1;
+    }
+    entry->fd = fd;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    return 0;
+}
+
+/*
+ * Searches the safe PATH directories for entry->name, the way execvp()
+ * would. Absolute names are pinned as they are.
+ */
+
+static int resolve_entry (exec_cache* cache, exec_entry* entry){
+    char path[PATH_MAX];
+    int i = 0;
+
+    forget_entry (entry);
+
+    if (entry->name[0] == '/')
+        return pin_file (entry, entry->name);
+
+    for (i=0; i<cache->dir_nbr; i++){
+        if (snprintf (path, sizeof (path), "%s/%s", cache->dirs[i], entry->name) >= (int) sizeof (path))
+            continue;
+        if (pin_file (entry, path) == 0)
+            return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * True if the file at entry->path is still the one that was pinned.
+ */
+
+static int still_valid (exec_entry* entry){
+    struct stat st;
+
+    if (entry->fd < 0 || stat (entry->path, &st) < 0)
+        return 0;
+    return st.st_dev == entry->dev && st.st_ino == entry->ino && st.st_size == entry->size
+        && st.st_mtim.tv_sec == entry->mtime.tv_sec && st.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+/*
+ * Returns the pinned executable for name, or NULL if it can't be found in
+ * PATH. Relative paths such as "./script" depend on the current directory
+ * and are never cached: NULL is returned and the caller executes them by
+ * name.
+ */
+
+exec_entry* exec_cache_lookup (exec_cache* cache, const char* name){
+    exec_entry* entry = NULL;
+    uint32_t slot = 0;
+
+    if (strchr (name, '/') != NULL && name[0] != '/')
+        return NULL;
+
+    slot = hash_name (name) & cache->mask;
+    while (cache->slots[slot] >= 0){
+        entry = &cache->entries[cache->slots[slot]];
+        if (!strcmp (entry->name, name))
+            break;
+        entry = NULL;
+        slot = (slot + 1) & cache->mask;
+    }
+
+    if (entry != NULL){
+        if (still_valid (entry))
+            return entry;
+        return resolve_entry (cache, entry) == 0 ? entry : NULL;
+    }
+
+    if (cache->entry_nbr < EXEC_CACHE_MAX){
+        entry = &cache->entries[cache->entry_nbr];
+        entry->name = strdup (name);
+        entry->fd = -1;
+        if (entry->name == NULL)
+            return NULL;
+        cache->slots[slot] = cache->entry_nbr++;
+    }else {
+        entry = &cache->scratch;
+        free (entry->name);
+        entry->name = strdup (name);
+        if (entry->name == NULL)
+            return NULL;
+    }
+
+    return resolve_entry (cache, entry) == 0 ? entry : NULL;
+}
+
+/*
+ * Resolves every plain name of the allowed list up front. Patterns are
+ * skipped: the names they allow are resolved the first time they're used.
+ */
+
+void exec_cache_prime (exec_cache* cache, char** names, int count){
+    int i = 0;
+
+    for (i=0; i<count; i++){
+        if (names[i][strcspn (names[i], "*?[\\")] == '\0')
+            exec_cache_lookup (cache, names[i]);
+    }
+}
+
+/*
+ * Returns the index-th PATH directory that is searched, or NULL past the
+ * last one.
+ */
+
+const char* exec_cache_dir (const exec_cache* cache, int index){
+    if (index < 0 || index >= cache->dir_nbr)
+        return NULL;
+    return cache->dirs[index];
+}
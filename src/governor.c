@@ -0,0 +1,389 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "governor.h"
+
+#ifndef GOVERNOR_CGROUP_PARENT
+#define GOVERNOR_CGROUP_PARENT "/sys/fs/cgroup/agros"
+#endif
+
+/* The period of cpu.max when it is given as a share */
+#define CPU_PERIOD 100000
+
+/* ioprio_set() values, from linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+
+const char* const governor_keys[] = {
+    "limit_cpu", "limit_as", "limit_nofile", "limit_nproc", "limit_fsize",
+    "nice", "ionice", "cpu_affinity",
+    "cgroup_memory_max", "cgroup_cpu_max", "cgroup_parent",
+    NULL
+};
+
+typedef struct rlimit_key rlimit_key;
+struct rlimit_key{
+    const char* key;
+    int resource;
+    int size;           /* takes K, M, G and T */
+};
+
+static const rlimit_key rlimit_keys[] = {
+    { "limit_cpu",      RLIMIT_CPU,     0 },
+    { "limit_as",       RLIMIT_AS,      1 },
+    { "limit_nofile",   RLIMIT_NOFILE,  0 },
+    { "limit_nproc",    RLIMIT_NPROC,   0 },
+    { "limit_fsize",    RLIMIT_FSIZE,   1 },
+};
+
+/* The cgroup of the session, once created */
+static char* cgroup_dir = NULL;
+static int cgroup_procs = -1;
+
+spawn_limits* governor_new (void){
+    return (spawn_limits*) calloc (1, sizeof (spawn_limits));
+}
+
+void governor_free (spawn_limits* limits){
+    if (limits == NULL)
+        return;
+    free (limits->memory_max);
+    free (limits->cpu_max);
+    free (limits->cgroup_parent);
+    free (limits);
+}
+
+/*
+ * Reads a count, or a size with size set, into *result. "unlimited" and
+ * "max" are RLIM_INFINITY.
+ */
+
+static int parse_number (const char* value, int size, rlim_t* result){
+    static const char units[] = "KMGT";
+    unsigned long long n = 0;
+    const char* unit = NULL;
+    char* end = NULL;
+    int shift = 0;
+
+    if (!strcmp (value, "unlimited") || !strcmp (value, "max")){
+        *result = RLIM_INFINITY;
+        return 0;
+    }
+    if (!isdigit ((unsigned char) *value))
+        return -1;
+
+    errno = 0;
+    n = strtoull (value, &end, 10);
+    if (errno != 0)
+        return -1;
+
+    if (size && *end != '\0' && (unit = strchr (units, toupper ((unsigned char) *end))) != NULL){
+        shift = 10 * (unit - units + 1);
+        if (n > (RLIM_INFINITY - 1) >> shift)
+            return -1;
+        n <<= shift;
+        end++;
+    }
+    if (*end != '\0' || n >= RLIM_INFINITY)
+        return -1;
+
+    *result = n;
+    return 0;
+}
+
+static int set_rlimit (spawn_limits* limits, int resource, rlim_t value){
+    int i = 0;
+
+    for (i=0; i<limits->rlimit_nbr && limits->resources[i] != resource; i++)
+        ;
+    if (i == SPAWN_RLIMITS)
+        return -1;
+    if (i == limits->rlimit_nbr)
+        limits->rlimit_nbr++;
+
+    /* The hard limit too: the command can't raise it again */
+    limits->resources[i] = resource;
+    limits->values[i].rlim_cur = value;
+    limits->values[i].rlim_max = value;
+    return 0;
+}
+
+/*
+ * "idle", "best-effort" or "realtime", with an optional ":level".
+ */
+
+static int parse_ionice (const char* value, int* ioprio){
+    const char* colon = strchr (value, ':');
+    size_t len = colon ? (size_t) (colon - value) : strlen (value);
+    int class = 0, level = 4;
+    char* end = NULL;
+
+    if (len == 4 && !strncmp (value, "idle", len))
+        class = IOPRIO_CLASS_IDLE;
+    else if (len == 11 && !strncmp (value, "best-effort", len))
+        class = IOPRIO_CLASS_BE;
+    else if (len == 8 && !strncmp (value, "realtime", len))
+        class = IOPRIO_CLASS_RT;
+    else
+        return -1;
+
+    if (colon != NULL){
+        if (class == IOPRIO_CLASS_IDLE || !isdigit ((unsigned char) colon[1]))
+            return -1;
+        level = strtol (colon + 1, &end, 10);
+        if (*end != '\0' || level > 7)
+            return -1;
+    }
+    if (class == IOPRIO_CLASS_IDLE)
+        level = 0;
+
+    *ioprio = (class << IOPRIO_CLASS_SHIFT) | level;
+    return 0;
+}
+
+/*
+ * A list of CPUs and ranges of CPUs: "0-3,6".
+ */
+
+static int parse_cpus (const char* value, cpu_set_t* cpus){
+    const char* p = value;
+    char* end = NULL;
+    long first = 0, last = 0;
+
+    CPU_ZERO (cpus);
+    while (1){
+        if (!isdigit ((unsigned char) *p))
+            return -1;
+        first = last = strtol (p, &end, 10);
+        if (*end == '-'){
+            if (!isdigit ((unsigned char) end[1]))
+                return -1;
+            last = strtol (end + 1, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE)
+            return -1;
+        for (; first<=last; first++)
+            CPU_SET (first, cpus);
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            return -1;
+        p = end + 1;
+    }
+    return CPU_COUNT (cpus) > 0 ? 0 : -1;
+}
+
+/*
+ * cpu.max: "max", a share of one CPU ("50%", "150%") or "quota period".
+ */
+
+static char* parse_cpu_max (const char* value){
+    char buf[64];
+    unsigned long quota = 0, period = 0;
+    char* end = NULL;
+
+    if (!strcmp (value, "max") || !strcmp (value, "unlimited"))
+        return strdup ("max");
+    if (!isdigit ((unsigned char) *value))
+        return NULL;
+
+    quota = strtoul (value, &end, 10);
+    if (!strcmp (end, "%")){
+        if (quota == 0 || quota > 100000)
+            return NULL;
+        snprintf (buf, sizeof (buf), "%lu %d", quota * (CPU_PERIOD / 100), CPU_PERIOD);
+        return strdup (buf);
+    }
+    if (*end != ' ' || !isdigit ((unsigned char) end[1]))
+        return NULL;
+    period = strtoul (end + 1, &end, 10);
+    if (*end != '\0' || quota == 0 || period == 0)
+        return NULL;
+    snprintf (buf, sizeof (buf), "%lu %lu", quota, period);
+    return strdup (buf);
+}
+
+/*
+ * Sets key (one of governor_keys) to value. Returns -1 if value is not
+ * valid for it.
+ */
+
+int governor_set (spawn_limits* limits, const char* key, const char* value){
+    char buf[32];
+    rlim_t n = 0;
+    char* end = NULL;
+    long nice = 0;
+    size_t i = 0;
+
+    for (i=0; i<sizeof (rlimit_keys) / sizeof (rlimit_keys[0]); i++){
+        if (!strcmp (key, rlimit_keys[i].key)){
+            if (parse_number (value, rlimit_keys[i].size, &n) < 0)
+                return -1;
+            return set_rlimit (limits, rlimit_keys[i].resource, n);
+        }
+    }
+
+    if (!strcmp (key, "nice")){
+        errno = 0;
+        nice = strtol (value, &end, 10);
+        if (end == value || *end != '\0' || errno != 0 || nice < -20 || nice > 19)
+            return -1;
+        limits->set_nice = 1;
+        limits->nice = nice;
+        return 0;
+    }
+    if (!strcmp (key, "ionice"))
+        return parse_ionice (value, &limits->ioprio);
+    if (!strcmp (key, "cpu_affinity")){
+        if (parse_cpus (value, &limits->affinity) < 0)
+            return -1;
+        limits->set_affinity = 1;
+        return 0;
+    }
+
+    if (!strcmp (key, "cgroup_memory_max")){
+        if (parse_number (value, 1, &n) < 0)
+            return -1;
+        if (n == RLIM_INFINITY)
+            snprintf (buf, sizeof (buf), "max");
+        else
+            snprintf (buf, sizeof (buf), "%llu", (unsigned long long) n);
+        free (limits->memory_max);
+        limits->memory_max = strdup (buf);
+        return limits->memory_max ? 0 : -1;
+    }
+    if (!strcmp (key, "cgroup_cpu_max")){
+        free (limits->cpu_max);
+        limits->cpu_max = parse_cpu_max (value);
+        return limits->cpu_max ? 0 : -1;
+    }
+    if (!strcmp (key, "cgroup_parent")){
+        if (value[0] != '/')
+            return -1;
+        free (limits->cgroup_parent);
+        limits->cgroup_parent = strdup (value);
+        return limits->cgroup_parent ? 0 : -1;
+    }
+
+    return -1;
+}
+
+static int write_control (const char* dir, const char* file, const char* value){
+    char path[PATH_MAX];
+    int fd = -1, saved = 0;
+    ssize_t written = 0;
+
+    if (snprintf (path, sizeof (path), "%s/%s", dir, file) >= (int) sizeof (path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open (path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    written = write (fd, value, strlen (value));
+    saved = errno;
+    close (fd);
+    errno = saved;
+    return written < 0 ? -1 : 0;
+}
+
+/*
+ * Creates the cgroup of the session if limits asks for one, or applies
+ * the new values to the one that exists. Returns a descriptor on its
+ * cgroup.procs for the launcher, or -1 with errno set if the session has
+ * no cgroup.
+ */
+
+int governor_cgroup (const spawn_limits* limits){
+    const char* parent = NULL;
+    int saved = 0;
+
+    if (cgroup_dir == NULL){
+        if (limits == NULL || (limits->memory_max == NULL && limits->cpu_max == NULL)){
+            errno = 0;
+            return -1;
+        }
+
+        parent = limits->cgroup_parent ? limits->cgroup_parent : GOVERNOR_CGROUP_PARENT;
+        if (asprintf (&cgroup_dir, "%s/agros-%d", parent, (int) getpid ()) < 0){
+            cgroup_dir = NULL;
+            return -1;
+        }
+        if (mkdir (cgroup_dir, 0755) < 0 && errno != EEXIST){
+            saved = errno;
+            free (cgroup_dir);
+            cgroup_dir = NULL;
+            errno = saved;
+            return -1;
+        }
+    }
+
+    /* A policy reloaded without them lifts the caps */
+    if (write_control (cgroup_dir, "memory.max", limits && limits->memory_max ? limits->memory_max : "max") < 0
+        || write_control (cgroup_dir, "cpu.max", limits && limits->cpu_max ? limits->cpu_max : "max") < 0){
+        saved = errno;
+        governor_release ();
+        errno = saved;
+        return -1;
+    }
+
+    if (cgroup_procs < 0){
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/cgroup.procs", cgroup_dir);
+        cgroup_procs = open (path, O_WRONLY | O_CLOEXEC);
+        if (cgroup_procs < 0){
+            saved = errno;
+            governor_release ();
+            errno = saved;
+            return -1;
+        }
+    }
+    return cgroup_procs;
+}
+
+/*
+ * Removes the cgroup of the session. It stays while background commands
+ * still run in it.
+ */
+
+void governor_release (void){
+    if (cgroup_procs >= 0)
+        close (cgroup_procs);
+    cgroup_procs = -1;
+    if (cgroup_dir != NULL)
+        rmdir (cgroup_dir);
+    free (cgroup_dir);
+    cgroup_dir = NULL;
+}
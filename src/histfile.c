@@ -0,0 +1,349 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "histfile.h"
+
+struct histfile{
+    char* path;
+    int fd;
+    int max_lines;
+    char* last;             /* the last line loaded or saved */
+    int compacting;
+    pthread_t compactor;
+};
+
+/*
+ * Creates the directories above path, private to the user.
+ */
+
+static void make_parents (const char* path){
+    char* copy = strdup (path);
+    char* slash = NULL;
+
+    if (copy == NULL)
+        return;
+    for (slash = strchr (copy + 1, '/'); slash; slash = strchr (slash + 1, '/')){
+        *slash = '\0';
+        mkdir (copy, 0700);
+        *slash = '/';
+    }
+    free (copy);
+}
+
+static int write_all (int fd, const char* buf, size_t size){
+    ssize_t n = 0;
+
+    while (size > 0){
+        n = write (fd, buf, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/*
+ * Opens the history file at path, giving a new one its header. Returns
+ * the descriptor, unlocked, or -1.
+ */
+
+static int open_file (const char* path){
+    char magic[HISTFILE_MAGIC_LEN];
+    struct stat st;
+    int fd = -1;
+
+    fd = open (path, O_RDWR | O_CREAT | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+    if (flock (fd, LOCK_EX) < 0 || fstat (fd, &st) < 0)
+        goto fail;
+    if (st.st_size == 0 && write_all (fd, HISTFILE_MAGIC, HISTFILE_MAGIC_LEN) < 0){
+        ftruncate (fd, 0);
+        goto fail;
+    }
+    if (pread (fd, magic, HISTFILE_MAGIC_LEN, 0) != HISTFILE_MAGIC_LEN || memcmp (magic, HISTFILE_MAGIC, HISTFILE_MAGIC_LEN)){
+        errno = EPROTO;
+        goto fail;
+    }
+    flock (fd, LOCK_UN);
+    return fd;
+
+fail:
+    close (fd);
+    return -1;
+}
+
+/*
+ * The length of the line that ends at offset in a mapped history file, or
+ * 0 if no whole line ends there.
+ */
+
+static uint32_t line_before (const char* map, size_t offset){
+    uint32_t len = 0, lead = 0;
+
+    if (offset < HISTFILE_MAGIC_LEN + HISTFILE_FRAME)
+        return 0;
+    memcpy (&len, map + offset - sizeof (len), sizeof (len));
+    if (len == 0 || len > HISTFILE_LINE_MAX || offset - HISTFILE_MAGIC_LEN - HISTFILE_FRAME < len)
+        return 0;
+    memcpy (&lead, map + offset - HISTFILE_FRAME - len, sizeof (lead));
+    return lead == len ? len : 0;
+}
+
+/*
+ * Where the last whole line of a mapped history file ends: the end of the
+ * file, unless a write was cut short by a crash. Only then is the file
+ * walked from the start.
+ */
+
+static size_t lines_end (const char* map, size_t size){
+    size_t offset = HISTFILE_MAGIC_LEN;
+    uint32_t len = 0;
+
+    if (size == HISTFILE_MAGIC_LEN || line_before (map, size) > 0)
+        return size;
+    while (offset + HISTFILE_FRAME <= size){
+        memcpy (&len, map + offset, sizeof (len));
+        if (len == 0 || len > HISTFILE_LINE_MAX || len > size - offset - HISTFILE_FRAME
+            || line_before (map, offset + HISTFILE_FRAME + len) != len)
+            break;
+        offset += HISTFILE_FRAME + len;
+    }
+    return offset;
+}
+
+/*
+ * Walks back from end over at most max lines, that take at most max_bytes.
+ * Returns where the first of them starts, and their number in *count.
+ */
+
+static size_t tail_start (const char* map, size_t end, int max, size_t max_bytes, int* count){
+    size_t offset = end;
+    uint32_t len = 0;
+
+    *count = 0;
+    while (*count < max && (len = line_before (map, offset)) > 0 && end - offset + HISTFILE_FRAME + len <= max_bytes){
+        offset -= HISTFILE_FRAME + len;
+        (*count)++;
+    }
+    return offset;
+}
+
+/*
+ * True when the lines before the kept ones take more room than they do,
+ * or the file is too large or has a line cut short.
+ */
+
+static int needs_compaction (size_t size, size_t start, size_t end){
+    return end != size || end > HISTFILE_MAX_BYTES || start - HISTFILE_MAGIC_LEN > end - start;
+}
+
+/*
+ * Rewrites the history file with its last lines only, at most max_lines
+ * of them and half of HISTFILE_MAX_BYTES. Runs in a thread of its own.
+ */
+
+static void* compact (void* arg){
+    char tmp[4096];
+    histfile* hist = (histfile*) arg;
+    struct stat st, cur;
+    char* map = MAP_FAILED;
+    size_t start = 0, end = 0;
+    int fd = -1, out = -1, count = 0;
+
+    if (snprintf (tmp, sizeof (tmp), "%s.XXXXXX", hist->path) >= (int) sizeof (tmp))
+        return NULL;
+    fd = open (hist->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 || flock (fd, LOCK_EX) < 0)
+        goto out;
+
+    /* Another session may have compacted it first */
+    if (fstat (fd, &st) < 0 || stat (hist->path, &cur) < 0 || st.st_ino != cur.st_ino || st.st_dev != cur.st_dev
+        || st.st_size < HISTFILE_MAGIC_LEN)
+        goto out;
+    map = (char*) mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto out;
+
+    end = lines_end (map, st.st_size);
+    if (!needs_compaction (st.st_size, tail_start (map, end, hist->max_lines, SIZE_MAX, &count), end))
+        goto out;
+    start = tail_start (map, end, hist->max_lines, HISTFILE_MAX_BYTES / 2, &count);
+
+    out = mkostemp (tmp, O_CLOEXEC);
+    if (out < 0)
+        goto out;
+    if (write_all (out, HISTFILE_MAGIC, HISTFILE_MAGIC_LEN) < 0 || write_all (out, map + start, end - start) < 0
+        || fdatasync (out) < 0 || rename (tmp, hist->path) < 0)
+        unlink (tmp);
+    close (out);
+
+out:
+    if (map != MAP_FAILED)
+        munmap (map, st.st_size);
+    if (fd >= 0)
+        close (fd);
+    return NULL;
+}
+
+/*
+ * Opens the history file at path, creating it and the directories above
+ * it if needed, and passes its last max_lines lines to add. Returns NULL
+ * with errno set if it can't be used: a file that isn't a history file is
+ * left alone.
+ */
+
+histfile* histfile_open (const char* path, int max_lines, histfile_add add){
+    histfile* hist = NULL;
+    struct stat st;
+    char* map = MAP_FAILED;
+    size_t start = 0, end = 0, offset = 0;
+    uint32_t len = 0;
+    int count = 0, saved = 0;
+
+    if (max_lines <= 0){
+        errno = EINVAL;
+        return NULL;
+    }
+    hist = (histfile*) calloc (1, sizeof (histfile));
+    if (hist == NULL)
+        return NULL;
+    hist->fd = -1;
+    hist->max_lines = max_lines;
+    hist->path = strdup (path);
+    if (hist->path == NULL)
+        goto fail;
+
+    make_parents (path);
+    hist->fd = open_file (path);
+    if (hist->fd < 0 || flock (hist->fd, LOCK_SH) < 0 || fstat (hist->fd, &st) < 0)
+        goto fail;
+
+    map = (char*) mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, hist->fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+
+    /* Only the lines that are kept are read, from the end */
+    end = lines_end (map, st.st_size);
+    start = tail_start (map, end, max_lines, SIZE_MAX, &count);
+    for (offset=start; offset<end; offset+=HISTFILE_FRAME+len){
+        memcpy (&len, map + offset, sizeof (len));
+        add (map + offset + sizeof (len), len);
+        if (offset + HISTFILE_FRAME + len == end)
+            hist->last = strndup (map + offset + sizeof (len), len);
+    }
+    munmap (map, st.st_size);
+    flock (hist->fd, LOCK_UN);
+
+    if (needs_compaction (st.st_size, start, end))
+        hist->compacting = pthread_create (&hist->compactor, NULL, compact, hist) == 0;
+    return hist;
+
+fail:
+    saved = errno;
+    histfile_close (hist);
+    errno = saved;
+    return NULL;
+}
+
+/*
+ * Takes the lock of the history file, opening it again first if it was
+ * replaced by a compaction, or removed.
+ */
+
+static int lock_current (histfile* hist){
+    struct stat st, cur;
+    int fd = -1;
+
+    for (;;){
+        if (flock (hist->fd, LOCK_EX) < 0 || fstat (hist->fd, &cur) < 0)
+            return -1;
+        if (stat (hist->path, &st) == 0 && st.st_dev == cur.st_dev && st.st_ino == cur.st_ino)
+            return 0;
+        flock (hist->fd, LOCK_UN);
+        fd = open_file (hist->path);
+        if (fd < 0)
+            return -1;
+        close (hist->fd);
+        hist->fd = fd;
+    }
+}
+
+/*
+ * Appends line to the history file. Returns -1 if it couldn't be.
+ */
+
+int histfile_append (histfile* hist, const char* line){
+    char buf[HISTFILE_FRAME + HISTFILE_LINE_MAX];
+    uint32_t len = strlen (line);
+    struct stat st;
+    int status = 0;
+
+    if (len == 0 || len > HISTFILE_LINE_MAX || (hist->last != NULL && !strcmp (hist->last, line)))
+        return 0;
+    memcpy (buf, &len, sizeof (len));
+    memcpy (buf + sizeof (len), line, len);
+    memcpy (buf + sizeof (len) + len, &len, sizeof (len));
+
+    if (lock_current (hist) < 0)
+        return -1;
+    status = fstat (hist->fd, &st);
+    if (status == 0 && (status = write_all (hist->fd, buf, HISTFILE_FRAME + len)) < 0)
+        ftruncate (hist->fd, st.st_size);
+    flock (hist->fd, LOCK_UN);
+
+    free (hist->last);
+    hist->last = strdup (line);
+    return status;
+}
+
+/*
+ * Closes the history file, once a compaction that was started is done.
+ */
+
+void histfile_close (histfile* hist){
+    if (hist == NULL)
+        return;
+    if (hist->compacting)
+        pthread_join (hist->compactor, NULL);
+    if (hist->fd >= 0)
+        close (hist->fd);
+    free (hist->path);
+    free (hist->last);
+    free (hist);
+}
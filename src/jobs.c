@@ -0,0 +1,355 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "audit.h"
+#include "metrics.h"
+
+static job_t job_table[JOB_TABLE_SIZE];
+
+/* How many jobs may run at once, and the id the next one gets */
+static int job_max = JOB_TABLE_SIZE;
+static int job_next_id = 1;
+static int job_loglevel = 0;
+
+/*
+ * Reaps the jobs of the table that finished. Only their pids are waited
+ * for, so the foreground command is left for the launcher.
+ */
+
+void jobs_reap (void){
+    struct rusage usage;
+    int status = 0;
+    int i = 0;
+
+    for (i=0; i<JOB_TABLE_SIZE; i++){
+        if (job_table[i].id == 0 || job_table[i].done)
+            continue;
+        if (wait4 (job_table[i].pid, &status, WNOHANG, &usage) == job_table[i].pid){
+            job_table[i].status = status;
+            job_table[i].usage = usage;
+            clock_gettime (CLOCK_MONOTONIC, &job_table[i].finished);
+            job_table[i].done = 1;
+        }
+    }
+}
+
+/*
+ * Sleeps until a child exits. SIGCHLD is blocked (see run_session()), so
+ * one that exited since the last jobs_reap() is pending and ends the wait
+ * at once.
+ */
+
+static void wait_child (void){
+    sigset_t set;
+
+    sigemptyset (&set);
+    sigaddset (&set, SIGCHLD);
+    while (sigwaitinfo (&set, NULL) < 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * max_jobs is the number of background jobs allowed to run at once; a
+ * negative value means as many as the table holds.
+ */
+
+void jobs_init (int max_jobs, int loglevel){
+    job_max = (max_jobs < 0 || max_jobs > JOB_TABLE_SIZE) ? JOB_TABLE_SIZE : max_jobs;
+    job_loglevel = loglevel;
+}
+
+static int running_jobs (void){
+    int i = 0, count = 0;
+
+    for (i=0; i<JOB_TABLE_SIZE; i++){
+        if (job_table[i].id != 0 && !job_table[i].done)
+            count++;
+    }
+    return count;
+}
+
+/*
+ * True if no other background job may start now.
+ */
+
+int jobs_full (void){
+    jobs_reap ();
+    return running_jobs () >= job_max;
+}
+
+/*
+ * Sleeps until a running job finishes and frees a place for another one.
+ */
+
+void jobs_wait_slot (void){
+    jobs_reap ();
+    while (job_max > 0 && running_jobs () >= job_max){
+        wait_child ();
+        jobs_reap ();
+    }
+}
+
+static double seconds (struct timeval tv){
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void describe_status (int status, char* buf, size_t size){
+    if (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+        snprintf (buf, size, "Done");
+    else if (WIFEXITED (status))
+        snprintf (buf, size, "Exit %d", WEXITSTATUS (status));
+    else if (WIFSIGNALED (status))
+        snprintf (buf, size, "Killed (%s)", strsignal (WTERMSIG (status)));
+    else
+        snprintf (buf, size, "Done");
+}
+
+/*
+ * Prints one line for the job, with its resource usage if it is done.
+ */
+
+static void print_job (FILE* out, job_t* job){
+    char state[64];
+    double real = 0;
+
+    if (!job->done){
+        fprintf (out, "[%d]  %-12s %s\n", job->id, "Running", job->line);
+        return;
+    }
+
+    describe_status (job->status, state, sizeof (state));
+    real = (job->finished.tv_sec - job->started.tv_sec) + (job->finished.tv_nsec - job->started.tv_nsec) / 1e9;
+    fprintf (out, "[%d]  %-12s %s  (%.2fs real, %.2fs user, %.2fs sys)\n", job->id, state, job->line,
+             real, seconds (job->usage.ru_utime), seconds (job->usage.ru_stime));
+}
+
+/*
+ * Logs a finished job and frees its slot.
+ */
+
+static void collect_job (job_t* job){
+    char name[METRICS_NAME];
+    int64_t wall = 0;
+
+    if (metrics_enabled){
+        snprintf (name, sizeof (name), "%.*s", (int) strcspn (job->line, " "), job->line);
+        wall = (job->finished.tv_sec - job->started.tv_sec) * 1000000000LL + job->finished.tv_nsec - job->started.tv_nsec;
+        metrics_ran (name, wall > 0 ? wall : 0, &job->usage);
+    }
+    if (job_loglevel >= 3)
+        audit (LOG_NOTICE, "Job %d (%s) finished with status %d: %.2fs user, %.2fs sys, %ld KB max RSS.",
+                job->id, job->line, job->status, seconds (job->usage.ru_utime),
+                seconds (job->usage.ru_stime), job->usage.ru_maxrss);
+    free (job->line);
+    memset (job, 0, sizeof (job_t));
+}
+
+/*
+ * Records a background command started as pid. Returns its job id, or -1
+ * if it can't be recorded. jobs_reap() only waits for the pids of the
+ * table, so the caller must then end and reap the command itself, or it
+ * stays a zombie until the session exits. jobs_full() and
+ * jobs_wait_slot() keep a slot free beforehand.
+ */
+
+int jobs_add (pid_t pid, char** argv){
+    job_t* job = NULL;
+    size_t len = 0;
+    int i = 0;
+
+    jobs_reap ();
+
+    /* Done jobs nobody asked about (scripts never see a prompt) make way */
+    for (i=0; i<JOB_TABLE_SIZE && job == NULL; i++){
+        if (job_table[i].id == 0)
+            job = &job_table[i];
+    }
+    for (i=0; i<JOB_TABLE_SIZE && job == NULL; i++){
+        if (job_table[i].done){
+            collect_job (&job_table[i]);
+            job = &job_table[i];
+        }
+    }
+    if (job == NULL)
+        return -1;
+
+    for (i=0; argv[i]; i++)
+        len += strlen (argv[i]) + 1;
+    job->line = (char*) malloc (len + 1);
+    if (job->line == NULL)
+        return -1;
+    job->line[0] = '\0';
+    for (i=0; argv[i]; i++){
+        if (i > 0)
+            strcat (job->line, " ");
+        strcat (job->line, argv[i]);
+    }
+
+    /* Recycle ids once the table is empty, like other shells do */
+    if (running_jobs () == 0){
+        job_next_id = 1;
+        for (i=0; i<JOB_TABLE_SIZE; i++){
+            if (job_table[i].id >= job_next_id)
+                job_next_id = job_table[i].id + 1;
+        }
+    }
+
+    job->id = job_next_id++;
+    job->pid = pid;
+    job->done = 0;
+    clock_gettime (CLOCK_MONOTONIC, &job->started);
+    return job->id;
+}
+
+/*
+ * True if a job finished and wasn't reported yet.
+ */
+
+int jobs_done (void){
+    int i = 0;
+
+    for (i=0; i<JOB_TABLE_SIZE; i++){
+        if (job_table[i].id != 0 && job_table[i].done)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Reports the jobs that finished since the last time, and forgets them.
+ */
+
+void jobs_notify (FILE* out){
+    int i = 0;
+
+    jobs_reap ();
+    for (i=0; i<JOB_TABLE_SIZE; i++){
+        if (job_table[i].id != 0 && job_table[i].done){
+            print_job (out, &job_table[i]);
+            collect_job (&job_table[i]);
+        }
+    }
+}
+
+/*
+ * The "jobs" built-in: every job, by id. Finished ones are forgotten once
+ * listed.
+ */
+
+void jobs_list (FILE* out){
+    int i = 0, id = 0, next = 0;
+
+    jobs_reap ();
+    for (id=0; ; id=next){
+        next = 0;
+        for (i=0; i<JOB_TABLE_SIZE; i++){
+            if (job_table[i].id > id && (next == 0 || job_table[i].id < next))
+                next = job_table[i].id;
+        }
+        if (next == 0)
+            break;
+        for (i=0; i<JOB_TABLE_SIZE; i++){
+            if (job_table[i].id == next){
+                print_job (out, &job_table[i]);
+                if (job_table[i].done)
+                    collect_job (&job_table[i]);
+                break;
+            }
+        }
+    }
+}
+
+static job_t* find_job (int id){
+    int i = 0;
+
+    for (i=0; i<JOB_TABLE_SIZE; i++){
+        if (job_table[i].id != 0 && job_table[i].id == id)
+            return &job_table[i];
+    }
+    return NULL;
+}
+
+/*
+ * The "wait" built-in. Waits for job id and stores its wait status in
+ * *status, or waits for every job if id is 0 (*status is then 0). Returns
+ * -1 if there is no such job.
+ */
+
+int jobs_wait (int id, int* status){
+    job_t* job = NULL;
+    int i = 0;
+
+    *status = 0;
+    jobs_reap ();
+
+    if (id != 0){
+        job = find_job (id);
+        if (job == NULL)
+            return -1;
+        while (!job->done){
+            wait_child ();
+            jobs_reap ();
+        }
+        *status = job->status;
+        collect_job (job);
+    }else {
+        while (running_jobs () > 0){
+            wait_child ();
+            jobs_reap ();
+        }
+        for (i=0; i<JOB_TABLE_SIZE; i++){
+            if (job_table[i].id != 0)
+                collect_job (&job_table[i]);
+        }
+    }
+    return 0;
+}
+
+/*
+ * The "kill %n" built-in: sends sig to the process group of job id.
+ * Returns -1 with errno set on failure.
+ */
+
+int jobs_kill (int id, int sig){
+    job_t* job = NULL;
+    int result = 0;
+
+    jobs_reap ();
+    job = find_job (id);
+    if (job == NULL || job->done){
+        errno = ESRCH;
+        result = -1;
+    }else {
+        result = kill (-job->pid, sig);
+    }
+    return result;
+}
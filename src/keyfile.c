@@ -0,0 +1,615 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A GKeyFile for the embedded build. See keyfile.h for what it reads.
+ * A file is kept as its groups in the order they came, each with its keys
+ * and their raw values; values are unescaped when they are read, as glib
+ * does.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "keyfile.h"
+
+/* The codes of glib's G_KEY_FILE_ERROR, for the GErrors set here */
+enum {
+    KEYFILE_ERROR_PARSE = 1,
+    KEYFILE_ERROR_NOT_FOUND = 2,
+    KEYFILE_ERROR_KEY_NOT_FOUND = 3,
+    KEYFILE_ERROR_GROUP_NOT_FOUND = 4,
+    KEYFILE_ERROR_INVALID_VALUE = 5
+};
+
+typedef struct keyfile_pair keyfile_pair;
+struct keyfile_pair{
+    char* key;
+    char* value;
+};
+
+typedef struct keyfile_group keyfile_group;
+struct keyfile_group{
+    char* name;
+    keyfile_pair* pairs;
+    size_t npairs;
+    size_t size;
+};
+
+struct GKeyFile{
+    keyfile_group* groups;
+    size_t ngroups;
+    size_t size;
+};
+
+static void set_error (GError** error, int code, const char* format, ...){
+    va_list ap;
+    GError* err = NULL;
+
+    if (error == NULL || *error != NULL)
+        return;
+    err = (GError*) calloc (1, sizeof (GError));
+    if (err == NULL)
+        return;
+    err->code = code;
+    va_start (ap, format);
+    if (vasprintf (&err->message, format, ap) < 0)
+        err->message = NULL;
+    va_end (ap);
+    *error = err;
+}
+
+static int is_space (char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/*
+ * True if s is well-formed UTF-8: no overlong forms, surrogates or code
+ * points past U+10FFFF.
+ */
+
+static int valid_utf8 (const char* s){
+    static const unsigned long smallest[4] = { 0, 0x80, 0x800, 0x10000 };
+    const unsigned char* p = (const unsigned char*) s;
+    unsigned long cp = 0;
+    int n = 0, i = 0;
+
+    while (*p){
+        if (*p < 0x80){
+            p++;
+            continue;
+        }
+        n = (*p & 0xe0) == 0xc0 ? 1 : (*p & 0xf0) == 0xe0 ? 2 : (*p & 0xf8) == 0xf0 ? 3 : -1;
+        if (n < 0)
+            return 0;
+        cp = *p & (0x3f >> n);
+        for (i=1; i<=n; i++){
+            if ((p[i] & 0xc0) != 0x80)
+                return 0;
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        if (cp < smallest[n] || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            return 0;
+        p += n + 1;
+    }
+    return 1;
+}
+
+static void clear (GKeyFile* key_file){
+    size_t i = 0, j = 0;
+
+    for (i=0; i<key_file->ngroups; i++){
+        for (j=0; j<key_file->groups[i].npairs; j++){
+            free (key_file->groups[i].pairs[j].key);
+            free (key_file->groups[i].pairs[j].value);
+        }
+        free (key_file->groups[i].pairs);
+        free (key_file->groups[i].name);
+    }
+    free (key_file->groups);
+    key_file->groups = NULL;
+    key_file->ngroups = key_file->size = 0;
+}
+
+static keyfile_group* find_group (GKeyFile* key_file, const char* name){
+    size_t i = 0;
+
+    for (i=0; i<key_file->ngroups; i++){
+        if (!strcmp (key_file->groups[i].name, name))
+            return &key_file->groups[i];
+    }
+    return NULL;
+}
+
+static keyfile_pair* find_pair (keyfile_group* group, const char* key){
+    size_t i = 0;
+
+    for (i=0; i<group->npairs; i++){
+        if (!strcmp (group->pairs[i].key, key))
+            return &group->pairs[i];
+    }
+    return NULL;
+}
+
+/*
+ * Grows an array of *size elements to hold one more than used. Returns -1
+ * if there is no memory for it.
+ */
+
+static int grow (void** array, size_t* size, size_t used, size_t elem){
+    size_t bigger = *size ? *size * 2 : 8;
+    void* resized = NULL;
+
+    if (used < *size)
+        return 0;
+    resized = realloc (*array, bigger * elem);
+    if (resized == NULL)
+        return -1;
+    *array = resized;
+    *size = bigger;
+    return 0;
+}
+
+/*
+ * Makes name the current group, adding it the first time. Returns its
+ * index, or -1.
+ */
+
+static long add_group (GKeyFile* key_file, const char* name, size_t len){
+    keyfile_group* group = NULL;
+    size_t i = 0;
+
+    for (i=0; i<key_file->ngroups; i++){
+        if (strlen (key_file->groups[i].name) == len && !strncmp (key_file->groups[i].name, name, len))
+            return i;
+    }
+    if (grow ((void**) &key_file->groups, &key_file->size, key_file->ngroups, sizeof (keyfile_group)) < 0)
+        return -1;
+    group = &key_file->groups[key_file->ngroups];
+    memset (group, 0, sizeof (keyfile_group));
+    group->name = strndup (name, len);
+    if (group->name == NULL)
+        return -1;
+    return key_file->ngroups++;
+}
+
+static int add_pair (keyfile_group* group, char* key, char* value){
+    keyfile_pair* pair = find_pair (group, key);
+
+    if (pair != NULL){
+        free (key);
+        free (pair->value);
+        pair->value = value;
+        return 0;
+    }
+    if (grow ((void**) &group->pairs, &group->size, group->npairs, sizeof (keyfile_pair)) < 0)
+        return -1;
+    group->pairs[group->npairs].key = key;
+    group->pairs[group->npairs].value = value;
+    group->npairs++;
+    return 0;
+}
+
+/*
+ * What glib takes for a key: not empty, no '=', '[' or ']' except around a
+ * locale at the end, and no space at either end.
+ */
+
+static int valid_key (const char* key){
+    const char* q = key + strcspn (key, "=[]");
+
+    if (q == key || key[0] == ' ' || q[-1] == ' ')
+        return 0;
+    if (*q == '['){
+        q++;
+        while ((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z') || (*q >= '0' && *q <= '9')
+               || *q == '-' || *q == '_' || *q == '.' || *q == '@' || (unsigned char) *q >= 0x80)
+            q++;
+        if (*q++ != ']')
+            return 0;
+    }
+    return *q == '\0';
+}
+
+/*
+ * Reads one line, without its newline. current is the index of the group
+ * the keys go to, -1 before the first.
+ */
+
+static int parse_line (GKeyFile* key_file, const char* line, size_t len, long* current, GError** error){
+    const char* end = line + len;
+    const char* p = line;
+    const char* close = NULL;
+    const char* eq = NULL;
+    const char* key_end = NULL;
+    const char* locale = NULL;
+    char* key = NULL;
+    char* value = NULL;
+
+    while (p < end && is_space (*p))
+        p++;
+    if (p == end || *p == '#')
+        return 0;
+
+    if (*p == '['){
+        close = memchr (p, ']', end - p);
+        if (close != NULL){
+            for (eq=close+1; eq<end && (*eq == ' ' || *eq == '\t'); eq++)
+                ;
+            if (eq == end){
+                for (eq=p+1; eq<close && (unsigned char) *eq >= 0x20 && *eq != 0x7f && *eq != '['; eq++)
+                    ;
+                if (close == p + 1 || eq != close){
+                    set_error (error, KEYFILE_ERROR_PARSE, "Invalid group name: %.*s", (int) (close - p - 1), p + 1);
+                    return -1;
+                }
+                *current = add_group (key_file, p + 1, close - p - 1);
+                return *current < 0 ? -1 : 0;
+            }
+        }
+    }
+
+    eq = memchr (p, '=', end - p);
+    if (eq == NULL || eq == p){
+        set_error (error, KEYFILE_ERROR_PARSE,
+                   "Key file contains line \"%.*s\" which is not a key-value pair, group, or comment",
+                   (int) (end - p), p);
+        return -1;
+    }
+    if (*current < 0){
+        set_error (error, KEYFILE_ERROR_PARSE, "Key file does not start with a group");
+        return -1;
+    }
+
+    for (key_end=eq; key_end>p && is_space (key_end[-1]); key_end--)
+        ;
+    key = strndup (p, key_end - p);
+    if (key == NULL)
+        return -1;
+    if (!valid_key (key)){
+        set_error (error, KEYFILE_ERROR_PARSE, "Invalid key name: %s", key);
+        free (key);
+        return -1;
+    }
+    /* glib keeps the translations of the locale only, and AGROS runs
+       in the C locale */
+    locale = key + strcspn (key, "[");
+    if (locale[0] == '[' && locale[1] != ']'){
+        free (key);
+        return 0;
+    }
+    for (p=eq+1; p<end && is_space (*p); p++)
+        ;
+    value = strndup (p, end - p);
+    if (value == NULL || add_pair (&key_file->groups[*current], key, value) < 0){
+        free (key);
+        free (value);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Unescapes value into a new string. With pieces, also splits it on the
+ * ';' that aren't escaped, into a NULL-terminated array of *count strings,
+ * and returns NULL on an invalid escape; a plain string keeps them as they
+ * are, as glib does.
+ */
+
+static char* unescape (const char* value, char*** pieces, size_t* count, GError** error){
+    char* string = (char*) malloc (strlen (value) + 1);
+    char** list = NULL;
+    size_t size = 0, n = 0;
+    const char* p = value;
+    char* q = string;
+    char* q0 = string;
+
+    if (string == NULL)
+        return NULL;
+
+    while (*p){
+        if (*p == '\\'){
+            switch (*++p){
+            case 's':  *q = ' ';  break;
+            case 'n':  *q = '\n'; break;
+            case 't':  *q = '\t'; break;
+            case 'r':  *q = '\r'; break;
+            case '\\': *q = '\\'; break;
+            case '\0':
+                if (pieces != NULL){
+                    set_error (error, KEYFILE_ERROR_INVALID_VALUE, "Key file contains escape character at end of line");
+                    goto invalid;
+                }
+                goto done;
+            case ';':
+                if (pieces != NULL){
+                    *q = ';';
+                    break;
+                }
+                /* fall through */
+            default:
+                if (pieces != NULL){
+                    set_error (error, KEYFILE_ERROR_INVALID_VALUE, "Key file contains invalid escape sequence \"\\%c\"", *p);
+                    goto invalid;
+                }
+                *q++ = '\\';
+                *q = *p;
+                break;
+            }
+        }else {
+            *q = *p;
+            if (pieces != NULL && *p == ';'){
+                if (grow ((void**) &list, &size, n + 1, sizeof (char*)) < 0 || (list[n] = strndup (q0, q - q0)) == NULL)
+                    goto invalid;
+                n++;
+                q0 = q + 1;
+            }
+        }
+        p++;
+        q++;
+    }
+done:
+    *q = '\0';
+
+    if (pieces != NULL){
+        if (grow ((void**) &list, &size, n + 1, sizeof (char*)) < 0)
+            goto invalid;
+        if (q0 < q && (list[n++] = strdup (q0)) == NULL){
+            n--;
+            goto invalid;
+        }
+        list[n] = NULL;
+        *pieces = list;
+        *count = n;
+    }
+    return string;
+
+invalid:
+    while (n > 0)
+        free (list[--n]);
+    free (list);
+    free (string);
+    return NULL;
+}
+
+static const char* get_value (GKeyFile* key_file, const char* group, const char* key, GError** error){
+    keyfile_group* g = find_group (key_file, group);
+    keyfile_pair* pair = NULL;
+
+    if (g == NULL){
+        set_error (error, KEYFILE_ERROR_GROUP_NOT_FOUND, "Key file does not have group \"%s\"", group);
+        return NULL;
+    }
+    pair = find_pair (g, key);
+    if (pair == NULL){
+        set_error (error, KEYFILE_ERROR_KEY_NOT_FOUND, "Key file does not have key \"%s\" in group \"%s\"", key, group);
+        return NULL;
+    }
+    return pair->value;
+}
+
+static const char* get_utf8_value (GKeyFile* key_file, const char* group, const char* key, GError** error){
+    const char* value = get_value (key_file, group, key, error);
+
+    if (value != NULL && !valid_utf8 (value)){
+        set_error (error, KEYFILE_ERROR_INVALID_VALUE,
+                   "Key file contains key \"%s\" with value \"%s\" which is not UTF-8", key, value);
+        return NULL;
+    }
+    return value;
+}
+
+GKeyFile* g_key_file_new (void){
+    return (GKeyFile*) calloc (1, sizeof (GKeyFile));
+}
+
+void g_key_file_free (GKeyFile* key_file){
+    if (key_file == NULL)
+        return;
+    clear (key_file);
+    free (key_file);
+}
+
+gboolean g_key_file_load_from_data (GKeyFile* key_file, const gchar* data, gsize length,
+                                    GKeyFileFlags flags, GError** error){
+    const char* end = data + length;
+    const char* line = data;
+    const char* next = NULL;
+    size_t len = 0;
+    long current = -1;
+
+    (void) flags;
+    clear (key_file);
+    for (; line<end; line=next){
+        next = memchr (line, '\n', end - line);
+        next = next != NULL ? next + 1 : end;
+        len = next - line;
+        if (len > 0 && line[len-1] == '\n')
+            len--;
+        if (len > 0 && line[len-1] == '\r')
+            len--;
+        if (parse_line (key_file, line, len, &current, error) < 0){
+            /* Only a parse error sets one, anything else is memory */
+            set_error (error, KEYFILE_ERROR_PARSE, "%s", strerror (ENOMEM));
+            clear (key_file);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+gboolean g_key_file_load_from_file (GKeyFile* key_file, const gchar* file, GKeyFileFlags flags,
+                                    GError** error){
+    struct stat st;
+    char* data = NULL;
+    ssize_t got = 0;
+    size_t len = 0;
+    gboolean result = FALSE;
+    int fd = open (file, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat (fd, &st) < 0)
+        goto failed;
+    if (S_ISDIR (st.st_mode)){
+        errno = EISDIR;
+        goto failed;
+    }
+    data = (char*) malloc (st.st_size + 1);
+    if (data == NULL)
+        goto failed;
+    while ((got = read (fd, data + len, st.st_size - len)) > 0 && len + got < (size_t) st.st_size)
+        len += got;
+    if (got < 0)
+        goto failed;
+    len += got;
+
+    result = g_key_file_load_from_data (key_file, data, len, flags, error);
+    goto out;
+
+failed:
+    set_error (error, KEYFILE_ERROR_NOT_FOUND, "%s", strerror (errno));
+out:
+    if (fd >= 0)
+        close (fd);
+    free (data);
+    return result;
+}
+
+gboolean g_key_file_has_group (GKeyFile* key_file, const gchar* group){
+    return find_group (key_file, group) != NULL;
+}
+
+gboolean g_key_file_has_key (GKeyFile* key_file, const gchar* group, const gchar* key, GError** error){
+    keyfile_group* g = find_group (key_file, group);
+
+    if (g == NULL){
+        set_error (error, KEYFILE_ERROR_GROUP_NOT_FOUND, "Key file does not have group \"%s\"", group);
+        return FALSE;
+    }
+    return find_pair (g, key) != NULL;
+}
+
+gchar** g_key_file_get_groups (GKeyFile* key_file, gsize* length){
+    gchar** groups = (gchar**) calloc (key_file->ngroups + 1, sizeof (gchar*));
+    size_t i = 0;
+
+    if (groups == NULL)
+        return NULL;
+    for (i=0; i<key_file->ngroups; i++){
+        if ((groups[i] = strdup (key_file->groups[i].name)) == NULL){
+            g_strfreev (groups);
+            return NULL;
+        }
+    }
+    if (length != NULL)
+        *length = key_file->ngroups;
+    return groups;
+}
+
+gchar** g_key_file_get_keys (GKeyFile* key_file, const gchar* group, gsize* length, GError** error){
+    keyfile_group* g = find_group (key_file, group);
+    gchar** keys = NULL;
+    size_t i = 0;
+
+    if (g == NULL){
+        set_error (error, KEYFILE_ERROR_GROUP_NOT_FOUND, "Key file does not have group \"%s\"", group);
+        return NULL;
+    }
+    keys = (gchar**) calloc (g->npairs + 1, sizeof (gchar*));
+    if (keys == NULL)
+        return NULL;
+    for (i=0; i<g->npairs; i++){
+        if ((keys[i] = strdup (g->pairs[i].key)) == NULL){
+            g_strfreev (keys);
+            return NULL;
+        }
+    }
+    if (length != NULL)
+        *length = g->npairs;
+    return keys;
+}
+
+gchar* g_key_file_get_string (GKeyFile* key_file, const gchar* group, const gchar* key, GError** error){
+    const char* value = get_utf8_value (key_file, group, key, error);
+
+    return value != NULL ? unescape (value, NULL, NULL, error) : NULL;
+}
+
+int g_key_file_get_integer (GKeyFile* key_file, const gchar* group, const gchar* key, GError** error){
+    const char* value = get_value (key_file, group, key, error);
+    char* end = NULL;
+    long result = 0;
+
+    if (value == NULL)
+        return 0;
+    errno = 0;
+    result = strtol (value, &end, 10);
+    if (*value == '\0' || (*end != '\0' && !is_space (*end))){
+        set_error (error, KEYFILE_ERROR_INVALID_VALUE, "Value \"%s\" cannot be interpreted as a number.", value);
+        return 0;
+    }
+    if (errno == ERANGE || result > INT_MAX || result < INT_MIN){
+        set_error (error, KEYFILE_ERROR_INVALID_VALUE, "Integer value \"%s\" out of range", value);
+        return 0;
+    }
+    return (int) result;
+}
+
+gchar** g_key_file_get_string_list (GKeyFile* key_file, const gchar* group, const gchar* key,
+                                    gsize* length, GError** error){
+    const char* value = get_utf8_value (key_file, group, key, error);
+    char** pieces = NULL;
+    char* string = NULL;
+    size_t count = 0;
+
+    if (value == NULL || (string = unescape (value, &pieces, &count, error)) == NULL)
+        return NULL;
+    free (string);
+    if (length != NULL)
+        *length = count;
+    return pieces;
+}
+
+void g_free (void* mem){
+    free (mem);
+}
+
+void g_strfreev (gchar** str_array){
+    size_t i = 0;
+
+    for (i=0; str_array != NULL && str_array[i] != NULL; i++)
+        free (str_array[i]);
+    free (str_array);
+}
+
+void g_error_free (GError* error){
+    if (error == NULL)
+        return;
+    free (error->message);
+    free (error);
+}
@@ -0,0 +1,256 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "launcher.h"
+
+/* From linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+
+/* The child only makes a few system calls before exec, but
+   execvp() builds candidate paths on the stack */
+#define SPAWN_STACK_SIZE (128 * 1024)
+
+/*
+ * The stack the child runs on. The parent is suspended until the child
+ * has called exec, so a single stack is enough for the whole session.
+ */
+
+static char* spawn_stack = NULL;
+
+/* Set to 0 the first time the kernel refuses CLONE_PIDFD */
+static int spawn_use_pidfd = 1;
+
+extern char** environ;
+
+/*
+ * Applies the limits of the profile to the child. System calls only.
+ */
+
+static int apply_limits (spawn_t* sp){
+    const spawn_limits* limits = sp->limits;
+    int i = 0;
+
+    if (sp->cgroup_fd >= 0 && write (sp->cgroup_fd, "0", 1) < 0)
+        return -1;
+    if (limits == NULL)
+        return 0;
+
+    for (i=0; i<limits->rlimit_nbr; i++){
+        if (setrlimit (limits->resources[i], &limits->values[i]) < 0)
+            return -1;
+    }
+    if (limits->set_nice && setpriority (PRIO_PROCESS, 0, limits->nice) < 0)
+        return -1;
+    if (limits->ioprio != 0 && syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, limits->ioprio) < 0)
+        return -1;
+    if (limits->set_affinity && sched_setaffinity (0, sizeof (cpu_set_t), &limits->affinity) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Runs in the child, sharing the parent's memory. It must not call
+ * anything that takes a lock or allocates: only plain system calls.
+ */
+
+static int spawn_child (void* arg){
+    spawn_t* sp = (spawn_t*) arg;
+    struct sigaction sa;
+    sigset_t none;
+    pid_t pgrp = 0;
+    int sig = 0, fd = 0;
+
+    /* Handlers installed by AGROS would run on the parent's data. Reset
+       them before unblocking signals; ignored signals stay ignored. */
+    for (sig=1; sig<NSIG; sig++){
+        if (sigaction (sig, NULL, &sa) == 0 && sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL){
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigemptyset (&sa.sa_mask);
+            sigaction (sig, &sa, NULL);
+        }
+    }
+    /* With every signal blocked, a group that isn't the foreground one
+       may still take the terminal */
+    if (sp->pgroup){
+        setpgid (0, sp->pgid);
+        pgrp = getpgrp ();
+        if (sp->tty_fd >= 0)
+            ioctl (sp->tty_fd, TIOCSPGRP, &pgrp);
+    }
+    if (sp->ctty_fd >= 0 && (setsid () < 0 || ioctl (sp->ctty_fd, TIOCSCTTY, 0) < 0)){
+        sp->error = errno;
+        _exit (127);
+    }
+
+    for (fd=0; fd<3; fd++){
+        if (sp->fds[fd] >= 0 && dup2 (sp->fds[fd], fd) < 0){
+            sp->error = errno;
+            _exit (127);
+        }
+    }
+
+    if (apply_limits (sp) < 0){
+        sp->error = errno;
+        _exit (127);
+    }
+
+    /* Not the parent's mask: the session blocks SIGCHLD for its event loop */
+    sigemptyset (&none);
+    sigprocmask (SIG_SETMASK, &none, NULL);
+
+    if (sp->timed)
+        clock_gettime (CLOCK_MONOTONIC, &sp->exec_time);
+
+    if (sp->exec_path != NULL){
+        execve (sp->exec_path, sp->argv, environ);
+    }else if (sp->exec_fd >= 0){
+        syscall (SYS_execveat, sp->exec_fd, "", sp->argv, environ, AT_EMPTY_PATH);
+    }else {
+        execvp (sp->argv[0], sp->argv);
+    }
+
+    sp->error = errno;
+    _exit (127);
+}
+
+/*
+ * Starts sp->argv. Returns 0 once the command is running, or -1 with
+ * sp->error set if the process could not be created or exec failed. In
+ * the latter case the child has already been reaped, and sp->pid is left
+ * set to what it was.
+ */
+
+int spawn_process (spawn_t* sp){
+    sigset_t all;
+    int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+    int pidfd = -1;
+    pid_t pid = 0;
+
+    sp->pid = -1;
+    sp->pidfd = -1;
+    sp->error = 0;
+
+    if (spawn_stack == NULL){
+        spawn_stack = (char*) mmap (NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (spawn_stack == MAP_FAILED){
+            spawn_stack = NULL;
+            sp->error = errno;
+            return -1;
+        }
+    }
+
+    sigfillset (&all);
+    sigprocmask (SIG_BLOCK, &all, &sp->saved_mask);
+
+    if (spawn_use_pidfd){
+        pid = clone (spawn_child, spawn_stack + SPAWN_STACK_SIZE, flags | CLONE_PIDFD, sp, &pidfd);
+        if (pid < 0 && errno == EINVAL)
+            spawn_use_pidfd = 0;
+    }
+    if (!spawn_use_pidfd){
+        pidfd = -1;
+        pid = clone (spawn_child, spawn_stack + SPAWN_STACK_SIZE, flags, sp);
+    }
+    if (pid < 0)
+        sp->error = errno;
+
+    sigprocmask (SIG_SETMASK, &sp->saved_mask, NULL);
+
+    if (pid < 0)
+        return -1;
+
+    sp->pid = pid;
+    if (sp->error != 0){
+        waitpid (pid, NULL, 0);
+        if (pidfd >= 0)
+            close (pidfd);
+        return -1;
+    }
+
+    sp->pidfd = pidfd;
+    return 0;
+}
+
+/*
+ * Waits for the command to finish. Returns -1 if it can't be waited for.
+ */
+
+int spawn_wait (spawn_t* sp, int* status){
+    pid_t pid = 0;
+
+    do {
+        pid = wait4 (sp->pid, status, 0, &sp->usage);
+    } while (pid < 0 && errno == EINTR);
+
+    if (pid < 0)
+        memset (&sp->usage, 0, sizeof (sp->usage));
+    spawn_release (sp);
+    return pid < 0 ? -1 : 0;
+}
+
+/*
+ * Collects the command if it has finished, without waiting. Returns 1
+ * with *status set if it has, 0 if it is still running and -1 if it can't
+ * be waited for. A command that was stopped is also reported, with a
+ * status for which WIFSTOPPED() is true; it is still to be collected.
+ * The pidfd is kept until spawn_release().
+ */
+
+int spawn_reap (spawn_t* sp, int* status){
+    pid_t pid = 0;
+
+    do {
+        pid = wait4 (sp->pid, status, WNOHANG | WUNTRACED, &sp->usage);
+    } while (pid < 0 && errno == EINTR);
+
+    if (pid == 0)
+        return 0;
+    if (pid < 0)
+        memset (&sp->usage, 0, sizeof (sp->usage));
+    return pid < 0 ? -1 : 1;
+}
+
+/*
+ * Forgets about a command without waiting for it.
+ */
+
+void spawn_release (spawn_t* sp){
+    if (sp->pidfd >= 0)
+        close (sp->pidfd);
+    sp->pidfd = -1;
+}
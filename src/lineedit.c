@@ -0,0 +1,701 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A line editor for the embedded build. See lineedit.h for what it does.
+ * The terminal is put in raw mode while a line is read only, so the
+ * commands AGROS runs get it as it was. The whole line is drawn again
+ * after each key, in a single write().
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include "lineedit.h"
+
+/* Where the word to complete starts, as readline's default */
+#define LINEEDIT_WORD_BREAKS    " \t\n\"\\'`@$><=;|&{("
+
+/* More matches than that are listed only if the user says so */
+#define LINEEDIT_QUERY_ITEMS    100
+
+/* The Delete key, which has no control character of its own. CTRL() is
+   <termios.h>'s */
+#define KEY_DELETE              0x100
+
+const char* rl_readline_name = NULL;
+rl_completion_func_t* rl_attempted_completion_function = NULL;
+int history_base = 1;
+int history_length = 0;
+
+/* NULL-terminated, as history_list() returns it */
+static HIST_ENTRY** history = NULL;
+static int history_size = 0;
+
+/* At most that many lines are kept, -1 for no limit */
+static int history_max = -1;
+
+static struct termios saved_termios;
+static int raw_mode = 0;
+
+/*
+ * The line being edited. hist_pos is the line of the history shown,
+ * history_length for the new one, which is kept in pending meanwhile.
+ */
+
+typedef struct lineedit lineedit;
+struct lineedit{
+    const char* prompt;
+    char* buf;
+    size_t len;
+    size_t pos;
+    size_t size;
+    int hist_pos;
+    char* pending;
+};
+
+static void write_all (const char* data, size_t len){
+    ssize_t n = 0;
+
+    while (len > 0){
+        n = write (STDOUT_FILENO, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+static void raw_off (void){
+    if (raw_mode){
+        tcsetattr (STDIN_FILENO, TCSADRAIN, &saved_termios);
+        raw_mode = 0;
+    }
+}
+
+static int raw_on (void){
+    static int registered = 0;
+    struct termios raw;
+
+    if (tcgetattr (STDIN_FILENO, &saved_termios) < 0)
+        return -1;
+    if (!registered){
+        atexit (raw_off);
+        registered = 1;
+    }
+    raw = saved_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr (STDIN_FILENO, TCSADRAIN, &raw) < 0)
+        return -1;
+    raw_mode = 1;
+    return 0;
+}
+
+static int columns (void){
+    struct winsize ws;
+
+    if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0)
+        return 80;
+    return ws.ws_col;
+}
+
+/* The columns taken by len bytes of UTF-8: the bytes that start a character */
+static size_t width (const char* s, size_t len){
+    size_t n = 0, i = 0;
+
+    for (i=0; i<len; i++)
+        n += ((unsigned char) s[i] & 0xc0) != 0x80;
+    return n;
+}
+
+static size_t next_char (lineedit* le, size_t i){
+    if (i < le->len)
+        i++;
+    while (i < le->len && ((unsigned char) le->buf[i] & 0xc0) == 0x80)
+        i++;
+    return i;
+}
+
+static size_t prev_char (lineedit* le, size_t i){
+    if (i > 0)
+        i--;
+    while (i > 0 && ((unsigned char) le->buf[i] & 0xc0) == 0x80)
+        i--;
+    return i;
+}
+
+/*
+ * Draws the prompt and the part of the line around the cursor that fits,
+ * and puts the cursor back.
+ */
+
+static void refresh (lineedit* le){
+    size_t plen = strlen (le->prompt);
+    size_t pwidth = width (le->prompt, plen);
+    size_t cols = columns ();
+    size_t start = 0, end = le->len, used = 0;
+    char* out = NULL;
+
+    while (start < le->pos && pwidth + width (le->buf + start, le->pos - start) >= cols)
+        start = next_char (le, start);
+    while (end > le->pos && pwidth + width (le->buf + start, end - start) >= cols)
+        end = prev_char (le, end);
+
+    out = (char*) malloc (plen + (end - start) + 32);
+    if (out == NULL)
+        return;
+    out[used++] = '\r';
+    memcpy (out + used, le->prompt, plen);
+    used += plen;
+    memcpy (out + used, le->buf + start, end - start);
+    used += end - start;
+    used += sprintf (out + used, "\x1b[0K\r");
+    if (pwidth + width (le->buf + start, le->pos - start) > 0)
+        used += sprintf (out + used, "\x1b[%zuC", pwidth + width (le->buf + start, le->pos - start));
+    write_all (out, used);
+    free (out);
+}
+
+static int insert (lineedit* le, const char* s, size_t n){
+    char* bigger = NULL;
+    size_t size = le->size;
+
+    while (le->len + n + 1 > size)
+        size *= 2;
+    if (size != le->size){
+        bigger = (char*) realloc (le->buf, size);
+        if (bigger == NULL)
+            return -1;
+        le->buf = bigger;
+        le->size = size;
+    }
+    memmove (le->buf + le->pos + n, le->buf + le->pos, le->len - le->pos + 1);
+    memcpy (le->buf + le->pos, s, n);
+    le->len += n;
+    le->pos += n;
+    return 0;
+}
+
+static void delete_range (lineedit* le, size_t from, size_t to){
+    memmove (le->buf + from, le->buf + to, le->len - to + 1);
+    le->len -= to - from;
+    if (le->pos > to)
+        le->pos -= to - from;
+    else if (le->pos > from)
+        le->pos = from;
+}
+
+static void set_line (lineedit* le, const char* line){
+    le->len = le->pos = 0;
+    le->buf[0] = '\0';
+    insert (le, line, strlen (line));
+}
+
+static void show_history (lineedit* le, int to){
+    if (to < 0 || to > history_length || to == le->hist_pos)
+        return;
+    if (le->hist_pos == history_length){
+        free (le->pending);
+        le->pending = strdup (le->buf);
+    }
+    le->hist_pos = to;
+    if (to < history_length)
+        set_line (le, history[to]->line);
+    else
+        set_line (le, le->pending != NULL ? le->pending : "");
+}
+
+static int compare_matches (const void* a, const void* b){
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Lists the matches sorted, in columns down then across, as readline
+ * does, under the line.
+ */
+
+static void list_matches (char** matches){
+    char** sorted = NULL;
+    char* line = NULL;
+    char answer = 0;
+    size_t n = 0, i = 0, kept = 0, widest = 0, cols = columns ();
+    size_t per_line = 0, rows = 0, row = 0, col = 0, used = 0;
+
+    while (matches[n] != NULL)
+        n++;
+    sorted = (char**) malloc (n * sizeof (char*));
+    if (sorted == NULL)
+        return;
+    memcpy (sorted, matches, n * sizeof (char*));
+    qsort (sorted, n, sizeof (char*), compare_matches);
+    for (i=0; i<n; i++){
+        if (kept > 0 && !strcmp (sorted[kept-1], sorted[i]))
+            continue;
+        sorted[kept++] = sorted[i];
+        if (width (sorted[i], strlen (sorted[i])) > widest)
+            widest = width (sorted[i], strlen (sorted[i]));
+    }
+
+    write_all ("\n", 1);
+    if (kept > LINEEDIT_QUERY_ITEMS){
+        line = NULL;
+        if (asprintf (&line, "Display all %zu possibilities? (y or n)", kept) > 0)
+            write_all (line, strlen (line));
+        free (line);
+        while (read (STDIN_FILENO, &answer, 1) < 0 && errno == EINTR)
+            ;
+        write_all ("\n", 1);
+        if (answer != 'y' && answer != 'Y' && answer != ' '){
+            free (sorted);
+            return;
+        }
+    }
+
+    per_line = cols / (widest + 2) > 0 ? cols / (widest + 2) : 1;
+    rows = (kept + per_line - 1) / per_line;
+    line = (char*) malloc (per_line * (widest + 2) * 4 + 2);
+    for (row=0; line != NULL && row<rows; row++){
+        used = 0;
+        for (col=0; col<per_line && col * rows + row < kept; col++){
+            i = col * rows + row;
+            used += sprintf (line + used, "%s", sorted[i]);
+            if ((col + 1) * rows + row < kept)
+                used += sprintf (line + used, "%*s", (int) (widest + 2 - width (sorted[i], strlen (sorted[i]))), "");
+        }
+        line[used++] = '\n';
+        write_all (line, used);
+    }
+    free (line);
+    free (sorted);
+}
+
+/*
+ * Completes the word before the cursor. Returns 1 if the line changed; a
+ * Tab that changes nothing lists the matches when again is set.
+ */
+
+static int complete (lineedit* le, int again){
+    char** matches = NULL;
+    char* text = NULL;
+    size_t start = le->pos, i = 0;
+    int changed = 0;
+
+    while (start > 0 && strchr (LINEEDIT_WORD_BREAKS, le->buf[start-1]) == NULL)
+        start--;
+    text = strndup (le->buf + start, le->pos - start);
+    if (text != NULL && rl_attempted_completion_function != NULL)
+        matches = rl_attempted_completion_function (text, start, le->pos);
+
+    if (matches == NULL || matches[0] == NULL){
+        write_all ("\a", 1);
+    }else if (matches[1] == NULL || strlen (matches[0]) > le->pos - start){
+        delete_range (le, start, le->pos);
+        insert (le, matches[0], strlen (matches[0]));
+        if (matches[1] == NULL)
+            insert (le, " ", 1);
+        changed = 1;
+    }else if (again){
+        list_matches (matches + 1);
+    }else {
+        write_all ("\a", 1);
+    }
+
+    for (i=0; matches != NULL && matches[i] != NULL; i++)
+        free (matches[i]);
+    free (matches);
+    free (text);
+    return changed;
+}
+
+/*
+ * Reads the rest of an escape sequence and returns the key it stands for
+ * as the control character that does the same, or 0.
+ */
+
+static int read_escape (void){
+    char seq[8];
+    size_t n = 0;
+
+    if (read (STDIN_FILENO, &seq[0], 1) != 1)
+        return 0;
+    if (seq[0] == 'O'){
+        if (read (STDIN_FILENO, &seq[0], 1) != 1)
+            return 0;
+    }else if (seq[0] == '['){
+        /* Parameters, then the final byte */
+        do {
+            if (read (STDIN_FILENO, &seq[n], 1) != 1)
+                return 0;
+        } while ((seq[n] < 0x40 || seq[n] > 0x7e) && ++n < sizeof (seq) - 1);
+        if (seq[n] == '~'){
+            switch (seq[0]){
+            case '1': case '7': return CTRL ('A');
+            case '4': case '8': return CTRL ('E');
+            case '3':           return KEY_DELETE;
+            }
+            return 0;
+        }
+        seq[0] = seq[n];
+    }else {
+        return 0;
+    }
+
+    switch (seq[0]){
+    case 'A': return CTRL ('P');
+    case 'B': return CTRL ('N');
+    case 'C': return CTRL ('F');
+    case 'D': return CTRL ('B');
+    case 'H': return CTRL ('A');
+    case 'F': return CTRL ('E');
+    }
+    return 0;
+}
+
+/*
+ * The line being read, between rl_callback_handler_install() and the end
+ * of the line. Without a terminal, or on a dumb one, plain is set: the
+ * prompt is printed once and the line is read as it comes.
+ */
+
+static lineedit current;
+static rl_vcpfunc_t* line_handler = NULL;
+static int plain = 0;
+static int tabbed = 0;
+
+static void forget_line (void){
+    raw_off ();
+    free ((char*) current.prompt);
+    free (current.buf);
+    free (current.pending);
+    memset (&current, 0, sizeof (current));
+    line_handler = NULL;
+}
+
+/*
+ * Hands line (NULL at the end of the input) to the handler. The handler
+ * is removed first, so the next line needs rl_callback_handler_install().
+ */
+
+static void accept_line (char* line){
+    rl_vcpfunc_t* handler = line_handler;
+
+    if (line == current.buf)
+        current.buf = NULL;
+    forget_line ();
+    handler (line);
+}
+
+void rl_callback_handler_install (const char* prompt, rl_vcpfunc_t* handler){
+    const char* term = getenv ("TERM");
+
+    forget_line ();
+    current.prompt = strdup (prompt != NULL ? prompt : "");
+    current.hist_pos = history_length;
+    current.size = 128;
+    current.buf = (char*) calloc (1, current.size);
+    if (current.prompt == NULL || current.buf == NULL){
+        forget_line ();
+        return;
+    }
+    line_handler = handler;
+    tabbed = 0;
+
+    fflush (stdout);
+    plain = !isatty (STDIN_FILENO) || (term != NULL && !strcmp (term, "dumb")) || raw_on () < 0;
+    if (plain)
+        write_all (current.prompt, strlen (current.prompt));
+    else
+        refresh (&current);
+}
+
+void rl_callback_handler_remove (void){
+    forget_line ();
+}
+
+/*
+ * The line from a pipe or a dumb terminal. Read a byte at a time so that
+ * nothing past the line is taken from the commands that read stdin next.
+ */
+
+static void read_plain (void){
+    ssize_t n = 0;
+    char c = 0;
+
+    n = read (STDIN_FILENO, &c, 1);
+    if (n < 0 && errno == EINTR)
+        return;
+    if (n == 0 && current.len == 0){
+        accept_line (NULL);
+        return;
+    }
+    if (n <= 0 || c == '\n'){
+        accept_line (current.buf);
+        return;
+    }
+    insert (&current, &c, 1);
+}
+
+/*
+ * Reads a key, which may take more than a byte, and does what it says.
+ */
+
+void rl_callback_read_char (void){
+    lineedit* le = &current;
+    char c[4];
+    ssize_t n = 0;
+    int key = 0, more = 0, i = 0;
+
+    if (line_handler == NULL)
+        return;
+    if (plain){
+        read_plain ();
+        return;
+    }
+
+    n = read (STDIN_FILENO, c, 1);
+    if (n < 0 && errno == EINTR)
+        return;
+    if (n <= 0){
+        accept_line (NULL);
+        return;
+    }
+    key = (unsigned char) c[0];
+    if (key == 0x1b)
+        key = read_escape ();
+
+    if (key == '\t'){
+        if (complete (le, tabbed))
+            tabbed = 0;
+        else
+            tabbed = !tabbed;
+        refresh (le);
+        return;
+    }
+    tabbed = 0;
+
+    switch (key){
+    case '\r':
+    case '\n':
+        le->pos = le->len;
+        refresh (le);
+        write_all ("\n", 1);
+        accept_line (le->buf);
+        return;
+    case CTRL ('C'):
+        write_all ("^C\n", 3);
+        le->len = le->pos = 0;
+        le->buf[0] = '\0';
+        le->hist_pos = history_length;
+        break;
+    case CTRL ('D'):
+        if (le->len == 0){
+            accept_line (NULL);
+            return;
+        }
+        /* fall through */
+    case KEY_DELETE:
+        if (le->pos < le->len)
+            delete_range (le, le->pos, next_char (le, le->pos));
+        break;
+    case CTRL ('H'):
+    case 0x7f:
+        if (le->pos > 0)
+            delete_range (le, prev_char (le, le->pos), le->pos);
+        break;
+    case CTRL ('A'):
+        le->pos = 0;
+        break;
+    case CTRL ('E'):
+        le->pos = le->len;
+        break;
+    case CTRL ('B'):
+        le->pos = prev_char (le, le->pos);
+        break;
+    case CTRL ('F'):
+        le->pos = next_char (le, le->pos);
+        break;
+    case CTRL ('K'):
+        delete_range (le, le->pos, le->len);
+        break;
+    case CTRL ('U'):
+        delete_range (le, 0, le->pos);
+        break;
+    case CTRL ('W'):
+        i = le->pos;
+        while (i > 0 && le->buf[i-1] == ' ')
+            i--;
+        while (i > 0 && le->buf[i-1] != ' ')
+            i--;
+        delete_range (le, i, le->pos);
+        break;
+    case CTRL ('L'):
+        write_all ("\x1b[H\x1b[2J", 7);
+        break;
+    case CTRL ('P'):
+        show_history (le, le->hist_pos - 1);
+        break;
+    case CTRL ('N'):
+        show_history (le, le->hist_pos + 1);
+        break;
+    default:
+        if (key < 0x20 || key == 0x7f || key > 0xff)
+            break;
+        /* The rest of a UTF-8 character comes before it's drawn */
+        more = key >= 0xf0 ? 3 : key >= 0xe0 ? 2 : key >= 0xc0 ? 1 : 0;
+        for (i=1; i<=more; i++){
+            while ((n = read (STDIN_FILENO, &c[i], 1)) < 0 && errno == EINTR)
+                ;
+            if (n != 1){
+                accept_line (NULL);
+                return;
+            }
+        }
+        insert (le, c, more + 1);
+        break;
+    }
+    refresh (le);
+}
+
+/*
+ * Takes the prompt and the line off the screen, so that something can be
+ * printed in their place, and draws them again.
+ */
+
+int rl_clear_visible_line (void){
+    if (line_handler != NULL && !plain)
+        write_all ("\r\x1b[0K", 5);
+    return 0;
+}
+
+int rl_forced_update_display (void){
+    if (line_handler != NULL && !plain)
+        refresh (&current);
+    return 0;
+}
+
+char** rl_completion_matches (const char* text, rl_compentry_func_t* generator){
+    char** matches = NULL;
+    char** bigger = NULL;
+    char* match = NULL;
+    size_t n = 0, size = 0, common = 0, i = 0;
+
+    while ((match = generator (text, n)) != NULL){
+        if (n + 2 >= size){
+            size = size ? size * 2 : 16;
+            bigger = (char**) realloc (matches, size * sizeof (char*));
+            if (bigger == NULL){
+                free (match);
+                break;
+            }
+            matches = bigger;
+        }
+        matches[++n] = match;
+    }
+    if (n == 0){
+        free (matches);
+        return NULL;
+    }
+
+    /* matches[0] is what they all start with, or the only one */
+    if (n == 1){
+        matches[0] = matches[1];
+        matches[1] = NULL;
+        return matches;
+    }
+    common = strlen (matches[1]);
+    for (i=2; i<=n; i++){
+        size_t j = 0;
+        while (j < common && matches[i][j] == matches[1][j])
+            j++;
+        common = j;
+    }
+    matches[0] = strndup (matches[1], common);
+    matches[n+1] = NULL;
+    return matches;
+}
+
+static void drop_oldest (int count){
+    int i = 0;
+
+    for (i=0; i<count; i++){
+        free (history[i]->line);
+        free (history[i]);
+    }
+    memmove (history, history + count, (history_length - count + 1) * sizeof (HIST_ENTRY*));
+    history_length -= count;
+    history_base += count;
+}
+
+void add_history (const char* line){
+    HIST_ENTRY** bigger = NULL;
+    HIST_ENTRY* entry = NULL;
+    int size = 0;
+
+    if (history_max == 0)
+        return;
+    if (history_max > 0 && history_length >= history_max)
+        drop_oldest (history_length - history_max + 1);
+
+    if (history_length + 1 >= history_size){
+        size = history_size ? history_size * 2 : 64;
+        bigger = (HIST_ENTRY**) realloc (history, size * sizeof (HIST_ENTRY*));
+        if (bigger == NULL)
+            return;
+        history = bigger;
+        history_size = size;
+    }
+    entry = (HIST_ENTRY*) calloc (1, sizeof (HIST_ENTRY));
+    if (entry == NULL || (entry->line = strdup (line)) == NULL){
+        free (entry);
+        return;
+    }
+    history[history_length++] = entry;
+    history[history_length] = NULL;
+}
+
+HIST_ENTRY* history_get (int offset){
+    int i = offset - history_base;
+
+    return i >= 0 && i < history_length ? history[i] : NULL;
+}
+
+HIST_ENTRY** history_list (void){
+    return history;
+}
+
+void stifle_history (int max){
+    if (max < 0)
+        max = 0;
+    if (history_length > max)
+        drop_oldest (history_length - max);
+    history_max = max;
+}
@@ -0,0 +1,227 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * agros-login: the thin client of agrosd. It takes the same options as
+ * agros and is meant to be the login shell of AGROS users when agrosd
+ * runs. It hands its terminal to a session agrosd has already started,
+ * forwards the signals it gets to that session and exits with its status.
+ *
+ * When agrosd isn't running, or refuses the connection, agros-login runs
+ * agros itself, so logins never depend on the daemon.
+ *
+ * It only needs libc: no glib, no readline, no passwd lookup.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "agrosd.h"
+
+#ifndef AGROS_BIN
+#define AGROS_BIN "agros"
+#endif
+
+/* Set once the session is running; signals are forwarded to its group */
+static volatile sig_atomic_t session_pid = 0;
+static volatile sig_atomic_t last_signal = 0;
+
+extern char** environ;
+
+static void forward_signal (int sig){
+    last_signal = sig;
+    if (session_pid > 0)
+        kill (-session_pid, sig);
+}
+
+/*
+ * Starts agros in place of agros-login, in the same mode.
+ */
+
+static void run_agros (char* name, int mode, char* command){
+    char* argv[] = { name, NULL, NULL, NULL };
+
+    if (mode == AGROSD_COMMAND){
+        argv[1] = "-c";
+        argv[2] = command;
+    }else if (mode == AGROSD_SCRIPT)
+        argv[1] = "-s";
+
+    execv (AGROS_BIN, argv);
+    fprintf (stderr, "agros-login: could not execute %s: %s\n", AGROS_BIN, strerror (errno));
+    exit (127);
+}
+
+/*
+ * Sends the request, the command line and the environment, with the
+ * standard descriptors and the current directory. Returns -1 on failure.
+ */
+
+static int send_request (int sock, int mode, const char* command){
+    union { struct cmsghdr align; char buf[CMSG_SPACE (AGROSD_CLIENT_FDS * sizeof (int))]; } control;
+    agrosd_request request;
+    struct msghdr msg;
+    struct cmsghdr* cmsg = NULL;
+    struct iovec iov[3];
+    char* env = NULL;
+    size_t env_len = 0, len = 0;
+    int fds[AGROSD_CLIENT_FDS];
+    int result = -1;
+    int i = 0;
+
+    for (i=0; environ[i]; i++)
+        env_len += strlen (environ[i]) + 1;
+    request.magic = AGROSD_MAGIC;
+    request.version = AGROSD_VERSION;
+    request.mode = mode;
+    request.command_len = command ? strlen (command) + 1 : 0;
+    request.env_len = env_len;
+    if (request.command_len + env_len > AGROSD_MAX_DATA)
+        return -1;
+
+    env = (char*) malloc (env_len + 1);
+    if (env == NULL)
+        return -1;
+    for (i=0; environ[i]; i++){
+        memcpy (env + len, environ[i], strlen (environ[i]) + 1);
+        len += strlen (environ[i]) + 1;
+    }
+
+    fds[0] = STDIN_FILENO;
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+    fds[3] = open (".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fds[3] < 0){
+        free (env);
+        return -1;
+    }
+
+    iov[0].iov_base = &request;
+    iov[0].iov_len = sizeof (request);
+    iov[1].iov_base = (void*) (command ? command : "");
+    iov[1].iov_len = request.command_len;
+    iov[2].iov_base = env;
+    iov[2].iov_len = env_len;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    if (sendmsg (sock, &msg, MSG_NOSIGNAL) >= 0)
+        result = 0;
+
+    close (fds[3]);
+    free (env);
+    return result;
+}
+
+/*
+ * Reads one reply. Returns -1 when the connection is closed.
+ */
+
+static int read_reply (int sock, agrosd_reply* reply){
+    ssize_t len = 0;
+
+    do {
+        len = recv (sock, reply, sizeof (agrosd_reply), 0);
+    } while (len < 0 && errno == EINTR);
+
+    return len == sizeof (agrosd_reply) ? 0 : -1;
+}
+
+int main (int argc, char** argv){
+    const char* path = AGROSD_SOCKET;
+    char* command = NULL;
+    int mode = AGROSD_INTERACTIVE;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    agrosd_reply reply;
+    int signals[] = { SIGINT, SIGQUIT, SIGTERM, SIGHUP, SIGWINCH };
+    int sock = -1;
+    int opt = 0;
+    size_t i = 0;
+
+    while ((opt = getopt (argc, argv, "c:sS:")) != -1){
+        switch (opt){
+            case 'c':
+                command = optarg;
+                mode = AGROSD_COMMAND;
+                break;
+            case 's':
+                mode = AGROSD_SCRIPT;
+                break;
+            case 'S':
+                path = optarg;
+                break;
+            default:
+                fprintf (stderr, "usage: %s [-S socket] [-c command | -s]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (addr.sun_path))
+        run_agros (argv[0], mode, command);
+    strcpy (addr.sun_path, path);
+
+    sock = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect (sock, (struct sockaddr*) &addr, sizeof (addr)) < 0)
+        run_agros (argv[0], mode, command);
+
+    /* Nothing has started until the session says so */
+    if (send_request (sock, mode, command) < 0 || read_reply (sock, &reply) < 0 || reply.type != AGROSD_STARTED){
+        close (sock);
+        run_agros (argv[0], mode, command);
+    }
+    session_pid = reply.value;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = forward_signal;
+    sigemptyset (&sa.sa_mask);
+    for (i=0; i<sizeof (signals) / sizeof (signals[0]); i++)
+        sigaction (signals[i], &sa, NULL);
+
+    while (read_reply (sock, &reply) == 0){
+        if (reply.type == AGROSD_EXITED)
+            return reply.value;
+    }
+
+    /* The session died without a word, most likely from a forwarded signal */
+    return last_signal ? 128 + last_signal : EXIT_FAILURE;
+}
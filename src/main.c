@@ -25,112 +25,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <syslog.h>
-#include <sys/wait.h>
 #include "agros.h"
+#include "trace.h"
 
-int main (){
-    int pid = 0;
-    command_t cmd = {NULL, 0, {NULL}};
-    char *commandline = (char *)NULL;
-    char* username = NULL;
-    config_t ag_config;
-    int bg_cmd = AG_FALSE;
-    char prompt[MAX_LINE_LEN];
-
-    /* Sets the username */
-    set_username (&username);
-
-    /* Opens the syslog file */
-    openlog (username, LOG_PID, LOG_USER);
-
-    /* Parses the config files for data */
-    parse_config (&ag_config, username);
-
-    /* Initializes GNU Readline */
-    initialize_readline(&ag_config);
-
-    /*
-     *   Main loop:
-     *   - print prompt
-     *   - read input and parse it
-     *   - either a built-in command ("cd", "?" or "exit)
-     *   - or a system command, in which case the program forks and executes it with execvp()
-     */
+/*
+ * Usage:
+ *   agros                  interactive session (or script mode if stdin is not a terminal)
+ *   agros -c "cmd args"    runs a single command, as sshd does for forced commands
+ *   agros -s               reads newline-separated commands from stdin
+ *
+ * In the non-interactive modes AGROS exits with the status of the last command.
+ */
 
-    if (ag_config.welcome_message != NULL && strlen (ag_config.welcome_message) > 0) {
-        fprintf (stdout, "\n%s\n\n", ag_config.welcome_message);
+int main (int argc, char** argv){
+    char* username = NULL;
+    char* commandline = NULL;
+    int script = AG_FALSE;
+    int opt = 0;
+
+    while ((opt = getopt (argc, argv, "c:s")) != -1){
+        switch (opt){
+            case 'c':
+                commandline = optarg;
+                break;
+            case 's':
+                script = AG_TRUE;
+                break;
+            default:
+                fprintf (stderr, "usage: %s [-c command | -s]\n", argv[0]);
+                return AG_STATUS_USAGE;
+        }
     }
 
-    while (AG_TRUE){
-	/* Set the prompt */
-	get_prompt(prompt, MAX_LINE_LEN, username);
-
-	/* 
-	 * Read a line of input 
-	 * commandline should be deallocated with free() 
-	 */
-	commandline = read_input (prompt);
+    /* Times the login and every command if AGROS_TRACE is set */
+    trace_open ();
 
-        parse_command (commandline, &cmd);
-
-        switch (get_cmd_code (cmd.name)){
-            case EMPTY_CMD:
-   	            break;
-
-            case CD_CMD:
-                change_directory (cmd.argv[1], ag_config.loglevel);
-   	            break;
-
-            case HELP_CMD:
-                print_help(&ag_config);
-   	            break;
-
-            case ENV_CMD:
-   	            print_env (cmd.argv[1]);
-   	            break;
-
-            case EXIT_CMD:
-		free (commandline);
-		commandline = (char *)NULL;
-                closelog ();
-   	            return 0;
-
-            case OTHER_CMD:
-
-                /* Determines whether the command should run in the bg or not */
-                bg_cmd = runs_in_background (&cmd);
-                pid = vfork();
-
-   	            if (pid == 0){
-                if (!check_validity (cmd, ag_config)){
-                    if (ag_config.loglevel == 3)    syslog (LOG_NOTICE, "Using command: %s.", cmd.name);
-                    execvp (cmd.argv[0], cmd.argv);
-   	        	    fprintf (stderr, "%s: Could not execute command!\nType '?' for help.\n", cmd.name);
-                    if (ag_config.loglevel >= 2)    syslog (LOG_NOTICE, "Could not execute: %s.", cmd.name);
-                }else {
-   	        	    fprintf (stdout, "Not allowed! \n");
-                    if (ag_config.warnings >= 0)    decrease_warnings (&ag_config);
-                    if (ag_config.loglevel >= 1)    syslog (LOG_ERR, "Trying to use forbidden command: %s.", cmd.name);
-                }
-
-                _exit(EXIT_FAILURE);
-   	            }else if (pid < 0){
-                    fprintf (stderr, "Error! ... Negative PID. God knows what that means ...\n");
-                    if (ag_config.loglevel >= 1) syslog (LOG_ERR, "Negative PID. Using command: %s.", cmd.name);
-   	            }else {
-                    if (!bg_cmd)
-                        wait (0);
-   	            }
-   	            break;
-        }
-
-	free (commandline);
-	commandline = (char *)NULL;
-    }
+    /* Sets the username */
+    TRACE_BEGIN ("set_username");
+    set_username (&username);
+    TRACE_END ("set_username");
 
-    if (commandline)
-	free (commandline);
-    closelog();
-    return 0;
+    return run_session (username, commandline, script);
 }
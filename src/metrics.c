@@ -0,0 +1,337 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <grp.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "metrics.h"
+
+/* How long a slot another session is claiming is waited for */
+#define METRICS_SPINS 1000
+
+/* What profiles and commands start with */
+typedef struct metrics_slot metrics_slot;
+struct metrics_slot{
+    uint32_t state;
+    char name[METRICS_NAME];
+};
+
+int metrics_enabled = 0;
+
+static metrics_segment* segment = NULL;
+static metrics_profile* profile = NULL;
+
+/* The last command looked up: a line counts the same one several times */
+static metrics_command* last = NULL;
+
+static void add (uint64_t* counter, uint64_t value){
+    __atomic_fetch_add (counter, value, __ATOMIC_RELAXED);
+}
+
+static void raise_to (uint64_t* counter, uint64_t value){
+    uint64_t seen = __atomic_load_n (counter, __ATOMIC_RELAXED);
+
+    while (seen < value && !__atomic_compare_exchange_n (counter, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static uint32_t hash_name (const char* name){
+    uint32_t h = 2166136261U;
+    int i = 0;
+
+    for (i=0; i<METRICS_NAME-1 && name[i]; i++){
+        h ^= (unsigned char) name[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ * Finds the slot of name, by open addressing in the count slots of size
+ * stride at base, and claims a free one for it if it has none. Returns
+ * NULL when the table is full.
+ */
+
+static void* find_slot (void* base, size_t stride, uint32_t count, const char* name){
+    metrics_slot* slot = NULL;
+    uint32_t start = hash_name (name) % count, state = 0, i = 0;
+    int spins = 0;
+
+    for (i=0; i<count; i++){
+        slot = (metrics_slot*) ((char*) base + (size_t) ((start + i) % count) * stride);
+        state = __atomic_load_n (&slot->state, __ATOMIC_ACQUIRE);
+        if (state == METRICS_FREE){
+            if (__atomic_compare_exchange_n (&slot->state, &state, METRICS_CLAIMED, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)){
+                strncpy (slot->name, name, METRICS_NAME - 1);
+                __atomic_store_n (&slot->state, METRICS_READY, __ATOMIC_RELEASE);
+                return slot;
+            }
+        }
+
+        /* Another session is naming it: it may be the same name. One that
+           died in the middle leaves the slot unused */
+        for (spins=0; state == METRICS_CLAIMED && spins < METRICS_SPINS; spins++){
+            sched_yield ();
+            state = __atomic_load_n (&slot->state, __ATOMIC_ACQUIRE);
+        }
+        if (state == METRICS_READY && !strncmp (slot->name, name, METRICS_NAME - 1))
+            return slot;
+    }
+    return NULL;
+}
+
+static metrics_command* command_slot (const char* name){
+    metrics_command* slot = NULL;
+
+    if (name == NULL)
+        name = "other";
+    if (last != NULL && !strncmp (last->name, name, METRICS_NAME - 1))
+        return last;
+
+    slot = (metrics_command*) find_slot (segment->commands, sizeof (metrics_command), METRICS_COMMANDS, name);
+    if (slot == NULL)
+        slot = (metrics_command*) find_slot (segment->commands, sizeof (metrics_command), METRICS_COMMANDS, "other");
+    last = slot;
+    return slot;
+}
+
+/*
+ * Creates the segment of key for root, mode 0660 with group METRICS_GROUP
+ * when it exists. Returns its id, or that of the segment another process
+ * just created.
+ */
+
+static int create_segment (key_t key){
+    struct shmid_ds ds;
+    struct group* grp = NULL;
+    int id = -1;
+
+    id = shmget (key, sizeof (metrics_segment), IPC_CREAT | IPC_EXCL | 0660);
+    if (id < 0)
+        return errno == EEXIST ? shmget (key, sizeof (metrics_segment), 0) : -1;
+    grp = getgrnam (METRICS_GROUP);
+    if (grp != NULL && shmctl (id, IPC_STAT, &ds) == 0){
+        ds.shm_perm.gid = grp->gr_gid;
+        shmctl (id, IPC_SET, &ds);
+    }
+    return id;
+}
+
+/*
+ * Attaches the segment of key. Root creates it if needed; other users
+ * only find it. Returns -1 with errno set if it can't be used (EPERM for
+ * a segment root doesn't own or that anyone can write), metrics then stay
+ * disabled. IPC_PRIVATE gives a segment of the caller's own.
+ */
+
+int metrics_open (key_t key){
+    struct shmid_ds ds;
+    uint32_t expected = 0;
+    void* addr = NULL;
+    int id = -1;
+
+    if (key == IPC_PRIVATE){
+        id = shmget (key, sizeof (metrics_segment), IPC_CREAT | 0600);
+    }else {
+        id = shmget (key, sizeof (metrics_segment), 0);
+        if (id < 0 && errno == ENOENT && geteuid () == 0)
+            id = create_segment (key);
+        if (id >= 0 && shmctl (id, IPC_STAT, &ds) == 0 && (ds.shm_perm.uid != 0 || (ds.shm_perm.mode & 0002))){
+            errno = EPERM;
+            return -1;
+        }
+    }
+    if (id < 0)
+        return -1;
+    addr = shmat (id, NULL, 0);
+    if (addr == (void*) -1)
+        return -1;
+    if (key == IPC_PRIVATE)
+        shmctl (id, IPC_RMID, NULL);
+
+    /* A new segment is all zeros, which is empty: the first session to
+       get here only has to mark it */
+    segment = (metrics_segment*) addr;
+    __atomic_compare_exchange_n (&segment->size, &expected, sizeof (metrics_segment), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    expected = 0;
+    __atomic_compare_exchange_n (&segment->magic, &expected, METRICS_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    if (segment->magic != METRICS_MAGIC || segment->size != sizeof (metrics_segment)){
+        metrics_close ();
+        errno = EPROTO;
+        return -1;
+    }
+
+    /* Where what doesn't fit goes */
+    metrics_enabled = 1;
+    command_slot (NULL);
+    return 0;
+}
+
+void metrics_close (void){
+    if (segment != NULL)
+        shmdt (segment);
+    segment = NULL;
+    profile = NULL;
+    last = NULL;
+    metrics_enabled = 0;
+}
+
+static int bucket_of (uint64_t ns){
+    uint64_t units = ns >> METRICS_UNIT;
+    int msb = 0, bucket = 0;
+
+    if (units < METRICS_SUB)
+        return units;
+    msb = 63 - __builtin_clzll (units);
+    bucket = (msb - METRICS_SUB_BITS + 1) * METRICS_SUB + ((units >> (msb - METRICS_SUB_BITS)) & (METRICS_SUB - 1));
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+/*
+ * The end of a bucket, in ns: the times counted in it are below it.
+ */
+
+uint64_t metrics_bucket_end (int bucket){
+    int octave = bucket / METRICS_SUB, sub = bucket % METRICS_SUB;
+
+    if (octave == 0)
+        return (uint64_t) (sub + 1) << METRICS_UNIT;
+    return (uint64_t) (METRICS_SUB + sub + 1) << (octave - 1) << METRICS_UNIT;
+}
+
+static void observe (metrics_histogram* h, uint64_t ns){
+    add (&h->count, 1);
+    add (&h->sum, ns);
+    add (&h->buckets[bucket_of (ns)], 1);
+}
+
+/*
+ * Starts counting for a session of the named profile.
+ */
+
+void metrics_session (const char* name){
+    if (!metrics_enabled)
+        return;
+    profile = (metrics_profile*) find_slot (segment->profiles, sizeof (metrics_profile), METRICS_PROFILES, name);
+    if (profile == NULL)
+        profile = (metrics_profile*) find_slot (segment->profiles, sizeof (metrics_profile), METRICS_PROFILES, "other");
+    if (profile != NULL)
+        add (&profile->sessions, 1);
+}
+
+void metrics_allowed (const char* name){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd != NULL)
+        add (&cmd->allowed, 1);
+    if (profile != NULL)
+        add (&profile->commands, 1);
+}
+
+/*
+ * A refusal. name is NULL for a command that isn't allowed at all.
+ */
+
+void metrics_denied (const char* name){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd != NULL)
+        add (&cmd->denied, 1);
+    if (profile != NULL)
+        add (&profile->denied, 1);
+}
+
+/*
+ * An allowed command that couldn't be run: not found, or the launcher
+ * failed. With fork_failed, no process could even be created.
+ */
+
+void metrics_failed (const char* name, int fork_failed){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd != NULL)
+        add (&cmd->failed, 1);
+    if (profile != NULL)
+        add (&profile->failed, 1);
+    if (metrics_enabled && fork_failed)
+        add (&segment->spawn_failures, 1);
+}
+
+void metrics_started (const char* name, uint64_t spawn_ns, uint64_t exec_ns){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd == NULL)
+        return;
+    observe (&cmd->times[METRICS_SPAWN], spawn_ns);
+    observe (&cmd->times[METRICS_EXEC], exec_ns);
+}
+
+/*
+ * A command that ended, after wall_ns. usage is what its process used, or
+ * NULL for a built-in.
+ */
+
+void metrics_ran (const char* name, uint64_t wall_ns, const struct rusage* usage){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd == NULL)
+        return;
+    observe (&cmd->times[METRICS_WALL], wall_ns);
+    if (usage == NULL)
+        return;
+    add (&cmd->user_us, usage->ru_utime.tv_sec * 1000000ULL + usage->ru_utime.tv_usec);
+    add (&cmd->system_us, usage->ru_stime.tv_sec * 1000000ULL + usage->ru_stime.tv_usec);
+    raise_to (&cmd->max_rss_kb, usage->ru_maxrss);
+}
+
+/*
+ * A command with cacheable, served as how says (METRICS_CACHE_*).
+ */
+
+void metrics_cached (const char* name, int how){
+    metrics_command* cmd = metrics_enabled ? command_slot (name) : NULL;
+
+    if (cmd == NULL)
+        return;
+    if (how == METRICS_CACHE_HIT)
+        add (&cmd->cache_hits, 1);
+    else if (how == METRICS_CACHE_COALESCED)
+        add (&cmd->cache_coalesced, 1);
+    else
+        add (&cmd->cache_misses, 1);
+}
+
+/*
+ * The user ran out of warnings.
+ */
+
+void metrics_kick (void){
+    if (profile != NULL)
+        add (&profile->kicks, 1);
+}
@@ -0,0 +1,87 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Generates builtins_hash.h, the perfect hash of the built-in commands of
+ * builtins.def, on the standard output. Run by make; see find_builtin().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "builtins.h"
+
+/* A power of two, at least twice the number of built-ins */
+#define SLOT_NBR 32
+
+static const char* names[] = {
+#define BUILTIN(name, handler, policy) name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#define NAME_NBR ((int) (sizeof (names) / sizeof (names[0])))
+
+int main (){
+    int slots[SLOT_NBR];
+    uint32_t seed = 0;
+    size_t max_len = 0;
+    int i = 0, found = 0;
+
+    if (NAME_NBR * 2 > SLOT_NBR){
+        fprintf (stderr, "mkbuiltins: %d built-ins need more than %d slots\n", NAME_NBR, SLOT_NBR);
+        return EXIT_FAILURE;
+    }
+
+    for (seed = 2166136261U; !found && seed != 2166136261U - 1000000; seed--){
+        for (i=0; i<SLOT_NBR; i++)
+            slots[i] = -1;
+        found = 1;
+        for (i=0; i<NAME_NBR && found; i++){
+            uint32_t slot = builtin_hash (seed, names[i]) & (SLOT_NBR - 1);
+            if (slots[slot] >= 0)
+                found = 0;
+            slots[slot] = i;
+        }
+    }
+    if (!found){
+        fprintf (stderr, "mkbuiltins: no perfect hash found, raise SLOT_NBR\n");
+        return EXIT_FAILURE;
+    }
+    seed++;
+
+    for (i=0; i<NAME_NBR; i++){
+        if (strlen (names[i]) > max_len)
+            max_len = strlen (names[i]);
+    }
+
+    printf ("/* Generated by mkbuiltins from include/builtins.def. Do not edit. */\n\n");
+    printf ("#define BUILTIN_SEED     %uU\n", seed);
+    printf ("#define BUILTIN_SLOTS    %d\n", SLOT_NBR);
+    printf ("#define BUILTIN_MAX_LEN  %d\n\n", (int) max_len);
+    printf ("static const signed char builtin_slots[BUILTIN_SLOTS] = {");
+    for (i=0; i<SLOT_NBR; i++)
+        printf ("%s%d", i == 0 ? "\n    " : i % 16 ? ", " : ",\n    ", slots[i]);
+    printf ("\n};\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,429 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "outcache.h"
+
+/* How often a session waiting for another's run looks again */
+#define OUTCACHE_POLL_MS    2
+
+/* One store in that many also removes what the user left out of date */
+#define OUTCACHE_PRUNE_ONE_IN 32
+
+/* Temporary files and locks of sessions that died are removed after that */
+#define OUTCACHE_STALE_SEC  60
+
+static int cache_dir = -1;
+static int cache_failed = 0;
+
+static uint64_t hash_key (const char* key, size_t len){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (i=0; i<len; i++){
+        h ^= (unsigned char) key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int64_t now_ns (void){
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Returns the ttl of name in rules ("name:ttl" each), or 0 if its output
+ * isn't shared.
+ */
+
+int outcache_ttl (char** rules, int count, const char* name){
+    const char* colon = NULL;
+    size_t len = strlen (name);
+    int i = 0;
+
+    for (i=0; i<count; i++){
+        colon = strrchr (rules[i], ':');
+        if (colon != NULL && (size_t) (colon - rules[i]) == len && !strncmp (rules[i], name, len))
+            return atoi (colon + 1);
+    }
+    return 0;
+}
+
+/*
+ * Returns the index of the first rule that isn't "name:ttl" with a ttl of
+ * 1 to OUTCACHE_MAX_TTL seconds, or -1 if they all are.
+ */
+
+int outcache_check (char** rules, int count){
+    const char* colon = NULL;
+    char* end = NULL;
+    long ttl = 0;
+    int i = 0;
+
+    for (i=0; i<count; i++){
+        colon = strrchr (rules[i], ':');
+        if (colon == NULL || colon == rules[i])
+            return i;
+        errno = 0;
+        ttl = strtol (colon + 1, &end, 10);
+        if (errno != 0 || end == colon + 1 || *end != '\0' || ttl < 1 || ttl > OUTCACHE_MAX_TTL)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Opens OUTCACHE_DIR, creating it if needed. Anyone who can replace the
+ * entries can make AGROS print what they want, so it is only used if it
+ * belongs to root or to the user, and if it is sticky when others can
+ * write it.
+ */
+
+static int open_dir (void){
+    struct stat st;
+    int fd = -1;
+
+    if (cache_dir >= 0 || cache_failed)
+        return cache_dir;
+
+    if (mkdir (OUTCACHE_DIR, 01777) == 0)
+        chmod (OUTCACHE_DIR, 01777);
+    fd = open (OUTCACHE_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 || fstat (fd, &st) < 0 || (st.st_uid != 0 && st.st_uid != geteuid ())
+        || ((st.st_mode & (S_IWGRP | S_IWOTH)) && !(st.st_mode & S_ISVTX))){
+        if (fd >= 0)
+            close (fd);
+        cache_failed = 1;
+        return -1;
+    }
+    cache_dir = fd;
+    return fd;
+}
+
+/*
+ * True if a file of the cache was written by root or by the user. Anyone
+ * can create files in OUTCACHE_DIR, and nothing else says who wrote what
+ * they hold.
+ */
+
+static int trusted (const struct stat* st){
+    return st->st_uid == 0 || st->st_uid == geteuid ();
+}
+
+/*
+ * Maps the entry called name if it is the one of result->key, written by
+ * root or the user, and still fresh. An expiry further away than
+ * OUTCACHE_MAX_TTL can't have been written by outcache_store(). Returns 0
+ * and fills result if so.
+ */
+
+static int read_entry (outcache_result* result, const char* name){
+    const outcache_header* h = NULL;
+    struct stat st;
+    void* map = NULL;
+    int64_t now = 0;
+    int fd = -1;
+
+    fd = openat (cache_dir, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat (fd, &st) < 0 || !S_ISREG (st.st_mode) || !trusted (&st) || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || (size_t) st.st_size < sizeof (outcache_header) + result->key_len
+        || (size_t) st.st_size > sizeof (outcache_header) + result->key_len + 2 * OUTCACHE_MAX_OUTPUT){
+        close (fd);
+        return -1;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    h = (const outcache_header*) map;
+    now = now_ns ();
+    if (memcmp (h->magic, OUTCACHE_MAGIC, 8) || h->key_len != result->key_len
+        || h->out_len > OUTCACHE_MAX_OUTPUT || h->err_len > OUTCACHE_MAX_OUTPUT
+        || sizeof (outcache_header) + h->key_len + h->out_len + h->err_len != (uint64_t) st.st_size
+        || memcmp ((const char*) map + sizeof (outcache_header), result->key, result->key_len)
+        || h->expires_ns <= now || h->expires_ns > now + OUTCACHE_MAX_TTL * 1000000000LL){
+        munmap (map, st.st_size);
+        return -1;
+    }
+
+    result->map = map;
+    result->map_len = st.st_size;
+    result->status = h->status;
+    result->out = (const char*) map + sizeof (outcache_header) + h->key_len;
+    result->out_len = h->out_len;
+    result->err = result->out + h->out_len;
+    result->err_len = h->err_len;
+    return 0;
+}
+
+/*
+ * Looks for the shared entry, then for the one of the user. Another
+ * user's file under the shared name is skipped, so it can't hide the
+ * user's own entry.
+ */
+
+static int find_entry (outcache_result* result){
+    char own[64];
+
+    if (read_entry (result, result->name) == 0)
+        return 0;
+    snprintf (own, sizeof (own), "%s.%u", result->name, (unsigned) geteuid ());
+    return read_entry (result, own);
+}
+
+/*
+ * Takes the lock of the key, waiting up to OUTCACHE_WAIT_MS for the
+ * session that holds it. Returns the lock, or -1 if it can't be had.
+ * *waited tells whether another session had it. A lock created by another
+ * user isn't waited for: what that user's session writes would not be
+ * read anyway.
+ */
+
+static int take_lock (const char* name, int* waited){
+    struct timespec pause = { 0, OUTCACHE_POLL_MS * 1000000L };
+    struct stat st;
+    char path[64];
+    int fd = -1, i = 0;
+
+    *waited = 0;
+    snprintf (path, sizeof (path), "%s.lock", name);
+    fd = openat (cache_dir, path, O_RDONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0444);
+    if (fd < 0)
+        return -1;
+    if (fstat (fd, &st) < 0 || !trusted (&st)){
+        close (fd);
+        return -1;
+    }
+
+    for (i=0; i<OUTCACHE_WAIT_MS/OUTCACHE_POLL_MS; i++){
+        if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+            return fd;
+        if (errno != EWOULDBLOCK && errno != EINTR)
+            break;
+        *waited = 1;
+        nanosleep (&pause, NULL);
+    }
+    close (fd);
+    return -1;
+}
+
+/*
+ * Looks up argv run in profile from the current directory. Returns OUTCACHE_HIT with the entry in
+ * result, OUTCACHE_MISS when the caller is to run the command and
+ * outcache_store() its output, or OUTCACHE_OFF when the cache can't be
+ * used. result must be released with outcache_release() in every case.
+ */
+
+int outcache_lookup (const char* profile, char** argv, outcache_result* result){
+    size_t len = strlen (profile) + 1;
+    char* cwd = NULL;
+    char* cursor = NULL;
+    int waited = 0;
+    int i = 0;
+
+    memset (result, 0, sizeof (outcache_result));
+    result->lock_fd = -1;
+    if (open_dir () < 0)
+        return OUTCACHE_OFF;
+
+    /* ls, or cat with a relative path, prints something else elsewhere */
+    cwd = getcwd (NULL, 0);
+    if (cwd == NULL)
+        return OUTCACHE_OFF;
+    len += strlen (cwd) + 1;
+    for (i=0; argv[i] != NULL; i++)
+        len += strlen (argv[i]) + 1;
+    result->key = (char*) malloc (len);
+    if (result->key == NULL){
+        free (cwd);
+        return OUTCACHE_OFF;
+    }
+    cursor = stpcpy (result->key, profile) + 1;
+    cursor = stpcpy (cursor, cwd) + 1;
+    free (cwd);
+    for (i=0; argv[i] != NULL; i++)
+        cursor = stpcpy (cursor, argv[i]) + 1;
+    result->key_len = len;
+    snprintf (result->name, sizeof (result->name), "%016llx",
+              (unsigned long long) hash_key (result->key, result->key_len));
+
+    if (find_entry (result) == 0)
+        return OUTCACHE_HIT;
+
+    /* Whoever held the lock may have just written the entry */
+    result->lock_fd = take_lock (result->name, &waited);
+    if (result->lock_fd >= 0 && find_entry (result) == 0){
+        close (result->lock_fd);
+        result->lock_fd = -1;
+        result->coalesced = waited;
+        return OUTCACHE_HIT;
+    }
+    return OUTCACHE_MISS;
+}
+
+/*
+ * Copies len bytes of the memfd in to out.
+ */
+
+static int copy_fd (int in, int out, size_t len){
+    char buf[65536];
+    off_t off = 0;
+    ssize_t n = 0;
+
+    while ((size_t) off < len){
+        n = pread (in, buf, sizeof (buf), off);
+        if (n <= 0 || write (out, buf, n) != n)
+            return -1;
+        off += n;
+    }
+    return 0;
+}
+
+/*
+ * Removes the files of the user that are of no use any more: entries out
+ * of date, temporary files and locks left by sessions that died.
+ */
+
+static void prune (void){
+    outcache_header h;
+    struct dirent* d = NULL;
+    struct stat st;
+    DIR* dir = NULL;
+    int64_t now = now_ns ();
+    int dfd = -1, fd = -1;
+
+    dfd = fcntl (cache_dir, F_DUPFD_CLOEXEC, 0);
+    if (dfd < 0 || (dir = fdopendir (dfd)) == NULL){
+        if (dfd >= 0)
+            close (dfd);
+        return;
+    }
+    rewinddir (dir);
+
+    while ((d = readdir (dir)) != NULL){
+        if (d->d_name[0] == '.' || fstatat (cache_dir, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0
+            || st.st_uid != geteuid () || !S_ISREG (st.st_mode))
+            continue;
+
+        if (strstr (d->d_name, ".lock") || strstr (d->d_name, ".tmp")){
+            if (st.st_mtime + OUTCACHE_STALE_SEC > now / 1000000000LL)
+                continue;
+            fd = openat (cache_dir, d->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd >= 0 && flock (fd, LOCK_EX | LOCK_NB) == 0)
+                unlinkat (cache_dir, d->d_name, 0);
+        }else {
+            fd = openat (cache_dir, d->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd >= 0 && (pread (fd, &h, sizeof (h), 0) != (ssize_t) sizeof (h) || h.expires_ns <= now))
+                unlinkat (cache_dir, d->d_name, 0);
+        }
+        if (fd >= 0)
+            close (fd);
+        fd = -1;
+    }
+    closedir (dir);
+}
+
+/*
+ * Writes the entry of a miss: the output in the memfds out_fd and err_fd,
+ * and status. Output over OUTCACHE_MAX_OUTPUT isn't kept. Lets go of the
+ * lock either way. Returns -1 if nothing was stored.
+ */
+
+int outcache_store (outcache_result* result, int out_fd, int err_fd, int status, int ttl){
+    outcache_header h;
+    struct stat out_st, err_st;
+    char tmp[64], own[64];
+    /* Only root's entries are shared; a user's output stays the user's */
+    mode_t mode = geteuid () == 0 ? 0644 : 0600;
+    int fd = -1, stored = -1;
+
+    if (result->key == NULL || fstat (out_fd, &out_st) < 0 || fstat (err_fd, &err_st) < 0
+        || out_st.st_size > OUTCACHE_MAX_OUTPUT || err_st.st_size > OUTCACHE_MAX_OUTPUT)
+        goto out;
+
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, OUTCACHE_MAGIC, 8);
+    h.expires_ns = now_ns () + (int64_t) ttl * 1000000000LL;
+    h.status = status;
+    h.key_len = result->key_len;
+    h.out_len = out_st.st_size;
+    h.err_len = err_st.st_size;
+
+    snprintf (tmp, sizeof (tmp), "%s.tmp.%d", result->name, (int) getpid ());
+    fd = openat (cache_dir, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd < 0)
+        goto out;
+    if (fchmod (fd, mode) < 0 || write (fd, &h, sizeof (h)) != (ssize_t) sizeof (h)
+        || write (fd, result->key, result->key_len) != (ssize_t) result->key_len
+        || copy_fd (out_fd, fd, h.out_len) < 0 || copy_fd (err_fd, fd, h.err_len) < 0){
+        unlinkat (cache_dir, tmp, 0);
+        goto out;
+    }
+
+    /* Another user's entry can't be replaced in a sticky directory */
+    snprintf (own, sizeof (own), "%s.%u", result->name, (unsigned) geteuid ());
+    if (renameat (cache_dir, tmp, cache_dir, result->name) == 0)
+        stored = 0;
+    else if ((errno == EPERM || errno == EACCES) && renameat (cache_dir, tmp, cache_dir, own) == 0)
+        stored = 0;
+    else
+        unlinkat (cache_dir, tmp, 0);
+
+    if (stored == 0 && (hash_key (tmp, strlen (tmp)) ^ (uint64_t) now_ns ()) % OUTCACHE_PRUNE_ONE_IN == 0)
+        prune ();
+
+out:
+    if (fd >= 0)
+        close (fd);
+    if (result->lock_fd >= 0)
+        close (result->lock_fd);
+    result->lock_fd = -1;
+    return stored;
+}
+
+void outcache_release (outcache_result* result){
+    if (result->map != NULL)
+        munmap (result->map, result->map_len);
+    if (result->lock_fd >= 0)
+        close (result->lock_fd);
+    free (result->key);
+    result->map = NULL;
+    result->lock_fd = -1;
+    result->key = NULL;
+}
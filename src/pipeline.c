@@ -0,0 +1,237 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+/* What one splice() moves at most */
+#define RELAY_CHUNK (64 * 1024)
+
+/*
+ * True if path, absolute and resolved, is inside redirect_paths.
+ */
+
+static int path_allowed (const char* path, char** paths, int path_nbr, const char* home){
+    char pattern[PATH_MAX];
+    size_t len = 0;
+    int i = 0, flags = 0;
+
+    for (i=0; i<path_nbr; i++){
+        if (paths[i][0] == '~' && paths[i][1] == '/'){
+            if (home == NULL)
+                continue;
+            len = snprintf (pattern, sizeof (pattern), "%s%s", home, paths[i] + 1);
+        }else {
+            len = snprintf (pattern, sizeof (pattern), "%s", paths[i]);
+        }
+        if (len == 0 || len >= sizeof (pattern))
+            continue;
+
+        /* "dir/" allows what is under dir, however deep */
+        flags = FNM_PATHNAME;
+        if (len > 1 && pattern[len-1] == '/'){
+            pattern[len-1] = '\0';
+            flags |= FNM_LEADING_DIR;
+        }
+        if (fnmatch (pattern, path, flags) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Opens the file of redirection r, if it is inside the allowed paths.
+ * Writes its resolved path to resolved. Returns the descriptor,
+ * close-on-exec, PIPELINE_DENIED if the path isn't allowed, or -1 with
+ * errno set if it can't be opened.
+ */
+
+int pipeline_open (const redirect_t* r, char** paths, int path_nbr, const char* home,
+                   char* resolved, size_t size){
+    char dir[PATH_MAX];
+    char real[PATH_MAX];
+    char link[64];
+    const char* base = NULL;
+    const char* slash = NULL;
+    ssize_t len = 0;
+    int dfd = -1, fd = -1, flags = 0, saved = 0;
+
+    snprintf (resolved, size, "%s", r->path);
+
+    slash = strrchr (r->path, '/');
+    if (slash == NULL){
+        strcpy (dir, ".");
+        base = r->path;
+    }else {
+        len = slash == r->path ? 1 : slash - r->path;
+        if ((size_t) len >= sizeof (dir)){
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy (dir, r->path, len);
+        dir[len] = '\0';
+        base = slash + 1;
+    }
+    if (*base == '\0' || !strcmp (base, ".") || !strcmp (base, "..")){
+        errno = EISDIR;
+        return -1;
+    }
+
+    dfd = open (dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0)
+        return -1;
+
+    /* Where the directory really is, whatever links led to it */
+    snprintf (link, sizeof (link), "/proc/self/fd/%d", dfd);
+    len = readlink (link, real, sizeof (real) - 1);
+    if (len < 0 && realpath (dir, real) == NULL){
+        saved = errno;
+        close (dfd);
+        errno = saved;
+        return -1;
+    }
+    if (len >= 0)
+        real[len] = '\0';
+
+    if ((size_t) snprintf (resolved, size, "%s/%s", strcmp (real, "/") ? real : "", base) >= size){
+        close (dfd);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (!path_allowed (resolved, paths, path_nbr, home)){
+        close (dfd);
+        return PIPELINE_DENIED;
+    }
+
+    if (r->mode == REDIR_IN)
+        flags = O_RDONLY;
+    else if (r->mode == REDIR_APPEND)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    fd = openat (dfd, base, flags | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC, 0666);
+    saved = errno;
+    close (dfd);
+    errno = saved;
+    return fd;
+}
+
+/*
+ * Moves the data of from[i] to to[i] for each of the link_nbr links, until
+ * every from[i] is at its end or every to[i] has no reader left, and counts
+ * it in bytes[i]. The descriptors are closed as each link ends: a stage
+ * whose next one is gone gets SIGPIPE on its next write, as with a plain
+ * pipe. The events of loop, if not NULL, are handled as they come.
+ */
+
+void pipeline_relay (int* from, int* to, size_t* bytes, int link_nbr, evloop* loop){
+    struct sigaction ignore, saved;
+    struct pollfd* polls = NULL;
+    char* full = NULL;
+    ssize_t n = 0;
+    int open_nbr = link_nbr, poll_nbr = link_nbr, i = 0;
+
+    polls = (struct pollfd*) calloc (link_nbr + 1, sizeof (struct pollfd));
+    full = (char*) calloc (link_nbr, 1);
+
+    /* A stage that stops reading makes splice() fail with EPIPE, and
+       must not end AGROS with it */
+    memset (&ignore, 0, sizeof (ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &ignore, &saved);
+
+    for (i=0; i<link_nbr; i++){
+        fcntl (from[i], F_SETFL, O_NONBLOCK);
+        fcntl (to[i], F_SETFL, O_NONBLOCK);
+    }
+
+    while (polls != NULL && full != NULL && open_nbr > 0){
+        /* Wait for data, or for room when the next stage is behind */
+        for (i=0; i<link_nbr; i++){
+            polls[i].fd = from[i] < 0 ? -1 : full[i] ? to[i] : from[i];
+            polls[i].events = full[i] ? POLLOUT : POLLIN;
+            polls[i].revents = 0;
+        }
+        if (loop != NULL){
+            polls[link_nbr].fd = evloop_fd (loop);
+            polls[link_nbr].events = POLLIN;
+            polls[link_nbr].revents = 0;
+            poll_nbr = link_nbr + 1;
+        }
+        if (poll (polls, poll_nbr, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (loop != NULL && polls[link_nbr].revents)
+            evloop_run (loop, 0);
+
+        for (i=0; i<link_nbr; i++){
+            if (polls[i].revents == 0)
+                continue;
+
+            n = splice (from[i], NULL, to[i], NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0){
+                bytes[i] += n;
+                full[i] = 0;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            /* There was data: it is the next pipe that is full */
+            if (n < 0 && errno == EAGAIN){
+                full[i] = 1;
+                continue;
+            }
+
+            /* The end of the data, or no one left to read it */
+            close (from[i]);
+            close (to[i]);
+            from[i] = to[i] = -1;
+            open_nbr--;
+        }
+    }
+
+    for (i=0; i<link_nbr; i++){
+        if (from[i] >= 0)
+            close (from[i]);
+        if (to[i] >= 0)
+            close (to[i]);
+        from[i] = to[i] = -1;
+    }
+
+    sigaction (SIGPIPE, &saved, NULL);
+    free (polls);
+    free (full);
+}
@@ -0,0 +1,1281 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "policy.h"
+
+#ifdef AGROS_EMBEDDED
+#include "keyfile.h"
+#else
+#include <glib.h>
+#endif
+
+/* Resolved profiles kept for later logins and reloads */
+#define CONF_PROFILE_CACHE 64
+
+/* Drop-in files larger than that are ignored */
+#define CONF_DROPIN_MAX (1024 * 1024)
+
+/*
+ * One section of a profile: the user's own or one of a group, with the
+ * drop-in file that can hold it. The identity of the file when it was read
+ * tells whether the profile is still up to date; a missing file counts.
+ */
+
+typedef struct conf_layer conf_layer;
+struct conf_layer{
+    char* name;
+    char* path;
+    GKeyFile* gkf;
+    int present;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+/*
+ * The sections a user's keys are looked up in, in order, and their drop-in
+ * files. Profiles are cached by user, uid and groups and shared by every
+ * conf_source of that user; refs counts them.
+ */
+
+typedef struct conf_profile conf_profile;
+struct conf_profile{
+    char* conf;
+    char* username;
+    uid_t uid;
+    gid_t* groups;
+    int ngroups;
+    conf_layer* layers;
+    int nlayers;
+    int refs;
+    unsigned long used;
+};
+
+static conf_profile* profile_cache[CONF_PROFILE_CACHE];
+static unsigned long profile_clock = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A configuration source. Either a loaded GKeyFile or a mapped policy image,
+ * and the profile of the user it is read for.
+ */
+
+struct conf_source{
+    int kind;
+    GKeyFile* gkf;
+    const unsigned char* map;
+    size_t map_len;
+    const policy_header* header;
+    const policy_section* sections;
+    const policy_key* keys;
+    const uint32_t* lists;
+    const policy_section* verified[4];
+    int nverified;
+    int failed;
+    conf_profile* profile;
+};
+
+/*
+ * A growable byte buffer used by the policy compiler.
+ */
+
+typedef struct policy_buf policy_buf;
+struct policy_buf{
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+};
+
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+/*
+ * Checksum of a region of the image. It only has to catch truncated or
+ * corrupted files, so it works 8 bytes at a time. Pass the result of a
+ * previous call as h to chain several regions.
+ */
+
+static uint64_t policy_checksum (uint64_t h, const void* region, size_t len){
+    const unsigned char* data = (const unsigned char*) region;
+    uint64_t word;
+    size_t i = 0;
+
+    for (i=0; i+8 <= len; i+=8){
+        memcpy (&word, data+i, 8);
+        h ^= word;
+        h = (h << 31) | (h >> 33);
+        h *= 0x100000001b3ULL;
+    }
+    for (; i<len; i++){
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/*
+ * Returns the string stored at offset off, or NULL if the offset points
+ * outside the image. The image is guaranteed to end with a '\0' so every
+ * valid offset yields a terminated string.
+ */
+
+static const char* image_string (conf_source* src, uint32_t off){
+    if (off < src->header->str_off || off >= src->map_len)
+        return NULL;
+    return (const char*) src->map + off;
+}
+
+/*
+ * Maps image_path and checks that it can be trusted and that it is not
+ * older than conf_path. Returns NULL when the caller should fall back to
+ * parsing the INI file instead.
+ */
+
+static conf_source* image_open (const char* conf_path, const char* image_path){
+    conf_source* src = NULL;
+    const policy_header* h = NULL;
+    policy_header header;
+    struct stat ist, cst;
+    void* map = NULL;
+    int have_conf = 0;
+    int fd = -1;
+
+    fd = open (image_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    /* The image is trusted blindly later on, so it must not be writable by
+       anyone but its owner, and the owner must be root or whoever owns the
+       conf file. */
+    if (fstat (fd, &ist) < 0 || !S_ISREG (ist.st_mode)
+        || (ist.st_mode & (S_IWGRP | S_IWOTH))
+        || (size_t) ist.st_size < sizeof (policy_header)){
+        close (fd);
+        return NULL;
+    }
+    have_conf = (stat (conf_path, &cst) == 0);
+    if (ist.st_uid != 0 && (!have_conf || ist.st_uid != cst.st_uid)){
+        close (fd);
+        return NULL;
+    }
+
+    map = mmap (NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    h = (const policy_header*) map;
+    if (memcmp (h->magic, POLICY_MAGIC, 8) || h->version != POLICY_VERSION
+        || h->total_size != (uint64_t) ist.st_size)
+        goto invalid;
+
+    /* Stale image: agros.conf changed since it was compiled. A missing
+       agros.conf is fine, the image can be shipped on its own. */
+    if (have_conf){
+        if ((uint64_t) cst.st_size != h->src_size || (uint64_t) cst.st_ino != h->src_ino
+            || cst.st_mtim.tv_sec != h->src_mtime_sec || cst.st_mtim.tv_nsec != h->src_mtime_nsec)
+            goto invalid;
+    }
+
+    if (h->section_off < sizeof (policy_header) || h->section_off > h->key_off
+        || h->key_off > h->list_off || h->list_off > h->str_off || h->str_off >= h->total_size
+        || (uint64_t) h->nsections * sizeof (policy_section) > h->key_off - h->section_off
+        || ((const unsigned char*) map)[h->total_size-1] != '\0')
+        goto invalid;
+
+    memcpy (&header, h, sizeof (header));
+    header.checksum = 0;
+    if (policy_checksum (CHECKSUM_SEED, &header, sizeof (header)) != h->checksum)
+        goto invalid;
+
+    src = (conf_source*) calloc (1, sizeof (conf_source));
+    if (src == NULL)
+        goto invalid;
+    src->kind = CONF_SRC_IMAGE;
+    src->map = (const unsigned char*) map;
+    src->map_len = h->total_size;
+    src->header = h;
+    src->sections = (const policy_section*) (src->map + h->section_off);
+    src->keys = (const policy_key*) (src->map + h->key_off);
+    src->lists = (const uint32_t*) (src->map + h->list_off);
+    return src;
+
+invalid:
+    munmap (map, ist.st_size);
+    return NULL;
+}
+
+/*
+ * Opens the configuration. The policy image is preferred when it is present
+ * and up to date; otherwise agros.conf is loaded with GKeyFile.
+ * Returns NULL if neither can be read.
+ */
+
+conf_source* conf_open (const char* conf_path, const char* image_path){
+    conf_source* src = NULL;
+    GKeyFile* gkf = NULL;
+
+    if (image_path != NULL){
+        src = image_open (conf_path, image_path);
+        if (src != NULL)
+            return src;
+    }
+
+    gkf = g_key_file_new ();
+    if (!g_key_file_load_from_file (gkf, conf_path, G_KEY_FILE_NONE, NULL)){
+        g_key_file_free (gkf);
+        return NULL;
+    }
+
+    src = (conf_source*) calloc (1, sizeof (conf_source));
+    if (src == NULL){
+        g_key_file_free (gkf);
+        return NULL;
+    }
+    src->kind = CONF_SRC_KEYFILE;
+    src->gkf = gkf;
+    return src;
+}
+
+static void profile_release (conf_profile* profile);
+
+void conf_close (conf_source* src){
+    if (src == NULL)
+        return;
+    profile_release (src->profile);
+    if (src->kind == CONF_SRC_KEYFILE)
+        g_key_file_free (src->gkf);
+    else
+        munmap ((void*) src->map, src->map_len);
+    free (src);
+}
+
+int conf_kind (conf_source* src){
+    return src->kind;
+}
+
+/*
+ * True if a corrupted section was found while reading the image. The
+ * values read so far can't be trusted and the caller should reload from
+ * agros.conf.
+ */
+
+int conf_failed (conf_source* src){
+    return src->failed;
+}
+
+/*
+ * Checks the bounds and the checksum of a section the first time it is
+ * used. A section that fails marks the whole source as failed.
+ */
+
+static int image_verify_section (conf_source* src, const policy_section* section){
+    const policy_header* h = src->header;
+    uint64_t sum = CHECKSUM_SEED;
+    int i = 0;
+
+    for (i=0; i<src->nverified; i++){
+        if (src->verified[i] == section)
+            return 1;
+    }
+
+    if (((uint64_t) section->first_key + section->nkeys) * sizeof (policy_key) > h->list_off - h->key_off
+        || ((uint64_t) section->list_first + section->list_count) * sizeof (uint32_t) > h->str_off - h->list_off
+        || section->str_first < h->str_off
+        || (uint64_t) section->str_first + section->str_len > h->total_size){
+        src->failed = 1;
+        return 0;
+    }
+
+    sum = policy_checksum (sum, section, offsetof (policy_section, checksum));
+    sum = policy_checksum (sum, &src->keys[section->first_key], section->nkeys * sizeof (policy_key));
+    sum = policy_checksum (sum, &src->lists[section->list_first], section->list_count * sizeof (uint32_t));
+    sum = policy_checksum (sum, src->map + section->str_first, section->str_len);
+    if (sum != section->checksum){
+        src->failed = 1;
+        return 0;
+    }
+
+    if (src->nverified < (int) (sizeof (src->verified) / sizeof (src->verified[0])))
+        src->verified[src->nverified++] = section;
+    return 1;
+}
+
+/*
+ * Binary searches for group in the image section table.
+ */
+
+static const policy_section* image_find_section (conf_source* src, const char* group){
+    uint32_t lo = 0, hi = src->header->nsections;
+    const char* name = NULL;
+    int cmp = 0;
+
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo)/2;
+        name = image_string (src, src->sections[mid].name_off);
+        if (name == NULL)
+            return NULL;
+        cmp = strcmp (group, name);
+        if (cmp == 0)
+            return image_verify_section (src, &src->sections[mid]) ? &src->sections[mid] : NULL;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+static const policy_key* image_find_key (conf_source* src, const char* group, const char* key){
+    const policy_section* section = image_find_section (src, group);
+    uint32_t lo = 0, hi = 0;
+    const char* name = NULL;
+    int cmp = 0;
+
+    if (section == NULL)
+        return NULL;
+
+    hi = section->nkeys;
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo)/2;
+        const policy_key* k = &src->keys[section->first_key + mid];
+        name = image_string (src, k->name_off);
+        if (name == NULL)
+            return NULL;
+        cmp = strcmp (key, name);
+        if (cmp == 0)
+            return k;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the drop-in file of the profile that sets key in group, or NULL
+ * if agros.conf (or its image) is the one to read.
+ */
+
+static GKeyFile* dropin_for (conf_source* src, const char* group, const char* key){
+    conf_layer* layer = NULL;
+    int i = 0;
+
+    if (src->profile == NULL)
+        return NULL;
+    for (i=0; i<src->profile->nlayers; i++){
+        layer = &src->profile->layers[i];
+        if (layer->gkf != NULL && !strcmp (layer->name, group))
+            return g_key_file_has_group (layer->gkf, group) && g_key_file_has_key (layer->gkf, group, key, NULL)
+                ? layer->gkf : NULL;
+    }
+    return NULL;
+}
+
+/*
+ * The GKeyFile to read key of group from, or NULL for the image.
+ */
+
+static GKeyFile* keyfile_for (conf_source* src, const char* group, const char* key){
+    GKeyFile* gkf = dropin_for (src, group, key);
+
+    if (gkf == NULL && src->kind == CONF_SRC_KEYFILE)
+        gkf = src->gkf;
+    return gkf;
+}
+
+int conf_has_group (conf_source* src, const char* group){
+    int i = 0;
+
+    for (i=0; src->profile && i<src->profile->nlayers; i++){
+        if (src->profile->layers[i].gkf != NULL && !strcmp (src->profile->layers[i].name, group)
+            && g_key_file_has_group (src->profile->layers[i].gkf, group))
+            return 1;
+    }
+    if (src->kind == CONF_SRC_KEYFILE)
+        return g_key_file_has_group (src->gkf, group);
+    return image_find_section (src, group) != NULL;
+}
+
+int conf_has_key (conf_source* src, const char* group, const char* key){
+    if (dropin_for (src, group, key) != NULL)
+        return 1;
+    if (src->kind == CONF_SRC_KEYFILE)
+        return g_key_file_has_group (src->gkf, group) && g_key_file_has_key (src->gkf, group, key, NULL);
+    return image_find_key (src, group, key) != NULL;
+}
+
+/*
+ * Returns a malloc'd copy of the value, or NULL if the key does not exist.
+ */
+
+char* conf_get_string (conf_source* src, const char* group, const char* key){
+    const policy_key* k = NULL;
+    const char* value = NULL;
+    GKeyFile* gkf = keyfile_for (src, group, key);
+    char* gvalue = NULL;
+    char* result = NULL;
+
+    if (gkf != NULL){
+        gvalue = g_key_file_get_string (gkf, group, key, NULL);
+        if (gvalue == NULL)
+            return NULL;
+        result = strdup (gvalue);
+        g_free (gvalue);
+        return result;
+    }
+
+    k = image_find_key (src, group, key);
+    if (k == NULL || (value = image_string (src, k->value_off)) == NULL)
+        return NULL;
+    return strdup (value);
+}
+
+/*
+ * Same semantics as g_key_file_get_integer(): 0 if the key is missing or
+ * is not a valid integer.
+ */
+
+int conf_get_integer (conf_source* src, const char* group, const char* key){
+    const policy_key* k = NULL;
+    const char* value = NULL;
+    GKeyFile* gkf = keyfile_for (src, group, key);
+    char* end = NULL;
+    long result = 0;
+
+    if (gkf != NULL)
+        return g_key_file_get_integer (gkf, group, key, NULL);
+
+    k = image_find_key (src, group, key);
+    if (k == NULL || (value = image_string (src, k->value_off)) == NULL || *value == '\0')
+        return 0;
+    errno = 0;
+    result = strtol (value, &end, 10);
+    if (*end != '\0' || errno != 0 || result > INT32_MAX || result < INT32_MIN)
+        return 0;
+    return (int) result;
+}
+
+/*
+ * Packs count strings into a single NULL-terminated block: the pointer
+ * array first, then the characters. The caller releases it with free().
+ */
+
+static char** pack_string_list (const char** strings, int count){
+    size_t size = (count + 1) * sizeof (char*);
+    char** result = NULL;
+    char* cursor = NULL;
+    int i = 0;
+
+    for (i=0; i<count; i++)
+        size += strlen (strings[i]) + 1;
+
+    result = (char**) malloc (size);
+    if (result == NULL)
+        return NULL;
+
+    cursor = (char*) (result + count + 1);
+    for (i=0; i<count; i++){
+        size_t len = strlen (strings[i]) + 1;
+        memcpy (cursor, strings[i], len);
+        result[i] = cursor;
+        cursor += len;
+    }
+    result[count] = NULL;
+
+    return result;
+}
+
+/*
+ * Returns the ';' separated list stored in key as a single block to be
+ * released with free(), or NULL if the key does not exist.
+ */
+
+char** conf_get_string_list (conf_source* src, const char* group, const char* key, int* count){
+    const policy_key* k = NULL;
+    const char** strings = NULL;
+    GKeyFile* gkf = keyfile_for (src, group, key);
+    char** glist = NULL;
+    char** result = NULL;
+    gsize glen = 0;
+    uint32_t i = 0;
+
+    if (gkf != NULL){
+        glist = g_key_file_get_string_list (gkf, group, key, &glen, NULL);
+        if (glist == NULL)
+            return NULL;
+        result = pack_string_list ((const char**) glist, glen);
+        g_strfreev (glist);
+        if (result != NULL && count != NULL)
+            *count = glen;
+        return result;
+    }
+
+    k = image_find_key (src, group, key);
+    if (k == NULL)
+        return NULL;
+    if (((uint64_t) k->list_first + k->list_count) * sizeof (uint32_t)
+        > src->header->str_off - src->header->list_off)
+        return NULL;
+
+    strings = (const char**) malloc ((k->list_count + 1) * sizeof (char*));
+    if (strings == NULL)
+        return NULL;
+    for (i=0; i<k->list_count; i++){
+        strings[i] = image_string (src, src->lists[k->list_first + i]);
+        if (strings[i] == NULL){
+            free (strings);
+            return NULL;
+        }
+    }
+
+    result = pack_string_list (strings, k->list_count);
+    free (strings);
+    if (result != NULL && count != NULL)
+        *count = k->list_count;
+    return result;
+}
+
+/*
+ * A key set in the user's own section takes precedence over the [@group]
+ * sections of the profile, which take precedence over [General].
+ */
+
+const char* conf_select_group (conf_source* src, const char* username, const char* key){
+    int i = 0;
+
+    if (src->profile == NULL){
+        if (conf_has_key (src, username, key))
+            return username;
+        return "General";
+    }
+
+    for (i=0; i<src->profile->nlayers; i++){
+        if (conf_has_key (src, src->profile->layers[i].name, key))
+            return src->profile->layers[i].name;
+    }
+    return "General";
+}
+
+static int compare_indirect (const void* a, const void* b){
+    return strcmp (**(char** const*) a, **(char** const*) b);
+}
+
+/*
+ * Like conf_get_string_list() on the group conf_select_group() picks, except
+ * that when that group is one of the user's [@group] sections, the lists of
+ * every group of the profile that sets key are merged, without duplicates.
+ * A key in the user's own section or in [General] is used as it is. The
+ * section used first is returned in group.
+ */
+
+char** conf_get_merged_list (conf_source* src, const char* username, const char* key, int* count, const char** group){
+    char*** parts = NULL;
+    const char** strings = NULL;
+    char*** sorted = NULL;
+    char** result = NULL;
+    int nparts = 0, total = 0, kept = 0;
+    int first = 0, i = 0, j = 0, n = 0;
+
+    *group = conf_select_group (src, username, key);
+    if (src->profile == NULL || *group == src->profile->layers[0].name || !strcmp (*group, "General"))
+        return conf_get_string_list (src, *group, key, count);
+
+    for (first=1; first<src->profile->nlayers; first++){
+        if (src->profile->layers[first].name == *group)
+            break;
+    }
+    parts = (char***) malloc (src->profile->nlayers * sizeof (char**));
+    if (parts == NULL)
+        return NULL;
+    for (i=first; i<src->profile->nlayers; i++){
+        if (!conf_has_key (src, src->profile->layers[i].name, key))
+            continue;
+        parts[nparts] = conf_get_string_list (src, src->profile->layers[i].name, key, &n);
+        if (parts[nparts] == NULL)
+            goto out;
+        nparts++;
+        total += n;
+    }
+    if (nparts == 1){
+        *count = total;
+        result = parts[0];
+        free (parts);
+        return result;
+    }
+
+    /* Duplicates sort next to each other. Of each run, the one that comes
+       first in strings[] is kept, so the merged list keeps the group order */
+    strings = (const char**) malloc ((total + 1) * sizeof (char*));
+    sorted = (char***) malloc ((total + 1) * sizeof (char**));
+    if (strings == NULL || sorted == NULL)
+        goto out;
+    n = 0;
+    for (i=0; i<nparts; i++){
+        for (j=0; parts[i][j] != NULL; j++){
+            strings[n] = parts[i][j];
+            sorted[n] = (char**) &strings[n];
+            n++;
+        }
+    }
+    qsort (sorted, n, sizeof (char**), compare_indirect);
+    for (i=0; i<n; i=j){
+        char** keep = sorted[i];
+        for (j=i+1; j<n && !strcmp (*sorted[j], *keep); j++){
+            if (sorted[j] < keep)
+                keep = sorted[j];
+        }
+        for (; i<j; i++){
+            if (sorted[i] != keep)
+                *sorted[i] = NULL;
+        }
+    }
+    for (i=0; i<n; i++){
+        if (strings[i] != NULL)
+            strings[kept++] = strings[i];
+    }
+
+    result = pack_string_list (strings, kept);
+    if (result != NULL)
+        *count = kept;
+
+out:
+    for (i=0; i<nparts; i++)
+        free (parts[i]);
+    free (parts);
+    free (strings);
+    free (sorted);
+    return result;
+}
+
+
+/*
+ * Profiles: the user's groups and the drop-in files of agros.conf.d.
+ */
+
+/*
+ * Fills uid, gid and the supplementary groups of username, in *groups,
+ * which the caller frees. A session running as the user already carries
+ * the groups its login got from getgrouplist(), so they are read from the
+ * process instead of asking NSS again. Returns -1 if the user is unknown,
+ * and -2 if its groups can't all be read: a [@group] section can forbid
+ * things, so a profile missing some of them must not be used.
+ */
+
+int conf_user_groups (const char* username, uid_t* uid, gid_t* gid, gid_t** groups, int* ngroups){
+    struct passwd pwd;
+    struct passwd* found = NULL;
+    char buf[4096];
+    gid_t* list = NULL;
+    int size = 0, n = 0, tries = 0;
+
+    *groups = NULL;
+    *ngroups = 0;
+    if (getpwnam_r (username, &pwd, buf, sizeof (buf), &found) != 0 || found == NULL)
+        return -1;
+    *uid = pwd.pw_uid;
+    *gid = pwd.pw_gid;
+
+    /* The list can grow between the two calls: then it is asked again */
+    for (tries=0; tries<3; tries++){
+        if (pwd.pw_uid == getuid () && pwd.pw_uid == geteuid () && pwd.pw_gid == getgid ())
+            size = getgroups (0, NULL);
+        else if (size == 0)
+            size = 64;
+        if (size < 0)
+            return -2;
+        free (list);
+        list = (gid_t*) malloc ((size + 1) * sizeof (gid_t));
+        if (list == NULL)
+            return -2;
+
+        n = size;
+        if (pwd.pw_uid == getuid () && pwd.pw_uid == geteuid () && pwd.pw_gid == getgid ())
+            n = getgroups (size, list);
+        else if (getgrouplist (pwd.pw_name, pwd.pw_gid, list, &n) < 0){
+            /* n is now the size that is needed */
+            size = n;
+            n = -1;
+        }
+        if (n >= 0){
+            *groups = list;
+            *ngroups = n;
+            return 0;
+        }
+    }
+    free (list);
+    return -2;
+}
+
+static int compare_gids (const void* a, const void* b){
+    gid_t x = *(const gid_t*) a, y = *(const gid_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_layers (const void* a, const void* b){
+    return strcmp (((const conf_layer*) a)->name, ((const conf_layer*) b)->name);
+}
+
+/*
+ * A user or group name that can be used as a file name.
+ */
+
+static int safe_name (const char* name){
+    return name[0] != '\0' && name[0] != '.' && strchr (name, '/') == NULL;
+}
+
+static void stamp_layer (conf_layer* layer, const struct stat* st){
+    layer->present = 1;
+    layer->dev = st->st_dev;
+    layer->ino = st->st_ino;
+    layer->size = st->st_size;
+    layer->mtime = st->st_mtim;
+    layer->ctime = st->st_ctim;
+}
+
+/*
+ * True if the drop-in file of layer is still the one that was read.
+ */
+
+static int layer_current (const conf_layer* layer){
+    struct stat st;
+
+    if (stat (layer->path, &st) < 0)
+        return !layer->present;
+    return layer->present && st.st_dev == layer->dev && st.st_ino == layer->ino && st.st_size == layer->size
+        && st.st_mtim.tv_sec == layer->mtime.tv_sec && st.st_mtim.tv_nsec == layer->mtime.tv_nsec
+        && st.st_ctim.tv_sec == layer->ctime.tv_sec && st.st_ctim.tv_nsec == layer->ctime.tv_nsec;
+}
+
+/*
+ * Reads the drop-in file of layer, if there is one. Like the policy image,
+ * it is ignored unless it belongs to root or to the owner of agros.conf and
+ * nobody else can write it: anyone who can edit it can grant commands.
+ */
+
+static void load_layer (conf_layer* layer, uid_t owner){
+    struct stat st;
+    char* data = NULL;
+    ssize_t len = 0;
+    int fd = -1;
+
+    fd = open (layer->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fstat (fd, &st) < 0)
+        goto out;
+    stamp_layer (layer, &st);
+    if (!S_ISREG (st.st_mode) || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || (st.st_uid != 0 && st.st_uid != owner) || st.st_size > CONF_DROPIN_MAX)
+        goto out;
+
+    data = (char*) malloc (st.st_size + 1);
+    if (data == NULL || (len = read (fd, data, st.st_size)) != st.st_size)
+        goto out;
+    layer->gkf = g_key_file_new ();
+    if (!g_key_file_load_from_data (layer->gkf, data, len, G_KEY_FILE_NONE, NULL)){
+        g_key_file_free (layer->gkf);
+        layer->gkf = NULL;
+    }
+
+out:
+    free (data);
+    close (fd);
+}
+
+static void profile_free (conf_profile* profile){
+    int i = 0;
+
+    if (profile == NULL)
+        return;
+    for (i=0; i<profile->nlayers; i++){
+        free (profile->layers[i].name);
+        free (profile->layers[i].path);
+        if (profile->layers[i].gkf != NULL)
+            g_key_file_free (profile->layers[i].gkf);
+    }
+    free (profile->layers);
+    free (profile->groups);
+    free (profile->conf);
+    free (profile->username);
+    free (profile);
+}
+
+/*
+ * Adds the layer called name, with its drop-in file agros.conf.d/kind/file.conf
+ */
+
+static int add_layer (conf_profile* profile, const char* name, const char* kind, const char* file){
+    conf_layer* layer = &profile->layers[profile->nlayers];
+    size_t len = strlen (profile->conf) + strlen (kind) + strlen (file) + 10;
+
+    memset (layer, 0, sizeof (conf_layer));
+    layer->name = strdup (name);
+    layer->path = (char*) malloc (len);
+    if (layer->name == NULL || layer->path == NULL){
+        free (layer->name);
+        free (layer->path);
+        return -1;
+    }
+    snprintf (layer->path, len, "%s.d/%s/%s.conf", profile->conf, kind, file);
+    profile->nlayers++;
+    return 0;
+}
+
+/*
+ * Resolves the profile of username: the names of its groups, in order,
+ * and the drop-in files of the user and of those groups. groups holds gid
+ * first, then the others in numeric order.
+ */
+
+static conf_profile* profile_build (const char* conf_path, const char* username,
+                                    uid_t uid, const gid_t* groups, int ngroups){
+    conf_profile* profile = NULL;
+    struct group grp;
+    struct group* found = NULL;
+    struct stat st;
+    char name[512];
+    char buf[4096];
+    uid_t owner = 0;
+    int others = 1;
+    int i = 0;
+
+    profile = (conf_profile*) calloc (1, sizeof (conf_profile));
+    if (profile == NULL)
+        return NULL;
+    profile->conf = strdup (conf_path);
+    profile->username = strdup (username);
+    profile->layers = (conf_layer*) calloc (ngroups + 1, sizeof (conf_layer));
+    profile->groups = (gid_t*) malloc ((ngroups + 1) * sizeof (gid_t));
+    if (!profile->conf || !profile->username || !profile->layers || !profile->groups)
+        goto fail;
+    profile->uid = uid;
+    profile->ngroups = ngroups;
+    memcpy (profile->groups, groups, ngroups * sizeof (gid_t));
+
+    if (add_layer (profile, username, "users", safe_name (username) ? username : ".") < 0)
+        goto fail;
+
+    for (i=0; i<ngroups; i++){
+        if (getgrgid_r (groups[i], &grp, buf, sizeof (buf), &found) != 0 || found == NULL)
+            continue;
+        if (snprintf (name, sizeof (name), "@%s", grp.gr_name) >= (int) sizeof (name))
+            continue;
+        if (add_layer (profile, name, "groups", safe_name (grp.gr_name) ? grp.gr_name : ".") < 0)
+            goto fail;
+        if (i == 0)
+            others = 2;
+    }
+
+    /* The primary group comes first, the others by name, so the order
+       doesn't depend on how NSS lists them */
+    if (profile->nlayers > others)
+        qsort (profile->layers + others, profile->nlayers - others, sizeof (conf_layer), compare_layers);
+
+    if (stat (conf_path, &st) == 0)
+        owner = st.st_uid;
+    for (i=0; i<profile->nlayers; i++)
+        load_layer (&profile->layers[i], owner);
+
+    return profile;
+
+fail:
+    profile_free (profile);
+    return NULL;
+}
+
+/*
+ * Returns the cached profile for (conf_path, username, uid, groups) if none
+ * of its drop-in files changed, or resolves it again. The caller holds a
+ * reference. Called with profile_lock held.
+ */
+
+static conf_profile* profile_get (const char* conf_path, const char* username,
+                                  uid_t uid, gid_t gid, const gid_t* groups, int ngroups){
+    gid_t* key = NULL;
+    conf_profile* profile = NULL;
+    int nkey = 1, slot = -1, i = 0, j = 0;
+
+    key = (gid_t*) malloc ((ngroups + 1) * sizeof (gid_t));
+    if (key == NULL)
+        return NULL;
+    key[0] = gid;
+    for (i=0; i<ngroups; i++){
+        if (groups[i] != gid)
+            key[nkey++] = groups[i];
+    }
+    qsort (key + 1, nkey - 1, sizeof (gid_t), compare_gids);
+    for (i=j=1; i<nkey; i++){
+        if (key[i] != key[j-1])
+            key[j++] = key[i];
+    }
+    nkey = j;
+
+    for (i=0; i<CONF_PROFILE_CACHE; i++){
+        profile = profile_cache[i];
+        if (profile != NULL && profile->uid == uid && profile->ngroups == nkey
+            && !memcmp (profile->groups, key, nkey * sizeof (gid_t))
+            && !strcmp (profile->username, username) && !strcmp (profile->conf, conf_path))
+            break;
+    }
+
+    if (i < CONF_PROFILE_CACHE){
+        for (j=0; j<profile->nlayers && layer_current (&profile->layers[j]); j++)
+            ;
+        if (j == profile->nlayers){
+            profile->refs++;
+            profile->used = ++profile_clock;
+            free (key);
+            return profile;
+        }
+        /* Out of date: it goes away with its last user */
+        profile_cache[i] = NULL;
+        if (profile->refs == 0)
+            profile_free (profile);
+    }
+
+    profile = profile_build (conf_path, username, uid, key, nkey);
+    free (key);
+    if (profile == NULL)
+        return NULL;
+    profile->refs = 1;
+    profile->used = ++profile_clock;
+
+    /* A free slot, or the least recently used profile nobody holds. With
+       neither, the profile lives as long as its source. */
+    for (i=0; i<CONF_PROFILE_CACHE; i++){
+        if (profile_cache[i] == NULL){
+            slot = i;
+            break;
+        }
+        if (profile_cache[i]->refs == 0 && (slot < 0 || profile_cache[i]->used < profile_cache[slot]->used))
+            slot = i;
+    }
+    if (slot >= 0){
+        profile_free (profile_cache[slot]);
+        profile_cache[slot] = profile;
+    }
+    return profile;
+}
+
+/*
+ * Drops a reference. A profile that isn't in the cache goes away with its
+ * last user.
+ */
+
+static void profile_release (conf_profile* profile){
+    int i = 0;
+
+    if (profile == NULL)
+        return;
+    pthread_mutex_lock (&profile_lock);
+    if (--profile->refs == 0){
+        for (i=0; i<CONF_PROFILE_CACHE && profile_cache[i] != profile; i++)
+            ;
+        if (i == CONF_PROFILE_CACHE)
+            profile_free (profile);
+    }
+    pthread_mutex_unlock (&profile_lock);
+}
+
+/*
+ * Reads src for username from now on: the [@group] sections of its primary
+ * group gid and of its groups apply, and so do the drop-in files of
+ * agros.conf.d. Returns -1 if the profile can't be resolved, and src is
+ * left as it was.
+ */
+
+int conf_use_profile (conf_source* src, const char* conf_path, const char* username,
+                      uid_t uid, gid_t gid, const gid_t* groups, int ngroups){
+    conf_profile* profile = NULL;
+
+    pthread_mutex_lock (&profile_lock);
+    profile = profile_get (conf_path, username, uid, gid, groups, ngroups);
+    pthread_mutex_unlock (&profile_lock);
+    if (profile == NULL)
+        return -1;
+
+    profile_release (src->profile);
+    src->profile = profile;
+    return 0;
+}
+
+/*
+ * Resolves the profile of username ahead of its login, so that processes
+ * forked later find it in their cache.
+ */
+
+int conf_prefetch_profile (const char* conf_path, const char* username,
+                           uid_t uid, gid_t gid, const gid_t* groups, int ngroups){
+    conf_profile* profile = NULL;
+
+    pthread_mutex_lock (&profile_lock);
+    profile = profile_get (conf_path, username, uid, gid, groups, ngroups);
+    pthread_mutex_unlock (&profile_lock);
+    if (profile == NULL)
+        return -1;
+    profile_release (profile);
+    return 0;
+}
+
+
+/*
+ * Policy compiler. Used by agros-policyc.
+ */
+
+static int buf_reserve (policy_buf* buf, size_t extra){
+    unsigned char* data = NULL;
+    size_t cap = buf->cap ? buf->cap : 4096;
+
+    while (buf->len + extra > cap)
+        cap *= 2;
+    if (cap != buf->cap){
+        data = (unsigned char*) realloc (buf->data, cap);
+        if (data == NULL)
+            return -1;
+        buf->data = data;
+        buf->cap = cap;
+    }
+    return 0;
+}
+
+static int buf_append (policy_buf* buf, const void* data, size_t len){
+    if (buf_reserve (buf, len) < 0)
+        return -1;
+    memcpy (buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+/*
+ * Appends a string to the string table and returns its offset relative to
+ * the start of the table.
+ */
+
+static uint32_t buf_add_string (policy_buf* buf, const char* string, int* error){
+    uint32_t off = buf->len;
+    if (buf_append (buf, string, strlen (string)+1) < 0)
+        *error = 1;
+    return off;
+}
+
+static int compare_strings (const void* a, const void* b){
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Compiles conf_path into image_path. The image is written to a temporary
+ * file and renamed into place so running sessions never see a partial
+ * image. Returns 0 on success, -1 on error (with a message on stderr).
+ */
+
+int policy_image_compile (const char* conf_path, const char* image_path){
+    GKeyFile* gkf = NULL;
+    GError* gerror = NULL;
+    char** groups = NULL;
+    char** keys = NULL;
+    char** list = NULL;
+    char* value = NULL;
+    gsize ngroups = 0, nkeys = 0, nlist = 0;
+    policy_buf sections = {NULL, 0, 0};
+    policy_buf keytab = {NULL, 0, 0};
+    policy_buf lists = {NULL, 0, 0};
+    policy_buf strings = {NULL, 0, 0};
+    policy_buf image = {NULL, 0, 0};
+    policy_header header;
+    policy_section section;
+    policy_key key;
+    struct stat st;
+    char* tmp_path = NULL;
+    uint32_t key_count = 0, list_count = 0;
+    uint64_t sum = 0;
+    size_t i = 0, j = 0, k = 0;
+    int error = 0, fd = -1, result = -1;
+
+    gkf = g_key_file_new ();
+    if (!g_key_file_load_from_file (gkf, conf_path, G_KEY_FILE_NONE, &gerror)){
+        fprintf (stderr, "%s: %s\n", conf_path, gerror ? gerror->message : "could not load file");
+        goto out;
+    }
+    if (stat (conf_path, &st) < 0){
+        perror (conf_path);
+        goto out;
+    }
+
+    groups = g_key_file_get_groups (gkf, &ngroups);
+    qsort (groups, ngroups, sizeof (char*), compare_strings);
+
+    for (i=0; i<ngroups; i++){
+        keys = g_key_file_get_keys (gkf, groups[i], &nkeys, NULL);
+        qsort (keys, nkeys, sizeof (char*), compare_strings);
+
+        memset (&section, 0, sizeof (section));
+        section.name_off = buf_add_string (&strings, groups[i], &error);
+        section.str_first = section.name_off;
+        section.first_key = key_count;
+        section.nkeys = nkeys;
+        section.list_first = list_count;
+
+        for (j=0; j<nkeys; j++){
+            value = g_key_file_get_string (gkf, groups[i], keys[j], &gerror);
+            if (value == NULL){
+                fprintf (stderr, "%s: [%s] %s: %s\n", conf_path, groups[i], keys[j],
+                         gerror ? gerror->message : "invalid value");
+                g_strfreev (keys);
+                goto out;
+            }
+            list = g_key_file_get_string_list (gkf, groups[i], keys[j], &nlist, NULL);
+
+            key.name_off = buf_add_string (&strings, keys[j], &error);
+            key.value_off = buf_add_string (&strings, value, &error);
+            key.list_first = list_count;
+            key.list_count = list ? nlist : 0;
+            for (k=0; list && k<nlist; k++){
+                uint32_t off = buf_add_string (&strings, list[k], &error);
+                error |= buf_append (&lists, &off, sizeof (off)) < 0;
+            }
+            list_count += key.list_count;
+            key_count++;
+            error |= buf_append (&keytab, &key, sizeof (key)) < 0;
+
+            g_free (value);
+            g_strfreev (list);
+        }
+        g_strfreev (keys);
+
+        section.list_count = list_count - section.list_first;
+        section.str_len = strings.len - section.str_first;
+        error |= buf_append (&sections, &section, sizeof (section)) < 0;
+    }
+
+    if (error){
+        fprintf (stderr, "%s: out of memory\n", conf_path);
+        goto out;
+    }
+
+    /* Every offset so far is relative to its own table. Fix them up now that
+       the position of each table is known. */
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, POLICY_MAGIC, 8);
+    header.version = POLICY_VERSION;
+    header.nsections = ngroups;
+    header.section_off = sizeof (header);
+    header.key_off = header.section_off + sections.len;
+    header.list_off = header.key_off + keytab.len;
+    header.str_off = header.list_off + lists.len;
+    header.total_size = header.str_off + strings.len;
+    header.src_size = st.st_size;
+    header.src_ino = st.st_ino;
+    header.src_mtime_sec = st.st_mtim.tv_sec;
+    header.src_mtime_nsec = st.st_mtim.tv_nsec;
+
+    for (i=0; i<sections.len; i+=sizeof (section)){
+        policy_section* s = (policy_section*) (sections.data + i);
+        s->name_off += header.str_off;
+        s->str_first += header.str_off;
+    }
+    for (i=0; i<keytab.len; i+=sizeof (key)){
+        policy_key* pk = (policy_key*) (keytab.data + i);
+        pk->name_off += header.str_off;
+        pk->value_off += header.str_off;
+    }
+    for (i=0; i<lists.len; i+=sizeof (uint32_t)){
+        uint32_t* off = (uint32_t*) (lists.data + i);
+        *off += header.str_off;
+    }
+
+    /* Checksums go last, once every offset they cover is final */
+    for (i=0; i<sections.len; i+=sizeof (section)){
+        policy_section* s = (policy_section*) (sections.data + i);
+        sum = policy_checksum (CHECKSUM_SEED, s, offsetof (policy_section, checksum));
+        sum = policy_checksum (sum, keytab.data + s->first_key * sizeof (policy_key), s->nkeys * sizeof (policy_key));
+        sum = policy_checksum (sum, lists.data + s->list_first * sizeof (uint32_t), s->list_count * sizeof (uint32_t));
+        sum = policy_checksum (sum, strings.data + (s->str_first - header.str_off), s->str_len);
+        s->checksum = sum;
+    }
+    header.checksum = policy_checksum (CHECKSUM_SEED, &header, sizeof (header));
+
+    if (buf_append (&image, &header, sizeof (header)) < 0
+        || buf_append (&image, sections.data, sections.len) < 0
+        || buf_append (&image, keytab.data, keytab.len) < 0
+        || buf_append (&image, lists.data, lists.len) < 0
+        || buf_append (&image, strings.data, strings.len) < 0){
+        fprintf (stderr, "%s: out of memory\n", conf_path);
+        goto out;
+    }
+
+    tmp_path = (char*) malloc (strlen (image_path) + 8);
+    if (tmp_path == NULL)
+        goto out;
+    sprintf (tmp_path, "%s.XXXXXX", image_path);
+    fd = mkstemp (tmp_path);
+    if (fd < 0){
+        perror (tmp_path);
+        goto out;
+    }
+    if (fchmod (fd, 0644) < 0 || write (fd, image.data, image.len) != (ssize_t) image.len
+        || fsync (fd) < 0){
+        perror (tmp_path);
+        unlink (tmp_path);
+        goto out;
+    }
+    if (rename (tmp_path, image_path) < 0){
+        perror (image_path);
+        unlink (tmp_path);
+        goto out;
+    }
+    result = 0;
+
+out:
+    if (fd >= 0)
+        close (fd);
+    if (gerror)
+        g_error_free (gerror);
+    g_strfreev (groups);
+    g_key_file_free (gkf);
+    free (tmp_path);
+    free (sections.data);
+    free (keytab.data);
+    free (lists.data);
+    free (strings.data);
+    free (image.data);
+    return result;
+}
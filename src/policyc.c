@@ -0,0 +1,70 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * agros-policyc: compiles agros.conf into the binary policy image that
+ * AGROS maps at login.
+ *
+ *   agros-policyc [conf_file [image_file]]
+ *
+ * Without arguments, it compiles CONFIG_FILE into POLICY_FILE, which is
+ * where AGROS looks for them. Given only a conf file, the image is written
+ * next to it with an ".img" suffix. Run it again every time agros.conf changes;
+ * until then sessions notice the image is stale and parse agros.conf.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "agros.h"
+#include "policy.h"
+
+int main (int argc, char** argv){
+    const char* conf_path = CONFIG_FILE;
+    const char* image_path = POLICY_FILE;
+    char* default_image = NULL;
+
+    if (argc > 3){
+        fprintf (stderr, "usage: %s [conf_file [image_file]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 2){
+        conf_path = argv[1];
+        default_image = (char*) malloc (strlen (conf_path) + 5);
+        if (default_image == NULL)
+            return EXIT_FAILURE;
+        sprintf (default_image, "%s.img", conf_path);
+        image_path = default_image;
+    }else if (argc == 3){
+        conf_path = argv[1];
+        image_path = argv[2];
+    }
+
+    if (policy_image_compile (conf_path, image_path) < 0){
+        free (default_image);
+        return EXIT_FAILURE;
+    }
+
+    free (default_image);
+    return EXIT_SUCCESS;
+}
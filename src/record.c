@@ -0,0 +1,585 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "record.h"
+
+/* After this long without output, what was compressed is written */
+#define RECORD_IDLE_MS 1000
+
+/* Stages past this many aren't watched for their end */
+#define RECORD_WATCH 32
+
+/* Output that deflate can't shrink by a sixteenth is stored for this many
+   chunks, then tried again */
+#define RECORD_STORED 16
+
+struct recorder{
+    int fd;
+    int failed;             /* a write failed, the file is incomplete */
+    int frame;              /* a command is being recorded */
+    z_stream z;
+    uint64_t bytes;         /* output of the command so far */
+    size_t pending;         /* bytes compressed since the last flush */
+    size_t produced;        /* what they came to, written so far */
+    size_t used;            /* deflate output waiting in data */
+    int level;
+    int stored;             /* chunks left to store */
+
+    /* A DATA record: header, time, then up to RECORD_CHUNK of output */
+    unsigned char data[RECORD_HEADER + 8 + RECORD_CHUNK];
+};
+
+static volatile sig_atomic_t resized = 0;
+
+static uint64_t now_ns (void){
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned char* put32 (unsigned char* p, uint32_t value){
+    int i = 0;
+
+    for (i=0; i<4; i++)
+        p[i] = value >> (8 * i);
+    return p + 4;
+}
+
+static unsigned char* put64 (unsigned char* p, uint64_t value){
+    int i = 0;
+
+    for (i=0; i<8; i++)
+        p[i] = value >> (8 * i);
+    return p + 8;
+}
+
+static int write_all (int fd, const void* buf, size_t len){
+    const char* p = (const char*) buf;
+    ssize_t written = 0;
+
+    while (len > 0){
+        written = write (fd, p, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/*
+ * Writes a record of type whose payload, len bytes, follows RECORD_HEADER
+ * bytes of room at the start of record.
+ */
+
+static void write_record (recorder* rec, int type, unsigned char* record, size_t len){
+    put32 (put32 (record, type), len);
+    if (!rec->failed && write_all (rec->fd, record, RECORD_HEADER + len) < 0)
+        rec->failed = 1;
+}
+
+static void write_data (recorder* rec){
+    if (rec->used == 0)
+        return;
+    put64 (rec->data + RECORD_HEADER, now_ns ());
+    write_record (rec, RECORD_DATA, rec->data, 8 + rec->used);
+    rec->produced += rec->used;
+    rec->used = 0;
+}
+
+/*
+ * Chooses the level of the next chunk after a flush. Output that is
+ * already compressed, or random, costs deflate the most for nothing: it
+ * is stored instead, which is about a copy.
+ */
+
+static void adapt_level (recorder* rec){
+    int level = rec->level;
+
+    if (rec->level == Z_BEST_SPEED && rec->produced > rec->pending - rec->pending / 16){
+        level = Z_NO_COMPRESSION;
+        rec->stored = RECORD_STORED;
+    }else if (rec->level == Z_NO_COMPRESSION && --rec->stored <= 0){
+        level = Z_BEST_SPEED;
+    }
+    if (level == rec->level)
+        return;
+
+    rec->z.next_out = rec->data + RECORD_HEADER + 8 + rec->used;
+    rec->z.avail_out = RECORD_CHUNK - rec->used;
+    if (deflateParams (&rec->z, level, Z_DEFAULT_STRATEGY) == Z_OK)
+        rec->level = level;
+    rec->used = RECORD_CHUNK - rec->z.avail_out;
+}
+
+/*
+ * Compresses what is in rec->z.next_in, writing DATA records as the
+ * buffer fills. With Z_SYNC_FLUSH or Z_FINISH, everything given so far
+ * is in the file when it returns.
+ */
+
+static void compress_output (recorder* rec, int flush){
+    unsigned char* out = rec->data + RECORD_HEADER + 8;
+    int ret = Z_OK;
+
+    for (;;){
+        rec->z.next_out = out + rec->used;
+        rec->z.avail_out = RECORD_CHUNK - rec->used;
+        ret = deflate (&rec->z, flush);
+        rec->used = RECORD_CHUNK - rec->z.avail_out;
+        if (ret == Z_STREAM_ERROR){
+            rec->failed = 1;
+            return;
+        }
+        if (rec->used == RECORD_CHUNK){
+            write_data (rec);
+            continue;
+        }
+        if (flush == Z_FINISH ? ret == Z_STREAM_END : rec->z.avail_in == 0)
+            break;
+    }
+
+    if (flush != Z_NO_FLUSH){
+        write_data (rec);
+        if (flush == Z_SYNC_FLUSH && rec->pending >= RECORD_CHUNK)
+            adapt_level (rec);
+        rec->pending = 0;
+        rec->produced = 0;
+    }
+}
+
+static void record_flush (recorder* rec){
+    if (rec->frame && rec->pending > 0){
+        rec->z.avail_in = 0;
+        compress_output (rec, Z_SYNC_FLUSH);
+    }
+}
+
+/*
+ * Creates the recording of a session of username in dir. Returns NULL,
+ * with errno set, if the file can't be created.
+ */
+
+recorder* record_open (const char* dir, const char* username){
+    char path[PATH_MAX];
+    char stamp[32];
+    unsigned char* session = NULL;
+    recorder* rec = NULL;
+    size_t len = strlen (username) + 1;
+    time_t now = time (NULL);
+    struct tm tm;
+    int saved = 0;
+
+    localtime_r (&now, &tm);
+    strftime (stamp, sizeof (stamp), "%Y%m%d-%H%M%S", &tm);
+    if ((size_t) snprintf (path, sizeof (path), "%s/%s-%s-%d.agrec", dir, username, stamp, (int) getpid ()) >= sizeof (path)){
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    rec = (recorder*) calloc (1, sizeof (recorder));
+    session = (unsigned char*) malloc (RECORD_HEADER + 12 + len);
+    if (rec == NULL || session == NULL){
+        free (rec);
+        free (session);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    rec->level = Z_BEST_SPEED;
+    rec->fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (rec->fd < 0 || deflateInit (&rec->z, rec->level) != Z_OK){
+        saved = rec->fd < 0 ? errno : ENOMEM;
+        if (rec->fd >= 0)
+            close (rec->fd);
+        free (rec);
+        free (session);
+        errno = saved;
+        return NULL;
+    }
+
+    memcpy (put32 (put64 (session + RECORD_HEADER, now_ns ()), getpid ()), username, len);
+    if (write_all (rec->fd, RECORD_MAGIC, RECORD_MAGIC_LEN) < 0)
+        rec->failed = 1;
+    write_record (rec, RECORD_SESSION, session, 12 + len);
+    free (session);
+
+    if (rec->failed){
+        saved = errno;
+        record_close (rec);
+        errno = saved;
+        return NULL;
+    }
+    return rec;
+}
+
+void record_close (recorder* rec){
+    if (rec == NULL)
+        return;
+    if (rec->frame)
+        record_end (rec, -1);
+    deflateEnd (&rec->z);
+    close (rec->fd);
+    free (rec);
+}
+
+/*
+ * Writes redirection r as it would be typed, "2>&1" or ">>log", to buf,
+ * which has room for its path and RECORD_REDIRECT more. Returns the
+ * length with the NUL.
+ */
+
+#define RECORD_REDIRECT 32
+
+static size_t format_redirect (const redirect_t* r, char* buf){
+    static const char* ops[] = { "<", ">", ">>" };
+    int len = 0;
+
+    if (r->mode == REDIR_DUP)
+        len = sprintf (buf, "%d>&%d", r->fd, r->target);
+    else if (r->fd == (r->mode == REDIR_IN ? 0 : 1))
+        len = sprintf (buf, "%s%s", ops[r->mode], r->path);
+    else
+        len = sprintf (buf, "%d%s%s", r->fd, ops[r->mode], r->path);
+    return len + 1;
+}
+
+/*
+ * Starts the frame of cmd: the words and redirections of its stages.
+ * Returns -1 if the recording can't go on.
+ */
+
+int record_begin (recorder* rec, const command_t* cmd){
+    unsigned char* begin = NULL;
+    unsigned char* p = NULL;
+    const stage_t* stage = NULL;
+    const redirect_t* r = NULL;
+    size_t len = 12, word = 0;
+    int i = 0, j = 0;
+
+    if (rec->frame)
+        record_end (rec, -1);
+
+    for (i=0; i<cmd->stage_nbr; i++){
+        stage = &cmd->stages[i];
+        len += 8;
+        for (j=0; j<stage->argc; j++)
+            len += strlen (stage->argv[j]) + 1;
+        for (j=stage->redirect_first; j<stage->redirect_first+stage->redirect_nbr; j++){
+            r = &cmd->redirects[j];
+            len += (r->path ? strlen (r->path) : 0) + RECORD_REDIRECT;
+        }
+    }
+    begin = (unsigned char*) malloc (RECORD_HEADER + len);
+    if (begin == NULL){
+        rec->failed = 1;
+        return -1;
+    }
+
+    p = put32 (put64 (begin + RECORD_HEADER, now_ns ()), cmd->stage_nbr);
+    for (i=0; i<cmd->stage_nbr; i++){
+        stage = &cmd->stages[i];
+        p = put32 (p, stage->argc);
+        for (j=0; j<stage->argc; j++){
+            word = strlen (stage->argv[j]) + 1;
+            memcpy (p, stage->argv[j], word);
+            p += word;
+        }
+        p = put32 (p, stage->redirect_nbr);
+        for (j=stage->redirect_first; j<stage->redirect_first+stage->redirect_nbr; j++)
+            p += format_redirect (&cmd->redirects[j], (char*) p);
+    }
+    write_record (rec, RECORD_BEGIN, begin, p - (begin + RECORD_HEADER));
+    free (begin);
+
+    deflateReset (&rec->z);
+    rec->frame = 1;
+    rec->bytes = 0;
+    rec->pending = 0;
+    rec->produced = 0;
+    rec->used = 0;
+    return rec->failed ? -1 : 0;
+}
+
+/*
+ * Adds size bytes to the output of the command being recorded.
+ */
+
+void record_output (recorder* rec, const void* data, size_t size){
+    if (!rec->frame || rec->failed || size == 0)
+        return;
+
+    rec->z.next_in = (unsigned char*) data;
+    rec->z.avail_in = size;
+    rec->bytes += size;
+    rec->pending += size;
+    compress_output (rec, rec->pending >= RECORD_CHUNK ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+/*
+ * Ends the frame of the command with its exit status. Returns -1 if the
+ * recording is incomplete.
+ */
+
+int record_end (recorder* rec, int status){
+    unsigned char end[RECORD_HEADER + 20];
+
+    if (rec->frame){
+        rec->z.avail_in = 0;
+        compress_output (rec, Z_FINISH);
+        put64 (put32 (put64 (end + RECORD_HEADER, now_ns ()), (uint32_t) status), rec->bytes);
+        write_record (rec, RECORD_END, end, 20);
+        rec->frame = 0;
+    }
+    return rec->failed ? -1 : 0;
+}
+
+/*
+ * Creates what the commands of a recorded line write to: *capture is
+ * given to them, AGROS reads *output. With a terminal on both sides of
+ * AGROS, it is a PTY that looks like it (*terminal is set); otherwise a
+ * pipe. Returns -1 with errno set on failure.
+ */
+
+int record_capture (int* output, int* capture, int* terminal){
+    struct termios term;
+    struct winsize size;
+    char name[64];
+    int fds[2];
+    int master = -1, slave = -1, saved = 0;
+
+    *terminal = isatty (STDIN_FILENO) && isatty (STDOUT_FILENO);
+    if (!*terminal){
+        if (pipe2 (fds, O_CLOEXEC) < 0)
+            return -1;
+        *output = fds[0];
+        *capture = fds[1];
+        return 0;
+    }
+
+    master = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0)
+        return -1;
+    if (grantpt (master) < 0 || unlockpt (master) < 0 || ptsname_r (master, name, sizeof (name)) != 0
+        || (slave = open (name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0){
+        saved = errno;
+        close (master);
+        errno = saved;
+        return -1;
+    }
+
+    /* The command sees the user's terminal settings, without the job
+       control AGROS doesn't do: a stopped command would never return */
+    if (tcgetattr (STDIN_FILENO, &term) == 0){
+        term.c_cc[VSUSP] = _POSIX_VDISABLE;
+        tcsetattr (slave, TCSANOW, &term);
+    }
+    if (ioctl (STDIN_FILENO, TIOCGWINSZ, &size) == 0)
+        ioctl (slave, TIOCSWINSZ, &size);
+
+    *output = master;
+    *capture = slave;
+    return 0;
+}
+
+static void on_resize (int sig){
+    (void) sig;
+    resized = 1;
+}
+
+/*
+ * Moves what the command wrote to output to AGROS's standard output and
+ * records it. When both are pipes (copy is then a pipe too), the data is
+ * tee()d into copy and splice()d out, and only the copy is read. Returns
+ * the bytes moved, 0 at the end of output and -1 with errno set.
+ */
+
+static ssize_t move_output (recorder* rec, int output, int* copy, char* buf){
+    ssize_t n = 0, moved = 0, done = 0;
+
+    if (copy[0] < 0){
+        n = read (output, buf, RECORD_CHUNK);
+        if (n > 0 && write_all (STDOUT_FILENO, buf, n) < 0)
+            return -1;
+        if (n > 0)
+            record_output (rec, buf, n);
+        return n;
+    }
+
+    n = tee (output, copy[1], RECORD_CHUNK, SPLICE_F_NONBLOCK);
+    if (n <= 0)
+        return n;
+    for (done=0; done<n; done+=moved){
+        moved = splice (output, NULL, STDOUT_FILENO, NULL, n - done, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR)
+            moved = 0;
+        else if (moved <= 0)
+            return -1;
+    }
+    for (done=0; done<n; done+=moved){
+        moved = read (copy[0], buf, n - done);
+        if (moved < 0 && errno == EINTR)
+            moved = 0;
+        else if (moved <= 0)
+            return -1;
+        record_output (rec, buf, moved);
+    }
+    return n;
+}
+
+/*
+ * Passes the output of the count stages in sps on, and records it, until
+ * there is no more or every stage has exited. With terminal, output is the
+ * PTY: what the user types goes to it, the real terminal is in raw mode
+ * meanwhile and its size follows the real one. The events of loop, if not
+ * NULL, are handled as they come.
+ *
+ * Returns 0, or -1 if AGROS's own output went away first. output should
+ * then be closed at once, so the stages get SIGPIPE or SIGHUP; otherwise
+ * only once they have been waited for: closing the PTY while a stage is
+ * still exiting would hang it up.
+ */
+
+int record_relay (recorder* rec, int output, int terminal, const spawn_t* sps, int count, evloop* loop){
+    static char buf[RECORD_CHUNK];
+    struct pollfd polls[RECORD_WATCH + 3];
+    struct sigaction ignore, resize, saved_pipe, saved_resize;
+    struct termios term, raw;
+    struct winsize size;
+    struct stat st;
+    int copy[2] = {-1, -1};
+    int poll_nbr = 3, exited = 0, watched = count <= RECORD_WATCH, raw_mode = 0, gone = 0, i = 0;
+    ssize_t n = 0;
+
+    /* The reader of AGROS's output may go, that must not end AGROS */
+    memset (&ignore, 0, sizeof (ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &ignore, &saved_pipe);
+
+    if (!terminal && fstat (STDOUT_FILENO, &st) == 0 && (S_ISFIFO (st.st_mode) || S_ISSOCK (st.st_mode))
+        && pipe2 (copy, O_CLOEXEC) < 0)
+        copy[0] = copy[1] = -1;
+
+    if (terminal){
+        memset (&resize, 0, sizeof (resize));
+        resize.sa_handler = on_resize;
+        sigaction (SIGWINCH, &resize, &saved_resize);
+        if (tcgetattr (STDIN_FILENO, &term) == 0){
+            raw = term;
+            cfmakeraw (&raw);
+            raw_mode = tcsetattr (STDIN_FILENO, TCSANOW, &raw) == 0;
+        }
+    }
+
+    polls[0].fd = output;
+    polls[0].events = POLLIN;
+    polls[1].fd = terminal ? STDIN_FILENO : -1;
+    polls[1].events = POLLIN;
+    polls[2].fd = loop != NULL ? evloop_fd (loop) : -1;
+    polls[2].events = POLLIN;
+    for (i=0; i<count && i<RECORD_WATCH; i++){
+        polls[poll_nbr].fd = sps[i].pidfd;
+        polls[poll_nbr++].events = POLLIN;
+        if (sps[i].pidfd < 0)
+            watched = 0;
+    }
+
+    while (!watched || exited < count){
+        n = poll (polls, poll_nbr, RECORD_IDLE_MS);
+        if (n == 0){
+            record_flush (rec);
+            continue;
+        }
+        if (n < 0 && errno != EINTR)
+            break;
+        if (resized){
+            resized = 0;
+            if (ioctl (STDIN_FILENO, TIOCGWINSZ, &size) == 0)
+                ioctl (output, TIOCSWINSZ, &size);
+        }
+        if (n < 0)
+            continue;
+
+        if (polls[1].revents){
+            n = read (STDIN_FILENO, buf, sizeof (buf));
+            if (n <= 0 || write_all (output, buf, n) < 0)
+                polls[1].fd = -1;
+        }
+        if (polls[2].revents)
+            evloop_run (loop, 0);
+        for (i=3; i<poll_nbr; i++){
+            if (polls[i].revents){
+                polls[i].fd = -1;
+                exited++;
+            }
+        }
+        if (polls[0].revents){
+            n = move_output (rec, output, copy, buf);
+            if (n == 0 || (n < 0 && errno == EIO))
+                break;
+            if (n < 0 && errno != EINTR && errno != EAGAIN){
+                gone = 1;
+                break;
+            }
+        }
+    }
+
+    /* Every stage exited: what they wrote last is still to be moved, but
+       whatever they left running in the background isn't waited for */
+    if (watched && exited == count){
+        fcntl (output, F_SETFL, O_NONBLOCK);
+        while (move_output (rec, output, copy, buf) > 0)
+            ;
+    }
+
+    if (copy[0] >= 0){
+        close (copy[0]);
+        close (copy[1]);
+    }
+    if (raw_mode)
+        tcsetattr (STDIN_FILENO, TCSADRAIN, &term);
+    if (terminal)
+        sigaction (SIGWINCH, &saved_resize, NULL);
+    sigaction (SIGPIPE, &saved_pipe, NULL);
+    record_flush (rec);
+    return gone ? -1 : 0;
+}
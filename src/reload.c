@@ -0,0 +1,225 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "reload.h"
+#include "audit.h"
+
+/* Editors and agros-policyc write in several steps. Reload once no event
+   came for this long. */
+#define RELOAD_SETTLE_MS 100
+
+/* The snapshot loaded by the watcher and not yet taken by the session */
+static config_t* pending = NULL;
+
+static pthread_t watcher;
+static int inotify_fd = -1;
+static int notify_fd = -1;
+static int conf_wd = -1;
+static char* watch_conf = NULL;
+static char* watch_image = NULL;
+static char* watch_user = NULL;
+
+/*
+ * True if path names the file called name in the watched directory.
+ */
+
+static int same_name (const char* path, const char* name){
+    const char* base = strrchr (path, '/');
+    return !strcmp (base ? base + 1 : path, name);
+}
+
+/*
+ * True if a buffer of inotify events mentions the conf, the image or a
+ * drop-in file. A drop-in file of another user costs a reload that finds
+ * the session's profile unchanged.
+ */
+
+static int touches_policy (char* buf, ssize_t len){
+    struct inotify_event* event = NULL;
+    char* p = NULL;
+
+    for (p=buf; p<buf+len; p+=sizeof (struct inotify_event) + event->len){
+        event = (struct inotify_event*) p;
+        if (event->len > 0 && event->wd != conf_wd)
+            return 1;
+        if (event->len > 0 && (same_name (watch_conf, event->name) || same_name (watch_image, event->name)))
+            return 1;
+    }
+    return 0;
+}
+
+static void* watch_policy (void* arg){
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+    config_t* fresh = NULL;
+    config_t* stale = NULL;
+    ssize_t len = 0;
+    int result = 0;
+
+    (void) arg;
+
+    for (;;){
+        len = read (inotify_fd, buf, sizeof (buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        if (!touches_policy (buf, len))
+            continue;
+
+        while (poll (&pfd, 1, RELOAD_SETTLE_MS) > 0){
+            if (read (inotify_fd, buf, sizeof (buf)) <= 0)
+                break;
+        }
+
+        fresh = (config_t*) calloc (1, sizeof (config_t));
+        if (fresh == NULL)
+            continue;
+        result = load_config (fresh, watch_user, watch_conf, watch_image);
+        if (result != CONF_OK){
+            audit (LOG_WARNING, "Could not reload %s (error %d), keeping the current policy.", watch_conf, result);
+            config_free (fresh);
+            free (fresh);
+            continue;
+        }
+
+        /* A snapshot the session hasn't taken yet is out of date now */
+        stale = __atomic_exchange_n (&pending, fresh, __ATOMIC_ACQ_REL);
+        if (stale != NULL){
+            config_free (stale);
+            free (stale);
+        }
+        if (notify_fd >= 0)
+            eventfd_write (notify_fd, 1);
+        audit (LOG_NOTICE, "Reloaded the policy from %s.", watch_conf);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts watching conf_path and image_path for username. Returns -1 if the
+ * watch can't be set up; the session then keeps its policy until logout.
+ */
+
+int reload_start (const char* conf_path, const char* image_path, const char* username){
+    sigset_t all, saved;
+    char* dir = NULL;
+    char* slash = NULL;
+    int result = 0;
+
+    if (inotify_fd >= 0)
+        return 0;
+
+    watch_conf = strdup (conf_path);
+    watch_image = strdup (image_path);
+    watch_user = strdup (username);
+    dir = strdup (conf_path);
+    if (!watch_conf || !watch_image || !watch_user || !dir){
+        free (dir);
+        return -1;
+    }
+
+    /* Watch the directory: editors replace the file rather than write it */
+    slash = strrchr (dir, '/');
+    if (slash == NULL)
+        strcpy (dir, ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+
+    inotify_fd = inotify_init1 (IN_CLOEXEC);
+    if (inotify_fd < 0 || (conf_wd = inotify_add_watch (inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)) < 0){
+        free (dir);
+        return -1;
+    }
+    free (dir);
+
+    /* The drop-in directories, when there are some */
+    dir = (char*) malloc (strlen (conf_path) + 16);
+    if (dir != NULL){
+        sprintf (dir, "%s.d/users", conf_path);
+        inotify_add_watch (inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ATTRIB);
+        sprintf (dir, "%s.d/groups", conf_path);
+        inotify_add_watch (inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ATTRIB);
+        free (dir);
+    }
+
+    /* Tells the session's event loop, when it has one */
+    notify_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    /* SIGCHLD must reach the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &saved);
+    if (pthread_create (&watcher, NULL, watch_policy, NULL) != 0)
+        result = -1;
+    pthread_sigmask (SIG_SETMASK, &saved, NULL);
+
+    return result;
+}
+
+/*
+ * An eventfd that becomes readable when a snapshot is published, or -1.
+ * The session reads it, then calls reload_poll() when it is free to.
+ */
+
+int reload_fd (void){
+    return notify_fd;
+}
+
+/*
+ * Replaces *config with the latest snapshot, if there is one. The warnings
+ * the user has left carry over, unless the new policy turns them off.
+ * Returns 1 if the policy changed.
+ */
+
+int reload_poll (config_t* config){
+    config_t* fresh = NULL;
+
+    if (__atomic_load_n (&pending, __ATOMIC_RELAXED) == NULL)
+        return 0;
+
+    fresh = __atomic_exchange_n (&pending, NULL, __ATOMIC_ACQUIRE);
+    if (fresh == NULL)
+        return 0;
+
+    if (fresh->warnings >= 0 && config->warnings >= 0 && config->warnings < fresh->warnings)
+        fresh->warnings = config->warnings;
+
+    config_free (config);
+    *config = *fresh;
+    free (fresh);
+    return 1;
+}
@@ -0,0 +1,296 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * agros-replay: prints the recording of a session (see record.h).
+ *
+ *   agros-replay FILE        the whole session: each line as it was typed,
+ *                            then its output
+ *   agros-replay -l FILE     one line per command: its number, when it
+ *                            started, how long it ran, its exit status, the
+ *                            size of its output and the line
+ *   agros-replay -c N FILE   the output of the N-th command only
+ *
+ * A file cut short, by a session that was killed say, is printed up to
+ * its last complete record. It only needs libc and zlib.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "record.h"
+
+/* Larger records are taken for corruption */
+#define REPLAY_MAX_RECORD (16 * 1024 * 1024)
+
+typedef struct replay_t replay_t;
+struct replay_t{
+    int list;               /* -l */
+    int only;               /* -c N, or 0 */
+    int index;              /* of the current command */
+    int inflating;
+    uint64_t start;
+    char* line;
+    z_stream z;
+};
+
+static uint32_t get32 (const unsigned char* p){
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t get64 (const unsigned char* p){
+    return get32 (p) | (uint64_t) get32 (p + 4) << 32;
+}
+
+static void format_time (uint64_t ns, char* buf, size_t size){
+    time_t t = ns / 1000000000ULL;
+    struct tm tm;
+
+    localtime_r (&t, &tm);
+    strftime (buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+/*
+ * Appends the count words at *p to line, quoted when they hold a blank.
+ * Returns where they end.
+ */
+
+static const unsigned char* format_words (const unsigned char* p, const unsigned char* end, uint32_t count,
+                                          char* line, size_t* used){
+    size_t word = 0;
+    uint32_t i = 0;
+
+    for (i=0; i<count && p < end; i++){
+        word = strnlen ((const char*) p, end - p);
+        if (*used > 0 && line[*used-1] != ' ')
+            line[(*used)++] = ' ';
+        if (word == 0 || strpbrk ((const char*) p, " \t") != NULL)
+            *used += sprintf (line + *used, "'%.*s'", (int) word, (const char*) p);
+        else
+            *used += sprintf (line + *used, "%.*s", (int) word, (const char*) p);
+        p += word + 1;
+    }
+    return p;
+}
+
+/*
+ * Rebuilds the line of a BEGIN record: the words and redirections of each
+ * stage, with " | " between the stages.
+ */
+
+static char* format_line (const unsigned char* p, const unsigned char* end){
+    char* line = NULL;
+    uint32_t stages = 0, i = 0;
+    size_t used = 0;
+
+    if (end - p < 4)
+        return NULL;
+    stages = get32 (p);
+    p += 4;
+
+    /* A word of n bytes takes n + 1 in the record, n + 3 quoted */
+    line = (char*) malloc (3 * (end - p) + 4 * stages + 1);
+    if (line == NULL)
+        return NULL;
+
+    for (i=0; i<stages && end - p >= 4; i++){
+        if (i > 0)
+            used += sprintf (line + used, " | ");
+        p = format_words (p + 4, end, get32 (p), line, &used);
+        if (end - p >= 4)
+            p = format_words (p + 4, end, get32 (p), line, &used);
+    }
+    line[used] = '\0';
+    return line;
+}
+
+static int selected (replay_t* r){
+    return !r->list && (r->only == 0 || r->only == r->index);
+}
+
+/*
+ * Inflates the output of a DATA record to stdout.
+ */
+
+static int print_output (replay_t* r, const unsigned char* data, size_t len){
+    unsigned char out[65536];
+    int ret = Z_OK;
+
+    r->z.next_in = (unsigned char*) data;
+    r->z.avail_in = len;
+    while (r->inflating && r->z.avail_in > 0){
+        r->z.next_out = out;
+        r->z.avail_out = sizeof (out);
+        ret = inflate (&r->z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return -1;
+        fwrite (out, 1, sizeof (out) - r->z.avail_out, stdout);
+        if (ret == Z_STREAM_END)
+            r->inflating = 0;
+        else if (ret == Z_BUF_ERROR)
+            break;
+    }
+    return 0;
+}
+
+static void end_command (replay_t* r, const unsigned char* p, size_t len){
+    char when[32];
+    int32_t status = 0;
+
+    if (r->line == NULL)
+        return;
+
+    if (r->list){
+        format_time (r->start, when, sizeof (when));
+        if (p == NULL)
+            printf ("%5d  %s  %10s  %6s  %12s  %s\n", r->index, when, "-", "-", "-", r->line);
+        else
+            printf ("%5d  %s  %9.3fs  %6d  %12llu  %s\n", r->index, when, (get64 (p) - r->start) / 1e9,
+                    (int32_t) get32 (p + 8), (unsigned long long) get64 (p + 12), r->line);
+    }else if (selected (r) && r->only == 0 && p != NULL && len >= 12 && (status = get32 (p + 8)) != 0){
+        printf ("[exit %d]\n", status);
+    }
+    free (r->line);
+    r->line = NULL;
+}
+
+static int replay_record (replay_t* r, uint32_t type, const unsigned char* p, size_t len){
+    char when[32];
+
+    switch (type){
+    case RECORD_SESSION:
+        if (len < 13 || r->only != 0)
+            break;
+        format_time (get64 (p), when, sizeof (when));
+        printf ("# Session of %.*s, started %s by agros[%u]\n", (int) strnlen ((const char*) p + 12, len - 12),
+                (const char*) p + 12, when, get32 (p + 8));
+        break;
+
+    case RECORD_BEGIN:
+        end_command (r, NULL, 0);
+        if (len < 12)
+            return -1;
+        r->index++;
+        r->start = get64 (p);
+        r->line = format_line (p + 8, p + len);
+        if (r->line == NULL)
+            return -1;
+        r->inflating = selected (r) && inflateReset (&r->z) == Z_OK;
+        if (selected (r) && r->only == 0){
+            format_time (r->start, when, sizeof (when));
+            printf ("[%s] $ %s\n", when, r->line);
+        }
+        break;
+
+    case RECORD_DATA:
+        if (len < 8)
+            return -1;
+        if (r->inflating && print_output (r, p + 8, len - 8) < 0)
+            return -1;
+        break;
+
+    case RECORD_END:
+        if (len < 20)
+            return -1;
+        r->inflating = 0;
+        end_command (r, p, len);
+        break;
+    }
+    return 0;
+}
+
+static void usage (void){
+    fprintf (stderr, "usage: agros-replay [-l | -c N] FILE\n");
+    exit (2);
+}
+
+int main (int argc, char** argv){
+    unsigned char header[RECORD_HEADER];
+    unsigned char magic[RECORD_MAGIC_LEN];
+    unsigned char* payload = NULL;
+    replay_t r;
+    FILE* file = NULL;
+    uint32_t type = 0, len = 0;
+    int opt = 0, status = EXIT_SUCCESS;
+
+    memset (&r, 0, sizeof (r));
+    while ((opt = getopt (argc, argv, "lc:")) != -1){
+        if (opt == 'l')
+            r.list = 1;
+        else if (opt == 'c' && (r.only = atoi (optarg)) > 0)
+            continue;
+        else
+            usage ();
+    }
+    if (optind != argc - 1 || (r.list && r.only))
+        usage ();
+
+    file = fopen (argv[optind], "rb");
+    if (file == NULL){
+        perror (argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (fread (magic, 1, RECORD_MAGIC_LEN, file) != RECORD_MAGIC_LEN || memcmp (magic, RECORD_MAGIC, RECORD_MAGIC_LEN)){
+        fprintf (stderr, "agros-replay: %s: not a recording of AGROS\n", argv[optind]);
+        fclose (file);
+        return EXIT_FAILURE;
+    }
+    if (inflateInit (&r.z) != Z_OK){
+        fprintf (stderr, "agros-replay: out of memory\n");
+        fclose (file);
+        return EXIT_FAILURE;
+    }
+
+    while (fread (header, 1, RECORD_HEADER, file) == RECORD_HEADER){
+        type = get32 (header);
+        len = get32 (header + 4);
+        if (len > REPLAY_MAX_RECORD || (payload = (unsigned char*) malloc (len + 1)) == NULL){
+            fprintf (stderr, "agros-replay: %s: command %d is damaged\n", argv[optind], r.index);
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (fread (payload, 1, len, file) != len){
+            free (payload);
+            break;
+        }
+        if (replay_record (&r, type, payload, len) < 0){
+            fprintf (stderr, "agros-replay: %s: command %d is damaged\n", argv[optind], r.index);
+            status = EXIT_FAILURE;
+        }
+        free (payload);
+        if (status != EXIT_SUCCESS)
+            break;
+    }
+
+    /* A command the recording ends in the middle of */
+    end_command (&r, NULL, 0);
+
+    inflateEnd (&r.z);
+    fclose (file);
+    return status;
+}
@@ -0,0 +1,307 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "scanner.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SCAN_EMPTY      0   /* No forbidden sequence at all */
+#define SCAN_ALL        1   /* An empty sequence: strstr() finds it everywhere */
+#define SCAN_BYTES      2   /* Only single characters */
+#define SCAN_AUTOMATON  3   /* Aho-Corasick */
+
+/* Single characters compared with SSE2 before falling back to the table */
+#define SCAN_SIMD_MAX   8
+
+/*
+ * The automaton works on byte classes rather than bytes: every byte that
+ * appears in no forbidden sequence shares class 0. That keeps the
+ * transition table a few KB even with dozens of sequences.
+ */
+
+struct forbidden_scanner{
+    int mode;
+
+    /* SCAN_BYTES */
+    unsigned char byte_set[256];
+    unsigned char bytes[SCAN_SIMD_MAX];
+    int byte_nbr;
+
+    /* SCAN_AUTOMATON */
+    unsigned char classes[256];
+    int class_nbr;
+    uint16_t* next;         /* next[state * class_nbr + class] */
+    unsigned char* accept;
+    int state_nbr;
+};
+
+/*
+ * Scans text with the 256 entry table.
+ */
+
+static int search_bytes (const forbidden_scanner* scanner, const char* text){
+    const unsigned char* c = (const unsigned char*) text;
+    for (; *c; c++){
+        if (scanner->byte_set[*c])
+            return 1;
+    }
+    return 0;
+}
+
+#ifdef __SSE2__
+
+/*
+ * Scans text 16 bytes at a time. Loads are aligned, so reading past the
+ * terminating '\0' never crosses into another page; the bytes before text
+ * and after the '\0' are masked out.
+ */
+
+static int search_bytes_simd (const forbidden_scanner* scanner, const char* text){
+    const uintptr_t misalign = (uintptr_t) text & 15;
+    const __m128i* block = (const __m128i*) (text - misalign);
+    const __m128i zero = _mm_setzero_si128 ();
+    __m128i needles[SCAN_SIMD_MAX];
+    __m128i data, hits;
+    unsigned int zmask = 0, pmask = 0;
+    int i = 0, first = 1;
+
+    for (i=0; i<scanner->byte_nbr; i++)
+        needles[i] = _mm_set1_epi8 ((char) scanner->bytes[i]);
+
+    for (;; block++){
+        data = _mm_load_si128 (block);
+        hits = _mm_cmpeq_epi8 (data, needles[0]);
+        for (i=1; i<scanner->byte_nbr; i++)
+            hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (data, needles[i]));
+
+        zmask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (data, zero));
+        pmask = _mm_movemask_epi8 (hits);
+        if (first){
+            zmask &= 0xffffU << misalign;
+            pmask &= 0xffffU << misalign;
+            first = 0;
+        }
+
+        if (zmask){
+            /* Only keep the hits before the end of the string */
+            pmask &= (zmask & -zmask) - 1;
+            return pmask != 0;
+        }
+        if (pmask)
+            return 1;
+    }
+}
+
+#endif
+
+static int search_automaton (const forbidden_scanner* scanner, const char* text){
+    const unsigned char* c = (const unsigned char*) text;
+    int state = 0;
+
+    for (; *c; c++){
+        state = scanner->next[state * scanner->class_nbr + scanner->classes[*c]];
+        if (scanner->accept[state])
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns 1 if text contains any of the forbidden sequences.
+ */
+
+int scanner_search (const forbidden_scanner* scanner, const char* text){
+    switch (scanner->mode){
+        case SCAN_ALL:
+            return 1;
+
+        case SCAN_BYTES:
+#ifdef __SSE2__
+            if (scanner->byte_nbr <= SCAN_SIMD_MAX)
+                return search_bytes_simd (scanner, text);
+#endif
+            return search_bytes (scanner, text);
+
+        case SCAN_AUTOMATON:
+            return search_automaton (scanner, text);
+    }
+
+    return 0;
+}
+
+/*
+ * Builds the Aho-Corasick automaton. The trie is built first with -1 for
+ * missing transitions, then a breadth-first pass fills every missing
+ * transition from the failure state, which turns the trie into a DFA.
+ */
+
+static int compile_automaton (forbidden_scanner* scanner, char** patterns, int count){
+    int* fail = NULL;
+    int* queue = NULL;
+    int* trie = NULL;
+    size_t total = 1;
+    int states = 1, head = 0, tail = 0;
+    int i = 0, c = 0, k = 0, state = 0, next = 0;
+    const unsigned char* p = NULL;
+
+    /* Byte classes */
+    memset (scanner->classes, 0, sizeof (scanner->classes));
+    scanner->class_nbr = 1;
+    for (i=0; i<count; i++){
+        for (p = (const unsigned char*) patterns[i]; *p; p++){
+            if (scanner->classes[*p] == 0)
+                scanner->classes[*p] = scanner->class_nbr++;
+        }
+        total += strlen (patterns[i]);
+    }
+    if (total > UINT16_MAX)
+        return -1;
+
+    trie = (int*) malloc (total * scanner->class_nbr * sizeof (int));
+    fail = (int*) calloc (total, sizeof (int));
+    queue = (int*) malloc (total * sizeof (int));
+    scanner->accept = (unsigned char*) calloc (total, 1);
+    if (!trie || !fail || !queue || !scanner->accept){
+        free (trie);
+        free (fail);
+        free (queue);
+        return -1;
+    }
+    memset (trie, -1, total * scanner->class_nbr * sizeof (int));
+
+    for (i=0; i<count; i++){
+        state = 0;
+        for (p = (const unsigned char*) patterns[i]; *p; p++){
+            c = scanner->classes[*p];
+            if (trie[state * scanner->class_nbr + c] < 0)
+                trie[state * scanner->class_nbr + c] = states++;
+            state = trie[state * scanner->class_nbr + c];
+        }
+        scanner->accept[state] = 1;
+    }
+
+    /* Class 0 never appears in a pattern, so from the root it loops */
+    for (c=0; c<scanner->class_nbr; c++){
+        next = trie[c];
+        if (next < 0)
+            trie[c] = 0;
+        else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail){
+        state = queue[head++];
+        /* A state accepts if any suffix of it does */
+        if (scanner->accept[fail[state]])
+            scanner->accept[state] = 1;
+
+        for (c=0; c<scanner->class_nbr; c++){
+            next = trie[state * scanner->class_nbr + c];
+            if (next < 0)
+                trie[state * scanner->class_nbr + c] = trie[fail[state] * scanner->class_nbr + c];
+            else {
+                fail[next] = trie[fail[state] * scanner->class_nbr + c];
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    scanner->next = (uint16_t*) malloc (states * scanner->class_nbr * sizeof (uint16_t));
+    if (scanner->next == NULL){
+        free (trie);
+        free (fail);
+        free (queue);
+        return -1;
+    }
+    for (k=0; k<states * scanner->class_nbr; k++)
+        scanner->next[k] = (uint16_t) trie[k];
+    scanner->state_nbr = states;
+
+    free (trie);
+    free (fail);
+    free (queue);
+    return 0;
+}
+
+/*
+ * Builds a scanner for the forbidden list. Returns NULL if memory runs
+ * out or if the sequences are too long for the automaton.
+ */
+
+forbidden_scanner* scanner_compile (char** patterns, int count){
+    forbidden_scanner* scanner = NULL;
+    int multibyte = 0, i = 0;
+
+    scanner = (forbidden_scanner*) calloc (1, sizeof (forbidden_scanner));
+    if (scanner == NULL)
+        return NULL;
+
+    scanner->mode = SCAN_EMPTY;
+    for (i=0; i<count; i++){
+        if (patterns[i][0] == '\0'){
+            scanner->mode = SCAN_ALL;
+            return scanner;
+        }
+        if (patterns[i][1] != '\0')
+            multibyte = 1;
+    }
+    if (count == 0)
+        return scanner;
+
+    if (!multibyte){
+        scanner->mode = SCAN_BYTES;
+        for (i=0; i<count; i++){
+            unsigned char c = (unsigned char) patterns[i][0];
+            if (scanner->byte_set[c])
+                continue;
+            scanner->byte_set[c] = 1;
+            if (scanner->byte_nbr < SCAN_SIMD_MAX)
+                scanner->bytes[scanner->byte_nbr] = c;
+            scanner->byte_nbr++;
+        }
+        return scanner;
+    }
+
+    scanner->mode = SCAN_AUTOMATON;
+    if (compile_automaton (scanner, patterns, count) < 0){
+        scanner_free (scanner);
+        return NULL;
+    }
+
+    return scanner;
+}
+
+void scanner_free (forbidden_scanner* scanner){
+    if (scanner == NULL)
+        return;
+    free (scanner->next);
+    free (scanner->accept);
+    free (scanner);
+}
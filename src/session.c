@@ -0,0 +1,1409 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <termios.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "agros.h"
+#include "audit.h"
+#include "launcher.h"
+#include "execcache.h"
+#include "jobs.h"
+#include "builtins.h"
+#include "reload.h"
+#include "trace.h"
+#include "pipeline.h"
+#include "governor.h"
+#include "record.h"
+#include "metrics.h"
+#include "allowlist.h"
+#include "outcache.h"
+#include "evloop.h"
+
+/* How long a command that timed out has to exit after SIGTERM, before
+   SIGKILL */
+#define KILL_GRACE_MS 2000
+
+/* Where allowed commands were found in PATH */
+exec_cache* exec_paths = NULL;
+
+/* The cgroup.procs of the session's cgroup, or -1 */
+static int session_cgroup = -1;
+
+/* The recording of the session, with record_dir */
+static recorder* session_record = NULL;
+
+/* Set by run_interactive(): there is someone to talk to about jobs */
+static int session_interactive = AG_FALSE;
+
+/*
+ * The event loop of the session (see evloop.h), NULL if it couldn't be
+ * set up: the session then blocks in readline and in wait4() as it used
+ * to, and has no timeouts. session_config is the policy its events see.
+ */
+
+static evloop* session_loop = NULL;
+static config_t* session_config = NULL;
+static int kill_timer = -1;
+static int idle_timer = -1;
+
+/* Between read_line() and the end of the line: the prompt is on screen */
+static int session_reading = AG_FALSE;
+static int session_idle = AG_FALSE;
+static char* typed_line = NULL;
+static int typed = AG_FALSE;
+
+/*
+ * The signals passed on to a line that runs in a process group of its
+ * own, as they would have reached it in AGROS's: they are blocked and
+ * read from the loop while it runs. SIGTTOU is only blocked, so AGROS
+ * can print and take the terminal back meanwhile.
+ */
+
+static const int forwarded_signals[] = { SIGINT, SIGQUIT, SIGTERM, SIGHUP };
+#define FORWARDED_NBR ((int) (sizeof (forwarded_signals) / sizeof (forwarded_signals[0])))
+
+/*
+ * The stages of the foreground line, from when they start until they are
+ * all collected. With a timeout, they run in a process group of their own
+ * (or two, when the last stage has a PTY of its own), which the timeout
+ * kills: SIGTERM first, then SIGKILL after KILL_GRACE_MS.
+ */
+
+typedef struct foreground foreground;
+struct foreground{
+    spawn_t* sps;
+    char* done;             /* the stages collected */
+    int count;
+    int left;
+    int status;             /* of the last stage, -1 if it can't be waited for */
+    const char* name;
+    int timeout;            /* seconds, 0 for none */
+    int own_group;
+    int tty;                /* the terminal the group took, or -1 */
+    struct termios modes;   /* of that terminal, before */
+    sigset_t saved_mask;
+    int expired;            /* 1 once sent SIGTERM, 2 once sent SIGKILL */
+    int forwarded;          /* SIGTERM or SIGHUP, once the line is over */
+};
+
+static foreground fg;
+
+/*
+ * Creates or updates the cgroup of the session, when the profile caps
+ * its memory or CPU (see governor.h).
+ */
+
+static void prepare_cgroup (config_t* config){
+    session_cgroup = governor_cgroup (config->limits);
+    if (session_cgroup < 0 && errno != 0)
+        audit (LOG_WARNING, "Could not set up the cgroup of the session: %s.", strerror (errno));
+}
+
+/*
+ * Sets up what running commands needs. With prime set, every plain name of
+ * the allowed list is resolved now, so that commands don't search PATH when
+ * they run; a one-shot session leaves it for the one command it runs.
+ */
+
+void prepare_session (config_t* config, int prime){
+    jobs_init (config->max_jobs, config->loglevel);
+    prepare_cgroup (config);
+    if (exec_paths == NULL)
+        exec_paths = exec_cache_new (getenv ("PATH"));
+    if (exec_paths != NULL && prime)
+        exec_cache_prime (exec_paths, config->allowed_list, config->allowed_nbr);
+}
+
+/*
+ * Switches to the latest policy if it was reloaded, along with what was
+ * derived from the old one.
+ */
+
+static void refresh_policy (config_t* config){
+    if (!reload_poll (config))
+        return;
+
+    jobs_init (config->max_jobs, config->loglevel);
+    prepare_cgroup (config);
+    if (exec_paths != NULL)
+        exec_cache_prime (exec_paths, config->allowed_list, config->allowed_nbr);
+    if (session_interactive)
+        set_completion_list (config);
+}
+
+/*
+ * Tells the user a line was refused and counts it against the warnings.
+ * The caller logs why. The refusal is counted for cmd when it is an
+ * allowed command, as "other" when it isn't (see metrics.h).
+ */
+
+static void count_refusal (command_t* cmd, config_t* config){
+    if (metrics_enabled)
+        metrics_denied (allowlist_match (config->allowed_matcher, cmd->name) ? cmd->name : NULL);
+    fprintf (stdout, "Not allowed! \n");
+    if (config->warnings >= 0)    decrease_warnings (config);
+}
+
+/*
+ * The policy is checked here, in the shell itself: a denied command is
+ * logged and counted against the warnings without ever creating a process.
+ * Returns AG_TRUE if cmd was denied.
+ */
+
+static int refuse_command (command_t* cmd, config_t* config){
+    int denied = 0;
+
+    TRACE_BEGIN ("check_validity");
+    denied = check_validity (cmd, config);
+    TRACE_END ("check_validity");
+
+    if (!denied){
+        metrics_allowed (cmd->name);
+        return AG_FALSE;
+    }
+
+    if (config->loglevel >= 1)    audit (LOG_ERR, "Trying to use forbidden command: %s.", cmd->name);
+    count_refusal (cmd, config);
+    return AG_TRUE;
+}
+
+/*
+ * Points view at the i-th stage of cmd, as a command of its own.
+ */
+
+static void stage_view (command_t* cmd, int i, command_t* view){
+    view->argc = cmd->stages[i].argc;
+    view->argv = cmd->stages[i].argv;
+    view->name = view->argv[0];
+}
+
+/*
+ * Checks a whole line before any of it runs: the pipes and redirections,
+ * then every stage. Only the first refusal is counted.
+ */
+
+static int refuse_line (command_t* cmd, config_t* config){
+    command_t stage = COMMAND_EMPTY;
+    int denied = 0, i = 0;
+
+    if (cmd->stage_nbr == 1 && cmd->redirect_nbr == 0)
+        return refuse_command (cmd, config);
+
+    TRACE_BEGIN ("check_validity");
+    denied = check_operators (cmd, config);
+    TRACE_END ("check_validity");
+
+    if (denied){
+        if (config->loglevel >= 1)    audit (LOG_ERR, "Trying to use a forbidden pipe or redirection: %s.", cmd->name);
+        count_refusal (cmd, config);
+        return AG_TRUE;
+    }
+
+    for (i=0; i<cmd->stage_nbr; i++){
+        stage_view (cmd, i, &stage);
+        if (refuse_command (&stage, config))
+            return AG_TRUE;
+    }
+    return AG_FALSE;
+}
+
+/*
+ * Finds the executable of cmd. Returns AG_TRUE with *entry set, to NULL
+ * for a relative path that is run as given, or AG_FALSE once the user was
+ * told it can't be found.
+ */
+
+static int find_command (command_t* cmd, config_t* config, exec_entry** entry){
+    *entry = NULL;
+
+    if (exec_paths == NULL)
+        prepare_session (config, AG_FALSE);
+    TRACE_BEGIN ("lookup");
+    if (exec_paths != NULL)
+        *entry = exec_cache_lookup (exec_paths, cmd->argv[0]);
+    TRACE_END ("lookup");
+
+    /* Not in any PATH directory AGROS trusts: there's nothing to run */
+    if (exec_paths != NULL && *entry == NULL && strchr (cmd->argv[0], '/') == NULL){
+        fprintf (stderr, "%s: Could not execute command!\nType '?' for help.\n", cmd->name);
+        if (config->loglevel >= 2)    audit (LOG_NOTICE, "Could not execute: %s (not found).", cmd->name);
+        metrics_failed (cmd->name, AG_FALSE);
+        return AG_FALSE;
+    }
+    return AG_TRUE;
+}
+
+/*
+ * Opens the file of every redirection of the line into files, before any
+ * stage starts. A path outside redirect_paths is refused like a forbidden
+ * command. Returns 0, or the status of the line.
+ */
+
+static int open_redirects (command_t* cmd, config_t* config, int* files){
+    char resolved[PATH_MAX];
+    char* home = NULL;
+    redirect_t* r = NULL;
+    int i = 0;
+
+    set_homedir (&home);
+
+    for (i=0; i<cmd->redirect_nbr; i++){
+        r = &cmd->redirects[i];
+        if (r->mode == REDIR_DUP)
+            continue;
+
+        files[i] = pipeline_open (r, config->redirect_paths, config->redirect_paths_nbr, home,
+                                  resolved, sizeof (resolved));
+        if (files[i] == PIPELINE_DENIED){
+            files[i] = -1;
+            if (config->loglevel >= 1)    audit (LOG_ERR, "Trying to redirect to a forbidden path: %s.", resolved);
+            count_refusal (cmd, config);
+            return AG_STATUS_DENIED;
+        }
+        if (files[i] < 0){
+            fprintf (stderr, "%s: %s\n", r->path, strerror (errno));
+            if (config->loglevel >= 2)    audit (LOG_NOTICE, "Could not open: %s (%s).", r->path, strerror (errno));
+            return EXIT_FAILURE;
+        }
+        if (config->loglevel == 3)    audit (LOG_NOTICE, "Redirecting to: %s.", resolved);
+    }
+    return 0;
+}
+
+/*
+ * Applies the redirections of the i-th stage to fds, the descriptors it
+ * gets from the pipes, in the order they were written. ">&n" of a
+ * descriptor the stage inherits takes a copy of AGROS's own, kept in
+ * copies: the launcher only takes descriptors from 3 on.
+ */
+
+static int stage_redirects (command_t* cmd, int i, int* files, int* fds, int* copies){
+    stage_t* stage = &cmd->stages[i];
+    redirect_t* r = NULL;
+    int j = 0;
+
+    for (j=stage->redirect_first; j<stage->redirect_first+stage->redirect_nbr; j++){
+        r = &cmd->redirects[j];
+        if (r->mode != REDIR_DUP){
+            fds[r->fd] = files[j];
+        }else if (fds[r->target] >= 0){
+            fds[r->fd] = fds[r->target];
+        }else if (r->fd != r->target){
+            if (copies[r->target] < 0)
+                copies[r->target] = fcntl (r->target, F_DUPFD_CLOEXEC, 3);
+            if (copies[r->target] < 0)
+                return -1;
+            fds[r->fd] = copies[r->target];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Starts cmd with fds as its standard descriptors (see launcher.h), in
+ * AGROS's process group when group is -1, in a new one when it is 0 and
+ * otherwise in group, which takes tty when not -1. Returns 0, or -1 once
+ * the user was told it couldn't be started.
+ */
+
+static int start_command (command_t* cmd, exec_entry* entry, config_t* config, int* fds, int ctty,
+                          pid_t group, int tty, spawn_t* sp){
+    uint64_t started = 0, exec_started = 0, now = 0;
+
+    if (config->loglevel == 3)    audit (LOG_NOTICE, "Using command: %s.", entry ? entry->path : cmd->name);
+
+    sp->argv = cmd->argv;
+    sp->exec_fd = entry && !entry->script ? entry->fd : -1;
+    sp->exec_path = entry && entry->script ? entry->path : NULL;
+    sp->pgroup = group >= 0;
+    sp->pgid = group > 0 ? group : 0;
+    sp->tty_fd = tty;
+    sp->timed = trace_enabled || metrics_enabled;
+    memcpy (sp->fds, fds, sizeof (sp->fds));
+    sp->limits = config->limits;
+    sp->cgroup_fd = session_cgroup;
+    sp->ctty_fd = ctty;
+    if (sp->timed)
+        started = trace_now ();
+    if (spawn_process (sp) < 0){
+        fprintf (stderr, "%s: Could not execute command!\nType '?' for help.\n", cmd->name);
+        if (config->loglevel >= 2)    audit (LOG_NOTICE, "Could not execute: %s (%s).", cmd->name, strerror (sp->error));
+        metrics_failed (cmd->name, sp->pid < 0);
+        return -1;
+    }
+
+    /* The child noted when it called exec: before that is the launcher's
+       work, after it the kernel's */
+    if (sp->timed){
+        exec_started = (uint64_t) sp->exec_time.tv_sec * 1000000000ULL + sp->exec_time.tv_nsec;
+        now = trace_now ();
+        if (trace_enabled){
+            trace_span ("spawn", started, exec_started);
+            trace_span ("exec", exec_started, now);
+        }
+        metrics_started (cmd->name, exec_started - started, now - exec_started);
+    }
+    return 0;
+}
+
+static void close_fd (int* fd){
+    if (*fd >= 0)
+        close (*fd);
+    *fd = -1;
+}
+
+/*
+ * Creates what connects a stage to the next: one pipe, or with relay two,
+ * whose middle ends are AGROS's, in *from and *to.
+ */
+
+static int open_link (int relay, int* out_fd, int* next_in, int* from, int* to){
+    int pipefd[2];
+
+    if (pipe2 (pipefd, O_CLOEXEC) < 0)
+        return -1;
+    *out_fd = pipefd[1];
+    *next_in = pipefd[0];
+    if (!relay)
+        return 0;
+
+    *from = pipefd[0];
+    *next_in = -1;
+    if (pipe2 (pipefd, O_CLOEXEC) < 0)
+        return -1;
+    *to = pipefd[1];
+    *next_in = pipefd[0];
+    return 0;
+}
+
+/*
+ * Sends sig to the process group of a stage, or to the stage alone when it
+ * is in AGROS's own.
+ */
+
+static void signal_stage (spawn_t* sp, int sig){
+    pid_t group = getpgid (sp->pid);
+
+    if (group > 0 && group != getpgrp ())
+        kill (-group, sig);
+    else
+        kill (sp->pid, sig);
+}
+
+static void signal_line (int sig){
+    int i = 0;
+
+    for (i=0; i<fg.count; i++){
+        if (!fg.done[i])
+            signal_stage (&fg.sps[i], sig);
+    }
+}
+
+static void stage_done (int i, int status){
+    spawn_t* sp = &fg.sps[i];
+
+    if (fg.done != NULL)
+        fg.done[i] = 1;
+    fg.left--;
+    if (i == fg.count - 1)
+        fg.status = status;
+    if (metrics_enabled)
+        metrics_ran (sp->argv[0], trace_now () - ((uint64_t) sp->exec_time.tv_sec * 1000000000ULL + sp->exec_time.tv_nsec),
+                     &sp->usage);
+}
+
+/*
+ * Collects the stages of the line that exited. One that was stopped is
+ * continued: AGROS has no job control to resume it with, and the line
+ * would never end.
+ */
+
+static void collect_stages (void){
+    int status = 0, result = 0, i = 0;
+
+    for (i=0; i<fg.count; i++){
+        if (fg.done[i])
+            continue;
+        result = spawn_reap (&fg.sps[i], &status);
+        if (result == 0)
+            continue;
+        if (result > 0 && WIFSTOPPED (status)){
+            signal_stage (&fg.sps[i], SIGCONT);
+            continue;
+        }
+        stage_done (i, result < 0 ? -1 : status);
+    }
+}
+
+/*
+ * Decides where a foreground line runs, before it starts. With a timeout,
+ * in a process group of its own, which takes the terminal with take_tty
+ * if AGROS has it; the signals AGROS is sent meanwhile are passed on to
+ * it. Returns 0 for a new group, with *tty the terminal it takes or -1,
+ * or -1 for AGROS's own group.
+ */
+
+static pid_t line_group (const char* name, config_t* config, int take_tty, int* tty){
+    sigset_t set;
+    int i = 0;
+
+    memset (&fg, 0, sizeof (fg));
+    fg.name = name;
+    fg.tty = *tty = -1;
+    fg.timeout = kill_timer >= 0 ? config->timeout : 0;
+    if (fg.timeout <= 0)
+        return -1;
+
+    fg.own_group = AG_TRUE;
+    sigemptyset (&set);
+    for (i=0; i<FORWARDED_NBR; i++)
+        sigaddset (&set, forwarded_signals[i]);
+    sigaddset (&set, SIGTTOU);
+    sigprocmask (SIG_BLOCK, &set, &fg.saved_mask);
+
+    if (take_tty && isatty (STDIN_FILENO) && tcgetpgrp (STDIN_FILENO) == getpgrp ()
+        && tcgetattr (STDIN_FILENO, &fg.modes) == 0)
+        fg.tty = *tty = STDIN_FILENO;
+    return 0;
+}
+
+/*
+ * Follows the count stages of the line that started: from now on the
+ * event loop collects them as they exit, and the timeout runs.
+ */
+
+static void watch_line (spawn_t* sps, int count){
+    fg.sps = sps;
+    fg.count = fg.left = count;
+    fg.status = 0;
+    if (session_loop != NULL && count > 0)
+        fg.done = (char*) calloc (count, 1);
+    if (fg.done != NULL && fg.timeout > 0)
+        evloop_arm (kill_timer, (int64_t) fg.timeout * 1000);
+}
+
+/*
+ * Waits for the stages of the line that are left and puts back what
+ * line_group() changed. *status is that of the last stage, -1 if it
+ * can't be waited for. Returns AG_TRUE if the line was killed for taking
+ * too long.
+ */
+
+static int end_line (int* status){
+    int forwarded = 0, expired = 0, i = 0;
+
+    if (fg.done != NULL){
+        collect_stages ();
+        while (fg.left > 0 && evloop_run (session_loop, -1) >= 0)
+            ;
+    }
+    /* Without the event loop, the way it was before */
+    for (i=0; i<fg.count; i++){
+        if (fg.done == NULL || !fg.done[i])
+            stage_done (i, spawn_wait (&fg.sps[i], status) < 0 ? -1 : *status);
+        spawn_release (&fg.sps[i]);
+    }
+    if (kill_timer >= 0)
+        evloop_arm (kill_timer, 0);
+
+    if (fg.own_group){
+        if (fg.tty >= 0){
+            tcsetpgrp (fg.tty, getpgrp ());
+            tcsetattr (fg.tty, TCSADRAIN, &fg.modes);
+        }
+        /* The signals that came meanwhile are taken, not left pending */
+        evloop_run (session_loop, 0);
+        sigprocmask (SIG_SETMASK, &fg.saved_mask, NULL);
+    }
+
+    *status = fg.status;
+    expired = fg.expired;
+    forwarded = fg.forwarded;
+    free (fg.done);
+    memset (&fg, 0, sizeof (fg));
+    fg.tty = -1;
+
+    /* AGROS was told to end too: it does, as it would have */
+    if (forwarded)
+        raise (forwarded);
+    return expired > 0;
+}
+
+/*
+ * Prints what a cached command wrote, and records it.
+ */
+
+static void print_cached (FILE* stream, const char* data, size_t len){
+    fwrite (data, 1, len, stream);
+    fflush (stream);
+    if (session_record != NULL)
+        record_output (session_record, data, len);
+}
+
+static void print_memfd (FILE* stream, int fd){
+    char buf[4096];
+    off_t off = 0;
+    ssize_t n = 0;
+
+    while ((n = pread (fd, buf, sizeof (buf), off)) > 0){
+        print_cached (stream, buf, n);
+        off += n;
+    }
+}
+
+/*
+ * Runs a command whose output the sessions share for ttl seconds (see
+ * outcache.h). A hit forks nothing. Otherwise the command runs with its
+ * input from /dev/null and its output in memfds, which are stored and
+ * then printed: cached or not, it never sees a terminal.
+ */
+
+static int run_cached (command_t* cmd, exec_entry* entry, config_t* config, int ttl){
+    outcache_result cached;
+    spawn_t sp;
+    pid_t group = -1;
+    int fds[3] = {-1, -1, -1};
+    int found = OUTCACHE_OFF, status = 0, timed_out = 0, tty = -1, i = 0;
+
+    TRACE_BEGIN ("outcache");
+    found = outcache_lookup (config->profile, cmd->argv, &cached);
+    TRACE_END ("outcache");
+
+    if (found == OUTCACHE_HIT){
+        if (config->loglevel == 3)    audit (LOG_NOTICE, "Using the cached output of: %s.", cmd->name);
+        metrics_cached (cmd->name, cached.coalesced ? METRICS_CACHE_COALESCED : METRICS_CACHE_HIT);
+        fflush (stdout);
+        print_cached (stdout, cached.out, cached.out_len);
+        print_cached (stderr, cached.err, cached.err_len);
+        status = cached.status;
+        goto out;
+    }
+    if (found == OUTCACHE_MISS)
+        metrics_cached (cmd->name, METRICS_CACHE_MISS);
+
+    fds[0] = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+    fds[1] = memfd_create ("agros-stdout", MFD_CLOEXEC);
+    fds[2] = memfd_create ("agros-stderr", MFD_CLOEXEC);
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0){
+        fprintf (stderr, "%s: %s\n", cmd->name, strerror (errno));
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    fflush (stdout);
+    group = line_group (cmd->name, config, AG_FALSE, &tty);
+    if (start_command (cmd, entry, config, fds, -1, group, tty, &sp) < 0){
+        watch_line (&sp, 0);
+        end_line (&status);
+        status = AG_STATUS_NOEXEC;
+        goto out;
+    }
+    watch_line (&sp, 1);
+    TRACE_BEGIN ("wait");
+    timed_out = end_line (&status);
+    TRACE_END ("wait");
+
+    /* A command killed by a signal, or for its timeout, didn't finish its
+       output */
+    if (found == OUTCACHE_MISS && status >= 0 && WIFEXITED (status) && !timed_out)
+        outcache_store (&cached, fds[1], fds[2], exit_status (status), ttl);
+    if (timed_out)
+        status = AG_STATUS_TIMEOUT;
+    else
+        status = status < 0 ? EXIT_FAILURE : exit_status (status);
+
+    print_memfd (stdout, fds[1]);
+    print_memfd (stderr, fds[2]);
+
+out:
+    for (i=0; i<3; i++)
+        close_fd (&fds[i]);
+    outcache_release (&cached);
+    return status;
+}
+
+/*
+ * Runs a system command, or a pipeline of them, with its redirections.
+ * Every stage is checked and found, and every file opened, before
+ * anything starts: a line that is refused runs nothing. The stages are
+ * connected with pipes, or through AGROS with pipe_relay (see
+ * pipeline.h), and the status is that of the last one. In a recorded
+ * session, what the line prints goes through AGROS instead (see record.h);
+ * its stages are then connected with plain pipes.
+ */
+
+static int run_external (command_t* cmd, config_t* config, int bg_cmd){
+    command_t stage = COMMAND_EMPTY;
+    spawn_t one;
+    exec_entry* one_entry = NULL;
+    spawn_t* sps = &one;
+    exec_entry** entries = &one_entry;
+    int* files = NULL;
+    int* from = NULL;
+    int* to = NULL;
+    size_t* bytes = NULL;
+    int links = cmd->stage_nbr - 1;
+    int fds[3];
+    int copies[3] = {-1, -1, -1};
+    int in_fd = -1, next_in = -1, out_fd = -1;
+    int output = -1, capture = -1, terminal = AG_FALSE;
+    int relay = config->pipe_relay;
+    int watching = AG_FALSE, timed_out = AG_FALSE, waited = 0, tty = -1;
+    pid_t group = 0;
+    int started = 0, status = 0, job = 0, ttl = 0, i = 0;
+
+    if (refuse_line (cmd, config))
+        return AG_STATUS_DENIED;
+
+    /* A single command needs none of this */
+    if (links > 0 || cmd->redirect_nbr > 0){
+        sps = (spawn_t*) calloc (cmd->stage_nbr, sizeof (spawn_t));
+        entries = (exec_entry**) calloc (cmd->stage_nbr, sizeof (exec_entry*));
+        files = (int*) malloc ((cmd->redirect_nbr + 1) * sizeof (int));
+        from = (int*) malloc ((links + 1) * sizeof (int));
+        to = (int*) malloc ((links + 1) * sizeof (int));
+        bytes = (size_t*) calloc (links + 1, sizeof (size_t));
+        if (!sps || !entries || !files || !from || !to || !bytes){
+            fprintf (stderr, "%s: %s\n", cmd->name, strerror (ENOMEM));
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        for (i=0; i<cmd->redirect_nbr; i++)
+            files[i] = -1;
+        for (i=0; i<links; i++)
+            from[i] = to[i] = -1;
+    }
+
+    for (i=0; i<cmd->stage_nbr; i++){
+        stage_view (cmd, i, &stage);
+        if (!find_command (&stage, config, &entries[i])){
+            status = AG_STATUS_NOEXEC;
+            goto out;
+        }
+    }
+
+    /* A command on its own whose output the sessions share */
+    if (links == 0 && cmd->redirect_nbr == 0 && !bg_cmd
+        && (ttl = outcache_ttl (config->cacheable, config->cacheable_nbr, cmd->name)) > 0){
+        status = run_cached (cmd, entries[0], config, ttl);
+        goto out;
+    }
+
+    if (bg_cmd && links > 0){
+        fprintf (stderr, "%s: Pipelines can't run in the background.\n", cmd->name);
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (bg_cmd && config->max_jobs == 0){
+        fprintf (stderr, "%s: Background jobs are not allowed.\n", cmd->name);
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    /* A script waits for a place, someone at the prompt is told to */
+    if (bg_cmd && jobs_full ()){
+        if (session_interactive){
+            fprintf (stderr, "%s: Too many background jobs. Type 'jobs' to see them.\n", cmd->name);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        jobs_wait_slot ();
+    }
+
+    if (cmd->redirect_nbr > 0 && (status = open_redirects (cmd, config, files)) != 0)
+        goto out;
+
+    /* A background command isn't waited for, its output isn't recorded */
+    if (session_record != NULL && !bg_cmd){
+        if (record_capture (&output, &capture, &terminal) < 0){
+            fprintf (stderr, "%s: The output can't be recorded: %s\n", cmd->name, strerror (errno));
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        relay = AG_FALSE;
+    }
+
+    /* Whatever AGROS printed must come out before the command's output */
+    fflush (stdout);
+
+    /* A background job has a group of its own, for "kill %n". The PTY of a
+       recorded session is the terminal of the line, not AGROS's */
+    if (!bg_cmd){
+        group = line_group (cmd->name, config, !terminal, &tty);
+        watching = AG_TRUE;
+    }
+
+    for (i=0; i<cmd->stage_nbr; i++){
+        fds[0] = i == 0 && terminal ? capture : in_fd;
+        fds[1] = fds[2] = capture;
+
+        stage_view (cmd, i, &stage);
+        if (i < links && open_link (relay, &out_fd, &next_in, &from[i], &to[i]) < 0){
+            fprintf (stderr, "%s: %s\n", stage.name, strerror (errno));
+            break;
+        }
+        if (i < links)
+            fds[1] = out_fd;
+
+        /* After the pipes, so that "2>&1 |" sends errors down the pipe */
+        if (stage_redirects (cmd, i, files, fds, copies) < 0){
+            fprintf (stderr, "%s: %s\n", stage.name, strerror (errno));
+            break;
+        }
+        /* On the PTY, the keys typed signal the last stage, which starts a
+           session and a group of its own */
+        if (i == links && terminal){
+            if (start_command (&stage, entries[i], config, fds, capture, -1, -1, &sps[i]) < 0)
+                break;
+        }else if (start_command (&stage, entries[i], config, fds, -1, group, i == 0 ? tty : -1, &sps[i]) < 0){
+            break;
+        }
+        started++;
+        if (i == 0 && group == 0)
+            group = sps[0].pid;
+
+        /* The stage has its own copies now */
+        close_fd (&in_fd);
+        close_fd (&out_fd);
+        close_fd (&copies[0]);
+        close_fd (&copies[1]);
+        close_fd (&copies[2]);
+        in_fd = next_in;
+        next_in = -1;
+    }
+
+    close_fd (&in_fd);
+    close_fd (&out_fd);
+    close_fd (&next_in);
+    close_fd (&copies[0]);
+    close_fd (&copies[1]);
+    close_fd (&copies[2]);
+    close_fd (&capture);
+    for (i=0; i<cmd->redirect_nbr; i++)
+        close_fd (&files[i]);
+
+    if (watching)
+        watch_line (sps, started);
+
+    /* The PTY stays open until the stages are waited for, see record.h */
+    if (output >= 0 && started > 0){
+        TRACE_BEGIN ("record");
+        if (record_relay (session_record, output, terminal, sps, started, session_loop) < 0)
+            close_fd (&output);
+        TRACE_END ("record");
+    }
+
+    if (started < cmd->stage_nbr){
+        /* The stages that started see the end of their pipes */
+        for (i=0; i<links; i++){
+            close_fd (&from[i]);
+            close_fd (&to[i]);
+        }
+        if (started == 0){
+            status = AG_STATUS_NOEXEC;
+            goto out;
+        }
+    }else if (links > 0 && relay){
+        TRACE_BEGIN ("relay");
+        pipeline_relay (from, to, bytes, links, session_loop);
+        TRACE_END ("relay");
+        for (i=0; i<links && config->loglevel == 3; i++)
+            audit (LOG_NOTICE, "Stage %d of the pipeline (%s) wrote %zu bytes.", i + 1, cmd->stages[i].argv[0], bytes[i]);
+    }
+
+    if (bg_cmd){
+        job = jobs_add (sps[0].pid, cmd->argv);
+        if (job < 0){
+            /* Nobody would reap it */
+            fprintf (stderr, "%s: Too many background jobs. Type 'jobs' to see them.\n", cmd->name);
+            killpg (sps[0].pid, SIGKILL);
+            spawn_wait (&sps[0], &waited);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        if (session_interactive)
+            fprintf (stdout, "[%d] %d\n", job, (int) sps[0].pid);
+        spawn_release (&sps[0]);
+        goto out;
+    }
+
+    TRACE_BEGIN ("wait");
+    watching = AG_FALSE;
+    timed_out = end_line (&status);
+    TRACE_END ("wait");
+
+    if (started < cmd->stage_nbr)
+        status = AG_STATUS_NOEXEC;
+    else if (timed_out)
+        status = AG_STATUS_TIMEOUT;
+    else
+        status = status < 0 ? EXIT_FAILURE : exit_status (status);
+
+out:
+    /* Nothing started: the line is over all the same */
+    if (watching)
+        end_line (&waited);
+    close_fd (&output);
+    close_fd (&capture);
+    if (files != NULL){
+        for (i=0; i<cmd->redirect_nbr; i++)
+            close_fd (&files[i]);
+    }
+    if (sps != &one){
+        free (sps);
+        free (entries);
+    }
+    free (files);
+    free (from);
+    free (to);
+    free (bytes);
+    return status;
+}
+
+/*
+ * Runs a built-in. In a recorded session, what it prints goes to a memfd
+ * first, then to the terminal and the recording.
+ */
+
+static int run_builtin (const builtin_t* builtin, command_t* cmd, config_t* config, int* exiting){
+    char buf[4096];
+    ssize_t n = 0;
+    int status = 0, out = -1, saved = -1;
+
+    if (session_record == NULL)
+        return builtin->run (cmd, config, exiting);
+
+    fflush (stdout);
+    out = memfd_create ("agros-builtin", MFD_CLOEXEC);
+    if (out >= 0)
+        saved = fcntl (STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    if (saved < 0 || dup2 (out, STDOUT_FILENO) < 0){
+        fprintf (stderr, "%s: The output can't be recorded: %s\n", cmd->name, strerror (errno));
+        close_fd (&out);
+        close_fd (&saved);
+        return EXIT_FAILURE;
+    }
+
+    status = builtin->run (cmd, config, exiting);
+
+    fflush (stdout);
+    dup2 (saved, STDOUT_FILENO);
+    close_fd (&saved);
+    lseek (out, 0, SEEK_SET);
+    while ((n = read (out, buf, sizeof (buf))) > 0){
+        fwrite (buf, 1, n, stdout);
+        record_output (session_record, buf, n);
+    }
+    close_fd (&out);
+    return status;
+}
+
+/*
+ * Runs one line of input:
+ *   - either a built-in command of the shell ("cd", "?", "exit" or one of
+ *     the job commands: "jobs", "wait" and "kill %n")
+ *   - or a system command. The ones listed in builtins.def ("echo", "pwd",
+ *     ...) run in-process when the policy allows them; the others are
+ *     checked and launched by run_external()
+ *   - or a pipeline of system commands, or one with redirections ("ls |
+ *     grep x > out"), also launched by run_external()
+ *
+ * Returns the exit status of the command, like a shell would: 0 for
+ * built-ins, the status of the child for system commands, AG_STATUS_DENIED
+ * when the policy refuses it and AG_STATUS_NOEXEC when it can't be run.
+ * A pipeline returns the status of its last command. A line with an open
+ * quote or a dangling '|' or redirection is refused with AG_STATUS_USAGE.
+ * Sets *exiting when the user asks to leave, or when the session is
+ * recorded and the recording fails: nothing runs unrecorded.
+ */
+
+int execute_line (char* commandline, command_t* cmd, config_t* config, int* exiting){
+    const builtin_t* builtin = NULL;
+    int status = BUILTIN_EXTERNAL;
+    int bg_cmd = AG_FALSE;
+    int parsed = PARSE_OK;
+    uint64_t started = 0;
+    int i = 0;
+
+    TRACE_BEGIN ("command");
+
+    TRACE_BEGIN ("parse_command");
+    parsed = parse_command (commandline, cmd);
+    TRACE_END ("parse_command");
+
+    if (parsed != PARSE_OK){
+        if (parsed == PARSE_ERR_QUOTE)
+            fprintf (stderr, "agros: unterminated quote\n");
+        else if (parsed == PARSE_ERR_SYNTAX)
+            fprintf (stderr, "agros: syntax error: a '|', '&' or a redirection without a command or a file\n");
+        else
+            fprintf (stderr, "agros: %s\n", strerror (E2BIG));
+        TRACE_END ("command");
+        return parsed == PARSE_ERR_LONG ? AG_STATUS_NOEXEC : AG_STATUS_USAGE;
+    }
+
+    TRACE_BEGIN ("find_builtin");
+    builtin = find_builtin (cmd->name);
+    TRACE_END ("find_builtin");
+
+    /* In a pipeline or with a redirection, it is the system commands that
+       run. The shell's own commands can't be part of one */
+    if (cmd->stage_nbr > 1 || cmd->redirect_nbr > 0){
+        for (i=0; i<cmd->stage_nbr; i++){
+            builtin = find_builtin (cmd->stages[i].argv[0]);
+            if (builtin != NULL && builtin->policy == BUILTIN_SHELL){
+                fprintf (stderr, "%s: Can't be used in a pipeline or with a redirection.\n", cmd->stages[i].argv[0]);
+                TRACE_END ("command");
+                return AG_STATUS_USAGE;
+            }
+        }
+        builtin = NULL;
+    }
+
+    if (session_record != NULL && cmd->argc > 0 && record_begin (session_record, cmd) < 0){
+        fprintf (stderr, "agros: The session can't be recorded, leaving.\n");
+        audit (LOG_ERR, "Could not write the recording of the session: %s.", strerror (errno));
+        *exiting = AG_TRUE;
+        TRACE_END ("command");
+        return EXIT_FAILURE;
+    }
+
+    /* A system command done in-process obeys the same policy. In the
+       background, it is the system command that runs */
+    if (builtin != NULL && builtin->policy == BUILTIN_SHELL){
+        status = run_builtin (builtin, cmd, config, exiting);
+    }else if (builtin != NULL && !(bg_cmd = runs_in_background (cmd))){
+        if (refuse_command (cmd, config)){
+            status = AG_STATUS_DENIED;
+        }else {
+            if (config->loglevel == 3)    audit (LOG_NOTICE, "Using built-in: %s.", cmd->name);
+            started = metrics_enabled ? trace_now () : 0;
+            status = run_builtin (builtin, cmd, config, exiting);
+            if (metrics_enabled)
+                metrics_ran (cmd->name, trace_now () - started, NULL);
+        }
+    }
+
+    /* Whatever the built-in printed must come out before what runs next */
+    fflush (stdout);
+
+    if (status == BUILTIN_EXTERNAL){
+        if (builtin == NULL || builtin->policy == BUILTIN_SHELL)
+            bg_cmd = runs_in_background (cmd);
+        status = run_external (cmd, config, bg_cmd);
+    }
+
+    if (session_record != NULL && cmd->argc > 0 && record_end (session_record, status) < 0){
+        fprintf (stderr, "agros: The session can't be recorded, leaving.\n");
+        audit (LOG_ERR, "Could not write the recording of the session: %s.", strerror (errno));
+        *exiting = AG_TRUE;
+    }
+
+    TRACE_END ("command");
+    return status;
+}
+
+/*
+ * The events of the loop. A child exited: the jobs and the stages of the
+ * line that did are collected, and a job that finished while the user
+ * types is told about at once.
+ */
+
+static void on_child (evloop* loop, int sig, void* data){
+    (void) loop;
+    (void) sig;
+    (void) data;
+
+    jobs_reap ();
+    if (fg.done != NULL)
+        collect_stages ();
+    if (session_reading && jobs_done ()){
+        hide_input ();
+        jobs_notify (stdout);
+        fflush (stdout);
+        show_input ();
+    }
+}
+
+/*
+ * The timeout of the line: SIGTERM, and SIGKILL after KILL_GRACE_MS to
+ * what is still there. SIGCONT goes with SIGTERM, for a stopped command.
+ */
+
+static void on_deadline (evloop* loop, int expirations, void* data){
+    (void) loop;
+    (void) expirations;
+    (void) data;
+
+    if (fg.done == NULL || fg.left == 0)
+        return;
+
+    if (fg.expired == 0){
+        fg.expired = 1;
+        fprintf (stderr, "%s: Timed out after %d seconds.\n", fg.name, fg.timeout);
+        if (session_config->loglevel >= 1)    audit (LOG_WARNING, "Command timed out after %d seconds: %s.", fg.timeout, fg.name);
+        signal_line (SIGTERM);
+        signal_line (SIGCONT);
+        evloop_arm (kill_timer, KILL_GRACE_MS);
+    }else {
+        fg.expired = 2;
+        signal_line (SIGKILL);
+    }
+}
+
+static void on_forward (evloop* loop, int sig, void* data){
+    (void) loop;
+    (void) data;
+
+    if (fg.done != NULL && fg.left > 0)
+        signal_line (sig);
+    if (sig == SIGTERM || sig == SIGHUP)
+        fg.forwarded = sig;
+}
+
+/*
+ * (Re)starts the wait for the user to type something.
+ */
+
+static void arm_idle (void){
+    if (idle_timer >= 0)
+        evloop_arm (idle_timer, (int64_t) session_config->idle_timeout * 1000);
+}
+
+static void on_idle (evloop* loop, int expirations, void* data){
+    (void) loop;
+    (void) expirations;
+    (void) data;
+
+    if (!session_reading)
+        return;
+    session_idle = AG_TRUE;
+    read_input_stop ();
+}
+
+static void on_input (evloop* loop, int fd, void* data){
+    (void) loop;
+    (void) fd;
+    (void) data;
+
+    if (read_input_key (&typed_line))
+        typed = AG_TRUE;
+    arm_idle ();
+}
+
+/*
+ * A new policy was loaded. At the prompt it is taken at once; during a
+ * line, by the next one.
+ */
+
+static void on_reload (evloop* loop, int fd, void* data){
+    eventfd_t count = 0;
+
+    (void) loop;
+    (void) data;
+
+    eventfd_read (fd, &count);
+    if (session_reading){
+        refresh_policy (session_config);
+        arm_idle ();
+    }
+}
+
+/*
+ * Sets up the event loop of the session. SIGCHLD is blocked for the whole
+ * session, so that it is read from the loop; the threads of the session
+ * block every signal. Without the loop, the session runs as it did before
+ * it had one: no timeouts, and jobs are collected between commands.
+ */
+
+static void prepare_events (config_t* config){
+    sigset_t set;
+    int i = 0;
+
+    session_config = config;
+    sigemptyset (&set);
+    sigaddset (&set, SIGCHLD);
+    sigprocmask (SIG_BLOCK, &set, NULL);
+
+    session_loop = evloop_new ();
+    if (session_loop != NULL && evloop_signals (session_loop, &set, on_child, NULL) >= 0){
+        sigemptyset (&set);
+        for (i=0; i<FORWARDED_NBR; i++)
+            sigaddset (&set, forwarded_signals[i]);
+        if (evloop_signals (session_loop, &set, on_forward, NULL) >= 0){
+            kill_timer = evloop_timer (session_loop, on_deadline, NULL);
+            idle_timer = evloop_timer (session_loop, on_idle, NULL);
+        }
+    }
+    if (session_loop == NULL || kill_timer < 0 || idle_timer < 0){
+        audit (LOG_WARNING, "Could not set up the event loop of the session: %s.", strerror (errno));
+        evloop_free (session_loop);
+        session_loop = NULL;
+        kill_timer = idle_timer = -1;
+        return;
+    }
+    if (reload_fd () >= 0)
+        evloop_watch (session_loop, reload_fd (), on_reload, NULL);
+}
+
+static void finish_events (void){
+    evloop_free (session_loop);
+    session_loop = NULL;
+    kill_timer = idle_timer = -1;
+}
+
+/*
+ * Reads a line at the prompt, with the event loop running meanwhile.
+ * Returns NULL at the end of the input, or once the user was idle for
+ * idle_timeout (session_idle is then set).
+ */
+
+static char* read_line (char* prompt){
+    char* line = NULL;
+
+    read_input_start (prompt);
+    if (session_loop == NULL || evloop_watch (session_loop, STDIN_FILENO, on_input, NULL) < 0){
+        while (!read_input_key (&line))
+            ;
+        return line;
+    }
+
+    typed_line = NULL;
+    typed = AG_FALSE;
+    session_reading = AG_TRUE;
+    arm_idle ();
+    while (!typed && !session_idle){
+        if (evloop_run (session_loop, -1) < 0){
+            read_input_stop ();
+            break;
+        }
+    }
+    session_reading = AG_FALSE;
+    evloop_arm (idle_timer, 0);
+    evloop_unwatch (session_loop, STDIN_FILENO);
+
+    line = typed_line;
+    typed_line = NULL;
+    return line;
+}
+
+/*
+ * The interactive session:
+ *   - print prompt
+ *   - read input and run it
+ * Returns when the user types "exit", closes the input (Ctrl-D) or stays
+ * idle at the prompt for idle_timeout seconds.
+ */
+
+int run_interactive (config_t* config, char* username){
+    command_t cmd = COMMAND_EMPTY;
+    char *commandline = (char *)NULL;
+    char prompt[MAX_LINE_LEN];
+    int exiting = AG_FALSE;
+    int status = 0;
+
+    /* Initializes GNU Readline */
+    TRACE_BEGIN ("initialize_readline");
+    initialize_readline (config);
+    TRACE_END ("initialize_readline");
+
+    if (config->welcome_message != NULL && strlen (config->welcome_message) > 0) {
+        fprintf (stdout, "\n%s\n\n", config->welcome_message);
+    }
+
+    session_interactive = AG_TRUE;
+
+    while (!exiting){
+        /* Tell about the background jobs that finished */
+        jobs_notify (stdout);
+
+        /* Set the prompt */
+        get_prompt (prompt, MAX_LINE_LEN, username);
+
+        /*
+         * Read a line of input
+         * commandline should be deallocated with free()
+         */
+        TRACE_BEGIN ("read_input");
+        commandline = read_line (prompt);
+        TRACE_END ("read_input");
+        if (commandline == NULL && session_idle){
+            fprintf (stdout, "\nIdle for %d seconds, logging out.\n", config->idle_timeout);
+            if (config->loglevel >= 2)    audit (LOG_NOTICE, "Logged out after %d seconds idle.", config->idle_timeout);
+            break;
+        }
+        if (commandline == NULL){
+            fprintf (stdout, "\n");
+            break;
+        }
+
+        refresh_policy (config);
+        status = execute_line (commandline, &cmd, config, &exiting);
+
+        free (commandline);
+        commandline = (char *)NULL;
+    }
+
+    command_free (&cmd);
+    finish_readline ();
+    return status;
+}
+
+/*
+ * Non-interactive sessions. No readline, no history, no prompt and no
+ * welcome message: the output of the commands is all the caller gets.
+ *
+ * run_command runs the single command given to "agros -c", the way sshd
+ * runs forced commands. run_script runs the newline-separated commands read
+ * from input and stops at the first "exit".
+ *
+ * Both return the exit status of the last command.
+ */
+
+int run_command (config_t* config, char* commandline){
+    command_t cmd = COMMAND_EMPTY;
+    int exiting = AG_FALSE;
+    int status = 0;
+
+    status = execute_line (commandline, &cmd, config, &exiting);
+
+    command_free (&cmd);
+    return status;
+}
+
+int run_script (config_t* config, FILE* input){
+    command_t cmd = COMMAND_EMPTY;
+    char* commandline = NULL;
+    size_t size = 0;
+    ssize_t length = 0;
+    int exiting = AG_FALSE;
+    int status = 0;
+
+    while (!exiting){
+        TRACE_BEGIN ("read_input");
+        length = getline (&commandline, &size, input);
+        TRACE_END ("read_input");
+        if (length < 0)
+            break;
+
+        refresh_policy (config);
+        status = execute_line (commandline, &cmd, config, &exiting);
+    }
+
+    free (commandline);
+    command_free (&cmd);
+    return status;
+}
+
+/*
+ * A whole session for username, once AGROS knows who it runs for: loads
+ * the policy, starts the audit log and runs the mode asked for (see
+ * main.c). Returns the exit status of the session.
+ */
+
+int run_session (char* username, char* commandline, int script){
+    config_t ag_config;
+    int status = 0;
+
+    /* Opens the audit log. Records are queued until the conf says where
+       they go */
+    TRACE_BEGIN ("openlog");
+    audit_open (username);
+    TRACE_END ("openlog");
+
+    /* Parses the config files for data */
+    TRACE_BEGIN ("parse_config");
+    parse_config (&ag_config, username);
+    TRACE_END ("parse_config");
+
+    TRACE_BEGIN ("audit_start");
+    if (audit_start (ag_config.audit_sink, ag_config.audit_file, ag_config.audit_overflow, ag_config.audit_spill) < 0)
+        audit (LOG_WARNING, "Could not open audit_file or audit_spill, or start the audit writer.");
+    TRACE_END ("audit_start");
+
+    /* Sessions that last follow changes to the policy */
+    TRACE_BEGIN ("watch_config");
+    if (commandline == NULL)
+        watch_config (username);
+    TRACE_END ("watch_config");
+
+    /* Children, timeouts and reloads are events of one loop */
+    TRACE_BEGIN ("prepare_events");
+    prepare_events (&ag_config);
+    TRACE_END ("prepare_events");
+
+    /* A one-shot command resolves only what it runs */
+    TRACE_BEGIN ("prepare_session");
+    prepare_session (&ag_config, commandline == NULL);
+    TRACE_END ("prepare_session");
+
+    /* Counted in the host-wide metrics, when they can be: a session isn't
+       refused for them */
+    if (ag_config.metrics){
+        if (metrics_open (METRICS_KEY) < 0)
+            audit (LOG_WARNING, "Could not attach the metrics segment: %s.", strerror (errno));
+        metrics_session (ag_config.profile);
+    }
+
+    /* A session that must be recorded doesn't start without it */
+    if (ag_config.record_dir != NULL){
+        session_record = record_open (ag_config.record_dir, username);
+        if (session_record == NULL){
+            fprintf (stderr, "Cannot launch AGROS; the session can't be recorded in %s.\n", ag_config.record_dir);
+            audit (LOG_ERR, "Could not start the recording of the session in %s: %s.", ag_config.record_dir, strerror (errno));
+            governor_release ();
+            audit_close ();
+            return EXIT_FAILURE;
+        }
+        if (ag_config.loglevel == 3)    audit (LOG_NOTICE, "Recording the session in %s.", ag_config.record_dir);
+    }
+
+    if (commandline != NULL)
+        status = run_command (&ag_config, commandline);
+    else if (script || !isatty (STDIN_FILENO))
+        status = run_script (&ag_config, stdin);
+    else
+        status = run_interactive (&ag_config, username);
+
+    record_close (session_record);
+    session_record = NULL;
+    finish_events ();
+    metrics_close ();
+    governor_release ();
+    audit_close ();
+    return status;
+}
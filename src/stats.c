@@ -0,0 +1,286 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * agros-stats: prints the host-wide metrics of AGROS (see metrics.h) in
+ * the Prometheus text format, for node_exporter's textfile collector or
+ * any scraper that runs a command.
+ *
+ *   agros-stats        the metrics
+ *   agros-stats -c     creates the segment, as root, for the sessions of
+ *                      other users, which can't (see metrics.h)
+ *   agros-stats -r     removes the segment, which starts them over; the
+ *                      sessions that have it keep counting in the old one
+ *
+ * The histograms are printed with a bucket every two powers of two, from
+ * about 8us to about 2h: the segment has four times as many.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "metrics.h"
+
+/* Segment buckets per printed one */
+#define STATS_STRIDE (2 * METRICS_SUB)
+
+static const char* histogram_names[METRICS_HISTOGRAMS] = {
+    "agros_command_spawn_seconds", "agros_command_exec_seconds", "agros_command_wall_seconds"
+};
+
+static const char* histogram_help[METRICS_HISTOGRAMS] = {
+    "Time from the launcher's fork to the command's exec.",
+    "Time from the command's exec to AGROS getting control back.",
+    "Time from the command's exec to its end."
+};
+
+/*
+ * Prints a name of the segment as a label value, escaped. The segment is
+ * shared with every session, so it isn't trusted to be terminated.
+ */
+
+static void print_label (const char* name){
+    size_t len = strnlen (name, METRICS_NAME - 1), i = 0;
+
+    putchar ('"');
+    for (i=0; i<len; i++){
+        if (name[i] == '\\' || name[i] == '"')
+            printf ("\\%c", name[i]);
+        else if (name[i] == '\n')
+            printf ("\\n");
+        else
+            putchar (name[i]);
+    }
+    putchar ('"');
+}
+
+static void print_header (const char* metric, const char* type, const char* help){
+    printf ("# HELP %s %s\n# TYPE %s %s\n", metric, help, metric, type);
+}
+
+static void print_value (const char* metric, const char* label, const char* name, const char* extra, uint64_t value){
+    printf ("%s{%s=", metric, label);
+    print_label (name);
+    printf ("%s} %llu\n", extra ? extra : "", (unsigned long long) value);
+}
+
+static int ready (uint32_t state){
+    return state == METRICS_READY;
+}
+
+/*
+ * One counter of every profile. offset is where it is in metrics_profile.
+ */
+
+static void print_profiles (const metrics_segment* seg, const char* metric, const char* help, size_t offset){
+    int i = 0;
+
+    print_header (metric, "counter", help);
+    for (i=0; i<METRICS_PROFILES; i++){
+        if (ready (seg->profiles[i].state))
+            print_value (metric, "profile", seg->profiles[i].name, NULL,
+                         *(const uint64_t*) ((const char*) &seg->profiles[i] + offset));
+    }
+}
+
+static void print_commands (const metrics_segment* seg, const char* metric, const char* type, const char* help,
+                            size_t offset){
+    int i = 0;
+
+    print_header (metric, type, help);
+    for (i=0; i<METRICS_COMMANDS; i++){
+        if (ready (seg->commands[i].state))
+            print_value (metric, "command", seg->commands[i].name, NULL,
+                         *(const uint64_t*) ((const char*) &seg->commands[i] + offset));
+    }
+}
+
+static void print_histograms (const metrics_segment* seg, int which){
+    const char* metric = histogram_names[which];
+    const metrics_histogram* h = NULL;
+    uint64_t cumulative = 0;
+    char le[64];
+    int i = 0, b = 0;
+
+    print_header (metric, "histogram", histogram_help[which]);
+    for (i=0; i<METRICS_COMMANDS; i++){
+        if (!ready (seg->commands[i].state))
+            continue;
+        h = &seg->commands[i].times[which];
+        if (h->count == 0)
+            continue;
+
+        /* The last bucket also holds what is past it, so it has no end */
+        cumulative = 0;
+        for (b=0; b<METRICS_BUCKETS-1; b++){
+            cumulative += h->buckets[b];
+            if ((b + 1) % STATS_STRIDE != 0)
+                continue;
+            snprintf (le, sizeof (le), ",le=\"%.6g\"", metrics_bucket_end (b) / 1e9);
+            printf ("%s_bucket", metric);
+            print_value ("", "command", seg->commands[i].name, le, cumulative);
+        }
+        printf ("%s_bucket", metric);
+        print_value ("", "command", seg->commands[i].name, ",le=\"+Inf\"", h->count);
+        printf ("%s_sum{command=", metric);
+        print_label (seg->commands[i].name);
+        printf ("} %.9f\n", h->sum / 1e9);
+        printf ("%s_count", metric);
+        print_value ("", "command", seg->commands[i].name, NULL, h->count);
+    }
+}
+
+static void print_cpu (const metrics_segment* seg){
+    const char* metric = "agros_command_cpu_seconds_total";
+    int i = 0;
+
+    print_header (metric, "counter", "CPU time of the commands' processes.");
+    for (i=0; i<METRICS_COMMANDS; i++){
+        if (!ready (seg->commands[i].state))
+            continue;
+        printf ("%s{command=", metric);
+        print_label (seg->commands[i].name);
+        printf (",mode=\"user\"} %.6f\n", seg->commands[i].user_us / 1e6);
+        printf ("%s{command=", metric);
+        print_label (seg->commands[i].name);
+        printf (",mode=\"system\"} %.6f\n", seg->commands[i].system_us / 1e6);
+    }
+}
+
+static void print_rss (const metrics_segment* seg){
+    const char* metric = "agros_command_max_rss_bytes";
+    int i = 0;
+
+    print_header (metric, "gauge", "Largest resident set of any of the commands' processes.");
+    for (i=0; i<METRICS_COMMANDS; i++){
+        if (ready (seg->commands[i].state))
+            print_value (metric, "command", seg->commands[i].name, NULL, seg->commands[i].max_rss_kb * 1024);
+    }
+}
+
+static void print_segment (const metrics_segment* seg){
+    int i = 0;
+
+    print_profiles (seg, "agros_sessions_total", "Sessions started.", offsetof (metrics_profile, sessions));
+    print_profiles (seg, "agros_commands_total", "Commands the policy allowed.", offsetof (metrics_profile, commands));
+    print_profiles (seg, "agros_denied_total", "Lines the policy refused.", offsetof (metrics_profile, denied));
+    print_profiles (seg, "agros_exec_failed_total", "Allowed commands that couldn't be executed.",
+                    offsetof (metrics_profile, failed));
+    print_profiles (seg, "agros_kicks_total", "Sessions ended for running out of warnings.", offsetof (metrics_profile, kicks));
+
+    print_header ("agros_spawn_failures_total", "counter", "Commands for which no process could be created.");
+    printf ("agros_spawn_failures_total %llu\n", (unsigned long long) seg->spawn_failures);
+
+    print_commands (seg, "agros_command_allowed_total", "counter", "Times the policy allowed the command.",
+                    offsetof (metrics_command, allowed));
+    print_commands (seg, "agros_command_denied_total", "counter", "Times the policy refused the command.",
+                    offsetof (metrics_command, denied));
+    print_commands (seg, "agros_command_exec_failed_total", "counter", "Times the command couldn't be executed.",
+                    offsetof (metrics_command, failed));
+    print_commands (seg, "agros_command_cache_hits_total", "counter", "Times the output came from the shared cache.",
+                    offsetof (metrics_command, cache_hits));
+    print_commands (seg, "agros_command_cache_coalesced_total", "counter",
+                    "Times the output came from the shared cache after waiting for another session to run the command.",
+                    offsetof (metrics_command, cache_coalesced));
+    print_commands (seg, "agros_command_cache_misses_total", "counter", "Times a cacheable command had to run.",
+                    offsetof (metrics_command, cache_misses));
+    for (i=0; i<METRICS_HISTOGRAMS; i++)
+        print_histograms (seg, i);
+    print_cpu (seg);
+    print_rss (seg);
+}
+
+static void usage (void){
+    fprintf (stderr, "usage: agros-stats [-c | -r]\n");
+    exit (2);
+}
+
+int main (int argc, char** argv){
+    const metrics_segment* seg = NULL;
+    struct shmid_ds ds;
+    int remove = 0, create = 0, opt = 0, id = -1;
+
+    while ((opt = getopt (argc, argv, "cr")) != -1){
+        if (opt == 'r')
+            remove = 1;
+        else if (opt == 'c')
+            create = 1;
+        else
+            usage ();
+    }
+    if (optind != argc || (create && remove))
+        usage ();
+
+    if (create){
+        if (geteuid () != 0){
+            fprintf (stderr, "agros-stats: Only root creates the segment.\n");
+            return EXIT_FAILURE;
+        }
+        if (metrics_open (METRICS_KEY) < 0){
+            perror ("agros-stats");
+            return EXIT_FAILURE;
+        }
+        metrics_close ();
+        return EXIT_SUCCESS;
+    }
+
+    /* No session has counted anything yet */
+    id = shmget (METRICS_KEY, 0, 0);
+    if (id < 0 && errno == ENOENT && !remove)
+        return EXIT_SUCCESS;
+    if (id < 0){
+        perror ("agros-stats");
+        return EXIT_FAILURE;
+    }
+
+    if (remove){
+        if (shmctl (id, IPC_RMID, NULL) < 0){
+            perror ("agros-stats");
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (shmctl (id, IPC_STAT, &ds) == 0 && (ds.shm_perm.uid != 0 || (ds.shm_perm.mode & 0002))){
+        fprintf (stderr, "agros-stats: The segment isn't root's or anyone can write it; remove it with -r.\n");
+        return EXIT_FAILURE;
+    }
+    seg = (const metrics_segment*) shmat (id, NULL, SHM_RDONLY);
+    if (seg == (void*) -1){
+        perror ("agros-stats");
+        return EXIT_FAILURE;
+    }
+    if (seg->magic != METRICS_MAGIC || seg->size != sizeof (metrics_segment)){
+        fprintf (stderr, "agros-stats: The segment has another layout, from another version of AGROS.\n");
+        return EXIT_FAILURE;
+    }
+
+    print_segment (seg);
+    shmdt (seg);
+    return EXIT_SUCCESS;
+}
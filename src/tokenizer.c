@@ -0,0 +1,531 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "agros.h"
+#include "tokenizer.h"
+
+/* The first chunk of an arena. Most lines fit in it */
+#define ARENA_CHUNK 4096
+
+/* The first size of argv */
+#define ARGV_SIZE 16
+
+/* Characters that end or change a word outside quotes */
+#define CHAR_PLAIN      0
+#define CHAR_BLANK      1
+#define CHAR_QUOTE      2
+#define CHAR_ESCAPE     3
+#define CHAR_OPERATOR   4
+
+/* The first sizes of stages and redirects */
+#define STAGES_SIZE 4
+#define REDIRECTS_SIZE 4
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CHAR_BLANK, [' '] = CHAR_BLANK, ['\t'] = CHAR_BLANK, ['\n'] = CHAR_BLANK,
+    ['\''] = CHAR_QUOTE, ['"'] = CHAR_QUOTE, ['\\'] = CHAR_ESCAPE,
+    ['|'] = CHAR_OPERATOR, ['<'] = CHAR_OPERATOR, ['>'] = CHAR_OPERATOR,
+    ['&'] = CHAR_OPERATOR,
+};
+
+typedef struct arena_chunk arena_chunk;
+struct arena_chunk{
+    arena_chunk* next;
+    size_t size;
+    char data[];
+};
+
+/*
+ * Chunks are never freed before arena_free(). Resetting goes back to the
+ * first chunk, and the following ones are used again as the arena fills.
+ */
+
+struct arena{
+    arena_chunk* first;
+    arena_chunk* current;
+    size_t used;
+};
+
+static arena_chunk* new_chunk (size_t size, arena_chunk* next){
+    arena_chunk* chunk = (arena_chunk*) malloc (sizeof (arena_chunk) + size);
+
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = next;
+    chunk->size = size;
+    return chunk;
+}
+
+arena* arena_new (void){
+    arena* a = (arena*) malloc (sizeof (arena));
+
+    if (a == NULL)
+        return NULL;
+    a->first = new_chunk (ARENA_CHUNK, NULL);
+    if (a->first == NULL){
+        free (a);
+        return NULL;
+    }
+    a->current = a->first;
+    a->used = 0;
+    return a;
+}
+
+/*
+ * Returns size bytes that stay valid until the next arena_reset(), or NULL
+ * if memory is exhausted.
+ */
+
+void* arena_alloc (arena* a, size_t size){
+    arena_chunk* chunk = a->current;
+    void* block = NULL;
+
+    /* Keeps blocks aligned for any use */
+    size = (size + sizeof (void*) - 1) & ~(sizeof (void*) - 1);
+
+    if (size > chunk->size - a->used){
+        /* The next chunk, if it is big enough, or a new one before it */
+        if (chunk->next == NULL || chunk->next->size < size){
+            arena_chunk* grown = new_chunk (size > 2 * chunk->size ? size : 2 * chunk->size, chunk->next);
+            if (grown == NULL)
+                return NULL;
+            chunk->next = grown;
+        }
+        a->current = chunk = chunk->next;
+        a->used = 0;
+    }
+
+    block = chunk->data + a->used;
+    a->used += size;
+    return block;
+}
+
+void arena_reset (arena* a){
+    a->current = a->first;
+    a->used = 0;
+}
+
+void arena_free (arena* a){
+    arena_chunk* chunk = NULL;
+
+    if (a == NULL)
+        return;
+    while (a->first != NULL){
+        chunk = a->first;
+        a->first = chunk->next;
+        free (chunk);
+    }
+    free (a);
+}
+
+/*
+ * True if p is a '&' with nothing but blanks after it. Only that '&' is an
+ * operator; the others are part of their word.
+ */
+
+static int ends_line (const char* p){
+    return *p == '&' && p[1 + strspn (p + 1, WHITESPACE)] == '\0';
+}
+
+static int at_operator (const char* p){
+    return char_class[(unsigned char) *p] == CHAR_OPERATOR && (*p != '&' || ends_line (p));
+}
+
+/*
+ * Reads the word at p, up to the first blank or operator outside quotes.
+ * Writes it unescaped to out unless out is NULL, and its length to
+ * *length. Returns the end of the word in the line, or NULL if a quote is
+ * left open.
+ */
+
+static char* scan_word (char* p, char* out, size_t* length){
+    size_t n = 0;
+    char quote = '\0';
+
+    while (1){
+        /* The common case: a run of ordinary characters */
+        if (quote == '\0'){
+            while (char_class[(unsigned char) *p] == CHAR_PLAIN){
+                if (out != NULL)
+                    out[n] = *p;
+                n++;
+                p++;
+            }
+            if (*p == '&' && !ends_line (p)){
+                if (out != NULL)
+                    out[n] = *p;
+                n++;
+                p++;
+                continue;
+            }
+            if (char_class[(unsigned char) *p] == CHAR_BLANK || char_class[(unsigned char) *p] == CHAR_OPERATOR)
+                break;
+        }else if (*p == '\0'){
+            break;
+        }
+
+        if (quote == '\''){
+            if (*p == '\''){
+                quote = '\0';
+                p++;
+                continue;
+            }
+        }else if (quote == '"'){
+            if (*p == '"'){
+                quote = '\0';
+                p++;
+                continue;
+            }
+            if (*p == '\\' && p[1] != '\0' && strchr ("\"\\$`", p[1]) != NULL)
+                p++;
+        }else if (*p == '\'' || *p == '"'){
+            quote = *p++;
+            continue;
+        }else if (p[1] != '\0'){
+            /* A backslash */
+            p++;
+        }
+
+        if (out != NULL)
+            out[n] = *p;
+        n++;
+        p++;
+    }
+
+    *length = n;
+    return quote ? NULL : p;
+}
+
+/*
+ * Takes the word at *pp and moves *pp past it. A word without quotes or
+ * backslashes that ends at a blank is ended in place; the others are
+ * copied to the arena. Returns the word, or NULL with *status set.
+ */
+
+static char* take_word (command_t* cmd, char** pp, size_t* total, int* status){
+    static long arg_max = 0;
+    size_t length = 0;
+    char* p = *pp;
+    char* end = NULL;
+    char* word = NULL;
+
+    if (arg_max == 0)
+        arg_max = sysconf (_SC_ARG_MAX);
+
+    end = scan_word (p, NULL, &length);
+    if (end == NULL){
+        *status = PARSE_ERR_QUOTE;
+        return NULL;
+    }
+
+    *total += length + 1 + sizeof (char*);
+    if (arg_max > 0 && *total > (size_t) arg_max){
+        *status = PARSE_ERR_LONG;
+        return NULL;
+    }
+
+    if (length == (size_t) (end - p) && char_class[(unsigned char) *end] != CHAR_OPERATOR){
+        /* Nothing to unescape, and the blank can go */
+        word = p;
+        if (*end != '\0')
+            *end++ = '\0';
+    }else {
+        word = (char*) arena_alloc (cmd->words, length + 1);
+        if (word == NULL){
+            *status = PARSE_ERR_LONG;
+            return NULL;
+        }
+        scan_word (p, word, &length);
+        word[length] = '\0';
+    }
+
+    *pp = end;
+    return word;
+}
+
+/*
+ * Makes room for count more words in argv.
+ */
+
+static int grow_argv (command_t* cmd, int used, int count){
+    char** argv = NULL;
+    int size = cmd->argv_size ? cmd->argv_size : ARGV_SIZE;
+
+    if (used + count <= cmd->argv_size)
+        return 0;
+
+    while (size < used + count)
+        size *= 2;
+    argv = (char**) realloc (cmd->argv, size * sizeof (char*));
+    if (argv == NULL)
+        return -1;
+    cmd->argv = argv;
+    cmd->argv_size = size;
+    return 0;
+}
+
+/*
+ * Starts a new stage, or a new redirection of the current one.
+ */
+
+static stage_t* add_stage (command_t* cmd){
+    stage_t* stages = NULL;
+    int size = cmd->stages_size ? 2 * cmd->stages_size : STAGES_SIZE;
+
+    if (cmd->stage_nbr == cmd->stages_size){
+        stages = (stage_t*) realloc (cmd->stages, size * sizeof (stage_t));
+        if (stages == NULL)
+            return NULL;
+        cmd->stages = stages;
+        cmd->stages_size = size;
+    }
+
+    stages = &cmd->stages[cmd->stage_nbr++];
+    stages->argc = 0;
+    stages->argv = NULL;
+    stages->redirect_first = cmd->redirect_nbr;
+    stages->redirect_nbr = 0;
+    return stages;
+}
+
+static redirect_t* add_redirect (command_t* cmd){
+    redirect_t* redirects = NULL;
+    int size = cmd->redirects_size ? 2 * cmd->redirects_size : REDIRECTS_SIZE;
+
+    if (cmd->redirect_nbr == cmd->redirects_size){
+        redirects = (redirect_t*) realloc (cmd->redirects, size * sizeof (redirect_t));
+        if (redirects == NULL)
+            return NULL;
+        cmd->redirects = redirects;
+        cmd->redirects_size = size;
+    }
+
+    cmd->stages[cmd->stage_nbr-1].redirect_nbr++;
+    return &cmd->redirects[cmd->redirect_nbr++];
+}
+
+/*
+ * Reads the redirection operator at *pp ("<", ">", ">>" or ">&", with an
+ * optional descriptor number before it) and its target. Returns PARSE_OK
+ * and moves *pp past them.
+ */
+
+static int take_redirect (command_t* cmd, char** pp, size_t* total){
+    redirect_t* r = NULL;
+    char* p = *pp;
+    int fd = -1, status = PARSE_OK;
+
+    if (*p >= '0' && *p <= '2')
+        fd = *p++ - '0';
+
+    r = add_redirect (cmd);
+    if (r == NULL)
+        return PARSE_ERR_LONG;
+    r->path = NULL;
+    r->target = -1;
+
+    if (*p == '<'){
+        r->mode = REDIR_IN;
+        r->fd = fd < 0 ? 0 : fd;
+        p++;
+    }else {
+        r->mode = REDIR_OUT;
+        r->fd = fd < 0 ? 1 : fd;
+        p++;
+        if (*p == '>'){
+            r->mode = REDIR_APPEND;
+            p++;
+        }else if (*p == '&'){
+            /* ">&n": n must be a descriptor of its own */
+            r->mode = REDIR_DUP;
+            p++;
+            if (*p < '0' || *p > '2' || (char_class[(unsigned char) p[1]] != CHAR_BLANK && !at_operator (p + 1)))
+                return PARSE_ERR_SYNTAX;
+            r->target = *p++ - '0';
+            *pp = p;
+            return PARSE_OK;
+        }
+    }
+
+    p += strspn (p, WHITESPACE);
+    if (*p == '\0' || at_operator (p))
+        return PARSE_ERR_SYNTAX;
+    r->path = take_word (cmd, &p, total, &status);
+    if (r->path == NULL)
+        return status;
+
+    *pp = p;
+    return PARSE_OK;
+}
+
+/*
+ * True if p starts a redirection: an operator, or a descriptor number
+ * right before one ("2>err").
+ */
+
+static int at_redirect (const char* p){
+    if (*p == '<' || *p == '>')
+        return 1;
+    return *p >= '0' && *p <= '2' && (p[1] == '<' || p[1] == '>');
+}
+
+/*
+ * This function splits a command line into the stages of cmd (see
+ * tokenizer.h). cmdline is modified and must outlive cmd, which points
+ * into it. cmd->name is argv[0] of the first stage, "" for a blank line.
+ *
+ * Returns PARSE_OK, PARSE_ERR_QUOTE if a quote is not closed,
+ * PARSE_ERR_SYNTAX for an empty stage or a redirection without a target,
+ * or PARSE_ERR_LONG if the words would not fit in ARG_MAX or in memory. On
+ * error cmd holds an empty command.
+ */
+
+int parse_command (char *cmdline, command_t *cmd){
+    stage_t* stage = NULL;
+    size_t total = 0;
+    char* p = cmdline;
+    char* word = NULL;
+    int used = 0, i = 0, status = PARSE_OK;
+
+    if (cmd->words == NULL)
+        cmd->words = arena_new ();
+    else
+        arena_reset (cmd->words);
+
+    cmd->argc = 0;
+    cmd->stage_nbr = 0;
+    cmd->redirect_nbr = 0;
+    cmd->background = 0;
+    if (cmd->words == NULL || grow_argv (cmd, 0, 2) < 0 || (stage = add_stage (cmd)) == NULL){
+        status = PARSE_ERR_LONG;
+        goto empty;
+    }
+
+    while (1){
+        p += strspn (p, WHITESPACE);
+        if (*p == '\0')
+            break;
+
+        if (*p == '|'){
+            /* Every stage must have a command: no "| grep", no "ls ||" */
+            if (stage->argc == 0){
+                status = PARSE_ERR_SYNTAX;
+                goto empty;
+            }
+            cmd->argv[used++] = NULL;
+            stage = add_stage (cmd);
+            if (stage == NULL){
+                status = PARSE_ERR_LONG;
+                goto empty;
+            }
+            p++;
+            continue;
+        }
+
+        if (ends_line (p)){
+            cmd->background = 1;
+            break;
+        }
+
+        if (at_redirect (p)){
+            status = take_redirect (cmd, &p, &total);
+            if (status != PARSE_OK)
+                goto empty;
+            continue;
+        }
+
+        word = take_word (cmd, &p, &total, &status);
+        if (word == NULL || grow_argv (cmd, used, 2) < 0){
+            if (word != NULL)
+                status = PARSE_ERR_LONG;
+            goto empty;
+        }
+        cmd->argv[used++] = word;
+        stage->argc++;
+    }
+
+    /* A blank line is the empty command, "". Redirections alone, a '&'
+       alone, or a line ending with '|', are errors */
+    if (stage->argc == 0){
+        if (cmd->stage_nbr > 1 || stage->redirect_nbr > 0 || cmd->background)
+            status = PARSE_ERR_SYNTAX;
+        goto empty;
+    }
+    cmd->argv[used] = NULL;
+
+    /* Each stage's words end with a NULL and the next ones follow */
+    used = 0;
+    for (i=0; i<cmd->stage_nbr; i++){
+        cmd->stages[i].argv = cmd->argv + used;
+        used += cmd->stages[i].argc + 1;
+    }
+
+    cmd->argc = cmd->stages[0].argc;
+    cmd->name = cmd->argv[0];
+    return PARSE_OK;
+
+    /* The blank line, or what is left of cmd after an error */
+empty:
+    cmd->argc = 0;
+    cmd->stage_nbr = 0;
+    cmd->redirect_nbr = 0;
+    cmd->background = 0;
+    if (cmd->argv != NULL){
+        cmd->argv[0] = "";
+        cmd->argv[1] = NULL;
+    }
+    cmd->name = "";
+    if (cmd->stages != NULL){
+        cmd->stage_nbr = 1;
+        cmd->stages[0].argc = 0;
+        cmd->stages[0].argv = cmd->argv;
+        cmd->stages[0].redirect_first = 0;
+        cmd->stages[0].redirect_nbr = 0;
+    }
+    return status;
+}
+
+/*
+ * Frees what parse_command() keeps from one line to the next.
+ */
+
+void command_free (command_t* cmd){
+    free (cmd->argv);
+    free (cmd->stages);
+    free (cmd->redirects);
+    arena_free (cmd->words);
+    cmd->argv = NULL;
+    cmd->argv_size = 0;
+    cmd->stages = NULL;
+    cmd->stages_size = 0;
+    cmd->stage_nbr = 0;
+    cmd->redirects = NULL;
+    cmd->redirects_size = 0;
+    cmd->redirect_nbr = 0;
+    cmd->words = NULL;
+    cmd->argc = 0;
+    cmd->name = NULL;
+}
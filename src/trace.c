@@ -0,0 +1,157 @@
+/*
+ *    AGROS - The new Limited Shell
+ *
+ *    Author: Joe "rahmu" Hakim Rahme <joe.hakim.rahme@gmail.com>
+ *
+ *
+ *    This file is part of AGROS.
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "trace.h"
+
+/* Events are kept in memory and written when this many are waiting */
+#define TRACE_BUFFER 4096
+
+typedef struct trace_record trace_record;
+struct trace_record{
+    const char* name;       /* a string literal */
+    char phase;             /* 'B', 'E' or 'X' */
+    uint64_t start;         /* nanoseconds, CLOCK_MONOTONIC */
+    uint64_t duration;      /* for 'X' */
+};
+
+int trace_enabled = 0;
+
+static trace_record records[TRACE_BUFFER];
+static int record_nbr = 0;
+static int trace_fd = -1;
+static int trace_written = 0;
+
+uint64_t trace_now (void){
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all (const char* buf, size_t len){
+    ssize_t written = 0;
+
+    while (len > 0){
+        written = write (trace_fd, buf, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        buf += written;
+        len -= written;
+    }
+}
+
+/*
+ * Writes the waiting events, as JSON objects of the traceEvents array.
+ * Timestamps are in microseconds.
+ */
+
+static void trace_flush (void){
+    char buf[256];
+    trace_record* r = NULL;
+    int pid = (int) getpid ();
+    int len = 0;
+    int i = 0;
+
+    for (i=0; i<record_nbr; i++){
+        r = &records[i];
+        len = snprintf (buf, sizeof (buf), "%s\n{\"name\":\"%s\",\"cat\":\"agros\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+                        trace_written++ ? "," : "", r->name, r->phase,
+                        (unsigned long long) (r->start / 1000), (unsigned long long) (r->start % 1000), pid, pid);
+        if (r->phase == 'X')
+            len += snprintf (buf + len, sizeof (buf) - len, ",\"dur\":%llu.%03llu",
+                             (unsigned long long) (r->duration / 1000), (unsigned long long) (r->duration % 1000));
+        len += snprintf (buf + len, sizeof (buf) - len, "}");
+        write_all (buf, len);
+    }
+    record_nbr = 0;
+}
+
+/*
+ * Turns tracing on if AGROS_TRACE is set. The file is created, never
+ * reused: O_EXCL and O_NOFOLLOW keep a planted file or link from being
+ * written through.
+ */
+
+void trace_open (void){
+    char path[256];
+
+    if (trace_enabled || getenv ("AGROS_TRACE") == NULL)
+        return;
+
+    snprintf (path, sizeof (path), "%s/agros-trace-%d.json", TRACE_DIR, (int) getpid ());
+    trace_fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (trace_fd < 0)
+        return;
+
+    write_all ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39);
+    trace_enabled = 1;
+    atexit (trace_close);
+}
+
+void trace_event (char phase, const char* name){
+    if (record_nbr == TRACE_BUFFER)
+        trace_flush ();
+    records[record_nbr].name = name;
+    records[record_nbr].phase = phase;
+    records[record_nbr].start = trace_now ();
+    records[record_nbr].duration = 0;
+    record_nbr++;
+}
+
+/*
+ * Records a phase timed by the caller, such as exec, which only the child
+ * sees start.
+ */
+
+void trace_span (const char* name, uint64_t start, uint64_t end){
+    if (!trace_enabled)
+        return;
+    if (record_nbr == TRACE_BUFFER)
+        trace_flush ();
+    records[record_nbr].name = name;
+    records[record_nbr].phase = 'X';
+    records[record_nbr].start = start;
+    records[record_nbr].duration = end > start ? end - start : 0;
+    record_nbr++;
+}
+
+void trace_close (void){
+    if (!trace_enabled)
+        return;
+    trace_flush ();
+    write_all ("\n]}\n", 4);
+    close (trace_fd);
+    trace_fd = -1;
+    trace_enabled = 0;
+}